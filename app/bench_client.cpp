@@ -0,0 +1,146 @@
+#include "client.hpp"
+#include "async_client.hpp"
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <iostream>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+// Bulk-load benchmark comparing one-request-per-round-trip with pipelining,
+// with MPUT/MGET batches, and with an AsyncKVClient shared by several threads.
+// Usage: bench_client [port] [ops] [depth] [value_size]
+
+using Clock = std::chrono::steady_clock;
+
+// Issue ops PUTs followed by ops GETs, keeping up to depth requests in flight
+double run(KVClient& client, int ops, int depth, const std::string& value, const std::string& prefix) {
+    auto start = Clock::now();
+
+    for (int pass = 0; pass < 2; pass++) {
+        int sent = 0;
+        int received = 0;
+        while (received < ops) {
+            while (sent < ops && sent - received < depth) {
+                std::string key = prefix + std::to_string(sent++);
+                if (pass == 0) client.queue_put(key, value);
+                else client.queue_get(key);
+            }
+            KVClient::Reply reply = client.read_reply();
+            if (reply.status != protocol::Status::Ok) {
+                throw std::runtime_error("Request " + std::to_string(reply.request_id) + " failed");
+            }
+            received++;
+        }
+    }
+
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// The same load as MPUT/MGET batches of batch keys each
+double run_batched(KVClient& client, int ops, int batch, const std::string& value, const std::string& prefix) {
+    auto start = Clock::now();
+
+    std::vector<std::pair<std::string, std::string>> items;
+    std::vector<std::string> keys;
+    for (int base = 0; base < ops; base += batch) {
+        items.clear();
+        for (int i = base; i < std::min(ops, base + batch); i++) {
+            items.emplace_back(prefix + std::to_string(i), value);
+        }
+        if (!client.multi_put(items)) {
+            throw std::runtime_error("MPUT failed");
+        }
+    }
+    for (int base = 0; base < ops; base += batch) {
+        keys.clear();
+        for (int i = base; i < std::min(ops, base + batch); i++) {
+            keys.push_back(prefix + std::to_string(i));
+        }
+        client.multi_get(keys);
+    }
+
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// The same load from threads threads sharing one AsyncKVClient, each keeping
+// up to depth requests in flight
+double run_async(AsyncKVClient& client, int ops, int depth, int threads, const std::string& value,
+                 const std::string& prefix) {
+    auto start = Clock::now();
+    std::atomic<int> failed{0};
+
+    for (int pass = 0; pass < 2; pass++) {
+        std::vector<std::thread> workers;
+        for (int t = 0; t < threads; t++) {
+            workers.emplace_back([&, t] {
+                std::atomic<int> outstanding{0};
+                for (int i = t; i < ops; i += threads) {
+                    while (outstanding.load() >= depth) {
+                        std::this_thread::yield();
+                    }
+                    outstanding++;
+                    auto done = [&](protocol::Status status, std::string) {
+                        if (status != protocol::Status::Ok) failed++;
+                        outstanding--;
+                    };
+                    std::string key = prefix + std::to_string(i);
+                    if (pass == 0) client.put_async(key, value, done);
+                    else client.get_async(key, done);
+                }
+                while (outstanding.load() > 0) {
+                    std::this_thread::yield();
+                }
+            });
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+    if (failed > 0) {
+        throw std::runtime_error(std::to_string(failed.load()) + " async requests failed");
+    }
+
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+int main(int argc, char* argv[]) {
+    int port = argc > 1 ? std::stoi(argv[1]) : 12345;
+    int ops = argc > 2 ? std::stoi(argv[2]) : 10000;
+    int depth = argc > 3 ? std::stoi(argv[3]) : 128;
+    size_t value_size = argc > 4 ? std::stoul(argv[4]) : 100;
+
+    try {
+        KVClient client("127.0.0.1", port);
+        std::string value(value_size, 'v');
+
+        std::cout << "DistKV pipelining benchmark: " << ops << " PUTs + " << ops
+                  << " GETs, " << value_size << " byte values\n";
+
+        double sequential = run(client, ops, 1, value, "seq_");
+        std::cout << "  depth=1\t" << sequential << " s\t"
+                  << static_cast<uint64_t>(2 * ops / sequential) << " ops/s\n";
+
+        double pipelined = run(client, ops, depth, value, "pipe_");
+        std::cout << "  depth=" << depth << "\t" << pipelined << " s\t"
+                  << static_cast<uint64_t>(2 * ops / pipelined) << " ops/s\n";
+
+        double batched = run_batched(client, ops, depth, value, "batch_");
+        std::cout << "  batch=" << depth << "\t" << batched << " s\t"
+                  << static_cast<uint64_t>(2 * ops / batched) << " ops/s\n";
+
+        const int threads = 4;
+        AsyncKVClient async_client("127.0.0.1", port);
+        double async = run_async(async_client, ops, depth, threads, value, "async_");
+        std::cout << "  async x" << threads << "\t" << async << " s\t"
+                  << static_cast<uint64_t>(2 * ops / async) << " ops/s\n";
+
+        std::cout << "  speedup\t" << sequential / pipelined << "x pipelined, "
+                  << sequential / batched << "x batched, " << sequential / async << "x async\n";
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
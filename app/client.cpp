@@ -1,13 +1,24 @@
 #include "client.hpp"
+#include "cluster_client.hpp"
 #include <iostream>
 #include <sstream>
 
 void print_help() {
     std::cout << "Commands:\n"
-              << "  put <key> <value>\n"
+              << "  put <key> <value> [ex <seconds>]\n"
               << "  get <key>\n"
               << "  delete <key>\n"
+              << "  getv <key>\n"
+              << "  cas <key> <version> <value>\n"
+              << "  incrby <key> <delta>\n"
+              << "  append <key> <suffix>\n"
+              << "  scan <start> [end]\n"
+              << "  prefix <prefix>\n"
               << "  persist\n"
+              << "  replication\n"
+              << "  cluster\n"
+              << "  stats\n"
+              << "  rebalance <host:port>...\n"
               << "  help\n"
               << "  exit\n";
 }
@@ -28,9 +39,13 @@ int main() {
             iss >> cmd;
 
             if (cmd == "put") {
-                std::string key, value;
-                iss >> key >> value;
-                if (client.put(key, value)) std::cout << "OK\n";
+                std::string key, value, option;
+                long seconds = 0;
+                iss >> key >> value >> option;
+                bool ok = option == "ex" || option == "EX"
+                              ? (iss >> seconds) && client.put(key, value, std::chrono::seconds(seconds))
+                              : client.put(key, value);
+                if (ok) std::cout << "OK\n";
                 else std::cout << "ERROR\n";
 
             } else if (cmd == "get") {
@@ -44,9 +59,67 @@ int main() {
                 if (client.remove(key)) std::cout << "OK\n";
                 else std::cout << "NOT_FOUND\n";
 
+            } else if (cmd == "getv") {
+                std::string key, value;
+                uint64_t version;
+                iss >> key;
+                if (client.get(key, value, version)) std::cout << version << " " << value << "\n";
+                else std::cout << "NOT_FOUND\n";
+
+            } else if (cmd == "cas") {
+                std::string key, value;
+                uint64_t expected = 0, version;
+                iss >> key >> expected >> value;
+                if (client.compare_and_set(key, expected, value, version)) std::cout << "OK " << version << "\n";
+                else std::cout << "CONFLICT " << version << "\n";
+
+            } else if (cmd == "incrby") {
+                std::string key;
+                int64_t delta = 0, result;
+                iss >> key >> delta;
+                if (client.increment(key, delta, result)) std::cout << result << "\n";
+                else std::cout << "ERROR\n";
+
+            } else if (cmd == "append") {
+                std::string key, suffix;
+                size_t length;
+                iss >> key >> suffix;
+                if (client.append(key, suffix, length)) std::cout << length << "\n";
+                else std::cout << "ERROR\n";
+
+            } else if (cmd == "scan" || cmd == "prefix") {
+                std::string first, end;
+                iss >> first >> end;
+                auto cursor = cmd == "scan" ? client.scan(first, end) : client.prefix_scan(first);
+                std::string key, value;
+                size_t count = 0;
+                while (cursor.next(key, value)) {
+                    std::cout << key << " " << value << "\n";
+                    count++;
+                }
+                std::cout << "(" << count << " keys)\n";
+
             } else if (cmd == "persist") {
                 if (client.persist()) std::cout << "OK\n";
 
+            } else if (cmd == "replication") {
+                std::cout << client.replication_info();
+
+            } else if (cmd == "cluster") {
+                std::cout << client.cluster_info();
+
+            } else if (cmd == "stats") {
+                std::cout << client.stats();
+
+            } else if (cmd == "rebalance") {
+                // Hand the cluster the new node list, via the server connected to
+                std::vector<std::string> nodes;
+                std::string node;
+                while (iss >> node) nodes.push_back(node);
+                ClusterClient cluster({"127.0.0.1:12345"});
+                if (!nodes.empty() && cluster.set_nodes(nodes)) std::cout << "OK\n";
+                else std::cout << "ERROR\n";
+
             } else if (cmd == "help") {
                 print_help();
 
@@ -1,19 +1,227 @@
 #include "server.hpp"
+#include "cluster.hpp"
 #include "kvstore.hpp"
+#include "raft.hpp"
 #include <iostream>
+#include <memory>
+#include <sstream>
+
+static void print_usage(const char* prog) {
+    std::cerr << "Usage: " << prog << " [port] [options]\n"
+              << "  --mode=epoll|threaded   connection handling model (default epoll)\n"
+              << "  --io-threads=N          epoll reactor threads (default one per core)\n"
+              << "  --backlog=N             listen() backlog (default 4096)\n"
+              << "  --shards=N              number of KVStore partitions (default 16)\n"
+              << "  --group-commit=on|off   batch concurrent log writes (default on)\n"
+              << "  --max-batch-bytes=N     flush a batch once N bytes are queued\n"
+              << "  --max-wait-us=N         linger up to N us for a batch to fill\n"
+              << "  --io-uring=on|off       write the log through io_uring if the kernel allows (default on)\n"
+              << "  --durability=always|everysec|os|memory\n"
+              << "                          sync every write, about once a second, never, or keep no log\n"
+              << "                          (default always); clients may ask for more or less per write\n"
+              << "  --checkpoint-interval-s=N  snapshot the store every N seconds\n"
+              << "  --checkpoint-log-bytes=N   snapshot once N bytes were logged since the last\n"
+              << "  --ordered-index=on|off  keep keys sorted for fast SCAN (default off)\n"
+              << "  --engine=memory|lsm     keep everything in memory, or spill to SSTables (default memory)\n"
+              << "  --memtable-bytes=N      lsm: flush the memtable to disk once N bytes were written\n"
+              << "  --block-cache-bytes=N   lsm: memory for cached SSTable blocks and indexes (0 = off)\n"
+              << "  --persistence=on|off    log writes and recover them on restart (default on)\n"
+              << "  --maxmemory=N           memory: evict keys to keep entries under N bytes (0 = no limit)\n"
+              << "  --eviction=lru|lfu      which keys --maxmemory evicts (default lru)\n"
+              << "  --replicaof=HOST:PORT   follow the server at HOST:PORT, refusing writes\n"
+              << "  --repl-backlog-bytes=N  memory: recent log kept for followers to resume from (0 = no leader)\n"
+              << "  --raft-peers=H:P,...    replicate writes with Raft among these servers, this one included\n"
+              << "  --raft-id=N             this server's position in --raft-peers (from 0)\n"
+              << "  --raft-log=FILE         Raft log file under storage/ (default raft.log)\n"
+              << "  --cluster-nodes=H:P,... partition keys over these servers by consistent hashing\n"
+              << "  --cluster-self=H:P      this server's name in --cluster-nodes (default 127.0.0.1:port)\n"
+              << "  --cluster-vnodes=N      ring points per cluster node (default 64)\n"
+              << "  --metrics-port=N        serve Prometheus metrics over HTTP on port N (default off)\n";
+}
 
 int main(int argc, char* argv[]) {
     int port = 12345; // default port
-    if (argc > 1) {
-        port = std::stoi(argv[1]);
+    KVStoreOptions options;
+    ServerOptions server_options;
+    options.replication_backlog_bytes = 16 << 20;
+    std::string leader_host;
+    int leader_port = 0;
+    RaftOptions raft_options;
+    ClusterTopology cluster_topology;
+    std::string cluster_self;
+    bool memory_only = false;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg.rfind("--", 0) != 0) {
+            port = std::stoi(arg);
+            continue;
+        }
+
+        size_t eq = arg.find('=');
+        std::string name = arg.substr(2, eq == std::string::npos ? std::string::npos : eq - 2);
+        std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+
+        if (name == "mode") {
+            if (value == "threaded") server_options.mode = ServerMode::Threaded;
+            else if (value == "epoll") server_options.mode = ServerMode::Epoll;
+            else {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (name == "io-threads") {
+            server_options.io_threads = std::stoi(value);
+        } else if (name == "backlog") {
+            server_options.backlog = std::stoi(value);
+        } else if (name == "shards") {
+            options.num_shards = std::stoul(value);
+        } else if (name == "group-commit") {
+            options.storage.group_commit = (value != "off");
+        } else if (name == "max-batch-bytes") {
+            options.storage.max_batch_bytes = std::stoul(value);
+        } else if (name == "max-wait-us") {
+            options.storage.max_wait = std::chrono::microseconds(std::stol(value));
+        } else if (name == "io-uring") {
+            options.storage.io_uring = (value != "off");
+        } else if (name == "durability") {
+            if (value == "memory") memory_only = true;
+            else if (!parse_durability(value, options.storage.durability) ||
+                     options.storage.durability == Durability::None) {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (name == "checkpoint-interval-s") {
+            options.checkpoint_interval = std::chrono::seconds(std::stol(value));
+        } else if (name == "checkpoint-log-bytes") {
+            options.checkpoint_log_bytes = std::stoull(value);
+        } else if (name == "ordered-index") {
+            options.ordered_index = (value != "off");
+        } else if (name == "engine") {
+            if (value == "lsm") options.engine = StorageEngine::Lsm;
+            else if (value == "memory") options.engine = StorageEngine::Memory;
+            else {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (name == "memtable-bytes") {
+            options.memtable_bytes = std::stoull(value);
+        } else if (name == "block-cache-bytes") {
+            options.lsm.block_cache_bytes = std::stoull(value);
+        } else if (name == "persistence") {
+            options.persistence = (value != "off");
+        } else if (name == "maxmemory") {
+            options.max_memory_bytes = std::stoull(value);
+        } else if (name == "eviction") {
+            if (value == "lru") options.eviction_policy = EvictionPolicy::Lru;
+            else if (value == "lfu") options.eviction_policy = EvictionPolicy::Lfu;
+            else {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (name == "replicaof") {
+            size_t colon = value.rfind(':');
+            if (colon == std::string::npos) {
+                print_usage(argv[0]);
+                return 1;
+            }
+            leader_host = value.substr(0, colon);
+            leader_port = std::stoi(value.substr(colon + 1));
+        } else if (name == "repl-backlog-bytes") {
+            options.replication_backlog_bytes = std::stoull(value);
+        } else if (name == "raft-peers") {
+            std::stringstream peers(value);
+            std::string peer;
+            while (std::getline(peers, peer, ',')) {
+                raft_options.peers.push_back(peer);
+            }
+        } else if (name == "raft-id") {
+            raft_options.id = std::stoul(value);
+        } else if (name == "raft-log") {
+            raft_options.log_file = value;
+        } else if (name == "cluster-nodes") {
+            std::stringstream nodes(value);
+            std::string node;
+            while (std::getline(nodes, node, ',')) {
+                cluster_topology.nodes.push_back(node);
+            }
+        } else if (name == "cluster-self") {
+            cluster_self = value;
+        } else if (name == "cluster-vnodes") {
+            cluster_topology.vnodes = std::stoul(value);
+        } else if (name == "metrics-port") {
+            server_options.metrics_port = std::stoi(value);
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (memory_only) {
+        // The LSM engine cannot do without its log
+        if (options.engine == StorageEngine::Lsm) {
+            print_usage(argv[0]);
+            return 1;
+        }
+        options.persistence = false;
+    }
+
+    bool raft = !raft_options.peers.empty();
+    if (raft && (leader_port != 0 || raft_options.id >= raft_options.peers.size())) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    bool cluster = !cluster_topology.nodes.empty();
+    if (cluster && (raft || leader_port != 0 || cluster_topology.vnodes == 0)) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (cluster_self.empty()) {
+        cluster_self = "127.0.0.1:" + std::to_string(port);
+    }
+    // Servers started from the same flags agree on the first topology;
+    // rebalancing moves to higher epochs
+    cluster_topology.epoch = 1;
+
+    if (raft) {
+        // Every node applies the same log; evicting on its own would diverge
+        options.max_memory_bytes = 0;
+        options.replication_backlog_bytes = 0;
     }
 
     try {
         // Create KVStore using a storage file
-        KVStore store("data.log");
+        KVStore store("data.log", options);
+
+        StorageStats stats = store.storage_stats();
+        std::cout << "Recovered in " << stats.recovery_total_us / 1000 << " ms (snapshot "
+                  << stats.recovery_snapshot_us / 1000 << " ms, log tail of "
+                  << stats.recovery_tail_bytes << " bytes " << stats.recovery_tail_us / 1000 << " ms)\n";
+        std::cout << "Log writes via " << (stats.io_uring ? "io_uring" : "write/fsync") << "\n";
+
+        std::unique_ptr<Replica> replica;
+        if (leader_port != 0) {
+            replica = std::make_unique<Replica>(store, leader_host, leader_port);
+            server_options.replica = replica.get();
+            std::cout << "Replicating from " << leader_host << ":" << leader_port << "\n";
+        }
+
+        std::unique_ptr<RaftNode> raft_node;
+        if (raft) {
+            raft_options.storage = options.storage;
+            raft_node = std::make_unique<RaftNode>(store, raft_options);
+            server_options.raft = raft_node.get();
+            std::cout << "Raft node " << raft_options.id << " of " << raft_options.peers.size() << "\n";
+        }
+
+        std::unique_ptr<ClusterNode> cluster_node;
+        if (cluster) {
+            cluster_node = std::make_unique<ClusterNode>(store, cluster_self, cluster_topology);
+            server_options.cluster = cluster_node.get();
+            std::cout << "Cluster node " << cluster_self << " of " << cluster_topology.nodes.size() << "\n";
+        }
 
         // Create server
-        KVServer server(&store, port);
+        KVServer server(&store, port, server_options);
 
         std::cout << "Starting DistKV Server on port " << port << "\n";
         server.run(); // This blocks and handles clients
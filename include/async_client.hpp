@@ -0,0 +1,90 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+#include "protocol.hpp"
+
+struct AsyncClientOptions {
+    size_t connections = 4; // sockets in the pool
+};
+
+// A thread-safe client that never blocks on the server. Requests from any
+// number of threads are spread over a pool of connections and pipelined on
+// each: a request is encoded into its connection's buffer and an event loop
+// thread of the client's own writes the buffers out and reads the replies,
+// so one client can keep any number of requests in flight at once.
+//
+// Each operation either returns a future or takes a callback. Callbacks run
+// on the event loop thread, in the order the replies arrive on their
+// connection, so they must not block; one that waits on another request of
+// the same client would deadlock. A connection that fails completes all of
+// its requests with Status::Error and leaves the pool; with none left every
+// request fails at once. Binary protocol only.
+class AsyncKVClient {
+public:
+    using Callback = std::function<void(protocol::Status status, std::string value)>;
+
+    AsyncKVClient(const std::string& host, int port, AsyncClientOptions options = {});
+    ~AsyncKVClient(); // fails whatever is still in flight
+
+    AsyncKVClient(const AsyncKVClient&) = delete;
+    AsyncKVClient& operator=(const AsyncKVClient&) = delete;
+
+    std::future<bool> put_async(const std::string& key, const std::string& value);
+    std::future<std::optional<std::string>> get_async(const std::string& key);
+    std::future<bool> remove_async(const std::string& key);
+
+    void put_async(const std::string& key, const std::string& value, Callback done);
+    void get_async(const std::string& key, Callback done);
+    void remove_async(const std::string& key, Callback done);
+
+    // Any single-frame request, for opcodes with no method of their own
+    void request_async(protocol::Opcode op, const std::string& key, const std::string& value, Callback done);
+
+    // Requests sent and not yet answered, over all connections
+    size_t in_flight() const { return pending.load(); }
+    size_t live_connections() const;
+
+private:
+    struct Connection {
+        int fd = -1;
+        std::mutex mtx;                // guards outbox, waiting, next_id, closed
+        std::string outbox;            // frames encoded but not yet handed to the loop
+        std::deque<Callback> waiting;  // one per request sent, in send order
+        uint32_t next_id = 0;
+        bool closed = false;
+        bool scheduled = false;        // queued for the loop to write
+
+        // Owned by the event loop thread
+        std::string sending;
+        size_t sent = 0;
+        std::string rbuf;
+        bool want_write = false;       // EPOLLOUT registered
+    };
+
+    std::vector<std::unique_ptr<Connection>> connections;
+    std::atomic<size_t> next_connection{0};
+    std::atomic<size_t> pending{0};
+
+    int epfd = -1;
+    int wake_fd = -1; // eventfd: connections have been scheduled, or stopping
+
+    std::mutex ready_mtx;
+    std::vector<Connection*> ready; // connections with frames in their outbox
+    std::atomic<bool> stopping{false};
+
+    std::thread loop;
+
+    void run_loop();
+    void write_out(Connection& conn);
+    void read_in(Connection& conn);
+    void fail(Connection& conn);
+};
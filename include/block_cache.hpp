@@ -0,0 +1,108 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct BlockCacheStats
+{
+    uint64_t capacity_bytes = 0;
+    uint64_t used_bytes = 0;   // cached blocks, overhead included
+    uint64_t pinned_bytes = 0; // index blocks and filters, never evicted
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t inserts = 0;
+    uint64_t rejects = 0; // blocks the admission filter kept out
+    uint64_t evictions = 0;
+};
+
+// Fixed-budget cache of SSTable data blocks, keyed by file and block number.
+// The key space is split over shards with their own lock, clock hand and
+// counters. Eviction is CLOCK (second chance); admission is TinyLFU: a
+// count-min sketch estimates how often each block was asked for recently,
+// and a new block only replaces the clock's victim if it is wanted more
+// often. Blocks read once, as in a long scan, therefore never push out the
+// working set.
+//
+// Index blocks and bloom filters live in their SSTable, pinned for its
+// whole life; they are charged to the same budget so the total stays under
+// capacity_bytes.
+class BlockCache
+{
+public:
+    using Block = std::shared_ptr<const std::string>;
+
+    explicit BlockCache(uint64_t capacity_bytes, size_t num_shards = 16);
+
+    BlockCache(const BlockCache &) = delete;
+    BlockCache &operator=(const BlockCache &) = delete;
+
+    // The cached block, or null. Only lookups that would also insert count
+    // towards the block's popularity.
+    Block lookup(uint64_t file, uint64_t block, bool fill = true);
+
+    // Offer a block read from disk; it may be turned away
+    void insert(uint64_t file, uint64_t block, Block data);
+
+    // Charge or release memory held outside the cache
+    void pin(uint64_t bytes) { pinned += bytes; }
+    void unpin(uint64_t bytes) { pinned -= bytes; }
+
+    BlockCacheStats stats() const;
+    std::vector<BlockCacheStats> shard_stats() const;
+
+private:
+    struct Slot
+    {
+        uint64_t key;
+        Block data;
+        uint64_t charge;
+        bool referenced;
+    };
+
+    // 4-bit counters in four rows, halved every sample_size increments so
+    // that old popularity fades
+    class FrequencySketch
+    {
+    public:
+        explicit FrequencySketch(size_t expected_entries);
+        void record(uint64_t hash);
+        uint32_t estimate(uint64_t hash) const;
+
+    private:
+        std::vector<uint8_t> counters; // two per byte
+        size_t mask;
+        size_t sample_size;
+        size_t additions = 0;
+
+        size_t index(uint64_t hash, int row) const;
+        uint32_t get(size_t i) const;
+        void halve();
+    };
+
+    struct alignas(64) Shard
+    {
+        mutable std::mutex mtx;
+        std::unordered_map<uint64_t, size_t> index; // key -> slot
+        std::vector<Slot> slots;
+        std::vector<size_t> free_slots;
+        size_t hand = 0;
+        uint64_t used = 0;
+        FrequencySketch sketch;
+        uint64_t hits = 0, misses = 0, inserts = 0, rejects = 0, evictions = 0;
+
+        explicit Shard(size_t expected_entries) : sketch(expected_entries) {}
+    };
+
+    uint64_t capacity;
+    std::atomic<uint64_t> pinned{0};
+    std::vector<std::unique_ptr<Shard>> shards;
+
+    uint64_t shard_budget() const;
+    Shard &shard_for(uint64_t hash) { return *shards[hash % shards.size()]; }
+    void evict(Shard &shard, size_t slot);
+};
@@ -1,16 +1,144 @@
 #pragma once
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <optional>
 #include <string>
+#include <utility>
+#include <vector>
+#include "durability.hpp"
+#include "protocol.hpp"
 
 class KVClient {
 public:
-    KVClient(const std::string& host, int port);
+    enum class Protocol { Text, Binary };
+
+    KVClient(const std::string& host, int port, Protocol protocol = Protocol::Binary);
     ~KVClient();
     bool put(const std::string& key, const std::string& value);
+    // Put a key that expires ttl after it was written; ttl must be positive
+    bool put(const std::string& key, const std::string& value, std::chrono::seconds ttl);
     std::string get(const std::string& key);
+    bool get(const std::string& key, std::string& value);
     bool remove(const std::string& key);
     bool persist();
 
+    // A value with its version, which changes with every write to the key
+    bool get(const std::string& key, std::string& value, uint64_t& version);
+
+    // Atomic updates done by the server. compare_and_set writes value only
+    // if key is still at expected_version (0 = only if it does not exist);
+    // version is set to the new version, or after a conflict, when it
+    // returns false, to the current one (0 if there is none). increment
+    // adds delta to the decimal integer at key (missing = 0) and fails if
+    // the value is not one; append adds suffix to the value.
+    bool compare_and_set(const std::string& key, uint64_t expected_version, const std::string& value,
+                         uint64_t& version);
+    bool increment(const std::string& key, int64_t delta, int64_t& result);
+    bool append(const std::string& key, const std::string& suffix, size_t& length);
+
+    // Put or remove acknowledged once the write is as durable as level asks
+    // instead of the server's default; lsn, if given, is set to the write's
+    // log sequence number (0 if the server keeps no log). Binary protocol only.
+    bool put(const std::string& key, const std::string& value, Durability level, uint64_t* lsn = nullptr);
+    bool remove(const std::string& key, Durability level, uint64_t* lsn = nullptr);
+
+    // Wait until the server has made lsn (0 = everything it logged so far)
+    // as durable as level asks; returns the server's durable LSN. Lets
+    // writes made with a weak level be confirmed later in one round trip.
+    uint64_t wait_durable(uint64_t lsn = 0, Durability level = Durability::Always);
+
+    // The server's replication state as "name:value" lines (see ReplInfo)
+    std::string replication_info();
+
+    // The server's cluster topology and state as "name:value" lines (see
+    // ClusterInfo and ClusterTopology::parse)
+    std::string cluster_info();
+
+    // The server's request latencies and counters as "name:value" lines
+    // (see Stats)
+    std::string stats();
+
+    // Send one binary request and wait for its reply; for requests with no
+    // method of their own, such as the ones servers send each other
+    protocol::Status request(protocol::Opcode op, const std::string& key, const std::string& value,
+                             std::string& result);
+
+    // Batch operations. Large batches are split into frames of about
+    // BATCH_FRAME_BYTES that are pipelined; each frame is applied atomically
+    // by the server, the batch as a whole is not.
+    static constexpr size_t BATCH_FRAME_BYTES = 1 << 20;
+    bool multi_put(const std::vector<std::pair<std::string, std::string>>& items);
+    std::vector<std::optional<std::string>> multi_get(const std::vector<std::string>& keys);
+    size_t multi_remove(const std::vector<std::string>& keys);
+
+    // One page of the keys in [start, end) in key order, at most limit of
+    // them (0 = as many as the server sends); an empty end means no upper
+    // bound. more is set if the range continues past the last key returned.
+    // Over the text protocol keys cannot contain spaces and a start of "-"
+    // means from the first key.
+    std::vector<std::pair<std::string, std::string>> scan_page(const std::string& start, const std::string& end,
+                                                               size_t limit, bool& more);
+
+    // Walks a range one SCAN page at a time, so only a page is held in
+    // memory and the server never locks a shard for longer than a page
+    class ScanCursor {
+    public:
+        bool next(std::string& key, std::string& value);
+
+    private:
+        friend class KVClient;
+        ScanCursor(KVClient& client, std::string start, std::string end, size_t page_size);
+
+        KVClient& client;
+        std::string start; // where the next page begins
+        std::string end;
+        size_t page_size;
+        std::vector<std::pair<std::string, std::string>> page;
+        size_t pos = 0;
+        bool done = false;
+    };
+    ScanCursor scan(const std::string& start, const std::string& end = "", size_t page_size = 1000);
+    ScanCursor prefix_scan(const std::string& prefix, size_t page_size = 1000);
+
+    // Pipelining (binary protocol only): queue any number of requests,
+    // send them with one flush(), then collect the replies in order.
+    struct Reply {
+        uint32_t request_id = 0;
+        protocol::Status status = protocol::Status::Error;
+        std::string value;
+    };
+    uint32_t queue_put(const std::string& key, const std::string& value);
+    uint32_t queue_put(const std::string& key, const std::string& value, std::chrono::seconds ttl);
+    uint32_t queue_get(const std::string& key);
+    uint32_t queue_remove(const std::string& key);
+    // A SCAN page as scan_page() asks for it; decode the reply's value with
+    // protocol::decode_entries
+    uint32_t queue_scan(const std::string& start, const std::string& end, size_t limit);
+    void flush();
+    Reply read_reply(); // flushes first if needed
+    size_t in_flight() const { return inflight.size(); }
+
 private:
     int sockfd;
+    Protocol protocol;
+    uint32_t next_id = 0;
+    std::string rbuf;             // bytes received but not yet consumed
+    std::string wbuf;             // queued frames not yet sent
+    std::deque<uint32_t> inflight; // ids awaiting a reply, in send order
+
+    uint32_t queue(protocol::Opcode op, const std::string& key, const std::string& value, uint16_t flags = 0);
+
     std::string send_request(const std::string& req);
+    protocol::Status send_frame(protocol::Opcode op, const std::string& key,
+                                const std::string& value, std::string& result, uint16_t flags = 0);
+
+    // A write at level, with its LSN returned in lsn
+    bool durable_write(protocol::Opcode op, const std::string& key, const std::string& value,
+                       Durability level, uint64_t* lsn);
+    void send_all(const std::string& data);
+    void fill();
+
+    // A ReplInfo, ClusterInfo or Stats reply; command is its text protocol name
+    std::string info_lines(protocol::Opcode op, const std::string& command);
 };
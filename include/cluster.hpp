@@ -0,0 +1,159 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "protocol.hpp"
+
+class KVClient;
+class KVStore;
+
+// Partitioning of the keyspace over several servers by consistent hashing.
+// Every node of a topology owns vnodes points on a 64-bit hash ring, and a
+// key belongs to the node with the first point at or after the key's hash,
+// so a node joining or leaving moves only its share of the keys.
+//
+// A KVServer in cluster mode answers requests for keys it does not own with
+// Moved and the owner's host:port; a ClusterClient (see cluster_client.hpp)
+// fetches the topology and sends each key straight to its owner. Multi-key
+// requests must only hold keys of the node they are sent to. SCAN is not
+// routed and covers only the keys of the node it is sent to.
+//
+// Topologies are numbered by epoch and a node only ever moves to a higher
+// one. Keys move by being pulled: once it has a new topology, a node asks
+// each previous owner in turn for the keys it now owns, a batch at a time,
+// until that owner has none left for it. Meanwhile, before it serves any
+// request for a key, it pulls that key from the key's previous owner, so
+// no read misses a key in transit and no write is undone by a late copy.
+// A key is removed from its old owner in the same step that hands it over,
+// and applied by the new owner before anything else there touches it.
+// Only the previous topology is tracked: a rebalance should finish (see
+// ClusterStatus::migrating on the old nodes) before the next one starts.
+// Topologies live in memory; a restarted node starts from its flags again.
+//
+// ClusterPull, binary protocol:
+//   request: topology | from | count u32 | count x (len u32 | key), where
+//            topology is len u32 | lines, from the puller's host:port as
+//            len u32 | bytes, and count 0 asks for the next batch of keys
+//            the puller owns
+//   reply:   done u8 | topology | records, the keys found and now removed
+//            here, in the Storage encoding with their deadlines (see
+//            Storage::encode_put); done once nothing is left for the puller
+// Each side moves to the other's topology if it is newer, and a node that
+// is behind gets no keys.
+
+struct ClusterTopology {
+    uint64_t epoch = 0;
+    uint32_t vnodes = 64;           // ring points per node
+    std::vector<std::string> nodes; // host:port of every node
+
+    // "name:value" lines: epoch, vnodes, then one node line per node;
+    // parse() ignores names it does not know
+    std::string to_string() const;
+    static bool parse(std::string_view text, ClusterTopology &topology);
+};
+
+// Stable across processes and builds, unlike std::hash, since clients and
+// servers must agree on it
+uint64_t cluster_hash(std::string_view data);
+
+class HashRing {
+public:
+    HashRing() = default;
+    explicit HashRing(const ClusterTopology &topology);
+
+    bool empty() const { return points.empty(); }
+
+    // Index in the topology's nodes of the key's owner; the ring must not be empty
+    size_t owner(std::string_view key) const;
+
+private:
+    std::vector<std::pair<uint64_t, uint32_t>> points; // (hash, node), sorted
+};
+
+struct ClusterStatus {
+    uint64_t epoch = 0;
+    bool migrating = false;  // holds keys other nodes have yet to pull
+    size_t importing = 0;    // previous owners not yet pulled dry
+    uint64_t keys_sent = 0;  // pulled from here by other nodes
+    uint64_t keys_received = 0;
+};
+
+// The cluster state of one server: its topology, the key routing, and the
+// thread that moves keys when the topology changes
+class ClusterNode {
+public:
+    // self is this node's host:port as it appears in topologies; a node not
+    // in the topology owns no keys
+    ClusterNode(KVStore &store, const std::string &self, const ClusterTopology &topology);
+    ~ClusterNode();
+
+    ClusterTopology topology() const;
+    ClusterStatus status() const;
+
+    // Topology and status as "name:value" lines, for ClusterInfo
+    std::string info() const;
+
+    // Move to topology if its epoch is higher; false if it is lower, or
+    // equal with different nodes
+    bool set_topology(const ClusterTopology &topology);
+
+    // Whether this node serves all of keys: Ok once any of them still on
+    // their previous owner have been pulled, Moved with the owner of the
+    // first key it does not own in moved_to, or Error if a previous owner
+    // could not be reached
+    protocol::Status route(const std::vector<std::string_view> &keys, std::string &moved_to);
+    protocol::Status route(std::string_view key, std::string &moved_to);
+
+    // Answer ClusterSet or another node's ClusterPull; false if it is
+    // malformed or refused, in which case it gets an error
+    bool handle(protocol::Opcode op, std::string_view body, std::string &reply);
+
+    // Most keys handed over per ClusterPull
+    static constexpr size_t PULL_BATCH = 1000;
+
+private:
+    KVStore &store;
+    std::string self;
+
+    mutable std::mutex mtx;
+    std::condition_variable changed;
+    ClusterTopology current;
+    HashRing ring;
+    ClusterTopology previous;
+    HashRing previous_ring;
+    bool scanned = false; // outgoing is complete for the current topology
+    std::map<std::string, std::deque<std::string>> outgoing; // owner -> keys held for it
+    std::set<std::string> importing; // previous owners not yet pulled dry
+    bool stopping = false;
+    uint64_t keys_sent = 0;
+    uint64_t keys_received = 0;
+
+    // Serializes this node's pulls, so a request never reads the store
+    // while a pull of its key is on the way; guards connections
+    std::mutex pull_mtx;
+    std::map<std::string, std::unique_ptr<KVClient>> connections;
+
+    std::thread migrator;
+
+    // Called with mtx held
+    bool adopt(const ClusterTopology &topology);
+    bool owns(std::string_view key) const;
+    bool holds_keys_for(const std::string &node) const;
+
+    void migrate_loop();
+
+    // Pull keys (or, if empty, the next batch) from source; done is set
+    // once source has nothing left for this node
+    protocol::Status pull(const std::string &source, const std::vector<std::string> &keys, bool &done);
+
+    bool handle_pull(std::string_view body, std::string &reply);
+};
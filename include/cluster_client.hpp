@@ -0,0 +1,72 @@
+#pragma once
+#include "client.hpp"
+#include "cluster.hpp"
+#include <chrono>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+// A client for a cluster of servers (see cluster.hpp) that sends each key
+// straight to the node owning it. It keeps one binary-protocol connection
+// per node and fans batches out to the nodes in parallel, pipelining each
+// node's share. A Moved reply means the client's topology is behind: it
+// fetches the replying node's and tries again, up to MAX_ATTEMPTS times.
+// Like KVClient, not to be shared between threads.
+class ClusterClient {
+public:
+    // seeds: host:port of one or more nodes to fetch the topology from
+    explicit ClusterClient(const std::vector<std::string>& seeds);
+
+    bool put(const std::string& key, const std::string& value);
+    bool put(const std::string& key, const std::string& value, std::chrono::seconds ttl);
+    bool get(const std::string& key, std::string& value);
+    bool remove(const std::string& key);
+
+    // Keys are grouped by owner and each group goes to its node as one
+    // pipelined run of requests; the batch as a whole is not atomic
+    bool multi_put(const std::vector<std::pair<std::string, std::string>>& items);
+    std::vector<std::optional<std::string>> multi_get(const std::vector<std::string>& keys);
+    size_t multi_remove(const std::vector<std::string>& keys);
+
+    const ClusterTopology& topology() const { return topo; }
+
+    // Fetch the newest topology any seed or known node has
+    void refresh();
+
+    // Rebalance over nodes: give every node of the current and the new
+    // topology the new one, with the next epoch (vnodes 0 = as now). Keys
+    // move in the background; false if some node did not take it.
+    bool set_nodes(const std::vector<std::string>& nodes, uint32_t vnodes = 0);
+
+    static constexpr int MAX_ATTEMPTS = 5;
+
+private:
+    struct Op {
+        protocol::Opcode op;
+        const std::string* key;
+        const std::string* value = nullptr;
+        std::chrono::seconds ttl{0};
+        protocol::Status status = protocol::Status::Error;
+        std::string result;
+        std::string sent_to; // node of the last attempt
+        std::string moved_to; // owner it named if it answered Moved
+    };
+
+    std::vector<std::string> seeds;
+    ClusterTopology topo;
+    HashRing ring;
+    std::map<std::string, std::unique_ptr<KVClient>> connections;
+
+    // Null if the node cannot be reached
+    KVClient* connection(const std::string& address);
+
+    // Take address's topology if it is newer; returns whether it was
+    bool learn(const std::string& address);
+
+    // Send every op to its owner and collect the replies; ops still without
+    // an answer after MAX_ATTEMPTS are left with status Error
+    void run(std::vector<Op>& ops);
+};
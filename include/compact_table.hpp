@@ -0,0 +1,155 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Hash table that keeps keys and values in large arena slabs instead of one
+// heap allocation per string. Each entry is stored contiguously in a slab as
+//
+//   key_len u32 | value_len u32 | key | value
+//
+// and indexed by an open-addressing (linear probing) array of 12-byte slots
+// holding a 32-bit hash fingerprint plus the entry's slab and offset. An
+// overwrite with a different value size appends a fresh entry; the old one
+// becomes garbage that defragment() reclaims by moving the live entries out
+// of sparse slabs.
+//
+// Optionally every slot also carries a 32-bit access word, which eviction
+// policies keep recency or frequency in. A reader holding only shared
+// access may update it, since it is atomic.
+//
+// Not thread-safe: const members may run concurrently with each other, but
+// anything that modifies the table needs exclusive access. Views returned by
+// find() and for_each() are invalidated by the next modification.
+class CompactTable {
+public:
+    CompactTable();
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+
+    bool find(std::string_view key, std::string_view &value) const;
+    bool contains(std::string_view key) const;
+
+    // Keep an access word per entry from now on, 4 bytes a slot. A new
+    // entry's word starts at 0; an overwrite keeps it.
+    void track_access();
+
+    // find() that also replaces the entry's access word w with touch(w).
+    // Two readers touching the same entry at once may lose one update,
+    // which an approximate policy can live with.
+    template <typename Touch>
+    bool find(std::string_view key, std::string_view &value, Touch touch) const {
+        bool found;
+        size_t i = probe(key, hash_of(key), found);
+        if (found) {
+            value = entry_value(entry_at(slots[i]));
+            if (access) {
+                access[i].store(touch(access[i].load(std::memory_order_relaxed)), std::memory_order_relaxed);
+            }
+        }
+        return found;
+    }
+
+    // Call f(key, access word) for up to n live entries, in slot order from
+    // a position picked by random: eviction candidates at O(n) cost
+    template <typename F>
+    void sample(size_t n, uint64_t random, F f) const {
+        size_t mask = slots.size() - 1;
+        size_t i = static_cast<size_t>(random) & mask;
+        for (size_t visited = 0; n > 0 && visited <= mask; visited++, i = (i + 1) & mask) {
+            if (slots[i].tag >= FIRST_TAG) {
+                f(entry_key(entry_at(slots[i])), access ? access[i].load(std::memory_order_relaxed) : 0);
+                n--;
+            }
+        }
+    }
+
+    // Insert or overwrite; returns true if the key was new. old_value_size,
+    // if given, receives the replaced value's size.
+    bool put(std::string_view key, std::string_view value, size_t *old_value_size = nullptr);
+
+    // Returns false if the key was absent
+    bool erase(std::string_view key, size_t *old_value_size = nullptr);
+
+    void clear();
+
+    template <typename F>
+    void for_each(F f) const {
+        for (const Slot &slot : slots) {
+            if (slot.tag >= FIRST_TAG) {
+                const char *entry = entry_at(slot);
+                f(entry_key(entry), entry_value(entry));
+            }
+        }
+    }
+
+    // Memory held for the table: slab capacity plus the slot array
+    size_t memory_bytes() const;
+
+    // Slab bytes taken up by overwritten or erased entries
+    size_t garbage_bytes() const { return garbage; }
+
+    // Memory held for live entries and the slot array: memory_bytes() less
+    // the garbage and the room left at the end of the slab being filled
+    size_t live_bytes() const;
+
+    // Move the live entries out of up to max_slabs of the sparsest slabs and
+    // release them. Returns the number of slab bytes freed, 0 once no slab is
+    // worth evacuating.
+    size_t defragment(size_t max_slabs = 1);
+
+private:
+    static constexpr uint32_t EMPTY = 0;
+    static constexpr uint32_t DELETED = 1;
+    static constexpr uint32_t FIRST_TAG = 2;
+    static constexpr size_t ENTRY_HEADER = 8;
+
+    struct Slot {
+        uint32_t tag;  // EMPTY, DELETED or a hash fingerprint >= FIRST_TAG
+        uint32_t slab;
+        uint32_t offset;
+    };
+
+    struct Slab {
+        std::unique_ptr<char[]> data;
+        uint32_t capacity = 0;
+        uint32_t used = 0; // bytes handed out, live or not
+        uint32_t live = 0; // bytes of entries still indexed
+    };
+
+    std::vector<Slot> slots; // power-of-two sized
+    std::unique_ptr<std::atomic<uint32_t>[]> access; // one word per slot, if tracked
+    unsigned shift = 0;      // 64 - log2(slots.size()), for picking a home slot
+    size_t count = 0;
+    size_t deleted = 0; // DELETED slots, which still lengthen probes
+    std::vector<Slab> slabs;
+    std::vector<uint32_t> free_slabs;
+    uint32_t active;        // slab new entries are appended to
+    size_t next_slab_bytes; // slabs start small and double up to a limit
+    size_t slab_bytes = 0;  // capacity of all slabs
+    size_t garbage = 0;
+
+    static uint64_t hash_of(std::string_view key);
+    static uint32_t tag_of(uint64_t hash);
+    static uint32_t read_u32(const char *p);
+    static std::string_view entry_key(const char *entry);
+    static std::string_view entry_value(const char *entry);
+    static size_t entry_size(const char *entry);
+
+    const char *entry_at(const Slot &slot) const;
+    size_t home(uint64_t hash) const;
+
+    // Index of the slot holding key, or of the slot to insert it into
+    size_t probe(std::string_view key, uint64_t hash, bool &found) const;
+    void rehash(size_t capacity);
+    Slot allocate(std::string_view key, std::string_view value, uint32_t tag);
+    void release(const Slot &slot);
+    uint32_t new_slab(size_t capacity);
+    void free_slab(uint32_t index);
+};
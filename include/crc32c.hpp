@@ -0,0 +1,8 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// CRC-32C (Castagnoli). Uses the SSE4.2 crc32 instruction when the CPU has
+// it and a slicing-by-8 table otherwise. Pass a previous result as crc to
+// checksum data in pieces.
+uint32_t crc32c(const void *data, size_t len, uint32_t crc = 0);
@@ -0,0 +1,22 @@
+#pragma once
+#include <cstdint>
+#include <string_view>
+
+// How far a write must get before it is acknowledged, from safest to
+// fastest. The values go over the wire in request flags (see protocol.hpp).
+enum class Durability : uint8_t {
+    Always = 1,   // fdatasync'ed; every commit group is synced
+    EverySec = 2, // written to the OS; the log is synced about once a second
+    Os = 3,       // written to the OS, which flushes it whenever it likes
+    None = 4,     // not waited for; written with the next commit group
+};
+
+// Parse "always", "everysec", "os" or "none"; false for anything else
+inline bool parse_durability(std::string_view name, Durability& level) {
+    if (name == "always") level = Durability::Always;
+    else if (name == "everysec") level = Durability::EverySec;
+    else if (name == "os") level = Durability::Os;
+    else if (name == "none") level = Durability::None;
+    else return false;
+    return true;
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include <cstdint>
+#include "expiry.hpp"
+
+// Which keys make room once a store set up as a cache reaches its memory cap
+enum class EvictionPolicy {
+    Lru, // least recently used
+    Lfu, // least frequently used, counts fading over time
+};
+
+// Eviction is approximate, as in Redis: each entry keeps a 32-bit access
+// word (see CompactTable::track_access), and a store over its cap evicts
+// the worst of a handful of sampled entries rather than maintaining an
+// exact order, which would need a lock shared by every read.
+//
+// LRU words are the time of the last access in milliseconds, modulo 2^32.
+// LFU words are minutes u16 | counter u8: a logarithmic access counter
+// (incremented with probability 1 / ((counter - LFU_INIT) * LFU_LOG_FACTOR
+// + 1), so 255 means about a million hits) that loses one every
+// LFU_DECAY_MINUTES since the minute stamp, which is when it last changed.
+namespace eviction {
+
+constexpr uint32_t LFU_INIT = 5; // new keys start here, so they are not evicted at once
+constexpr uint32_t LFU_LOG_FACTOR = 10;
+constexpr uint32_t LFU_DECAY_MINUTES = 1;
+
+inline uint32_t lru_clock() {
+    return static_cast<uint32_t>(unix_now_ms());
+}
+
+inline uint32_t lfu_minutes() {
+    return static_cast<uint32_t>(unix_now_ms() / 60000) & 0xffff;
+}
+
+inline uint32_t lfu_counter(uint32_t word, uint32_t now_minutes) {
+    if (word == 0) {
+        return LFU_INIT;
+    }
+    uint32_t counter = word & 0xff;
+    uint32_t elapsed = (now_minutes - (word >> 8)) & 0xffff;
+    uint32_t decay = elapsed / LFU_DECAY_MINUTES;
+    return decay >= counter ? 0 : counter - decay;
+}
+
+// The word after an access; random is any uniformly distributed value
+inline uint32_t lfu_touch(uint32_t word, uint32_t now_minutes, uint32_t random) {
+    uint32_t counter = lfu_counter(word, now_minutes);
+    if (counter < 255) {
+        uint32_t base = counter > LFU_INIT ? counter - LFU_INIT : 0;
+        if (random % (base * LFU_LOG_FACTOR + 1) == 0) {
+            counter++;
+        }
+    }
+    return (now_minutes << 8) | counter;
+}
+
+// How good a candidate for eviction the entry is; the highest goes first
+inline uint64_t score(EvictionPolicy policy, uint32_t word, uint32_t now_ms, uint32_t now_minutes) {
+    if (policy == EvictionPolicy::Lru) {
+        return static_cast<uint32_t>(now_ms - word); // idle time
+    }
+    return 255 - lfu_counter(word, now_minutes);
+}
+
+} // namespace eviction
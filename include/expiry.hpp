@@ -0,0 +1,16 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+
+// Expiry deadlines are wall-clock times in milliseconds since the Unix
+// epoch, so a deadline written to the log means the same after a restart;
+// 0 means the entry never expires.
+inline uint64_t unix_now_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::system_clock::now().time_since_epoch())
+        .count();
+}
+
+inline bool is_expired(uint64_t expires_at, uint64_t now_ms) {
+    return expires_at != 0 && expires_at <= now_ms;
+}
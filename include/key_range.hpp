@@ -0,0 +1,18 @@
+#pragma once
+#include <string>
+#include <string_view>
+
+// Exclusive upper bound of the keys that start with prefix, for turning a
+// prefix scan into a range scan: the prefix with its trailing 0xff bytes
+// dropped and the last remaining byte incremented. Empty, meaning no upper
+// bound, if nothing is left.
+inline std::string prefix_end(std::string_view prefix) {
+    std::string end(prefix);
+    while (!end.empty() && static_cast<unsigned char>(end.back()) == 0xff) {
+        end.pop_back();
+    }
+    if (!end.empty()) {
+        end.back() = static_cast<char>(static_cast<unsigned char>(end.back()) + 1);
+    }
+    return end;
+}
@@ -1,29 +1,336 @@
 #pragma once
 #include <string>
 #include <optional>
+#include <set>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
 #include <mutex>
-#include <unordered_map>
+#include <shared_mutex>
+#include <thread>
+#include <vector>
+#include "compact_table.hpp"
+#include "eviction.hpp"
+#include "lsm.hpp"
+#include "replication.hpp"
 #include "storage.hpp"
+#include "timer_wheel.hpp"
+
+enum class StorageEngine
+{
+    Memory, // every entry in RAM; the log only provides durability
+    Lsm     // recent writes in RAM, older data in SSTables on disk
+};
+
+struct KVStoreOptions
+{
+    // Where the data lives. A store written by the Lsm engine must keep
+    // using it: the Memory engine does not read SSTables.
+    StorageEngine engine = StorageEngine::Memory;
+
+    // Number of independently locked partitions; keys are spread by hash
+    size_t num_shards = 16;
+
+    // Log every write and replay the log on startup. A cache that may come
+    // back empty can turn this off; the Lsm engine always logs.
+    bool persistence = true;
+
+    // Cache mode: once the tables hold this many bytes of entries, writes
+    // make room by evicting other keys (0 = no limit). Evictions are logged
+    // as deletes, if there is a log. Memory engine only.
+    size_t max_memory_bytes = 0;
+    EvictionPolicy eviction_policy = EvictionPolicy::Lru;
+
+    // Keys sampled per eviction; more gets closer to exact LRU or LFU
+    size_t eviction_samples = 5;
+
+    // Compact in the background once this fraction of the log is garbage
+    // (overwritten or deleted records); 0 disables automatic compaction
+    double compact_garbage_ratio = 0.5;
+
+    // ...but only once the log holds at least this many bytes
+    uint64_t compact_min_bytes = 64 << 20;
+
+    // Write a snapshot and truncate the log this often (0 = off)
+    std::chrono::seconds checkpoint_interval{0};
+
+    // ...or as soon as this many bytes were logged since the last one (0 = off)
+    uint64_t checkpoint_log_bytes = 0;
+
+    // Defragment a shard's arena in the background once this fraction of it
+    // is garbage (0 = never)...
+    double defrag_garbage_ratio = 0.25;
+
+    // ...and it holds at least this many garbage bytes
+    size_t defrag_min_bytes = 1 << 20;
+
+    // Expire keys whose TTL has passed this often, whether or not they are
+    // read again (0 = only when read)...
+    std::chrono::milliseconds expiry_interval{100};
+
+    // ...removing at most this many per shard and lock hold
+    size_t expiry_batch = 128;
+
+    // Keep each shard's keys sorted as well, so scans cost O(log n + limit)
+    // per shard instead of a walk over every entry. Costs one extra copy of
+    // every key. Memory engine only; LSM scans are always ordered.
+    bool ordered_index = false;
+
+    // Keep about this many bytes of the latest writes for followers to
+    // stream (see ReplicationLog); 0 = this store cannot lead. A follower
+    // that falls further behind, or connects while a full sync would take
+    // longer to send than the backlog lasts, has to start over. Memory
+    // engine only.
+    size_t replication_backlog_bytes = 0;
+
+    // Lsm: flush the memtables to a level-0 SSTable and truncate the log
+    // once this many bytes were written to them. Checkpoints and persist()
+    // flush too; automatic log compaction does not apply.
+    uint64_t memtable_bytes = 64 << 20;
+
+    LsmOptions lsm;
+
+    StorageOptions storage;
+};
 
 class KVStore
 {
 public:
-    KVStore(const std::string &storage_file);
+    KVStore(const std::string &storage_file, const KVStoreOptions &options = KVStoreOptions());
+    ~KVStore();
 
-    // Store key-value pair
-    bool put(const std::string &key, const std::string &value);
+    // Store key-value pair; a nonzero ttl makes it expire after that long
+    bool put(const std::string &key, const std::string &value,
+             std::chrono::milliseconds ttl = std::chrono::milliseconds(0));
 
     // Retrieve value by key
     bool get(const std::string &key, std::string& val);
 
+    // ...and its version, which changes with every write to the key. A key
+    // that is deleted and written again never gets a version it had before,
+    // and versions survive restarts, so a version names one value for good.
+    bool get(const std::string &key, std::string &val, uint64_t &version);
+
     // Delete key
     bool remove(const std::string &key);
 
-    // Persist current in-memory state to storage
+    // Variants of put/remove that apply the write and queue its log record
+    // but leave waiting for durability to the caller; seq is set for
+    // wait_durable(). Lets a pipelined batch share one fsync.
+    bool put_nowait(const std::string &key, const std::string &value, uint64_t &seq,
+                    std::chrono::milliseconds ttl = std::chrono::milliseconds(0));
+    bool remove_nowait(const std::string &key, uint64_t &seq);
+    void wait_durable(uint64_t seq);
+
+    // Atomic read-modify-writes, each done under the key's shard lock.
+    // compare_and_set writes value only if the key is at expected_version
+    // (0 = only if it does not exist) and clears any expiry, as put does;
+    // version is set to the new version, or to the current one (0 if
+    // none) when it returns false. increment adds delta to the decimal
+    // integer stored at key, a missing key counting as 0, and sets result
+    // to the sum; it fails if the value is not an integer or the sum would
+    // overflow. append adds suffix to the value, a missing key counting as
+    // empty, and sets length to the new size. Both keep any expiry.
+    bool compare_and_set(const std::string &key, uint64_t expected_version, const std::string &value,
+                         uint64_t &version);
+    bool increment(const std::string &key, int64_t delta, int64_t &result);
+    bool append(const std::string &key, const std::string &suffix, size_t &length);
+
+    bool compare_and_set_nowait(const std::string &key, uint64_t expected_version, const std::string &value,
+                                uint64_t &version, uint64_t &seq);
+    bool increment_nowait(const std::string &key, int64_t delta, int64_t &result, uint64_t &seq);
+    bool append_nowait(const std::string &key, const std::string &suffix, size_t &length, uint64_t &seq);
+
+    // Wait only as far as level asks (see Storage::wait_durable); the
+    // plain form uses options.storage.durability
+    void wait_durable(uint64_t seq, Durability level);
+
+    // Last log sequence known to be synced; 0 without persistence
+    uint64_t durable_lsn() const;
+
+    // What plain writes wait for: options.storage.durability, or None
+    // without a log
+    Durability durability() const;
+
+    // Batch variants. Every shard the batch touches is locked once, so the
+    // batch is applied atomically, and its writes go to the log as one
+    // record with a single fsync. multi_put rejects the whole batch if any
+    // key is empty; multi_remove returns how many keys existed.
+    bool multi_put(const std::vector<std::pair<std::string, std::string>> &items);
+    std::vector<std::optional<std::string>> multi_get(const std::vector<std::string> &keys);
+    size_t multi_remove(const std::vector<std::string> &keys);
+
+    // As above, leaving the wait for durability to the caller; seq stays 0
+    // if nothing was logged
+    bool multi_put_nowait(const std::vector<std::pair<std::string, std::string>> &items, uint64_t &seq);
+    size_t multi_remove_nowait(const std::vector<std::string> &keys, uint64_t &seq);
+
+    // Up to limit entries (0 = no limit) with start <= key < end, in key
+    // order; an empty end means no upper bound. Each shard is read under its
+    // own lock for no more than limit entries, so writers are only held up
+    // briefly, and continuing from the last key + '\0' pages through a range
+    // of any size. Writes made while a scan runs may or may not show up in it.
+    std::vector<std::pair<std::string, std::string>> scan(const std::string &start, const std::string &end,
+                                                          size_t limit = 0);
+    std::vector<std::pair<std::string, std::string>> prefix_scan(const std::string &prefix, size_t limit = 0);
+
+    // Persist current in-memory state to storage. Runs a compaction on the
+    // background thread and waits for it; other clients keep being served.
+    // Like checkpoint(), does nothing without persistence.
     void persist();
 
+    // Write a point-in-time snapshot and drop the log it covers, so the next
+    // restart only replays what is written after it. Runs on the background
+    // thread like persist(); see StorageStats for its timings.
+    void checkpoint();
+
+    // Group commit batch and fsync counters of the underlying log
+    StorageStats storage_stats() const;
+
+    // Log sync latencies (empty without persistence), and how long
+    // requests waited for a shard lock another thread held
+    metrics::Histogram::Snapshot sync_latency() const;
+    metrics::Histogram::Snapshot lock_waits() const;
+
+    // Fraction of the log that compaction would reclaim
+    double garbage_ratio() const;
+
+    // Bytes of memory held by the in-memory tables
+    size_t memory_bytes() const;
+
+    // Bytes of those taken by live entries, the figure max_memory_bytes
+    // caps; the rest is garbage not yet reclaimed and room in new slabs
+    size_t memory_used() const { return memory_in_use; }
+
+    // Keys removed to stay under max_memory_bytes
+    uint64_t evicted_count() const { return evicted; }
+
+    // Level layout and flush/compaction counters (all zero for the Memory engine)
+    LsmStats lsm_stats() const;
+
+    // Keys removed because their TTL passed, on read or by the expiry pass
+    uint64_t expired_count() const { return expired; }
+
+    size_t shard_count() const { return num_shards; }
+
+    // Whether writes are logged, and the store comes back after a restart
+    bool persistent() const { return storage != nullptr; }
+
+    // Replication leader state; null unless replication_backlog_bytes is set
+    ReplicationLog *replication_log() const { return replication.get(); }
+
+    // Call emit for every live key, one shard at a time, as a checkpoint
+    // does; each shard's keys come sorted. The Lsm engine reports keys that
+    // are already on disk without their deadline or version.
+    void dump(const Storage::Emit &emit);
+
+    // Apply the operations of one record streamed from a replication
+    // leader, with their deadlines and versions as they are (puts without a
+    // version get a new one); a batch is applied atomically. Returns the log
+    // sequence for wait_durable().
+    uint64_t apply_replicated(const std::vector<Storage::LogOp> &ops);
+
+    // Remove the keys that exist, in one batch, and append them with their
+    // deadlines and versions to records as puts in the Storage encoding, for another node
+    // to apply. Returns how many were moved out; seq is for wait_durable().
+    size_t extract(const std::vector<std::string> &keys, std::string &records, uint64_t &seq);
+
 private:
-    std::mutex mtx;                                     // thread-safe access
-    std::unordered_map<std::string, std::string> store; // in memory key-val store
-    Storage storage;                                    // persistent layer
+    // Each shard sits on its own cache line so neighbouring locks don't false-share
+    struct alignas(64) Shard
+    {
+        mutable std::shared_mutex mtx;           // readers share, writers exclusive
+        CompactTable store;                      // in memory key-val store
+        std::set<std::string, std::less<>> keys; // sorted keys, only with ordered_index
+        std::atomic<uint64_t> live_bytes{0};     // log bytes the live entries need
+        size_t memory = 0;                       // this shard's part of memory_in_use
+
+        // The last version handed out here. Entries of store (and frozen)
+        // are version u64 LE | value.
+        uint64_t clock = 0;
+
+        // Lsm: store is the memtable's puts, tombstones its deletes (with
+        // empty values). A flush freezes both until they are on disk.
+        CompactTable tombstones;
+        std::unique_ptr<CompactTable> frozen;
+        std::unique_ptr<CompactTable> frozen_tombstones;
+
+        // Deadlines (Unix ms, u64 LE) of the entries that expire, and the
+        // timers that remove them if they are not read first
+        CompactTable expiries;
+        std::unique_ptr<CompactTable> frozen_expiries;
+        TimerWheel wheel;
+    };
+
+    size_t num_shards;
+    std::unique_ptr<Shard[]> shards;
+    KVStoreOptions options;
+    std::unique_ptr<Storage> storage;                   // persistent layer, null without persistence
+    std::unique_ptr<LsmTree> lsm;                       // Lsm engine only
+    std::unique_ptr<ReplicationLog> replication;        // when leading followers
+    std::atomic<uint64_t> memtable_used{0};             // bytes written since the last flush
+    std::atomic<uint64_t> expired{0};
+    std::atomic<size_t> memory_in_use{0};
+    std::atomic<uint64_t> evicted{0};
+    mutable metrics::Histogram lock_wait_histogram;
+
+    // Lsm flush in progress, kept across a failed attempt so it is retried
+    // rather than freezing (and losing) the frozen tables; maintenance thread only
+    bool flush_pending = false;
+    uint64_t flush_tail = 0;
+    uint64_t flush_sealed = 0;
+
+    // Background compaction and checkpointing; persist() and checkpoint()
+    // wait for a generation of their job to complete
+    std::thread maintainer;
+    std::mutex maint_mtx;
+    std::condition_variable maint_cv;
+    bool maint_stopping = false;
+    uint64_t compact_requested = 0;
+    uint64_t compact_completed = 0;
+    std::string compact_error;
+    uint64_t checkpoint_requested = 0;
+    uint64_t checkpoint_completed = 0;
+    std::string checkpoint_error;
+    std::atomic<bool> defrag_requested{false};
+    bool level_compaction_pending = false;
+
+    size_t shard_index(const std::string &key) const;
+    Shard &shard_for(const std::string &key);
+    std::vector<std::unique_lock<std::shared_mutex>> lock_shards(std::vector<size_t> indices);
+    std::unique_lock<std::shared_mutex> write_lock(const Shard &shard) const;
+    std::shared_lock<std::shared_mutex> read_lock(const Shard &shard) const;
+    SSTable::Lookup memtable_get(const Shard &shard, const std::string &key, std::string &value,
+                                 bool *expired = nullptr, uint64_t *version = nullptr,
+                                 uint64_t *expires_at = nullptr) const;
+    static SSTable::Lookup found_entry(std::string_view entry, const CompactTable &expiries, const std::string &key,
+                                       std::string &value, uint64_t *version, uint64_t *expires_at);
+    SSTable::Lookup disk_get(const std::string &key, std::string &value, uint64_t *version = nullptr,
+                             uint64_t *expires_at = nullptr) const;
+    bool exists(const Shard &shard, const std::string &key) const;
+    using Modify = std::function<bool(std::string *current, uint64_t version, std::string &next)>;
+    bool read_modify_write(const std::string &key, bool keep_deadline, uint64_t &version, uint64_t &seq,
+                           const Modify &modify);
+    void apply_put(Shard &shard, const std::string &key, std::string_view value, uint64_t expires_at,
+                   uint64_t version);
+    void apply_remove(Shard &shard, const std::string &key);
+    bool expire_due();
+    uint64_t log_put(const std::string &key, const std::string &value, uint64_t expires_at, uint64_t version);
+    uint64_t log_remove(const std::string &key);
+    uint64_t log_batch(const WriteBatch &batch);
+    uint32_t touched(uint32_t access) const;
+    void account(Shard &shard);
+    void evict(Shard &shard, std::string_view keep, size_t target, uint64_t &seq);
+    void memtable_range(const Shard &shard, const std::string &start, const std::string &end, size_t limit,
+                        LsmTree::Overlay &out) const;
+    void flush_memtables();
+    void maintenance_loop();
+    void maybe_maintain(bool fragmented = false);
+    bool fragmented(const Shard &shard) const;
+    void defragment();
+    void scan_shard(const Shard &shard, const std::string &start, const std::string &end, size_t limit,
+                    std::vector<std::pair<std::string, std::string>> &out) const;
+    void snapshot(const Storage::Emit &emit);
 };
@@ -0,0 +1,139 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "sstable.hpp"
+
+struct LsmOptions
+{
+    // Target size of an SSTable data block, the unit read from disk
+    size_t block_bytes = 4096;
+
+    // Bloom filter size; 10 bits per key gives about 1% false positives
+    size_t bloom_bits_per_key = 10;
+
+    // Merge level 0 into level 1 once it holds this many flushed files
+    size_t level0_files = 4;
+
+    // Size limit of level 1; every deeper level may be level_multiplier
+    // times bigger than the one above it
+    uint64_t level1_bytes = 64 << 20;
+    size_t level_multiplier = 10;
+
+    // Compaction output is cut into files of about this size
+    uint64_t file_bytes = 16 << 20;
+
+    // Memory for cached data blocks plus every file's index and filter;
+    // 0 turns the cache off
+    uint64_t block_cache_bytes = 64 << 20;
+};
+
+struct LsmStats
+{
+    std::vector<size_t> level_files;  // SSTables per level
+    std::vector<uint64_t> level_bytes; // their total size
+    uint64_t flushes = 0;              // memtables written as level-0 files
+    uint64_t compactions = 0;          // compaction steps completed
+    uint64_t compaction_read_bytes = 0;
+    uint64_t compaction_write_bytes = 0;
+    BlockCacheStats block_cache;
+};
+
+// The on-disk part of the LSM engine: immutable SSTables organised in
+// levels, storage/<filename>.NNNNNN.sst, listed by storage/<filename>.manifest.
+// Level 0 holds flushed memtables, newest first, whose key ranges may
+// overlap; every deeper level is sorted and non-overlapping. Compaction
+// merges level 0 into level 1, or one file of an oversized level into the
+// overlapping files of the next, keeping only the newest version of each
+// key, and drops tombstones once no deeper level could hold an older
+// version; entries past their expiry deadline count as tombstones. The
+// manifest is rewritten atomically after every flush or compaction; files
+// it does not list are leftovers and removed on open.
+//
+// Lookups and scans work on a reference-counted snapshot of the level
+// layout, so they never wait for a flush or compaction; replaced files are
+// deleted once the last reader lets go of them. Point lookups fill the
+// block cache; scans and compactions only read from it.
+class LsmTree
+{
+public:
+    LsmTree(const std::string &filename, const LsmOptions &options = LsmOptions());
+
+    // Newest version of key on disk; an expired one reads as Deleted. Found
+    // also reports the entry's expiry deadline (0 = none) and the store's
+    // version of it (0 = none) if asked.
+    SSTable::Lookup get(std::string_view key, std::string &value, uint64_t *entry_expires_at = nullptr,
+                        uint64_t *entry_version = nullptr) const;
+
+    struct Entry
+    {
+        std::string_view key;
+        std::string_view value;
+        bool deleted;            // tombstone
+        uint64_t expires_at = 0; // Unix ms, 0 = never
+        uint64_t version = 0;    // the store's version of the entry, 0 = none
+    };
+
+    // Write entries, sorted by key without duplicates, as a new level-0 file
+    void flush(const std::vector<Entry> &entries);
+
+    // Whether a level is over its limit. compact() runs a single step of
+    // the merge, returning false if there was nothing to do; it must not
+    // run concurrently with itself.
+    bool needs_compaction() const;
+    bool compact();
+
+    // Newer entries laid over the tree by a scan, sorted by key; no value
+    // means the key was deleted
+    using Overlay = std::vector<std::pair<std::string, std::optional<std::string>>>;
+
+    // Append up to limit live entries (0 = no limit) with start <= key < end
+    // (empty end = no bound) to out in key order, taking overlay entries
+    // over anything on disk
+    void scan(const std::string &start, const std::string &end, size_t limit, const Overlay &overlay,
+              std::vector<std::pair<std::string, std::string>> &out) const;
+
+    LsmStats stats() const;
+
+    // Remove every SSTable and the manifest belonging to filename
+    static void destroy(const std::string &filename);
+
+private:
+    using Level = std::vector<std::shared_ptr<SSTable>>;
+    struct Version
+    {
+        std::vector<Level> levels;
+    };
+
+    std::string filename; // path prefix of the files
+    LsmOptions options;
+    std::unique_ptr<BlockCache> cache; // declared first so it outlives the tables
+
+    mutable std::mutex mtx; // guards current
+    std::shared_ptr<const Version> current;
+
+    std::mutex install_mtx;                    // one layout change at a time
+    uint64_t next_file = 1;                    // guarded by install_mtx
+    std::vector<std::string> compact_pointers; // per level, where the last compaction stopped
+
+    std::atomic<uint64_t> stat_flushes{0};
+    std::atomic<uint64_t> stat_compactions{0};
+    std::atomic<uint64_t> stat_compaction_read{0};
+    std::atomic<uint64_t> stat_compaction_written{0};
+
+    std::shared_ptr<const Version> version() const;
+    std::string table_path(uint64_t number) const;
+    std::string manifest_path() const;
+    uint64_t new_file_number();
+    uint64_t level_limit(size_t level) const;
+    void load();
+    void write_manifest(const Version &version, uint64_t next);
+    void install(const std::vector<std::shared_ptr<SSTable>> &removed, size_t level,
+                 const std::vector<std::shared_ptr<SSTable>> &added);
+};
@@ -0,0 +1,74 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Instrumentation cheap enough to leave on at full load. Every metric keeps
+// STRIPES copies of its counters, each on cache lines of its own, and a
+// thread always updates the same copy with relaxed atomic adds, so threads
+// recording at once do not fight over a cache line and nothing ever locks.
+// Reads add the copies up; they see each counter at some recent value, not
+// all of them at one instant.
+namespace metrics {
+
+constexpr size_t STRIPES = 8;
+
+// The copy the calling thread updates
+size_t stripe();
+
+class Counter {
+public:
+    void add(uint64_t n = 1) { stripes[stripe()].value.fetch_add(n, std::memory_order_relaxed); }
+    uint64_t value() const;
+
+private:
+    struct alignas(64) Stripe {
+        std::atomic<uint64_t> value{0};
+    };
+    std::array<Stripe, STRIPES> stripes;
+};
+
+// Latencies in nanoseconds, HDR style: values fall into power-of-two ranges
+// each split into SUB_BUCKETS equal steps, so a percentile read back is
+// within 1/SUB_BUCKETS (12.5%) of the value recorded, from 1 ns up to
+// several minutes, and recording costs a handful of adds.
+class Histogram {
+public:
+    static constexpr size_t SUB_BITS = 3;
+    static constexpr size_t SUB_BUCKETS = size_t(1) << SUB_BITS;
+    static constexpr size_t BUCKETS = (40 - SUB_BITS + 1) * SUB_BUCKETS; // up to 2^40 ns
+
+    void record(uint64_t ns);
+    void record(std::chrono::nanoseconds elapsed) { record(static_cast<uint64_t>(elapsed.count())); }
+
+    struct Snapshot {
+        uint64_t count = 0;
+        uint64_t sum_ns = 0;
+        uint64_t max_ns = 0;
+        std::vector<uint64_t> buckets; // BUCKETS counts
+
+        // The value below which fraction q (0 to 1) of the samples fall,
+        // rounded up to its bucket's upper bound; 0 without samples
+        uint64_t percentile(double q) const;
+        double mean_ns() const { return count ? double(sum_ns) / count : 0; }
+    };
+    Snapshot snapshot() const;
+
+    // Bucket a value falls into, and the largest value a bucket holds
+    static size_t bucket_of(uint64_t ns);
+    static uint64_t bucket_limit(size_t bucket);
+
+private:
+    struct alignas(64) Stripe {
+        std::atomic<uint64_t> count{0};
+        std::atomic<uint64_t> sum_ns{0};
+        std::atomic<uint64_t> max_ns{0};
+        std::array<std::atomic<uint64_t>, BUCKETS> buckets{};
+    };
+    std::array<Stripe, STRIPES> stripes;
+};
+
+} // namespace metrics
@@ -0,0 +1,191 @@
+// protocol.hpp
+#pragma once
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Binary wire protocol, spoken alongside the newline-terminated text protocol.
+// A request whose first byte is MAGIC is a binary frame; anything else is text.
+//
+// Frame layout (integers big-endian), used for requests and responses:
+//   magic u8 | opcode/status u8 | flags u16 | request_id u32 | key_len u32 | value_len u32
+//   key bytes | value bytes
+//
+// Multi-key requests (MPut, MGet, MDelete) leave the key empty and carry a
+// list in the value: count u32 | count x (len u32 | bytes). MPut's list
+// alternates keys and values. An MGet reply's value is count u32 followed by
+// found u8 | len u32 | bytes per requested key; an MDelete reply's value is
+// the number of keys removed as a u32.
+//
+// A Scan request carries the start key as its key and limit u32 | end key
+// as its value (empty end = no upper bound, limit 0 = as many as the server
+// sends). The reply's value is more u8 | count u32 | count x (len u32 |
+// bytes), keys alternating with values in key order; more is set when the
+// range continues past the last key returned.
+//
+// A PutEx request is a Put whose value is ttl_seconds u32 | value; the key
+// expires that many seconds after it was written.
+//
+// Versions (see KVStore): GetVersion answers like Get with version u64 |
+// value. Cas carries expected_version u64 | value (0 = the key must not
+// exist) and answers Ok with the new version u64, or Conflict with the
+// current one. IncrBy carries delta as an i64 and answers with the sum as an
+// i64, or Error if the stored value is not an integer; Append carries the
+// suffix and answers with the new length u64. Like Put, all three are
+// writes.
+//
+// Replication: a follower sends Sync with replication_id u64 | offset u64,
+// the position it has applied the leader's log up to (0 | 0 if none). The
+// connection then carries the leader's log stream, frames whose code is a
+// ReplMessage: FullSync or Continue (replication_id u64 | offset u64 where
+// the stream resumes), for a full sync Snapshot frames of log records and a
+// SnapshotEnd, then Records (leader_offset u64 | written_at u64 | records),
+// or Heartbeat (leader_offset u64 | now u64) while there is nothing to send.
+// Times are Unix ms on the leader's clock. The follower answers with ReplAck
+// frames carrying the offset u64 it has applied up to. ReplInfo returns the
+// node's replication state as "name:value" lines.
+//
+// RequestVote, AppendEntries and InstallSnapshot are Raft's RPCs between
+// the nodes of a cluster (see raft.hpp). A node that is not the Raft leader
+// answers writes with NotLeader and the leader's address, if it knows it.
+//
+// In cluster mode (see cluster.hpp) a node answers requests for keys it does
+// not own with Moved and the owner's host:port. ClusterInfo returns the
+// node's topology as "name:value" lines; ClusterSet installs a new one, and
+// ClusterPull moves keys between nodes while rebalancing.
+//
+// Durability: the low three flag bits of a Put, PutEx, Delete, MPut,
+// MDelete, Cas, IncrBy or Append request pick how durable the write must be before it is answered,
+// a Durability level (see storage.hpp), 0 for the server's default. With
+// FLAG_RETURN_LSN set, an Ok reply to Put, PutEx or Delete carries the
+// write's log sequence number as a u64 (0 if it was not logged). Durable
+// waits until the LSN u64 in its value (empty = everything logged so far) is
+// as durable as its flags ask, Always by default, and answers with the
+// server's durable LSN.
+//
+// Stats returns the server's counters and latency percentiles as
+// "name:value" lines (see KVServer).
+namespace protocol {
+
+constexpr uint8_t MAGIC = 0xD7;
+constexpr size_t HEADER_SIZE = 16;
+
+// Request flags
+constexpr uint16_t FLAG_DURABILITY = 0x7; // mask of the requested level
+constexpr uint16_t FLAG_RETURN_LSN = 0x8;
+
+// Largest key_len + value_len a server will accept in one frame
+constexpr size_t MAX_BODY_BYTES = 64 << 20;
+
+enum class Opcode : uint8_t {
+    Put = 1,
+    Get = 2,
+    Delete = 3,
+    Persist = 4,
+    MPut = 5,
+    MGet = 6,
+    MDelete = 7,
+    Scan = 8,
+    PutEx = 9,
+    Sync = 10,
+    ReplAck = 11,
+    ReplInfo = 12,
+    RequestVote = 13,
+    AppendEntries = 14,
+    InstallSnapshot = 15,
+    ClusterInfo = 16,
+    ClusterSet = 17,
+    ClusterPull = 18,
+    Durable = 19,
+    Stats = 20,
+    GetVersion = 21,
+    Cas = 22,
+    IncrBy = 23,
+    Append = 24,
+};
+
+enum class Status : uint8_t {
+    Ok = 0,
+    NotFound = 1,
+    Error = 2,
+    UnknownCmd = 3,
+    ReadOnly = 4, // a write sent to a follower
+    NotLeader = 5, // a write sent to a Raft follower; the value is the leader's host:port
+    Moved = 6,     // a key another cluster node owns; the value is its host:port
+    Conflict = 7,  // a Cas whose expected version did not match; the value is the current one
+};
+
+enum class ReplMessage : uint8_t {
+    FullSync = 1,
+    Continue = 2,
+    Snapshot = 3,
+    SnapshotEnd = 4,
+    Records = 5,
+    Heartbeat = 6,
+};
+
+struct FrameHeader {
+    uint8_t magic = MAGIC;
+    uint8_t code = 0; // Opcode in requests, Status in responses
+    uint16_t flags = 0;
+    uint32_t request_id = 0;
+    uint32_t key_len = 0;
+    uint32_t value_len = 0;
+
+    size_t frame_size() const { return HEADER_SIZE + key_len + value_len; }
+};
+
+// Decode a header from the front of buf; false if fewer than HEADER_SIZE bytes
+bool decode_header(std::string_view buf, FrameHeader& header);
+
+// Append just a frame header to out; the caller sends the body separately
+void encode_header(std::string& out, uint8_t code, uint32_t request_id,
+                   uint32_t key_len, uint32_t value_len, uint16_t flags = 0);
+
+// Append a complete frame to out
+void encode_frame(std::string& out, uint8_t code, uint32_t request_id,
+                  std::string_view key, std::string_view value, uint16_t flags = 0);
+
+inline void encode_request(std::string& out, Opcode op, uint32_t request_id,
+                           std::string_view key = {}, std::string_view value = {}, uint16_t flags = 0) {
+    encode_frame(out, static_cast<uint8_t>(op), request_id, key, value, flags);
+}
+
+// Multi-key bodies
+void encode_u32(std::string& out, uint32_t v);
+void encode_string(std::string& out, std::string_view s);
+bool decode_u32(std::string_view body, uint32_t& v);
+
+// Replication bodies are runs of u64s, records follow in a Records frame
+void encode_u64(std::string& out, uint64_t v);
+bool decode_u64(std::string_view body, uint64_t& v);
+
+// Split a count | (len | bytes)... list into views of body; false if malformed
+bool decode_strings(std::string_view body, std::vector<std::string_view>& items);
+
+void encode_values(std::string& out, const std::vector<std::optional<std::string>>& values);
+bool decode_values(std::string_view body, std::vector<std::optional<std::string>>& values);
+
+// Scan bodies
+void encode_scan_request(std::string& out, uint32_t limit, std::string_view end);
+bool decode_scan_request(std::string_view body, uint32_t& limit, std::string_view& end);
+void encode_entries(std::string& out, const std::vector<std::pair<std::string, std::string>>& entries, bool more);
+bool decode_entries(std::string_view body, std::vector<std::pair<std::string, std::string>>& entries, bool& more);
+
+// PutEx bodies
+void encode_ttl_value(std::string& out, uint32_t ttl_seconds, std::string_view value);
+bool decode_ttl_value(std::string_view body, uint32_t& ttl_seconds, std::string_view& value);
+
+// Cas bodies and GetVersion replies
+void encode_versioned_value(std::string& out, uint64_t version, std::string_view value);
+bool decode_versioned_value(std::string_view body, uint64_t& version, std::string_view& value);
+
+inline void encode_response(std::string& out, Status status, uint32_t request_id,
+                            std::string_view value = {}) {
+    encode_frame(out, static_cast<uint8_t>(status), request_id, {}, value);
+}
+
+} // namespace protocol
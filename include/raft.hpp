@@ -0,0 +1,227 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+#include "protocol.hpp"
+#include "storage.hpp"
+
+class KVStore;
+
+// Raft consensus (Ongaro and Ousterhout) over a cluster of KVServers, for
+// writes that are acknowledged only once a majority of nodes has them on
+// disk, and so survive the loss of any minority.
+//
+// Entries carry log records in the Storage encoding (see Storage::encode_put),
+// and committed entries are applied to the KVStore in log order through
+// KVStore::apply_replicated. The Raft log itself is kept in a Storage log of
+// its own: entry i is a put of key "e" + i (u64 big-endian) whose value is
+// term u64 | records, so appends share the group commit of any other log,
+// and a conflicting suffix is cut off by deleting its keys. The current term
+// and vote are one more key, and so is the snapshot position below.
+//
+// The snapshot is the KVStore itself. Once enough entries have been applied,
+// and are durable in the store's own log, the Raft log drops them and
+// remembers the last one's index and term (the store must be persistent
+// for that; without persistence the whole log is kept and replayed on
+// restart). A follower that needs dropped entries is sent the store's
+// contents instead, in InstallSnapshot chunks, followed by the entries from
+// the index the dump started at; replaying those over a dump that may
+// already hold some of them gives the same result.
+//
+// Peers talk over the binary protocol (integers big-endian):
+//   RequestVote:     term | candidate | last_log_index | last_log_term
+//     reply:         term | granted u8
+//   AppendEntries:   term | leader | prev_index | prev_term | leader_commit
+//                    | count u32 | count x (term u64 | len u32 | records)
+//     reply:         term | success u8 | index, the last index now matching
+//                    the leader on success, else where to retry from
+//   InstallSnapshot: term | leader | last_index | last_term | offset | done u8
+//                    | records, offset counting the record bytes sent before
+//     reply:         term | accepted u8
+//
+// Each follower is fed by a thread of the leader's that keeps up to
+// max_inflight AppendEntries outstanding on one connection, each carrying
+// every entry proposed since the last, so concurrent writes share RPCs and
+// fsyncs. Reads are served by every node from its own store, and so may be
+// stale on followers.
+
+struct RaftOptions {
+    // Every node's KVServer as host:port, this one included; peers and
+    // clients are pointed to them
+    std::vector<std::string> peers;
+    size_t id = 0; // this node's index in peers
+
+    // Storage log for the Raft log; one per node
+    std::string log_file = "raft.log";
+    StorageOptions storage;
+
+    // A follower that hears from no leader for a random time between this
+    // and twice this stands for election; a leader that has not heard from
+    // a majority for as long steps down
+    std::chrono::milliseconds election_timeout{300};
+
+    // A leader with nothing to send says so this often
+    std::chrono::milliseconds heartbeat_interval{50};
+
+    // Most entry bytes in one AppendEntries, and AppendEntries outstanding
+    // per follower
+    size_t max_batch_bytes = 1 << 20;
+    size_t max_inflight = 8;
+
+    // Drop applied entries from the Raft log once this many have piled up
+    // (0 = never); needs a persistent store
+    uint64_t snapshot_entries = 100000;
+
+    // How long a write waits to be committed before it is given up on
+    std::chrono::milliseconds commit_timeout{5000};
+};
+
+enum class RaftRole { Follower, Candidate, Leader };
+
+struct RaftStatus {
+    RaftRole role = RaftRole::Follower;
+    uint64_t term = 0;
+    int leader = -1; // index in peers, -1 if unknown
+    uint64_t last_index = 0;
+    uint64_t commit_index = 0;
+    uint64_t last_applied = 0;
+    uint64_t snapshot_index = 0;
+    uint64_t snapshots_sent = 0;
+    uint64_t snapshots_installed = 0;
+};
+
+class RaftNode {
+public:
+    RaftNode(KVStore &store, const RaftOptions &options);
+    ~RaftNode();
+
+    // Append records to the log if this node leads. index and term identify
+    // the entry for wait_applied(). Does not wait for anything.
+    bool propose(std::string records, uint64_t &index, uint64_t &term);
+
+    // Block until the entry at index is applied: true if it is the one
+    // proposed in term, false if another entry took its place or
+    // commit_timeout passed first (the write may or may not happen)
+    bool wait_applied(uint64_t index, uint64_t term);
+
+    // propose() and wait_applied() in one
+    bool replicate(std::string records);
+
+    // The leader's host:port as far as this node knows, empty if unknown
+    std::string leader_address() const;
+
+    RaftStatus status() const;
+
+    // Answer a peer's RequestVote, AppendEntries or InstallSnapshot. False
+    // if the request is malformed or dropped (see set_isolated), in which
+    // case the connection gets an error.
+    bool handle(protocol::Opcode op, std::string_view body, std::string &reply);
+
+    // Fault injection: an isolated node neither sends nor answers anything,
+    // as if cut off from the network; a drop rate loses that fraction of
+    // the messages sent and received
+    void set_isolated(bool isolated);
+    void set_drop_rate(double rate);
+
+private:
+    struct Entry {
+        uint64_t term;
+        std::string records; // empty for the no-op a new leader appends
+    };
+
+    struct Peer {
+        std::string host;
+        int port = 0;
+        int wake_fd = -1; // eventfd the peer's thread polls with its socket
+        std::thread thread;
+
+        // Guarded by mtx
+        uint64_t next_index = 1;
+        uint64_t match_index = 0;
+        uint64_t vote_term = 0; // term the vote was last requested in
+        std::chrono::steady_clock::time_point last_contact;
+    };
+
+    KVStore &store;
+    RaftOptions options;
+    std::unique_ptr<Storage> log_store;
+
+    std::mutex rpc_mtx; // one AppendEntries or InstallSnapshot at a time
+    mutable std::mutex mtx;
+    std::condition_variable changed; // role, log, commit or applied moved
+    RaftRole role = RaftRole::Follower;
+    uint64_t current_term = 0;
+    int voted_for = -1;
+    int leader = -1;
+    size_t votes = 0;
+    std::chrono::steady_clock::time_point election_deadline;
+
+    std::deque<Entry> log;       // entries from snapshot_index + 1 on
+    uint64_t snapshot_index = 0; // last entry dropped from the log
+    uint64_t snapshot_term = 0;
+    uint64_t commit_index = 0;
+    uint64_t last_applied = 0;
+    bool applying = false; // the apply thread is applying a batch unlocked
+
+    // Leader: how far its own log is on disk, and the latest append
+    uint64_t persisted_index = 0;
+    uint64_t pending_index = 0;
+    uint64_t pending_seq = 0;
+
+    // Follower: the snapshot being received
+    bool installing = false;
+    uint64_t install_term = 0;
+    uint64_t install_index = 0;
+    uint64_t install_offset = 0;
+    std::unordered_set<std::string> install_stale;
+
+    std::vector<std::unique_ptr<Peer>> peers; // null at this node's id
+    std::atomic<bool> isolated{false};
+    std::atomic<uint64_t> drop_permille{0};
+    std::atomic<uint64_t> snapshots_sent{0};
+    std::atomic<uint64_t> snapshots_installed{0};
+    bool stopping = false;
+    std::mt19937_64 rng;
+    std::thread ticker;  // elections, heartbeat checks
+    std::thread applier; // applies committed entries
+    std::thread syncer;  // makes the leader's appends durable
+
+    uint64_t last_index() const { return snapshot_index + log.size(); }
+    uint64_t term_at(uint64_t index) const;
+    size_t majority() const { return options.peers.size() / 2 + 1; }
+    bool dropped();
+
+    // Persistence of the Raft log, all called with mtx held
+    uint64_t persist_state();
+    uint64_t persist_entry(uint64_t index);
+    uint64_t truncate_from(uint64_t index);
+    void recover();
+
+    uint64_t become_follower(uint64_t term);
+    void start_election();
+    void become_leader();
+    void advance_commit();
+    void reset_election_deadline();
+    void wake_peers();
+
+    void tick_loop();
+    void apply_loop();
+    void sync_loop();
+    void compact_log();
+    void peer_loop(Peer &peer, size_t id);
+    void send_snapshot(Peer &peer, int sock, uint64_t term);
+
+    bool handle_vote(std::string_view body, std::string &reply);
+    bool handle_append(std::string_view body, std::string &reply);
+    bool handle_snapshot(std::string_view body, std::string &reply);
+};
@@ -0,0 +1,146 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+class KVStore;
+
+// Asynchronous leader-follower replication. A leader's KVStore keeps its
+// recent log records, encoded as in the segment files, in a ReplicationLog.
+// Followers connect over the binary protocol (see protocol.hpp) with the
+// position they have applied up to and are streamed the log from there, or
+// a snapshot of the whole store followed by the log written since it was
+// taken if that position is no longer held. Writes are acknowledged to
+// clients without waiting for followers, so a follower may lag behind.
+//
+// Positions are byte offsets into the stream of records a leader has
+// replicated since it started, tagged with a replication id picked at random
+// at startup: a follower of a restarted leader cannot resume and syncs fully.
+
+struct FollowerStatus {
+    std::string address;  // host:port the follower connected from
+    uint64_t offset = 0;  // acknowledged position
+    uint64_t lag_bytes = 0;
+    uint64_t last_ack_ms = 0; // Unix ms
+};
+
+// The leader side: a bounded backlog of recent records, and the streams
+// that feed it to followers
+class ReplicationLog {
+public:
+    explicit ReplicationLog(size_t backlog_bytes);
+    ~ReplicationLog();
+
+    uint64_t id() const { return replication_id; }
+
+    // Append whole records. Called under the shard lock of every key they
+    // touch, so each key's records are in the order the store applied them.
+    void append(std::string_view records);
+
+    // Position after the last record appended
+    uint64_t end_offset() const;
+
+    enum class Read { Data, Timeout, Gone };
+
+    // Copy the records from offset on, up to about max_bytes of them, to
+    // out, waiting up to wait for some to arrive. written_at receives when
+    // the last of them was appended (Unix ms). Gone if offset is no longer
+    // in the backlog, or not at a record boundary.
+    Read read(uint64_t offset, size_t max_bytes, std::chrono::milliseconds wait, std::string &out,
+              uint64_t &written_at) const;
+
+    // Stream the log to a follower that sent Sync with the given position,
+    // on a connected blocking socket, until it disconnects or falls too far
+    // behind. Takes ownership of fd; store must outlive the stream.
+    void serve(KVStore &store, int fd, uint64_t follower_id, uint64_t offset);
+
+    std::vector<FollowerStatus> followers() const;
+
+    // End every stream and wait for them to finish; called before the
+    // store goes away
+    void stop();
+
+private:
+    struct Chunk {
+        uint64_t offset;
+        uint64_t written_at;
+        std::string records;
+    };
+
+    uint64_t replication_id;
+    size_t backlog_bytes;
+
+    mutable std::mutex mtx;
+    mutable std::condition_variable appended;
+    std::condition_variable stream_ended;
+    std::deque<Chunk> chunks;
+    uint64_t start = 0; // offset of chunks.front()
+    uint64_t end = 0;
+    size_t held = 0;    // bytes of records in chunks
+    bool stopping = false;
+    std::list<FollowerStatus> streams; // one per connected follower
+};
+
+struct ReplicaOptions {
+    // Where a previous Replica of the same store left off (see
+    // ReplicaStatus); the default forces a full sync
+    uint64_t replication_id = 0;
+    uint64_t offset = 0;
+
+    // Wait between attempts to (re)connect to the leader
+    std::chrono::milliseconds retry_interval{500};
+};
+
+struct ReplicaStatus {
+    bool connected = false;
+    uint64_t replication_id = 0;
+    uint64_t offset = 0;        // position applied up to
+    uint64_t leader_offset = 0; // leader's position, as last heard
+    uint64_t lag_bytes = 0;     // leader_offset - offset
+    // How long ago the newest write not yet applied could have been made:
+    // 0 once caught up, else the time since the last applied record was
+    // written on the leader. Assumes the two clocks agree.
+    uint64_t lag_ms = 0;
+    uint64_t full_syncs = 0;
+    uint64_t partial_syncs = 0;
+};
+
+// The follower side: a thread that keeps a local store in sync with a
+// leader, reconnecting and resuming after errors. The store should take
+// no other writes (KVServer refuses them when it has a replica).
+class Replica {
+public:
+    Replica(KVStore &store, const std::string &host, int port, const ReplicaOptions &options = ReplicaOptions());
+    ~Replica();
+
+    ReplicaStatus status() const;
+
+    // Block until the replica has applied the leader's log up to offset
+    // (see ReplicationLog::end_offset), or timeout passes; returns which
+    bool wait_for(uint64_t offset, std::chrono::milliseconds timeout) const;
+
+private:
+    KVStore &store;
+    std::string host;
+    int port;
+    ReplicaOptions options;
+
+    mutable std::mutex mtx;
+    mutable std::condition_variable progress;
+    ReplicaStatus state;
+    uint64_t applied_written_at = 0; // leader time of the last applied record
+    int fd = -1;                     // current connection, shut down to stop
+    bool stopping = false;
+    std::thread worker;
+
+    void run();
+    void stream(int sock);
+    void full_sync(int sock, std::string &buffer, uint64_t id, uint64_t offset);
+};
@@ -1,16 +1,164 @@
 // server.hpp
 #pragma once
+#include "cluster.hpp"
 #include "kvstore.hpp"
+#include "metrics.hpp"
+#include "protocol.hpp"
+#include "raft.hpp"
+#include <array>
+#include <deque>
+#include <memory>
+#include <optional>
 #include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+enum class ServerMode {
+    Threaded, // one detached thread per accepted connection
+    Epoll     // fixed pool of epoll reactors with non-blocking sockets
+};
+
+struct ServerOptions {
+    ServerMode mode = ServerMode::Epoll;
+    int io_threads = 0; // reactor threads; 0 = one per core (at least 4)
+    int backlog = 4096; // listen() backlog
+
+    // Set on a follower: writes are refused with ReadOnly, and REPLICATION
+    // reports the replica's progress
+    Replica* replica = nullptr;
+
+    // Set on a Raft cluster member: writes go through the Raft log and are
+    // acknowledged once applied; nodes that do not lead answer NotLeader
+    RaftNode* raft = nullptr;
+
+    // Set in cluster mode: requests for keys another node owns are
+    // answered Moved, and the node takes part in rebalancing
+    ClusterNode* cluster = nullptr;
+
+    // Serve the STATS figures in Prometheus text format over HTTP on this
+    // port, at any path (0 = off)
+    int metrics_port = 0;
+};
+
+// Replies waiting to be written to one connection. Small replies are packed
+// into a shared chunk; large values are moved in as chunks of their own so
+// they are not copied again. Everything pending goes out in one writev.
+class OutputQueue {
+public:
+    std::string& tail();               // chunk to append small replies to
+    void append_owned(std::string&& chunk);
+    bool empty() const { return chunks.empty(); }
+
+    // Write as much as the socket takes; false on a hard socket error
+    bool write_to(int fd);
+
+    // Bytes written since the last call
+    uint64_t take_sent() { return std::exchange(sent, 0); }
+
+private:
+    std::deque<std::string> chunks;
+    uint64_t sent = 0;
+    size_t head_off = 0;  // bytes of chunks.front() already written
+    bool sealed = false;  // last chunk is an owned value, start a new one
+};
 
 class KVServer {
 public:
-    KVServer(KVStore* kv, int port);
+    KVServer(KVStore* kv, int port, const ServerOptions& options = ServerOptions());
     void run(); // Start the server
 
 private:
     KVStore* kvstore;
     int port;
+    ServerOptions options;
+
+    // Request counts and latencies, kept per opcode, plus connection and
+    // traffic counters. A request's latency is the time the server spent
+    // on it; the wait for its batch's writes to become durable is counted
+    // in durable_waits instead.
+    struct Metrics {
+        static constexpr size_t OPCODES = 32;
+        std::array<metrics::Histogram, OPCODES> requests;
+        metrics::Histogram durable_waits;
+        metrics::Counter accepted;
+        metrics::Counter closed;
+        metrics::Counter bytes_in;
+        metrics::Counter bytes_out;
+    };
+    std::unique_ptr<Metrics> stats = std::make_unique<Metrics>();
+
+    int open_listener(int listen_port, bool reuse_port);
+    void run_threaded();
+    void run_epoll();
+    void io_loop(int listen_fd);
 
     void handle_client(int client_socket);
+
+    // A follower's Sync request; the connection becomes its log stream
+    struct SyncRequest {
+        uint64_t replication_id;
+        uint64_t offset;
+    };
+
+    // Write what is left for a connection that sent Sync, then stream the
+    // log to it until it goes away. Takes ownership of fd.
+    void serve_follower(int fd, OutputQueue& out, SyncRequest sync);
+
+    // What the replies to a batch of requests wait for before they go out
+    struct PendingWrites {
+        uint64_t durable_seq = 0; // last log sequence written
+        Durability level = Durability::None; // strictest level a write asked for
+        uint64_t raft_index = 0;  // last Raft entry proposed...
+        uint64_t raft_term = 0;   // ...and the term it was proposed in
+        bool lost = false;        // a write already answered OK did not commit
+    };
+
+    // Consume every complete request (text or binary) in inbuf and append
+    // the replies to outbuf. Returns false if the connection should be dropped.
+    // Writes in one batch only wait for durability once, before replying.
+    // Stops at a Sync request, which is returned in sync.
+    bool process_input(std::string& inbuf, OutputQueue& out, std::optional<SyncRequest>& sync);
+
+    // Run one decoded command; GET results are written to result (the
+    // leader's address for NotLeader, the owner's for Moved) and what a
+    // write waits for to pending
+    protocol::Status execute(protocol::Opcode op, std::string_view key,
+                             std::string_view value, std::string& result,
+                             PendingWrites& pending);
+
+    // Wait until lsn is as durable as level asks, after the writes pending
+    // from the same batch
+    protocol::Status execute_durable(uint64_t lsn, Durability level, PendingWrites& pending);
+
+    // Run MPUT/MGET/MDELETE. args holds the keys, alternating with values for
+    // MPUT; MGET results go to values and MDELETE's count to removed
+    protocol::Status execute_multi(protocol::Opcode op, const std::vector<std::string_view>& args,
+                                   std::vector<std::optional<std::string>>& values, size_t& removed,
+                                   std::string& result, PendingWrites& pending);
+
+    // Raft: append a write's records to the log. Only the last entry of a
+    // batch is waited for, which vouches for the earlier ones as long as
+    // they were all proposed in the same term.
+    protocol::Status propose(std::string records, std::string& result, PendingWrites& pending);
+
+    // Raft: wait for the writes proposed so far to be applied, so a read
+    // sees them
+    void settle(PendingWrites& pending);
+
+    // Run SCAN: one page of [start, end) of at most limit entries, cut
+    // shorter by the server's page limits; more is set if the range goes on
+    protocol::Status execute_scan(std::string_view start, std::string_view end, size_t limit,
+                                  std::vector<std::pair<std::string, std::string>>& entries, bool& more);
+
+    // The node's replication state, as "name:value" lines
+    std::string replication_info() const;
+
+    // Server, store and log figures as "name:value" lines, or as
+    // Prometheus text for the metrics port
+    std::string stats_info() const;
+    std::string metrics_text() const;
+
+    // Answer HTTP requests on the metrics port, one at a time
+    void serve_metrics(int listen_fd);
 };
@@ -0,0 +1,162 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "block_cache.hpp"
+
+// Immutable sorted file of entries, written once by a memtable flush or a
+// compaction and never modified:
+//
+//   data blocks | index block | bloom filter | footer
+//
+// Data blocks hold about block_bytes of entries in key order, each
+//
+//   type u8 | key_len u32 | value_len u32 | key | value
+//
+// (type 1 = put, 2 = tombstone, 3 = put whose value starts with its expiry
+// deadline, expires_at u64 in Unix milliseconds, 4 = put whose value starts
+// with its version u64, 5 = put with both, deadline first), followed by the block's
+// crc32c. The index block holds offset u64 | size u32 | last_key_len u32 |
+// last_key per data block. The footer (integers little-endian, like the
+// log) is
+//
+//   index_offset u64 | index_size u64 | bloom_offset u64 | bloom_size u64 |
+//   entries u64 | crc32c u32 | magic "DKVSST01"
+//
+// with the crc covering the index and bloom filter. Readers keep the index
+// and filter in memory and pread one data block per lookup, unless the
+// block cache has it.
+class SSTableWriter
+{
+public:
+    SSTableWriter(const std::string &path, size_t block_bytes, size_t bloom_bits_per_key);
+    ~SSTableWriter(); // removes the file unless finish() succeeded
+
+    SSTableWriter(const SSTableWriter &) = delete;
+    SSTableWriter &operator=(const SSTableWriter &) = delete;
+
+    // Keys must be added in strictly increasing order; expires_at = 0
+    // means no expiry and version = 0 none recorded
+    void add(std::string_view key, std::string_view value, bool deleted, uint64_t expires_at = 0,
+             uint64_t version = 0);
+
+    // Write the index, filter and footer and fsync; returns the file size
+    uint64_t finish();
+
+    uint64_t bytes() const { return offset + block.size(); }
+    uint64_t entries() const { return count; }
+    const std::string &largest() const { return last_key; }
+
+private:
+    std::string path;
+    int fd;
+    size_t block_bytes;
+    size_t bits_per_key;
+    std::string block;   // data block being filled
+    std::string index;   // encoded index entries
+    std::vector<uint64_t> hashes; // one per key, for the bloom filter
+    std::string last_key;
+    uint64_t offset = 0; // bytes written to the file
+    uint64_t count = 0;
+    bool finished = false;
+
+    void flush_block();
+    void write(const std::string &data);
+};
+
+class SSTable
+{
+public:
+    // Open a finished file and load its index and filter; throws if they
+    // are damaged. With a cache, data blocks go through it and the index
+    // and filter are charged to its budget.
+    SSTable(const std::string &path, uint64_t number, BlockCache *cache = nullptr);
+    ~SSTable(); // also deletes the file once it was marked obsolete
+
+    SSTable(const SSTable &) = delete;
+    SSTable &operator=(const SSTable &) = delete;
+
+    enum class Lookup
+    {
+        Missing, // not in this file; older files may have it
+        Found,
+        Deleted, // a tombstone hides any older version
+    };
+    // Found also reports the entry's expiry deadline (0 = none) and version
+    // if asked; judging whether the deadline has passed is up to the caller
+    Lookup get(std::string_view key, std::string &value, uint64_t *expires_at = nullptr,
+               uint64_t *version = nullptr) const;
+
+    // False if the bloom filter rules the key out
+    bool may_contain(std::string_view key) const;
+
+    uint64_t number() const { return file_number; }
+    const std::string &smallest() const { return first_key; }
+    const std::string &largest() const { return last_key; }
+    uint64_t file_bytes() const { return size; }
+    uint64_t entries() const { return count; }
+
+    // Delete the file when the last reader lets go of this table
+    void mark_obsolete() { obsolete = true; }
+
+    // Walks the entries in key order, one data block in memory at a time.
+    // The table must outlive the iterator. Scans and compactions pass
+    // fill_cache = false so the blocks they read once stay out of the cache.
+    class Iterator
+    {
+    public:
+        explicit Iterator(const SSTable &table, bool fill_cache = true);
+        void seek(std::string_view key); // to the first entry >= key
+        void seek_to_first();
+        bool valid() const { return block_index < table->blocks.size(); }
+        void next();
+        std::string_view key() const { return current_key; }
+        std::string_view value() const { return current_value; }
+        bool deleted() const { return current_deleted; }
+        uint64_t expires_at() const { return current_expires_at; }
+        uint64_t version() const { return current_version; }
+
+    private:
+        const SSTable *table;
+        bool fill_cache;
+        size_t block_index;
+        BlockCache::Block data; // current block
+        size_t pos = 0;   // offset of the next entry in data
+        std::string_view current_key;
+        std::string_view current_value;
+        bool current_deleted = false;
+        uint64_t current_expires_at = 0;
+        uint64_t current_version = 0;
+
+        void load(size_t index);
+        void skip_empty_blocks();
+        void decode_next();
+    };
+
+private:
+    struct BlockHandle
+    {
+        uint64_t offset;
+        uint32_t size;
+        std::string last_key;
+    };
+
+    std::string path;
+    uint64_t file_number;
+    BlockCache *cache;
+    uint64_t pinned = 0; // index and filter bytes charged to the cache
+    int fd;
+    uint64_t size = 0;
+    uint64_t count = 0;
+    std::vector<BlockHandle> blocks;
+    std::string bloom; // filter bits
+    uint32_t bloom_probes = 0;
+    std::string first_key;
+    std::string last_key;
+    bool obsolete = false;
+
+    size_t find_block(std::string_view key) const; // first block whose last key >= key
+    BlockCache::Block read_block(size_t index, bool fill_cache) const;
+};
@@ -2,25 +2,323 @@
 #include <string>
 #include <vector>
 #include <utility>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include "durability.hpp"
+#include "metrics.hpp"
 
+struct StorageOptions
+{
+    // Queue concurrent appends and let one flusher write+fsync them as a batch
+    bool group_commit = true;
+
+    // Flush as soon as this many bytes are queued
+    size_t max_batch_bytes = 1 << 20;
+
+    // How long the flusher lingers for a batch to fill (0 = flush immediately)
+    std::chrono::microseconds max_wait{0};
+
+    // Start a new segment file once the active one reaches this size
+    size_t segment_bytes = 64 << 20;
+
+    // Threads used to replay the log on startup (0 = one per core)
+    size_t recovery_threads = 0;
+
+    // What writes wait for unless a caller asks otherwise, and how often the
+    // flusher syncs: every group for Always, about once a second for
+    // EverySec, only when a caller asks for Always with Os or None. Without
+    // group commit EverySec syncs no more often than Os.
+    Durability durability = Durability::Always;
+
+    // Write the log and compacted files through io_uring when the kernel
+    // allows it, falling back to write/fsync when it does not
+    bool io_uring = true;
+};
+
+struct StorageStats
+{
+    uint64_t batches = 0;           // write rounds issued
+    uint64_t syncs = 0;             // fdatasyncs issued (one per batch with Always)
+    uint64_t records = 0;           // records written
+    uint64_t bytes = 0;             // bytes written
+    uint64_t max_batch_records = 0; // largest batch seen
+    uint64_t fsync_total_us = 0;    // cumulative fsync latency
+    uint64_t fsync_max_us = 0;      // worst fsync latency
+    uint64_t compactions = 0;       // completed compactions
+    uint64_t log_bytes = 0;         // record bytes recovery would replay
+    bool io_uring = false;          // writes go through io_uring
+
+    uint64_t checkpoints = 0;          // snapshots written
+    uint64_t snapshot_bytes = 0;       // record bytes in the current snapshot
+    uint64_t snapshot_offset = 0;      // log position the current snapshot covers
+    uint64_t snapshot_write_us = 0;    // time taken by the last checkpoint
+    uint64_t recovery_snapshot_us = 0; // startup time spent parsing the snapshot
+    uint64_t recovery_tail_us = 0;     // startup time spent parsing the log after it
+    uint64_t recovery_tail_bytes = 0;  // size of that log tail
+    uint64_t recovery_total_us = 0;    // whole startup recovery, merge included
+};
+
+// Puts and deletes that go into the log as one batch record
+class IoUring;
+
+class WriteBatch
+{
+public:
+    void put(const std::string &key, const std::string &value, uint64_t expires_at = 0, uint64_t version = 0);
+    void remove(const std::string &key);
+    size_t count() const { return records; }
+    bool empty() const { return records == 0; }
+
+private:
+    friend class Storage;
+    std::string encoded; // nested records
+    size_t records = 0;
+};
+
+// Append-only log of binary records, split into segment files
+// storage/<filename>.NNNNNN. Every segment starts with a header:
+//
+//   magic "DKVSEG01" | flags u32 | reserved u32 | base_offset u64
+//
+// followed by records (integers little-endian):
+//
+//   crc32c u32 | type u8 | key_len u32 | value_len u32 | key | value
+//
+// The CRC covers everything after itself. A put with an expiry (type 4)
+// starts its value with the deadline, expires_at u64 in Unix milliseconds;
+// once that has passed the put reads as a delete, and compaction and
+// checkpoints leave it out. A put with a version (type 5, or 6 with an
+// expiry too) starts its value with version u64, after any deadline; the
+// log carries versions for the store and does not interpret them. Puts
+// written before versions existed (types 1 and 4) read as version 0. A
+// batch record has an empty key and nested put/delete records as its
+// value, so it is replayed whole or not at all.
+// base_offset is the logical log position of the segment's first record,
+// so positions keep growing across segments. A segment flagged FULL
+// (written by compact) holds the complete live set as of its base_offset
+// and supersedes every earlier segment.
+// Compaction runs concurrently with writers; see compact().
+//
+// A checkpoint writes the live set to storage/<filename>.snapshot instead:
+//
+//   magic "DKVSNP01" | flags u32 | reserved u32 | log_offset u64 | first_segment u64
+//
+// followed by put records (with or without expiry) sorted by key within
+// each run the snapshot source emits. Recovery loads the snapshot and
+// replays only the segments from first_segment on, which start at
+// log_offset; the covered segments are deleted once the snapshot is in place.
 class Storage
 {
 public:
-    Storage(const std::string &filename);
+    Storage(const std::string &filename, const StorageOptions &options = StorageOptions());
     ~Storage();
 
-    // Append a record to disk
+    // Append a record to disk, returns once it is durable
     void append(const std::string &key, const std::string &value);
 
-    // Delete a record from disk (for simplicity, could just mark tombstone)
+    // Delete a record from disk by appending a tombstone
     void remove(const std::string &key);
 
-    // Load all key-value pairs from disk
+    // Queue a record without waiting; returns its sequence number for
+    // wait_durable(). A nonzero expires_at (Unix ms) makes the put expire;
+    // a nonzero version is kept with it.
+    uint64_t enqueue_append(const std::string &key, const std::string &value, uint64_t expires_at = 0,
+                            uint64_t version = 0);
+    uint64_t enqueue_remove(const std::string &key);
+
+    // Queue a whole batch as one record: a single write and fsync, and
+    // recovered all or nothing after a crash
+    uint64_t enqueue_batch(const WriteBatch &batch);
+
+    // Block until every record up to and including seq is as safe as the
+    // level asks: synced for Always, handed to the OS for EverySec and Os,
+    // not waited for at all for None. Without a level, options.durability.
+    void wait_durable(uint64_t seq);
+    void wait_durable(uint64_t seq, Durability level);
+
+    // Sequence numbers are log sequence numbers (LSNs): the log position
+    // just past the record, so they keep growing across segments and
+    // restarts, and everything recovered at startup counts as synced. A seq
+    // beyond the end of the log is waited for only up to the end.
+    uint64_t durable_lsn() const;
+
+    // Load all key-value pairs from disk. Replay stops at the first torn or
+    // corrupt record.
     std::vector<std::pair<std::string, std::string>> load();
-    //  compact method to remove deleted entries and reduce file size
+
+    // Called once per live key with partition = std::hash(key) % partitions,
+    // its expiry deadline (0 = none) and version (0 = none recorded).
+    // Expired keys count as deleted.
+    using RecoverySink = std::function<void(size_t partition, std::string &&key, std::string &&value,
+                                            uint64_t expires_at, uint64_t version)>;
+
+    // Parallel replay of the memory-mapped log. Each partition is fed by a
+    // single thread, so sinks for different partitions may run concurrently
+    // without locking. Last writer wins by log position, as with load().
+    void recover(size_t partitions, const RecoverySink &sink);
+
+    // As above, also reporting every key whose last record is a delete, for
+    // engines whose older data lives outside the log
+    using RemovalSink = std::function<void(size_t partition, std::string &&key)>;
+    void recover(size_t partitions, const RecoverySink &sink, const RemovalSink &removed);
+
+    using Emit = std::function<void(const std::string &key, const std::string &value, uint64_t expires_at,
+                                    uint64_t version)>;
+
+    // Produces the live set for compaction by calling emit once per key;
+    // entries that have expired by then are dropped.
+    // sealed_below is the first segment id not covered by the compaction.
+    using Snapshot = std::function<void(uint64_t sealed_below, const Emit &emit)>;
+
+    // Rewrite the log as one compacted segment. Writers are only paused
+    // while the active segment is sealed; records appended while the
+    // snapshot is written land in a new tail segment and are kept. With no
+    // snapshot, the live set is rebuilt by replaying the sealed segments.
     void compact();
+    void compact(const Snapshot &snapshot);
+
+    // Write a snapshot of the live set and drop the log it covers, so
+    // restart time depends on the live data plus the log written since.
+    // Like compact(), only sealing the active segment pauses writers. With
+    // no snapshot source the sealed log is replayed and sorted.
+    void checkpoint();
+    void checkpoint(const Snapshot &snapshot);
+
+    // For engines that keep the live set outside the log (the LSM engine):
+    // send new writes to a fresh segment and return its id, then, once
+    // everything logged before it is stored elsewhere, drop the older
+    // segments with truncate(). sealed_bytes carries the log size at the cut
+    // from one to the other.
+    uint64_t rotate(uint64_t &sealed_bytes);
+    void truncate(uint64_t below_id, uint64_t sealed_bytes);
+
+    // Record bytes recovery would replay (live data plus garbage)
+    uint64_t log_bytes() const;
+
+    // Record bytes logged since the last checkpoint or compaction
+    uint64_t tail_bytes() const;
+
+    // On-disk size of one put record
+    static size_t record_bytes(size_t key_len, size_t value_len);
+
+    // Records encoded exactly as enqueue_*() logs them, for shipping the log
+    // elsewhere (replication)
+    static void encode_put(std::string &out, const std::string &key, const std::string &value,
+                           uint64_t expires_at = 0, uint64_t version = 0);
+    static void encode_remove(std::string &out, const std::string &key);
+    static void encode_batch(std::string &out, const WriteBatch &batch);
+
+    // One put or delete decoded from such records
+    struct LogOp
+    {
+        std::string_view key;
+        std::string_view value;
+        uint64_t expires_at; // Unix ms, 0 = never
+        bool deleted;
+        uint64_t version;    // 0 = none recorded
+    };
+
+    // Decode a run of whole records, calling f with the operations of each
+    // record in turn (several for a batch). Returns the bytes decoded, which
+    // stop short of data.size() at a torn or corrupt record.
+    static size_t decode_records(std::string_view data, const std::function<void(const std::vector<LogOp> &)> &f);
+
+    StorageStats stats() const;
+
+    // Distribution of log sync latencies
+    metrics::Histogram::Snapshot sync_latency() const;
+
+    // Remove every file belonging to a log (segments and leftovers)
+    static void destroy(const std::string &filename);
 
 private:
-    std::string filename;
-    int fd;
+    std::string filename; // path prefix of the segment files
+    int fd;               // active (last) segment
+    uint64_t active_id = 0;
+    uint64_t active_base = 0; // log position of the active segment's first record
+    size_t active_size = 0;   // bytes in the active segment, header included
+    StorageOptions options;
+
+    // Group commit state, guarded by mtx
+    mutable std::mutex mtx;
+    std::condition_variable flush_cv;   // wakes the flusher
+    std::condition_variable durable_cv; // wakes waiting writers
+    std::string pending;                // records queued for the next batch
+    uint64_t pending_records = 0;
+    uint64_t next_seq = 0;              // last sequence handed out
+    uint64_t written_seq = 0;           // last sequence handed to the OS
+    uint64_t durable_seq = 0;           // last sequence known to be on disk
+    uint64_t sync_wanted = 0;           // a caller waits for this one to be synced
+    bool flushing = false;
+    bool stopping = false;
+    std::string write_error;            // sticky error from the flusher
+    std::thread flusher;
+
+    // Null when io_uring is off or unavailable. log_ring belongs to whoever
+    // writes the log (see write_batch), file_ring to compact_mtx's holder.
+    std::unique_ptr<IoUring> log_ring;
+    std::unique_ptr<IoUring> file_ring;
+
+    std::atomic<uint64_t> stat_batches{0};
+    std::atomic<uint64_t> stat_syncs{0};
+    std::atomic<uint64_t> stat_records{0};
+    std::atomic<uint64_t> stat_bytes{0};
+    std::atomic<uint64_t> stat_max_batch{0};
+    std::atomic<uint64_t> stat_fsync_us{0};
+    std::atomic<uint64_t> stat_fsync_max_us{0};
+    metrics::Histogram sync_histogram;
+    std::atomic<uint64_t> stat_compactions{0};
+
+    std::atomic<uint64_t> stat_checkpoints{0};
+    std::atomic<uint64_t> stat_snapshot_bytes{0};
+    std::atomic<uint64_t> stat_snapshot_offset{0};
+    std::atomic<uint64_t> stat_snapshot_write_us{0};
+    std::atomic<uint64_t> stat_recovery_snapshot_us{0};
+    std::atomic<uint64_t> stat_recovery_tail_us{0};
+    std::atomic<uint64_t> stat_recovery_tail_bytes{0};
+    std::atomic<uint64_t> stat_recovery_total_us{0};
+
+    std::mutex compact_mtx;             // one compaction or checkpoint at a time
+    std::atomic<uint64_t> disk_bytes{0};
+    std::atomic<uint64_t> base_bytes{0}; // part of disk_bytes in the snapshot or compacted segment
+
+    uint64_t enqueue(std::string &&record, uint64_t records = 1);
+    void flush_loop();
+    void write_batch(const std::string &batch, uint64_t records, bool sync);
+    void write_all(const char *data, size_t len, const char *what);
+    void sync_and_record();
+    void write_and_sync(const std::string &batch);
+    void record_batch(uint64_t records, uint64_t bytes);
+    void record_sync(uint64_t us);
+    void wait_idle(std::unique_lock<std::mutex> &lock);
+    struct ReplayTimes
+    {
+        uint64_t snapshot_us = 0;
+        uint64_t tail_us = 0;
+        uint64_t tail_bytes = 0;
+    };
+
+    void replay(size_t partitions, size_t threads, const RecoverySink &sink,
+                uint64_t below_id = UINT64_MAX, ReplayTimes *times = nullptr,
+                const RemovalSink *removed = nullptr);
+    std::vector<std::pair<std::string, std::string>> read_all();
+
+    std::string segment_path(uint64_t id) const;
+    std::vector<uint64_t> list_segments() const;
+    std::string snapshot_path() const;
+    bool read_snapshot_header(uint64_t &log_offset, uint64_t &first_segment) const;
+    size_t replay_start(const std::vector<uint64_t> &ids, bool &use_snapshot) const;
+    void open_active();
+    uint64_t replayable_bytes(uint64_t &base) const;
+    void start_segment(uint64_t id, uint64_t base_offset);
+    uint64_t seal_active(uint64_t gap, uint64_t &cut, uint64_t &sealed_bytes);
+    void retire_segments(uint64_t below_id);
+    void convert_legacy(const std::string &legacy_path);
 };
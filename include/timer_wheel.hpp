@@ -0,0 +1,55 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "expiry.hpp"
+
+// Hierarchical timing wheel of key deadlines, for active expiry. Four levels
+// of 64 slots each: level 0 holds the timers due within the next 64 ticks,
+// one slot per tick, and every level above covers 64 times the span of the
+// one below. A timer is filed at the lowest level whose span covers the time
+// left until its deadline, and moved down (cascaded) when the clock reaches its
+// slot, so scheduling is O(1) and every timer is touched at most once per
+// level however long its deadline. Deadlines beyond the top level wait in
+// its last slot and are filed again from there.
+//
+// Timers cannot be cancelled. Whoever consumes the due keys checks them
+// against the current deadline of the key, so a timer for a key that was
+// since overwritten or deleted simply finds nothing to do.
+//
+// Not thread-safe; each KVStore shard has its own, guarded by the shard lock.
+class TimerWheel {
+public:
+    explicit TimerWheel(uint64_t tick_ms = 10, uint64_t now_ms = unix_now_ms());
+
+    void schedule(std::string_view key, uint64_t deadline_ms);
+
+    // Move the clock up to now_ms, appending (key, deadline) for every timer
+    // that fell due, but no more than max_keys of them. Returns true if more
+    // are due than fit, in which case the clock stops at the slot it was
+    // emptying.
+    bool advance(uint64_t now_ms, size_t max_keys, std::vector<std::pair<std::string, uint64_t>> &due);
+
+    size_t size() const { return count; }
+
+private:
+    static constexpr size_t LEVELS = 4;
+    static constexpr size_t SLOT_BITS = 6;
+    static constexpr size_t SLOTS = size_t(1) << SLOT_BITS;
+
+    struct Timer {
+        std::string key;
+        uint64_t deadline_ms;
+    };
+
+    uint64_t tick_ms;
+    uint64_t current; // next tick to process; every earlier one is done
+    size_t count = 0;
+    std::vector<Timer> slots[LEVELS][SLOTS];
+
+    void place(Timer &&timer);
+    void cascade();
+};
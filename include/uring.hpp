@@ -0,0 +1,67 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+struct io_uring_sqe;
+
+// A minimal io_uring: one submission and one completion ring set up with
+// the raw system calls, and just the operations the storage layer needs.
+// Requests are queued with write()/fsync() and handed to the kernel with
+// submit(); a whole chain (say a write and the fsync linked behind it) then
+// costs a single io_uring_enter. Not thread safe; give each thread its own.
+class IoUring
+{
+public:
+    // Whether the running kernel lets this process use io_uring with the
+    // operations below; probed once
+    static bool supported();
+
+    // Throws std::runtime_error if the ring cannot be set up
+    explicit IoUring(unsigned entries);
+    ~IoUring();
+
+    IoUring(const IoUring &) = delete;
+    IoUring &operator=(const IoUring &) = delete;
+
+    // Queue a request; false if the submission queue is full. user_data
+    // comes back with the completion. With link the next request queued
+    // starts only once this one has completed in full; if it fails or comes
+    // up short the rest of the chain completes with -ECANCELED.
+    bool write(int fd, const void *data, size_t len, uint64_t offset, uint64_t user_data, bool link = false);
+    bool fsync(int fd, bool datasync, uint64_t user_data, bool link = false);
+
+    // Hand everything queued to the kernel, then wait until at least
+    // wait_nr completions are ready
+    void submit(unsigned wait_nr = 0);
+
+    // Take the oldest completion: res is the request's result (bytes or
+    // -errno). peek() returns false if there is none; wait() blocks.
+    bool peek(uint64_t &user_data, int32_t &res);
+    void wait(uint64_t &user_data, int32_t &res);
+
+private:
+    int ring_fd = -1;
+    unsigned entries = 0;
+
+    void *sq_ring = nullptr;
+    size_t sq_ring_bytes = 0;
+    void *cq_ring = nullptr; // may be sq_ring
+    size_t cq_ring_bytes = 0;
+    io_uring_sqe *sqes = nullptr;
+    size_t sqes_bytes = 0;
+
+    unsigned *sq_head = nullptr;
+    unsigned *sq_tail = nullptr;
+    unsigned sq_mask = 0;
+    unsigned *sq_array = nullptr;
+    unsigned queued_tail = 0; // sq tail including requests not yet submitted
+    unsigned submitted_tail = 0;
+
+    unsigned *cq_head = nullptr;
+    unsigned *cq_tail = nullptr;
+    unsigned cq_mask = 0;
+    void *cqes = nullptr;
+
+    io_uring_sqe *next_sqe();
+    int enter(unsigned to_submit, unsigned wait_nr);
+};
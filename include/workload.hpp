@@ -0,0 +1,89 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <string_view>
+
+// Request streams modelled on the YCSB core workloads, shared by the load
+// generators so in-process and networked runs issue the same operations.
+// Records are numbered from 0 in insert order; key_name() spreads them over
+// the key space so neighbouring records do not share a shard or a page.
+namespace workload {
+
+enum class Distribution { Uniform, Zipfian, Latest };
+
+enum class Op { Read, Update, Insert, Scan, ReadModifyWrite };
+constexpr size_t OP_COUNT = 5;
+
+// "uniform", "zipfian" or "latest"; false for anything else
+bool parse_distribution(std::string_view name, Distribution& distribution);
+const char* distribution_name(Distribution distribution);
+const char* op_name(Op op);
+
+// The share of each operation (they add up to 1) and which records they
+// pick
+struct Mix {
+    double read = 0;
+    double update = 0;
+    double insert = 0;
+    double scan = 0;
+    double read_modify_write = 0;
+    Distribution distribution = Distribution::Zipfian;
+    size_t max_scan_length = 100; // scans read 1 to this many records
+};
+
+// YCSB core workload a to f (either case); false for any other name
+//   a  50% read, 50% update           zipfian   (session store)
+//   b  95% read, 5% update            zipfian   (photo tagging)
+//   c  100% read                      zipfian   (user profile cache)
+//   d  95% read, 5% insert            latest    (status updates)
+//   e  95% scan, 5% insert            zipfian   (threaded conversations)
+//   f  50% read, 50% read-modify-write zipfian  (user database)
+bool ycsb_mix(std::string_view name, Mix& mix);
+
+// The key of record n: "user" and a hash of n, as YCSB names them
+std::string key_name(uint64_t record);
+
+// Zipfian ranks over a number of items that may grow between calls, after
+// Gray et al., "Quickly Generating Billion-Record Synthetic Databases":
+// rank 0 is the most popular and the constant theta sets the skew. Growing
+// the item count extends the zeta sum instead of recomputing it, so
+// inserts cost O(1) each.
+class Zipfian {
+public:
+    static constexpr double THETA = 0.99;
+
+    explicit Zipfian(double theta = THETA);
+    uint64_t next(std::mt19937_64& rng, uint64_t items); // in [0, items)
+
+private:
+    double theta;
+    double alpha;
+    double zeta2;
+    uint64_t items = 0;
+    double zetan = 0;
+    double eta = 0;
+
+    void resize(uint64_t n);
+};
+
+// One thread's stream of operations and the records they touch
+class Generator {
+public:
+    Generator(const Mix& mix, uint64_t seed);
+
+    Op next_op();
+    // A record below records, the number inserted so far. Zipfian picks
+    // hot records scattered over the whole range; latest favours the
+    // records inserted last.
+    uint64_t next_record(uint64_t records);
+    size_t next_scan_length();
+
+private:
+    Mix mix;
+    std::mt19937_64 rng;
+    Zipfian zipfian;
+};
+
+} // namespace workload
@@ -0,0 +1,317 @@
+#include "async_client.hpp"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <stdexcept>
+
+using protocol::Opcode;
+using protocol::Status;
+
+namespace {
+
+int connect_to(const std::string& host, int port) {
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) <= 0) {
+        throw std::runtime_error("Invalid address");
+    }
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        throw std::runtime_error("Failed to create socket");
+    }
+    if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+        close(fd);
+        throw std::runtime_error("Connection failed");
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    return fd;
+}
+
+} // namespace
+
+AsyncKVClient::AsyncKVClient(const std::string& host, int port, AsyncClientOptions options) {
+    epfd = epoll_create1(0);
+    wake_fd = eventfd(0, EFD_NONBLOCK);
+    if (epfd < 0 || wake_fd < 0) {
+        if (epfd >= 0) close(epfd);
+        if (wake_fd >= 0) close(wake_fd);
+        throw std::runtime_error("Failed to create the client's event loop");
+    }
+
+    try {
+        for (size_t i = 0; i < std::max<size_t>(options.connections, 1); i++) {
+            auto conn = std::make_unique<Connection>();
+            conn->fd = connect_to(host, port);
+            epoll_event ev{};
+            ev.events = EPOLLIN;
+            ev.data.ptr = conn.get();
+            epoll_ctl(epfd, EPOLL_CTL_ADD, conn->fd, &ev);
+            connections.push_back(std::move(conn));
+        }
+    } catch (const std::exception&) {
+        for (auto& conn : connections) {
+            close(conn->fd);
+        }
+        close(epfd);
+        close(wake_fd);
+        throw;
+    }
+
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.ptr = nullptr;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, wake_fd, &ev);
+    loop = std::thread(&AsyncKVClient::run_loop, this);
+}
+
+AsyncKVClient::~AsyncKVClient() {
+    stopping = true;
+    uint64_t one = 1;
+    ssize_t n = write(wake_fd, &one, sizeof(one));
+    (void)n;
+    loop.join();
+    for (auto& conn : connections) {
+        fail(*conn);
+    }
+    close(epfd);
+    close(wake_fd);
+}
+
+size_t AsyncKVClient::live_connections() const {
+    size_t live = 0;
+    for (const auto& conn : connections) {
+        std::lock_guard<std::mutex> lock(conn->mtx);
+        live += !conn->closed;
+    }
+    return live;
+}
+
+void AsyncKVClient::request_async(Opcode op, const std::string& key, const std::string& value, Callback done) {
+    // Round-robin over the connections still open
+    for (size_t tries = 0; tries < connections.size(); tries++) {
+        Connection& conn = *connections[next_connection++ % connections.size()];
+        std::unique_lock<std::mutex> lock(conn.mtx);
+        if (conn.closed) {
+            continue;
+        }
+        protocol::encode_request(conn.outbox, op, ++conn.next_id, key, value);
+        conn.waiting.push_back(std::move(done));
+        pending++;
+        // Only the first request since the loop last took this outbox has
+        // to wake it; later ones ride along
+        bool wake = !conn.scheduled;
+        conn.scheduled = true;
+        lock.unlock();
+
+        if (wake) {
+            {
+                std::lock_guard<std::mutex> ready_lock(ready_mtx);
+                ready.push_back(&conn);
+            }
+            uint64_t one = 1;
+            ssize_t n = write(wake_fd, &one, sizeof(one));
+            (void)n;
+        }
+        return;
+    }
+    done(Status::Error, "");
+}
+
+void AsyncKVClient::run_loop() {
+    epoll_event events[64];
+    std::vector<Connection*> to_write;
+    while (!stopping) {
+        int n = epoll_wait(epfd, events, 64, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.ptr == nullptr) {
+                uint64_t count;
+                ssize_t r = read(wake_fd, &count, sizeof(count));
+                (void)r;
+                {
+                    std::lock_guard<std::mutex> lock(ready_mtx);
+                    to_write.swap(ready);
+                }
+                for (Connection* conn : to_write) {
+                    {
+                        std::lock_guard<std::mutex> lock(conn->mtx);
+                        conn->scheduled = false;
+                        if (conn->closed) {
+                            continue;
+                        }
+                        if (conn->sending.empty()) {
+                            conn->sending.swap(conn->outbox);
+                        } else {
+                            conn->sending += conn->outbox;
+                            conn->outbox.clear();
+                        }
+                    }
+                    write_out(*conn);
+                }
+                to_write.clear();
+                continue;
+            }
+
+            Connection& conn = *static_cast<Connection*>(events[i].data.ptr);
+            if (conn.fd < 0) {
+                continue;
+            }
+            if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+                read_in(conn);
+            }
+            if (conn.fd >= 0 && (events[i].events & EPOLLOUT)) {
+                write_out(conn);
+            }
+        }
+    }
+}
+
+void AsyncKVClient::write_out(Connection& conn) {
+    while (conn.sent < conn.sending.size()) {
+        ssize_t n = send(conn.fd, conn.sending.data() + conn.sent, conn.sending.size() - conn.sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                // Socket buffer full: finish once the server has read some
+                if (!conn.want_write) {
+                    epoll_event ev{};
+                    ev.events = EPOLLIN | EPOLLOUT;
+                    ev.data.ptr = &conn;
+                    epoll_ctl(epfd, EPOLL_CTL_MOD, conn.fd, &ev);
+                    conn.want_write = true;
+                }
+                return;
+            }
+            fail(conn);
+            return;
+        }
+        conn.sent += n;
+    }
+    conn.sending.clear();
+    conn.sent = 0;
+    if (conn.want_write) {
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.ptr = &conn;
+        epoll_ctl(epfd, EPOLL_CTL_MOD, conn.fd, &ev);
+        conn.want_write = false;
+    }
+}
+
+void AsyncKVClient::read_in(Connection& conn) {
+    char buffer[65536];
+    bool eof = false;
+    while (true) {
+        ssize_t n = read(conn.fd, buffer, sizeof(buffer));
+        if (n > 0) {
+            conn.rbuf.append(buffer, n);
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        eof = n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK);
+        break;
+    }
+
+    // The server answers each connection in order, so replies complete the
+    // waiting callbacks front to back
+    size_t off = 0;
+    protocol::FrameHeader header;
+    while (protocol::decode_header(std::string_view(conn.rbuf).substr(off), header) &&
+           conn.rbuf.size() - off >= header.frame_size()) {
+        Callback done;
+        {
+            std::lock_guard<std::mutex> lock(conn.mtx);
+            if (header.magic != protocol::MAGIC || conn.waiting.empty()) {
+                eof = true;
+                break;
+            }
+            done = std::move(conn.waiting.front());
+            conn.waiting.pop_front();
+        }
+        pending--;
+        done(static_cast<Status>(header.code),
+             conn.rbuf.substr(off + protocol::HEADER_SIZE + header.key_len, header.value_len));
+        off += header.frame_size();
+    }
+    conn.rbuf.erase(0, off);
+
+    if (eof) {
+        fail(conn);
+    }
+}
+
+void AsyncKVClient::fail(Connection& conn) {
+    std::deque<Callback> orphans;
+    {
+        std::lock_guard<std::mutex> lock(conn.mtx);
+        conn.closed = true;
+        conn.outbox.clear();
+        orphans.swap(conn.waiting);
+    }
+    if (conn.fd >= 0) {
+        epoll_ctl(epfd, EPOLL_CTL_DEL, conn.fd, nullptr);
+        close(conn.fd);
+        conn.fd = -1;
+    }
+    conn.sending.clear();
+    conn.sent = 0;
+    conn.rbuf.clear();
+    for (auto& done : orphans) {
+        pending--;
+        done(Status::Error, "");
+    }
+}
+
+std::future<bool> AsyncKVClient::put_async(const std::string& key, const std::string& value) {
+    auto promise = std::make_shared<std::promise<bool>>();
+    std::future<bool> result = promise->get_future();
+    put_async(key, value, [promise](Status status, std::string) { promise->set_value(status == Status::Ok); });
+    return result;
+}
+
+std::future<std::optional<std::string>> AsyncKVClient::get_async(const std::string& key) {
+    auto promise = std::make_shared<std::promise<std::optional<std::string>>>();
+    std::future<std::optional<std::string>> result = promise->get_future();
+    get_async(key, [promise](Status status, std::string value) {
+        if (status == Status::Ok) {
+            promise->set_value(std::move(value));
+        } else if (status == Status::NotFound) {
+            promise->set_value(std::nullopt);
+        } else {
+            promise->set_exception(std::make_exception_ptr(std::runtime_error("GET failed")));
+        }
+    });
+    return result;
+}
+
+std::future<bool> AsyncKVClient::remove_async(const std::string& key) {
+    auto promise = std::make_shared<std::promise<bool>>();
+    std::future<bool> result = promise->get_future();
+    remove_async(key, [promise](Status status, std::string) { promise->set_value(status == Status::Ok); });
+    return result;
+}
+
+void AsyncKVClient::put_async(const std::string& key, const std::string& value, Callback done) {
+    request_async(Opcode::Put, key, value, std::move(done));
+}
+
+void AsyncKVClient::get_async(const std::string& key, Callback done) {
+    request_async(Opcode::Get, key, "", std::move(done));
+}
+
+void AsyncKVClient::remove_async(const std::string& key, Callback done) {
+    request_async(Opcode::Delete, key, "", std::move(done));
+}
@@ -0,0 +1,235 @@
+#include "block_cache.hpp"
+#include <algorithm>
+
+namespace
+{
+
+// Bookkeeping per cached block beyond its bytes: slot, hash map node, control block
+constexpr uint64_t SLOT_OVERHEAD = 96;
+
+// Blocks are about this big by default; sizes the frequency sketch
+constexpr uint64_t TYPICAL_BLOCK_BYTES = 4096;
+
+uint64_t block_key(uint64_t file, uint64_t block)
+{
+    return (file << 24) ^ block;
+}
+
+// Spreads the key bits so shard and sketch positions are independent
+uint64_t mix(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ull;
+    x ^= x >> 33;
+    return x;
+}
+
+} // namespace
+
+BlockCache::FrequencySketch::FrequencySketch(size_t expected_entries)
+{
+    size_t width = 64;
+    while (width < expected_entries * 2)
+    {
+        width *= 2;
+    }
+    mask = width - 1;
+    counters.assign(width * 4 / 2, 0);
+    sample_size = std::max<size_t>(expected_entries, 64) * 10;
+}
+
+size_t BlockCache::FrequencySketch::index(uint64_t hash, int row) const
+{
+    static constexpr uint64_t SEEDS[4] = {0x97cb3127cd1ab0e5ull, 0xc2b2ae3d27d4eb4full, 0x165667b19e3779f9ull,
+                                          0x9e3779b97f4a7c15ull};
+    return row * (mask + 1) + (((hash * SEEDS[row]) >> 32) & mask);
+}
+
+uint32_t BlockCache::FrequencySketch::get(size_t i) const
+{
+    return (counters[i / 2] >> ((i & 1) * 4)) & 0xf;
+}
+
+void BlockCache::FrequencySketch::record(uint64_t hash)
+{
+    for (int row = 0; row < 4; row++)
+    {
+        size_t i = index(hash, row);
+        if (get(i) < 15)
+        {
+            counters[i / 2] += static_cast<uint8_t>(1 << ((i & 1) * 4));
+        }
+    }
+    if (++additions >= sample_size)
+    {
+        halve();
+    }
+}
+
+uint32_t BlockCache::FrequencySketch::estimate(uint64_t hash) const
+{
+    uint32_t lowest = 15;
+    for (int row = 0; row < 4; row++)
+    {
+        lowest = std::min(lowest, get(index(hash, row)));
+    }
+    return lowest;
+}
+
+void BlockCache::FrequencySketch::halve()
+{
+    for (auto &pair : counters)
+    {
+        pair = (pair >> 1) & 0x77;
+    }
+    additions /= 2;
+}
+
+BlockCache::BlockCache(uint64_t capacity_bytes, size_t num_shards)
+    : capacity(capacity_bytes)
+{
+    num_shards = std::max<size_t>(1, num_shards);
+    size_t expected = capacity_bytes / num_shards / TYPICAL_BLOCK_BYTES;
+    for (size_t i = 0; i < num_shards; i++)
+    {
+        shards.push_back(std::make_unique<Shard>(expected));
+    }
+}
+
+uint64_t BlockCache::shard_budget() const
+{
+    uint64_t held = pinned.load(std::memory_order_relaxed);
+    return held >= capacity ? 0 : (capacity - held) / shards.size();
+}
+
+BlockCache::Block BlockCache::lookup(uint64_t file, uint64_t block, bool fill)
+{
+    uint64_t key = block_key(file, block);
+    uint64_t hash = mix(key);
+    Shard &shard = shard_for(hash);
+    std::lock_guard<std::mutex> lock(shard.mtx);
+    if (fill)
+    {
+        shard.sketch.record(hash);
+    }
+    auto it = shard.index.find(key);
+    if (it == shard.index.end())
+    {
+        shard.misses++;
+        return nullptr;
+    }
+    Slot &slot = shard.slots[it->second];
+    if (fill)
+    {
+        slot.referenced = true;
+    }
+    shard.hits++;
+    return slot.data;
+}
+
+void BlockCache::insert(uint64_t file, uint64_t block, Block data)
+{
+    uint64_t key = block_key(file, block);
+    uint64_t hash = mix(key);
+    Shard &shard = shard_for(hash);
+    uint64_t charge = data->size() + SLOT_OVERHEAD;
+    uint64_t budget = shard_budget();
+
+    std::lock_guard<std::mutex> lock(shard.mtx);
+    if (shard.index.count(key) > 0)
+    {
+        return; // another reader got there first
+    }
+    if (charge > budget)
+    {
+        shard.rejects++;
+        return;
+    }
+
+    bool admitted = false;
+    while (shard.used + charge > budget)
+    {
+        // Second chance: referenced blocks lose their bit and are skipped
+        Slot &victim = shard.slots[shard.hand];
+        if (!victim.data || victim.referenced)
+        {
+            victim.referenced = false;
+            shard.hand = (shard.hand + 1) % shard.slots.size();
+            continue;
+        }
+        // The newcomer has to be wanted more often than what it replaces
+        if (!admitted && shard.sketch.estimate(hash) <= shard.sketch.estimate(mix(victim.key)))
+        {
+            shard.rejects++;
+            return;
+        }
+        admitted = true;
+        evict(shard, shard.hand);
+        shard.hand = (shard.hand + 1) % shard.slots.size();
+    }
+
+    size_t slot;
+    if (!shard.free_slots.empty())
+    {
+        slot = shard.free_slots.back();
+        shard.free_slots.pop_back();
+    }
+    else
+    {
+        slot = shard.slots.size();
+        shard.slots.emplace_back();
+    }
+    shard.slots[slot] = Slot{key, std::move(data), charge, false};
+    shard.index.emplace(key, slot);
+    shard.used += charge;
+    shard.inserts++;
+}
+
+void BlockCache::evict(Shard &shard, size_t slot)
+{
+    Slot &victim = shard.slots[slot];
+    shard.index.erase(victim.key);
+    shard.used -= victim.charge;
+    victim.data.reset();
+    shard.free_slots.push_back(slot);
+    shard.evictions++;
+}
+
+std::vector<BlockCacheStats> BlockCache::shard_stats() const
+{
+    std::vector<BlockCacheStats> result;
+    uint64_t budget = shard_budget();
+    for (const auto &shard : shards)
+    {
+        std::lock_guard<std::mutex> lock(shard->mtx);
+        BlockCacheStats s;
+        s.capacity_bytes = budget;
+        s.used_bytes = shard->used;
+        s.hits = shard->hits;
+        s.misses = shard->misses;
+        s.inserts = shard->inserts;
+        s.rejects = shard->rejects;
+        s.evictions = shard->evictions;
+        result.push_back(s);
+    }
+    return result;
+}
+
+BlockCacheStats BlockCache::stats() const
+{
+    BlockCacheStats total;
+    for (const auto &s : shard_stats())
+    {
+        total.used_bytes += s.used_bytes;
+        total.hits += s.hits;
+        total.misses += s.misses;
+        total.inserts += s.inserts;
+        total.rejects += s.rejects;
+        total.evictions += s.evictions;
+    }
+    total.capacity_bytes = capacity;
+    total.pinned_bytes = pinned.load();
+    return total;
+}
@@ -1,10 +1,32 @@
 #include "client.hpp"
+#include "key_range.hpp"
 #include <arpa/inet.h>
+#include <sys/socket.h>
 #include <unistd.h>
+#include <algorithm>
+#include <charconv>
 #include <iostream>
 #include <cstring>
+#include <stdexcept>
 
-KVClient::KVClient(const std::string& host, int port) {
+namespace {
+
+// The number that makes up the rest of a text reply line after skip bytes
+template <typename T>
+bool parse_reply(const std::string& reply, size_t skip, T& n) {
+    if (reply.size() <= skip || reply.back() != '\n') {
+        return false;
+    }
+    const char* first = reply.data() + skip;
+    const char* last = reply.data() + reply.size() - 1;
+    auto result = std::from_chars(first, last, n);
+    return first != last && result.ec == std::errc() && result.ptr == last;
+}
+
+} // namespace
+
+KVClient::KVClient(const std::string& host, int port, Protocol protocol)
+    : protocol(protocol) {
     sockfd = socket(AF_INET, SOCK_STREAM, 0);
     if (sockfd < 0) {
         perror("socket");
@@ -30,27 +52,545 @@ KVClient::~KVClient() {
     close(sockfd);
 }
 
+void KVClient::send_all(const std::string& data) {
+    size_t off = 0;
+    while (off < data.size()) {
+        ssize_t n = send(sockfd, data.data() + off, data.size() - off, MSG_NOSIGNAL);
+        if (n <= 0) {
+            throw std::runtime_error("Failed to send request");
+        }
+        off += n;
+    }
+}
+
+// Pull whatever the socket has into rbuf
+void KVClient::fill() {
+    char buffer[16384];
+    ssize_t n = read(sockfd, buffer, sizeof(buffer));
+    if (n <= 0) {
+        throw std::runtime_error("Connection closed by server");
+    }
+    rbuf.append(buffer, n);
+}
+
 std::string KVClient::send_request(const std::string& req) {
-    send(sockfd, req.c_str(), req.size(), 0);
-    char buffer[1024];
-    int n = read(sockfd, buffer, sizeof(buffer) - 1);
-    if (n <= 0) return "";
-    buffer[n] = '\0';
-    return std::string(buffer);
+    // Requests are newline-terminated so the server can frame them
+    send_all(req + "\n");
+
+    // A reply may arrive in several pieces; it ends at the first newline
+    size_t newline;
+    while ((newline = rbuf.find('\n')) == std::string::npos) {
+        fill();
+    }
+    std::string reply = rbuf.substr(0, newline + 1);
+    rbuf.erase(0, newline + 1);
+    return reply;
+}
+
+protocol::Status KVClient::send_frame(protocol::Opcode op, const std::string& key,
+                                      const std::string& value, std::string& result, uint16_t flags) {
+    queue(op, key, value, flags);
+    Reply reply = read_reply();
+    result = std::move(reply.value);
+    return reply.status;
+}
+
+uint32_t KVClient::queue(protocol::Opcode op, const std::string& key, const std::string& value, uint16_t flags) {
+    if (protocol != Protocol::Binary) {
+        throw std::logic_error("Pipelining requires the binary protocol");
+    }
+    uint32_t id = ++next_id;
+    protocol::encode_request(wbuf, op, id, key, value, flags);
+    inflight.push_back(id);
+    return id;
+}
+
+uint32_t KVClient::queue_put(const std::string& key, const std::string& value) {
+    return queue(protocol::Opcode::Put, key, value);
+}
+
+uint32_t KVClient::queue_put(const std::string& key, const std::string& value, std::chrono::seconds ttl) {
+    std::string body;
+    protocol::encode_ttl_value(body, static_cast<uint32_t>(ttl.count()), value);
+    return queue(protocol::Opcode::PutEx, key, body);
+}
+
+uint32_t KVClient::queue_get(const std::string& key) {
+    return queue(protocol::Opcode::Get, key, "");
+}
+
+uint32_t KVClient::queue_remove(const std::string& key) {
+    return queue(protocol::Opcode::Delete, key, "");
+}
+
+uint32_t KVClient::queue_scan(const std::string& start, const std::string& end, size_t limit) {
+    std::string body;
+    protocol::encode_scan_request(body, static_cast<uint32_t>(std::min<size_t>(limit, UINT32_MAX)), end);
+    return queue(protocol::Opcode::Scan, start, body);
+}
+
+void KVClient::flush() {
+    if (!wbuf.empty()) {
+        send_all(wbuf);
+        wbuf.clear();
+    }
+}
+
+KVClient::Reply KVClient::read_reply() {
+    if (inflight.empty()) {
+        throw std::logic_error("No request in flight");
+    }
+    flush();
+
+    protocol::FrameHeader header;
+    while (!protocol::decode_header(rbuf, header) || rbuf.size() < header.frame_size()) {
+        fill();
+    }
+    // The server answers in order, so the reply must match the oldest request
+    if (header.magic != protocol::MAGIC || header.request_id != inflight.front()) {
+        throw std::runtime_error("Malformed reply from server");
+    }
+    inflight.pop_front();
+
+    Reply reply;
+    reply.request_id = header.request_id;
+    reply.status = static_cast<protocol::Status>(header.code);
+    reply.value.assign(rbuf, protocol::HEADER_SIZE + header.key_len, header.value_len);
+    rbuf.erase(0, header.frame_size());
+    return reply;
 }
 
 bool KVClient::put(const std::string& key, const std::string& value) {
+    if (protocol == Protocol::Binary) {
+        std::string result;
+        return send_frame(protocol::Opcode::Put, key, value, result) == protocol::Status::Ok;
+    }
     return send_request("PUT " + key + " " + value) == "OK\n";
 }
 
+bool KVClient::put(const std::string& key, const std::string& value, std::chrono::seconds ttl) {
+    if (ttl.count() <= 0 || ttl.count() > UINT32_MAX) {
+        return false;
+    }
+    if (protocol == Protocol::Binary) {
+        std::string body, result;
+        protocol::encode_ttl_value(body, static_cast<uint32_t>(ttl.count()), value);
+        return send_frame(protocol::Opcode::PutEx, key, body, result) == protocol::Status::Ok;
+    }
+    return send_request("PUT " + key + " " + value + " EX " + std::to_string(ttl.count())) == "OK\n";
+}
+
 std::string KVClient::get(const std::string& key) {
+    if (protocol == Protocol::Binary) {
+        std::string value;
+        return get(key, value) ? value + "\n" : "KEY NOT_FOUND\n";
+    }
     return send_request("GET " + key);
 }
 
+bool KVClient::get(const std::string& key, std::string& value) {
+    if (protocol == Protocol::Binary) {
+        return send_frame(protocol::Opcode::Get, key, "", value) == protocol::Status::Ok;
+    }
+    std::string reply = send_request("GET " + key);
+    if (reply == "KEY NOT_FOUND\n") {
+        return false;
+    }
+    value = reply.substr(0, reply.size() - 1);
+    return true;
+}
+
 bool KVClient::remove(const std::string& key) {
+    if (protocol == Protocol::Binary) {
+        std::string result;
+        return send_frame(protocol::Opcode::Delete, key, "", result) == protocol::Status::Ok;
+    }
     return send_request("DELETE " + key) == "OK\n";
 }
 
+bool KVClient::get(const std::string& key, std::string& value, uint64_t& version) {
+    if (protocol == Protocol::Binary) {
+        std::string result;
+        std::string_view found;
+        if (send_frame(protocol::Opcode::GetVersion, key, "", result) != protocol::Status::Ok ||
+            !protocol::decode_versioned_value(result, version, found)) {
+            return false;
+        }
+        value.assign(found);
+        return true;
+    }
+    // <version> <value>
+    std::string reply = send_request("GETV " + key);
+    size_t space = reply.find(' ');
+    if (reply == "KEY NOT_FOUND\n" || space == std::string::npos || space == 0) {
+        return false;
+    }
+    auto parsed = std::from_chars(reply.data(), reply.data() + space, version);
+    if (parsed.ec != std::errc() || parsed.ptr != reply.data() + space) {
+        return false;
+    }
+    value = reply.substr(space + 1, reply.size() - space - 2);
+    return true;
+}
+
+bool KVClient::compare_and_set(const std::string& key, uint64_t expected_version, const std::string& value,
+                               uint64_t& version) {
+    version = 0;
+    if (protocol == Protocol::Binary) {
+        std::string body, result;
+        protocol::encode_versioned_value(body, expected_version, value);
+        protocol::Status status = send_frame(protocol::Opcode::Cas, key, body, result);
+        if (status == protocol::Status::Ok || status == protocol::Status::Conflict) {
+            protocol::decode_u64(result, version);
+        }
+        return status == protocol::Status::Ok;
+    }
+    // OK <version> or CONFLICT <version>
+    std::string reply = send_request("CAS " + key + " " + std::to_string(expected_version) + " " + value);
+    if (reply.rfind("CONFLICT ", 0) == 0) {
+        parse_reply(reply, 9, version);
+        return false;
+    }
+    return reply.rfind("OK ", 0) == 0 && parse_reply(reply, 3, version);
+}
+
+bool KVClient::increment(const std::string& key, int64_t delta, int64_t& result) {
+    if (protocol == Protocol::Binary) {
+        std::string body, reply;
+        uint64_t sum;
+        protocol::encode_u64(body, static_cast<uint64_t>(delta));
+        if (send_frame(protocol::Opcode::IncrBy, key, body, reply) != protocol::Status::Ok ||
+            !protocol::decode_u64(reply, sum)) {
+            return false;
+        }
+        result = static_cast<int64_t>(sum);
+        return true;
+    }
+    return parse_reply(send_request("INCRBY " + key + " " + std::to_string(delta)), 0, result);
+}
+
+bool KVClient::append(const std::string& key, const std::string& suffix, size_t& length) {
+    if (protocol == Protocol::Binary) {
+        std::string result;
+        uint64_t n;
+        if (send_frame(protocol::Opcode::Append, key, suffix, result) != protocol::Status::Ok ||
+            !protocol::decode_u64(result, n)) {
+            return false;
+        }
+        length = n;
+        return true;
+    }
+    return parse_reply(send_request("APPEND " + key + " " + suffix), 0, length);
+}
+
 bool KVClient::persist() {
+    if (protocol == Protocol::Binary) {
+        std::string result;
+        return send_frame(protocol::Opcode::Persist, "", "", result) == protocol::Status::Ok;
+    }
     return send_request("PERSIST") == "OK\n";
 }
+
+bool KVClient::put(const std::string& key, const std::string& value, Durability level, uint64_t* lsn) {
+    return durable_write(protocol::Opcode::Put, key, value, level, lsn);
+}
+
+bool KVClient::remove(const std::string& key, Durability level, uint64_t* lsn) {
+    return durable_write(protocol::Opcode::Delete, key, "", level, lsn);
+}
+
+bool KVClient::durable_write(protocol::Opcode op, const std::string& key, const std::string& value,
+                             Durability level, uint64_t* lsn) {
+    if (protocol != Protocol::Binary) {
+        throw std::logic_error("Durability levels require the binary protocol");
+    }
+    std::string result;
+    uint16_t flags = static_cast<uint16_t>(level) | (lsn ? protocol::FLAG_RETURN_LSN : 0);
+    if (send_frame(op, key, value, result, flags) != protocol::Status::Ok) {
+        return false;
+    }
+    if (lsn && !protocol::decode_u64(result, *lsn)) {
+        throw std::runtime_error("Malformed write reply");
+    }
+    return true;
+}
+
+uint64_t KVClient::wait_durable(uint64_t lsn, Durability level) {
+    if (protocol != Protocol::Binary) {
+        throw std::logic_error("DURABLE requires the binary protocol");
+    }
+    std::string body, result;
+    if (lsn != 0) {
+        protocol::encode_u64(body, lsn);
+    }
+    uint64_t durable;
+    if (send_frame(protocol::Opcode::Durable, "", body, result, static_cast<uint16_t>(level)) != protocol::Status::Ok ||
+        !protocol::decode_u64(result, durable)) {
+        throw std::runtime_error("DURABLE failed");
+    }
+    return durable;
+}
+
+std::string KVClient::replication_info() {
+    return info_lines(protocol::Opcode::ReplInfo, "REPLICATION");
+}
+
+std::string KVClient::cluster_info() {
+    return info_lines(protocol::Opcode::ClusterInfo, "CLUSTER");
+}
+
+std::string KVClient::stats() {
+    return info_lines(protocol::Opcode::Stats, "STATS");
+}
+
+protocol::Status KVClient::request(protocol::Opcode op, const std::string& key, const std::string& value,
+                                   std::string& result) {
+    return send_frame(op, key, value, result);
+}
+
+std::string KVClient::info_lines(protocol::Opcode op, const std::string& command) {
+    if (protocol == Protocol::Binary) {
+        std::string result;
+        if (send_frame(op, "", "", result) != protocol::Status::Ok) {
+            throw std::runtime_error(command + " failed");
+        }
+        return result;
+    }
+    send_all(command + "\n");
+    std::string info;
+    while (true) {
+        size_t newline;
+        while ((newline = rbuf.find('\n')) == std::string::npos) {
+            fill();
+        }
+        std::string line = rbuf.substr(0, newline + 1);
+        rbuf.erase(0, newline + 1);
+        if (line == "END\n") {
+            return info;
+        }
+        if (line.find(':') == std::string::npos) {
+            throw std::runtime_error(command + " failed");
+        }
+        info += line;
+    }
+}
+
+namespace {
+
+// Split [0, count) into runs whose encoded size stays near limit
+template <typename SizeOf>
+std::vector<std::pair<size_t, size_t>> split_batch(size_t count, size_t limit, SizeOf size_of) {
+    std::vector<std::pair<size_t, size_t>> runs;
+    size_t start = 0;
+    size_t bytes = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (i > start && bytes + size_of(i) > limit) {
+            runs.emplace_back(start, i);
+            start = i;
+            bytes = 0;
+        }
+        bytes += size_of(i);
+    }
+    if (start < count) {
+        runs.emplace_back(start, count);
+    }
+    return runs;
+}
+
+} // namespace
+
+bool KVClient::multi_put(const std::vector<std::pair<std::string, std::string>>& items) {
+    auto runs = split_batch(items.size(), BATCH_FRAME_BYTES, [&](size_t i) {
+        return 8 + items[i].first.size() + items[i].second.size();
+    });
+
+    bool ok = true;
+    if (protocol == Protocol::Binary) {
+        std::string body;
+        for (const auto& run : runs) {
+            body.clear();
+            protocol::encode_u32(body, static_cast<uint32_t>(2 * (run.second - run.first)));
+            for (size_t i = run.first; i < run.second; i++) {
+                protocol::encode_string(body, items[i].first);
+                protocol::encode_string(body, items[i].second);
+            }
+            queue(protocol::Opcode::MPut, "", body);
+        }
+        for (size_t i = 0; i < runs.size(); i++) {
+            ok = read_reply().status == protocol::Status::Ok && ok;
+        }
+        return ok;
+    }
+
+    for (const auto& run : runs) {
+        std::string req = "MPUT";
+        for (size_t i = run.first; i < run.second; i++) {
+            req += " " + items[i].first + " " + items[i].second;
+        }
+        ok = send_request(req) == "OK\n" && ok;
+    }
+    return ok;
+}
+
+std::vector<std::optional<std::string>> KVClient::multi_get(const std::vector<std::string>& keys) {
+    auto runs = split_batch(keys.size(), BATCH_FRAME_BYTES, [&](size_t i) { return 4 + keys[i].size(); });
+
+    std::vector<std::optional<std::string>> values;
+    values.reserve(keys.size());
+    if (protocol == Protocol::Binary) {
+        std::string body;
+        for (const auto& run : runs) {
+            body.clear();
+            protocol::encode_u32(body, static_cast<uint32_t>(run.second - run.first));
+            for (size_t i = run.first; i < run.second; i++) {
+                protocol::encode_string(body, keys[i]);
+            }
+            queue(protocol::Opcode::MGet, "", body);
+        }
+        std::vector<std::optional<std::string>> part;
+        for (const auto& run : runs) {
+            Reply reply = read_reply();
+            if (reply.status != protocol::Status::Ok || !protocol::decode_values(reply.value, part) ||
+                part.size() != run.second - run.first) {
+                throw std::runtime_error("MGET failed");
+            }
+            for (auto& value : part) {
+                values.push_back(std::move(value));
+            }
+        }
+        return values;
+    }
+
+    for (const auto& run : runs) {
+        std::string req = "MGET";
+        for (size_t i = run.first; i < run.second; i++) {
+            req += " " + keys[i];
+        }
+        send_all(req + "\n");
+        for (size_t i = run.first; i < run.second; i++) {
+            size_t newline;
+            while ((newline = rbuf.find('\n')) == std::string::npos) {
+                fill();
+            }
+            std::string line = rbuf.substr(0, newline);
+            rbuf.erase(0, newline + 1);
+            if (line == "ERROR") {
+                throw std::runtime_error("MGET failed");
+            }
+            if (line == "KEY NOT_FOUND") {
+                values.emplace_back();
+            } else {
+                values.emplace_back(std::move(line));
+            }
+        }
+    }
+    return values;
+}
+
+size_t KVClient::multi_remove(const std::vector<std::string>& keys) {
+    auto runs = split_batch(keys.size(), BATCH_FRAME_BYTES, [&](size_t i) { return 4 + keys[i].size(); });
+
+    size_t removed = 0;
+    if (protocol == Protocol::Binary) {
+        std::string body;
+        for (const auto& run : runs) {
+            body.clear();
+            protocol::encode_u32(body, static_cast<uint32_t>(run.second - run.first));
+            for (size_t i = run.first; i < run.second; i++) {
+                protocol::encode_string(body, keys[i]);
+            }
+            queue(protocol::Opcode::MDelete, "", body);
+        }
+        for (size_t i = 0; i < runs.size(); i++) {
+            Reply reply = read_reply();
+            uint32_t count;
+            if (reply.status != protocol::Status::Ok || !protocol::decode_u32(reply.value, count)) {
+                throw std::runtime_error("MDELETE failed");
+            }
+            removed += count;
+        }
+        return removed;
+    }
+
+    for (const auto& run : runs) {
+        std::string req = "MDELETE";
+        for (size_t i = run.first; i < run.second; i++) {
+            req += " " + keys[i];
+        }
+        std::string reply = send_request(req);
+        if (reply.compare(0, 8, "DELETED ") != 0) {
+            throw std::runtime_error("MDELETE failed");
+        }
+        removed += std::stoul(reply.substr(8));
+    }
+    return removed;
+}
+
+std::vector<std::pair<std::string, std::string>> KVClient::scan_page(const std::string& start, const std::string& end,
+                                                                     size_t limit, bool& more) {
+    std::vector<std::pair<std::string, std::string>> entries;
+    uint32_t n = static_cast<uint32_t>(std::min<size_t>(limit, UINT32_MAX));
+    if (protocol == Protocol::Binary) {
+        std::string body;
+        protocol::encode_scan_request(body, n, end);
+        std::string result;
+        if (send_frame(protocol::Opcode::Scan, start, body, result) != protocol::Status::Ok ||
+            !protocol::decode_entries(result, entries, more)) {
+            throw std::runtime_error("SCAN failed");
+        }
+        return entries;
+    }
+
+    send_all("SCAN " + (start.empty() ? "-" : start) + " " + (end.empty() ? "+" : end) + " " +
+             std::to_string(n) + "\n");
+    while (true) {
+        size_t newline;
+        while ((newline = rbuf.find('\n')) == std::string::npos) {
+            fill();
+        }
+        std::string line = rbuf.substr(0, newline);
+        rbuf.erase(0, newline + 1);
+        if (line == "END" || line == "MORE") {
+            more = line == "MORE";
+            return entries;
+        }
+        size_t space = line.find(' ');
+        if (space == std::string::npos) {
+            throw std::runtime_error("SCAN failed");
+        }
+        entries.emplace_back(line.substr(0, space), line.substr(space + 1));
+    }
+}
+
+KVClient::ScanCursor::ScanCursor(KVClient& client, std::string start, std::string end, size_t page_size)
+    : client(client), start(std::move(start)), end(std::move(end)), page_size(page_size) {}
+
+bool KVClient::ScanCursor::next(std::string& key, std::string& value) {
+    if (pos == page.size()) {
+        if (done) {
+            return false;
+        }
+        bool more = false;
+        page = client.scan_page(start, end, page_size, more);
+        pos = 0;
+        done = !more;
+        if (page.empty()) {
+            done = true;
+            return false;
+        }
+        // The smallest key after the last one seen
+        start = page.back().first + '\0';
+    }
+    key = std::move(page[pos].first);
+    value = std::move(page[pos].second);
+    pos++;
+    return true;
+}
+
+KVClient::ScanCursor KVClient::scan(const std::string& start, const std::string& end, size_t page_size) {
+    return ScanCursor(*this, start, end, page_size);
+}
+
+KVClient::ScanCursor KVClient::prefix_scan(const std::string& prefix, size_t page_size) {
+    return ScanCursor(*this, prefix, prefix_end(prefix), page_size);
+}
@@ -0,0 +1,403 @@
+#include "cluster.hpp"
+#include "client.hpp"
+#include "kvstore.hpp"
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <stdexcept>
+
+using protocol::Opcode;
+using protocol::Status;
+
+namespace {
+
+// Split off a len u32 | bytes field from the front of body
+bool take_string(std::string_view &body, std::string_view &out) {
+    uint32_t len;
+    if (!protocol::decode_u32(body, len) || body.size() - 4 < len) {
+        return false;
+    }
+    out = body.substr(4, len);
+    body.remove_prefix(4 + len);
+    return true;
+}
+
+bool take_topology(std::string_view &body, ClusterTopology &topology) {
+    std::string_view text;
+    return take_string(body, text) && ClusterTopology::parse(text, topology);
+}
+
+std::unique_ptr<KVClient> connect_to(const std::string &address) {
+    size_t colon = address.rfind(':');
+    if (colon == std::string::npos) {
+        throw std::invalid_argument("Cluster node '" + address + "' is not host:port");
+    }
+    return std::make_unique<KVClient>(address.substr(0, colon), std::stoi(address.substr(colon + 1)));
+}
+
+// Apply records in the Storage encoding to store; returns how many keys
+size_t apply_records(KVStore &store, std::string_view records) {
+    uint64_t seq = 0;
+    size_t keys = 0;
+    size_t decoded = Storage::decode_records(records, [&](const std::vector<Storage::LogOp> &ops) {
+        seq = std::max(seq, store.apply_replicated(ops));
+        keys += ops.size();
+    });
+    if (decoded != records.size()) {
+        throw std::runtime_error("Malformed records from a cluster node");
+    }
+    store.wait_durable(seq);
+    return keys;
+}
+
+} // namespace
+
+std::string ClusterTopology::to_string() const {
+    std::string text = "epoch:" + std::to_string(epoch) + "\nvnodes:" + std::to_string(vnodes) + "\n";
+    for (const auto &node : nodes) {
+        text += "node:" + node + "\n";
+    }
+    return text;
+}
+
+bool ClusterTopology::parse(std::string_view text, ClusterTopology &topology) {
+    topology = ClusterTopology();
+    try {
+        while (!text.empty()) {
+            size_t newline = text.find('\n');
+            std::string_view line = text.substr(0, newline);
+            text.remove_prefix(newline == std::string_view::npos ? text.size() : newline + 1);
+            size_t colon = line.find(':');
+            if (colon == std::string_view::npos) {
+                return false;
+            }
+            std::string_view name = line.substr(0, colon);
+            std::string value(line.substr(colon + 1));
+            if (name == "epoch") {
+                topology.epoch = std::stoull(value);
+            } else if (name == "vnodes") {
+                topology.vnodes = static_cast<uint32_t>(std::stoul(value));
+            } else if (name == "node") {
+                topology.nodes.push_back(value);
+            }
+        }
+    } catch (const std::exception &) {
+        return false;
+    }
+    return topology.vnodes > 0;
+}
+
+// FNV-1a, then a finalizer so short keys spread over the whole ring
+uint64_t cluster_hash(std::string_view data) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (char c : data) {
+        h ^= static_cast<uint8_t>(c);
+        h *= 0x100000001b3ull;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+HashRing::HashRing(const ClusterTopology &topology) {
+    points.reserve(topology.nodes.size() * topology.vnodes);
+    for (size_t i = 0; i < topology.nodes.size(); i++) {
+        for (uint32_t v = 0; v < topology.vnodes; v++) {
+            points.emplace_back(cluster_hash(topology.nodes[i] + "#" + std::to_string(v)), static_cast<uint32_t>(i));
+        }
+    }
+    std::sort(points.begin(), points.end());
+}
+
+size_t HashRing::owner(std::string_view key) const {
+    auto it = std::lower_bound(points.begin(), points.end(), std::make_pair(cluster_hash(key), uint32_t(0)));
+    return it == points.end() ? points.front().second : it->second;
+}
+
+ClusterNode::ClusterNode(KVStore &store, const std::string &self, const ClusterTopology &topology)
+    : store(store), self(self), current(topology), ring(topology) {
+    migrator = std::thread(&ClusterNode::migrate_loop, this);
+}
+
+ClusterNode::~ClusterNode() {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        stopping = true;
+    }
+    changed.notify_all();
+    migrator.join();
+}
+
+ClusterTopology ClusterNode::topology() const {
+    std::lock_guard<std::mutex> lock(mtx);
+    return current;
+}
+
+ClusterStatus ClusterNode::status() const {
+    std::lock_guard<std::mutex> lock(mtx);
+    ClusterStatus s;
+    s.epoch = current.epoch;
+    s.migrating = !scanned;
+    for (const auto &queued : outgoing) {
+        s.migrating = s.migrating || !queued.second.empty();
+    }
+    s.importing = importing.size();
+    s.keys_sent = keys_sent;
+    s.keys_received = keys_received;
+    return s;
+}
+
+std::string ClusterNode::info() const {
+    ClusterStatus s = status();
+    return topology().to_string() + "self:" + self + "\nmigrating:" + (s.migrating ? "yes" : "no") +
+           "\nimporting:" + std::to_string(s.importing) + "\nkeys_sent:" + std::to_string(s.keys_sent) +
+           "\nkeys_received:" + std::to_string(s.keys_received) + "\n";
+}
+
+bool ClusterNode::set_topology(const ClusterTopology &topology) {
+    std::lock_guard<std::mutex> lock(mtx);
+    return adopt(topology);
+}
+
+bool ClusterNode::adopt(const ClusterTopology &topology) {
+    if (topology.epoch < current.epoch) {
+        return false;
+    }
+    if (topology.epoch == current.epoch) {
+        return topology.nodes == current.nodes && topology.vnodes == current.vnodes;
+    }
+    previous = std::move(current);
+    previous_ring = std::move(ring);
+    current = topology;
+    ring = HashRing(current);
+
+    // Any earlier owner may hold keys this node now owns, until it says not
+    importing.clear();
+    for (const auto &node : previous.nodes) {
+        if (node != self) {
+            importing.insert(node);
+        }
+    }
+    scanned = false;
+    outgoing.clear();
+    changed.notify_all();
+    return true;
+}
+
+bool ClusterNode::owns(std::string_view key) const {
+    return !ring.empty() && current.nodes[ring.owner(key)] == self;
+}
+
+bool ClusterNode::holds_keys_for(const std::string &node) const {
+    auto it = outgoing.find(node);
+    return !scanned || (it != outgoing.end() && !it->second.empty());
+}
+
+Status ClusterNode::route(std::string_view key, std::string &moved_to) {
+    return route(std::vector<std::string_view>{key}, moved_to);
+}
+
+Status ClusterNode::route(const std::vector<std::string_view> &keys, std::string &moved_to) {
+    // A pull may bring news of a newer topology, after which the keys are
+    // routed again
+    for (int attempt = 0; attempt < 3; attempt++) {
+        std::map<std::string, std::vector<std::string>> to_pull; // previous owner -> keys
+        uint64_t epoch;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            if (ring.empty()) {
+                moved_to.clear();
+                return Status::Error;
+            }
+            for (std::string_view key : keys) {
+                const std::string &owner = current.nodes[ring.owner(key)];
+                if (owner != self) {
+                    moved_to = owner;
+                    return Status::Moved;
+                }
+                if (!importing.empty() && !previous_ring.empty()) {
+                    const std::string &source = previous.nodes[previous_ring.owner(key)];
+                    if (importing.count(source)) {
+                        to_pull[source].emplace_back(key);
+                    }
+                }
+            }
+            if (to_pull.empty()) {
+                return Status::Ok;
+            }
+            epoch = current.epoch;
+        }
+
+        bool done;
+        for (const auto &source : to_pull) {
+            if (pull(source.first, source.second, done) != Status::Ok) {
+                moved_to.clear();
+                return Status::Error;
+            }
+        }
+        std::lock_guard<std::mutex> lock(mtx);
+        if (current.epoch == epoch) {
+            return Status::Ok;
+        }
+    }
+    moved_to.clear();
+    return Status::Error;
+}
+
+Status ClusterNode::pull(const std::string &source, const std::vector<std::string> &keys, bool &done) {
+    std::lock_guard<std::mutex> one_at_a_time(pull_mtx);
+    ClusterTopology mine = topology();
+    std::string body;
+    protocol::encode_string(body, mine.to_string());
+    protocol::encode_string(body, self);
+    protocol::encode_u32(body, static_cast<uint32_t>(keys.size()));
+    for (const auto &key : keys) {
+        protocol::encode_string(body, key);
+    }
+
+    std::string reply;
+    ClusterTopology theirs;
+    size_t received;
+    try {
+        std::unique_ptr<KVClient> &client = connections[source];
+        if (!client) {
+            client = connect_to(source);
+        }
+        if (client->request(Opcode::ClusterPull, "", body, reply) != Status::Ok || reply.empty()) {
+            return Status::Error;
+        }
+        std::string_view rest = reply;
+        done = rest[0] != 0;
+        rest.remove_prefix(1);
+        if (!take_topology(rest, theirs)) {
+            return Status::Error;
+        }
+        received = apply_records(store, rest);
+    } catch (const std::exception &) {
+        connections.erase(source);
+        return Status::Error;
+    }
+
+    std::lock_guard<std::mutex> lock(mtx);
+    keys_received += received;
+    adopt(theirs);
+    if (done && theirs.epoch == mine.epoch && current.epoch == mine.epoch) {
+        importing.erase(source);
+    }
+    return Status::Ok;
+}
+
+void ClusterNode::migrate_loop() {
+    std::unique_lock<std::mutex> lock(mtx);
+    std::string last_source;
+    while (true) {
+        changed.wait(lock, [&] { return stopping || !scanned || !importing.empty(); });
+        if (stopping) {
+            break;
+        }
+        uint64_t epoch = current.epoch;
+
+        if (!scanned) {
+            // Line up everything held that belongs elsewhere, by new owner,
+            // for the owners to pull
+            ClusterTopology topology = current;
+            HashRing target = ring;
+            lock.unlock();
+            std::map<std::string, std::deque<std::string>> held;
+            if (!target.empty()) {
+                store.dump([&](const std::string &key, const std::string &, uint64_t, uint64_t) {
+                    const std::string &owner = topology.nodes[target.owner(key)];
+                    if (owner != self) {
+                        held[owner].push_back(key);
+                    }
+                });
+            }
+            lock.lock();
+            if (current.epoch == epoch) {
+                outgoing = std::move(held);
+                scanned = true;
+            }
+            continue;
+        }
+
+        // Pull each previous owner dry in turn
+        auto next = importing.upper_bound(last_source);
+        last_source = next == importing.end() ? *importing.begin() : *next;
+        uint64_t received = keys_received;
+        lock.unlock();
+        bool done = false;
+        Status status = pull(last_source, {}, done);
+        lock.lock();
+        if (status != Status::Ok || (!done && keys_received == received)) {
+            // Unreachable, or not ready to hand anything over yet
+            changed.wait_for(lock, std::chrono::milliseconds(status == Status::Ok ? 20 : 500));
+        }
+    }
+}
+
+bool ClusterNode::handle(Opcode op, std::string_view body, std::string &reply) {
+    ClusterTopology topology;
+    switch (op) {
+    case Opcode::ClusterSet:
+        return ClusterTopology::parse(body, topology) && set_topology(topology);
+    case Opcode::ClusterPull:
+        return handle_pull(body, reply);
+    default:
+        return false;
+    }
+}
+
+bool ClusterNode::handle_pull(std::string_view body, std::string &reply) {
+    ClusterTopology theirs;
+    std::string_view from;
+    std::vector<std::string_view> requested;
+    if (!take_topology(body, theirs) || !take_string(body, from) || !protocol::decode_strings(body, requested)) {
+        return false;
+    }
+
+    std::vector<std::string> keys;
+    ClusterTopology mine;
+    bool done = false;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        adopt(theirs);
+        mine = current;
+        // A puller that is behind learns the topology from the reply and
+        // routes again
+        if (current.epoch == theirs.epoch) {
+            std::string puller(from);
+            if (!requested.empty()) {
+                // Never give away a key this node owns
+                for (std::string_view key : requested) {
+                    if (!owns(key)) {
+                        keys.emplace_back(key);
+                    }
+                }
+            } else if (scanned) {
+                std::deque<std::string> &queued = outgoing[puller];
+                while (!queued.empty() && keys.size() < PULL_BATCH) {
+                    keys.push_back(std::move(queued.front()));
+                    queued.pop_front();
+                }
+            }
+            done = !holds_keys_for(puller);
+        }
+    }
+
+    // The keys leave the store before the reply goes out; one that is gone
+    // already was pulled before or has been deleted since the scan
+    reply += static_cast<char>(done ? 1 : 0);
+    protocol::encode_string(reply, mine.to_string());
+    uint64_t seq = 0;
+    size_t moved = keys.empty() ? 0 : store.extract(keys, reply, seq);
+    if (seq != 0) {
+        store.wait_durable(seq);
+    }
+    std::lock_guard<std::mutex> lock(mtx);
+    keys_sent += moved;
+    return true;
+}
@@ -0,0 +1,272 @@
+#include "cluster_client.hpp"
+#include <set>
+#include <stdexcept>
+#include <thread>
+
+using protocol::Opcode;
+using protocol::Status;
+
+ClusterClient::ClusterClient(const std::vector<std::string>& seeds) : seeds(seeds) {
+    refresh();
+    if (topo.nodes.empty()) {
+        throw std::runtime_error("No cluster node answered");
+    }
+}
+
+KVClient* ClusterClient::connection(const std::string& address) {
+    auto& client = connections[address];
+    if (!client) {
+        size_t colon = address.rfind(':');
+        try {
+            if (colon != std::string::npos) {
+                client = std::make_unique<KVClient>(address.substr(0, colon), std::stoi(address.substr(colon + 1)));
+            }
+        } catch (const std::exception&) {
+        }
+    }
+    if (!client) {
+        connections.erase(address);
+        return nullptr;
+    }
+    return client.get();
+}
+
+bool ClusterClient::learn(const std::string& address) {
+    KVClient* client = connection(address);
+    if (!client) {
+        return false;
+    }
+    ClusterTopology topology;
+    try {
+        if (!ClusterTopology::parse(client->cluster_info(), topology)) {
+            return false;
+        }
+    } catch (const std::exception&) {
+        connections.erase(address);
+        return false;
+    }
+    if (topology.epoch <= topo.epoch && !topo.nodes.empty()) {
+        return false;
+    }
+    topo = std::move(topology);
+    ring = HashRing(topo);
+    return true;
+}
+
+void ClusterClient::refresh() {
+    std::vector<std::string> addresses = seeds;
+    addresses.insert(addresses.end(), topo.nodes.begin(), topo.nodes.end());
+    for (const auto& address : addresses) {
+        learn(address);
+    }
+}
+
+bool ClusterClient::set_nodes(const std::vector<std::string>& nodes, uint32_t vnodes) {
+    refresh();
+    ClusterTopology next;
+    next.epoch = topo.epoch + 1;
+    next.vnodes = vnodes != 0 ? vnodes : topo.vnodes;
+    next.nodes = nodes;
+
+    std::set<std::string> everyone(topo.nodes.begin(), topo.nodes.end());
+    everyone.insert(nodes.begin(), nodes.end());
+    bool ok = true;
+    std::string body = next.to_string();
+    for (const auto& address : everyone) {
+        KVClient* client = connection(address);
+        std::string result;
+        try {
+            ok = client && client->request(Opcode::ClusterSet, "", body, result) == Status::Ok && ok;
+        } catch (const std::exception&) {
+            connections.erase(address);
+            ok = false;
+        }
+    }
+    topo = std::move(next);
+    ring = HashRing(topo);
+    return ok;
+}
+
+void ClusterClient::run(std::vector<Op>& ops) {
+    std::vector<Op*> pending;
+    for (auto& op : ops) {
+        pending.push_back(&op);
+    }
+
+    for (int attempt = 0; attempt < MAX_ATTEMPTS && !pending.empty(); attempt++) {
+        if (attempt > 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(20 * attempt));
+        }
+
+        // Group by node. An op bounced by a node the topology still points
+        // to goes where that node said.
+        std::map<std::string, std::vector<Op*>> by_node;
+        for (Op* op : pending) {
+            std::string owner = ring.empty() ? std::string() : topo.nodes[ring.owner(*op->key)];
+            if (!op->moved_to.empty() && owner == op->sent_to) {
+                owner = op->moved_to;
+            }
+            op->status = Status::Error;
+            op->sent_to = owner;
+            op->moved_to.clear();
+            by_node[owner].push_back(op);
+        }
+
+        // One thread per node, each on its own connection
+        std::vector<std::pair<KVClient*, std::vector<Op*>*>> work;
+        for (auto& group : by_node) {
+            if (KVClient* client = group.first.empty() ? nullptr : connection(group.first)) {
+                work.emplace_back(client, &group.second);
+            }
+        }
+        std::vector<char> broken(work.size(), 0);
+        auto send = [&](size_t i) {
+            KVClient& client = *work[i].first;
+            try {
+                for (Op* op : *work[i].second) {
+                    if (op->op == Opcode::PutEx) client.queue_put(*op->key, *op->value, op->ttl);
+                    else if (op->op == Opcode::Put) client.queue_put(*op->key, *op->value);
+                    else if (op->op == Opcode::Get) client.queue_get(*op->key);
+                    else client.queue_remove(*op->key);
+                }
+                client.flush();
+                for (Op* op : *work[i].second) {
+                    KVClient::Reply reply = client.read_reply();
+                    op->status = reply.status;
+                    op->result = std::move(reply.value);
+                }
+            } catch (const std::exception&) {
+                broken[i] = 1;
+            }
+        };
+        if (work.size() == 1) {
+            send(0);
+        } else {
+            std::vector<std::thread> threads;
+            for (size_t i = 0; i < work.size(); i++) {
+                threads.emplace_back(send, i);
+            }
+            for (auto& thread : threads) {
+                thread.join();
+            }
+        }
+
+        // Retry what was bounced or failed, with a fresher topology
+        bool stale = false;
+        std::set<std::string> bounced_by;
+        for (size_t i = 0; i < work.size(); i++) {
+            if (broken[i]) {
+                connections.erase(work[i].second->front()->sent_to);
+                stale = true;
+            }
+        }
+        std::vector<Op*> retry;
+        for (Op* op : pending) {
+            if (op->status == Status::Moved) {
+                op->moved_to = op->result;
+                bounced_by.insert(op->sent_to);
+                retry.push_back(op);
+            } else if (op->status != Status::Ok && op->status != Status::NotFound) {
+                stale = stale || op->sent_to.empty();
+                retry.push_back(op);
+            }
+        }
+        for (const auto& address : bounced_by) {
+            learn(address);
+        }
+        if (stale) {
+            refresh();
+        }
+        pending = std::move(retry);
+    }
+}
+
+bool ClusterClient::put(const std::string& key, const std::string& value) {
+    std::vector<Op> ops(1);
+    ops[0].op = Opcode::Put;
+    ops[0].key = &key;
+    ops[0].value = &value;
+    run(ops);
+    return ops[0].status == Status::Ok;
+}
+
+bool ClusterClient::put(const std::string& key, const std::string& value, std::chrono::seconds ttl) {
+    if (ttl.count() <= 0 || ttl.count() > UINT32_MAX) {
+        return false;
+    }
+    std::vector<Op> ops(1);
+    ops[0].op = Opcode::PutEx;
+    ops[0].key = &key;
+    ops[0].value = &value;
+    ops[0].ttl = ttl;
+    run(ops);
+    return ops[0].status == Status::Ok;
+}
+
+bool ClusterClient::get(const std::string& key, std::string& value) {
+    std::vector<Op> ops(1);
+    ops[0].op = Opcode::Get;
+    ops[0].key = &key;
+    run(ops);
+    if (ops[0].status == Status::Error) {
+        throw std::runtime_error("GET failed on every attempt");
+    }
+    value = std::move(ops[0].result);
+    return ops[0].status == Status::Ok;
+}
+
+bool ClusterClient::remove(const std::string& key) {
+    std::vector<Op> ops(1);
+    ops[0].op = Opcode::Delete;
+    ops[0].key = &key;
+    run(ops);
+    return ops[0].status == Status::Ok;
+}
+
+bool ClusterClient::multi_put(const std::vector<std::pair<std::string, std::string>>& items) {
+    std::vector<Op> ops(items.size());
+    for (size_t i = 0; i < items.size(); i++) {
+        ops[i].op = Opcode::Put;
+        ops[i].key = &items[i].first;
+        ops[i].value = &items[i].second;
+    }
+    run(ops);
+    bool ok = true;
+    for (const auto& op : ops) {
+        ok = ok && op.status == Status::Ok;
+    }
+    return ok;
+}
+
+std::vector<std::optional<std::string>> ClusterClient::multi_get(const std::vector<std::string>& keys) {
+    std::vector<Op> ops(keys.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+        ops[i].op = Opcode::Get;
+        ops[i].key = &keys[i];
+    }
+    run(ops);
+    std::vector<std::optional<std::string>> values(keys.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+        if (ops[i].status == Status::Error) {
+            throw std::runtime_error("MGET failed on every attempt");
+        }
+        if (ops[i].status == Status::Ok) {
+            values[i] = std::move(ops[i].result);
+        }
+    }
+    return values;
+}
+
+size_t ClusterClient::multi_remove(const std::vector<std::string>& keys) {
+    std::vector<Op> ops(keys.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+        ops[i].op = Opcode::Delete;
+        ops[i].key = &keys[i];
+    }
+    run(ops);
+    size_t removed = 0;
+    for (const auto& op : ops) {
+        removed += op.status == Status::Ok;
+    }
+    return removed;
+}
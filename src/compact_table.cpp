@@ -0,0 +1,330 @@
+#include "compact_table.hpp"
+#include <algorithm>
+#include <functional>
+
+namespace {
+
+constexpr size_t MIN_SLOTS = 16;
+constexpr size_t MIN_SLAB_BYTES = 64 << 10;
+constexpr size_t MAX_SLAB_BYTES = 1 << 20;
+
+// Entries bigger than this get a slab of their own, freed as soon as the
+// entry dies, instead of pinning most of a shared slab
+constexpr size_t LARGE_ENTRY_BYTES = MAX_SLAB_BYTES / 4;
+
+constexpr uint32_t NO_SLAB = UINT32_MAX;
+
+} // namespace
+
+CompactTable::CompactTable() : active(NO_SLAB), next_slab_bytes(MIN_SLAB_BYTES) {
+    rehash(MIN_SLOTS);
+}
+
+uint64_t CompactTable::hash_of(std::string_view key) {
+    return std::hash<std::string_view>{}(key);
+}
+
+// The low bits of the hash also pick the KVStore shard, so the home slot
+// comes from the high bits of a multiplicative mix instead
+size_t CompactTable::home(uint64_t hash) const {
+    return static_cast<size_t>((hash * 0x9E3779B97F4A7C15ull) >> shift);
+}
+
+uint32_t CompactTable::tag_of(uint64_t hash) {
+    uint32_t tag = static_cast<uint32_t>(hash >> 32);
+    return tag < FIRST_TAG ? tag + FIRST_TAG : tag;
+}
+
+uint32_t CompactTable::read_u32(const char *p) {
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+std::string_view CompactTable::entry_key(const char *entry) {
+    return std::string_view(entry + ENTRY_HEADER, read_u32(entry));
+}
+
+std::string_view CompactTable::entry_value(const char *entry) {
+    return std::string_view(entry + ENTRY_HEADER + read_u32(entry), read_u32(entry + 4));
+}
+
+size_t CompactTable::entry_size(const char *entry) {
+    return ENTRY_HEADER + size_t(read_u32(entry)) + read_u32(entry + 4);
+}
+
+const char *CompactTable::entry_at(const Slot &slot) const {
+    return slabs[slot.slab].data.get() + slot.offset;
+}
+
+size_t CompactTable::probe(std::string_view key, uint64_t hash, bool &found) const {
+    uint32_t tag = tag_of(hash);
+    size_t mask = slots.size() - 1;
+    size_t first_deleted = SIZE_MAX;
+    for (size_t i = home(hash);; i = (i + 1) & mask) {
+        const Slot &slot = slots[i];
+        if (slot.tag == EMPTY) {
+            found = false;
+            return first_deleted != SIZE_MAX ? first_deleted : i;
+        }
+        if (slot.tag == DELETED) {
+            if (first_deleted == SIZE_MAX) {
+                first_deleted = i;
+            }
+        } else if (slot.tag == tag && entry_key(entry_at(slot)) == key) {
+            found = true;
+            return i;
+        }
+    }
+}
+
+bool CompactTable::find(std::string_view key, std::string_view &value) const {
+    bool found;
+    size_t i = probe(key, hash_of(key), found);
+    if (found) {
+        value = entry_value(entry_at(slots[i]));
+    }
+    return found;
+}
+
+void CompactTable::track_access() {
+    if (!access) {
+        access.reset(new std::atomic<uint32_t>[slots.size()]());
+    }
+}
+
+bool CompactTable::contains(std::string_view key) const {
+    bool found;
+    probe(key, hash_of(key), found);
+    return found;
+}
+
+bool CompactTable::put(std::string_view key, std::string_view value, size_t *old_value_size) {
+    // Keep at least a quarter of the slots empty so probe sequences stay
+    // short. Double when the table is really full, otherwise just sweep out
+    // the DELETED slots.
+    if ((count + deleted + 1) * 4 > slots.size() * 3) {
+        size_t capacity = slots.size();
+        while ((count + 1) * 2 > capacity) {
+            capacity *= 2;
+        }
+        rehash(capacity);
+    }
+
+    uint64_t hash = hash_of(key);
+    bool found;
+    size_t i = probe(key, hash, found);
+    if (found) {
+        Slot &slot = slots[i];
+        char *entry = slabs[slot.slab].data.get() + slot.offset;
+        size_t old_size = read_u32(entry + 4);
+        if (old_value_size != nullptr) {
+            *old_value_size = old_size;
+        }
+        if (old_size == value.size()) {
+            std::memmove(entry + ENTRY_HEADER + key.size(), value.data(), value.size());
+            return false;
+        }
+        // value may point into the old entry, so it is released only after the copy
+        Slot fresh = allocate(key, value, slot.tag);
+        release(slot);
+        slot = fresh;
+        return false;
+    }
+
+    if (slots[i].tag == DELETED) {
+        deleted--;
+    }
+    slots[i] = allocate(key, value, tag_of(hash));
+    if (access) {
+        access[i].store(0, std::memory_order_relaxed);
+    }
+    count++;
+    return true;
+}
+
+bool CompactTable::erase(std::string_view key, size_t *old_value_size) {
+    bool found;
+    size_t i = probe(key, hash_of(key), found);
+    if (!found) {
+        return false;
+    }
+    if (old_value_size != nullptr) {
+        *old_value_size = entry_value(entry_at(slots[i])).size();
+    }
+    release(slots[i]);
+    slots[i].tag = DELETED;
+    count--;
+    deleted++;
+    return true;
+}
+
+void CompactTable::clear() {
+    slots.clear();
+    count = 0;
+    deleted = 0;
+    slabs.clear();
+    free_slabs.clear();
+    active = NO_SLAB;
+    next_slab_bytes = MIN_SLAB_BYTES;
+    slab_bytes = 0;
+    garbage = 0;
+    rehash(MIN_SLOTS);
+}
+
+size_t CompactTable::memory_bytes() const {
+    return slab_bytes + slots.capacity() * (sizeof(Slot) + (access ? sizeof(uint32_t) : 0));
+}
+
+size_t CompactTable::live_bytes() const {
+    size_t unused = active == NO_SLAB ? 0 : slabs[active].capacity - slabs[active].used;
+    return memory_bytes() - garbage - unused;
+}
+
+// Rebuild the slot array at the given power-of-two size, dropping DELETED
+// slots; access words move along with their entries
+void CompactTable::rehash(size_t capacity) {
+    std::vector<Slot> old(capacity, Slot{EMPTY, 0, 0});
+    old.swap(slots);
+    std::unique_ptr<std::atomic<uint32_t>[]> old_access;
+    if (access) {
+        old_access = std::move(access);
+        access.reset(new std::atomic<uint32_t>[capacity]());
+    }
+    shift = 64;
+    for (size_t n = capacity; n > 1; n >>= 1) {
+        shift--;
+    }
+    deleted = 0;
+
+    size_t mask = capacity - 1;
+    for (size_t j = 0; j < old.size(); j++) {
+        const Slot &slot = old[j];
+        if (slot.tag < FIRST_TAG) {
+            continue;
+        }
+        size_t i = home(hash_of(entry_key(entry_at(slot))));
+        while (slots[i].tag != EMPTY) {
+            i = (i + 1) & mask;
+        }
+        slots[i] = slot;
+        if (access) {
+            access[i].store(old_access[j].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        }
+    }
+}
+
+CompactTable::Slot CompactTable::allocate(std::string_view key, std::string_view value, uint32_t tag) {
+    size_t size = ENTRY_HEADER + key.size() + value.size();
+
+    uint32_t index;
+    if (size > LARGE_ENTRY_BYTES) {
+        index = new_slab(size);
+    } else {
+        if (active == NO_SLAB || slabs[active].capacity - slabs[active].used < size) {
+            // Whatever is left at the end of the old active slab is given up
+            if (active != NO_SLAB) {
+                garbage += slabs[active].capacity - slabs[active].used;
+            }
+            uint32_t previous = active;
+            active = new_slab(std::max(next_slab_bytes, size));
+            next_slab_bytes = std::min(next_slab_bytes * 2, MAX_SLAB_BYTES);
+            if (previous != NO_SLAB && slabs[previous].live == 0) {
+                free_slab(previous);
+            }
+        }
+        index = active;
+    }
+
+    Slab &slab = slabs[index];
+    char *p = slab.data.get() + slab.used;
+    uint32_t key_len = static_cast<uint32_t>(key.size());
+    uint32_t value_len = static_cast<uint32_t>(value.size());
+    std::memcpy(p, &key_len, 4);
+    std::memcpy(p + 4, &value_len, 4);
+    std::memcpy(p + ENTRY_HEADER, key.data(), key.size());
+    std::memcpy(p + ENTRY_HEADER + key.size(), value.data(), value.size());
+
+    Slot slot{tag, index, slab.used};
+    slab.used += static_cast<uint32_t>(size);
+    slab.live += static_cast<uint32_t>(size);
+    return slot;
+}
+
+void CompactTable::release(const Slot &slot) {
+    Slab &slab = slabs[slot.slab];
+    uint32_t size = static_cast<uint32_t>(entry_size(slab.data.get() + slot.offset));
+    slab.live -= size;
+    garbage += size;
+    if (slab.live == 0 && slot.slab != active) {
+        free_slab(slot.slab);
+    }
+}
+
+uint32_t CompactTable::new_slab(size_t capacity) {
+    uint32_t index;
+    if (!free_slabs.empty()) {
+        index = free_slabs.back();
+        free_slabs.pop_back();
+    } else {
+        index = static_cast<uint32_t>(slabs.size());
+        slabs.emplace_back();
+    }
+    Slab &slab = slabs[index];
+    slab.data.reset(new char[capacity]); // not zeroed; every byte is written before it is read
+    slab.capacity = static_cast<uint32_t>(capacity);
+    slab.used = 0;
+    slab.live = 0;
+    slab_bytes += capacity;
+    return index;
+}
+
+// Only ever called on a slab that is no longer active, so its unused tail
+// was already counted as garbage
+void CompactTable::free_slab(uint32_t index) {
+    Slab &slab = slabs[index];
+    garbage -= slab.capacity - slab.live;
+    slab_bytes -= slab.capacity;
+    slab.data.reset();
+    slab.capacity = 0;
+    slab.used = 0;
+    slab.live = 0;
+    free_slabs.push_back(index);
+}
+
+size_t CompactTable::defragment(size_t max_slabs) {
+    // Evacuate the slabs that are less than half live, emptiest first
+    std::vector<std::pair<uint32_t, uint32_t>> candidates; // (live, index)
+    for (uint32_t i = 0; i < slabs.size(); i++) {
+        const Slab &slab = slabs[i];
+        if (i != active && slab.data && size_t(slab.live) * 2 < slab.capacity) {
+            candidates.emplace_back(slab.live, i);
+        }
+    }
+    std::sort(candidates.begin(), candidates.end());
+    if (candidates.size() > max_slabs) {
+        candidates.resize(max_slabs);
+    }
+
+    size_t freed = 0;
+    for (const auto &candidate : candidates) {
+        uint32_t index = candidate.second;
+
+        // Walk every entry in the slab; the ones the index still points at are live
+        for (uint32_t offset = 0; offset < slabs[index].used;) {
+            const char *entry = slabs[index].data.get() + offset;
+            uint32_t size = static_cast<uint32_t>(entry_size(entry));
+            std::string_view key = entry_key(entry);
+            bool found;
+            size_t i = probe(key, hash_of(key), found);
+            if (found && slots[i].slab == index && slots[i].offset == offset) {
+                slots[i] = allocate(key, entry_value(entry), slots[i].tag);
+            }
+            offset += size;
+        }
+
+        freed += slabs[index].capacity - candidate.first;
+        free_slab(index);
+    }
+    return freed;
+}
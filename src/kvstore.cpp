@@ -1,47 +1,1391 @@
 #include "kvstore.hpp"
+#include "expiry.hpp"
+#include "key_range.hpp"
+#include <algorithm>
+#include <charconv>
+#include <functional>
+#include <iostream>
+#include <numeric>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <unordered_set>
+#include <vector>
 
-KVStore::KVStore(const std::string &storage_file) : storage(storage_file) {
-    std::lock_guard<std::mutex> lock(mtx);
-    auto data = storage.load();
-    store.reserve(data.size());
-    for (const auto &kv : data) {
-        store.emplace(kv.first, kv.second);
+namespace {
+
+void encode_u64(char *out, uint64_t v) {
+    for (size_t i = 0; i < sizeof(uint64_t); i++) {
+        out[i] = static_cast<char>(v >> (8 * i));
     }
 }
 
-bool KVStore::put(const std::string &key, const std::string &value) {
-    if (key.empty()) {
+uint64_t decode_u64(const char *p) {
+    uint64_t v = 0;
+    for (size_t i = 0; i < sizeof(uint64_t); i++) {
+        v |= static_cast<uint64_t>(static_cast<uint8_t>(p[i])) << (8 * i);
+    }
+    return v;
+}
+
+std::string encode_deadline(uint64_t expires_at) {
+    std::string out(sizeof(uint64_t), '\0');
+    encode_u64(&out[0], expires_at);
+    return out;
+}
+
+// The key's expiry deadline, or 0 if it has none
+uint64_t deadline_of(const CompactTable &expiries, std::string_view key) {
+    std::string_view found;
+    if (expiries.empty() || !expiries.find(key, found)) {
+        return 0;
+    }
+    return decode_u64(found.data());
+}
+
+// Table entries hold the key's version, u64 LE, in front of its value
+constexpr size_t VERSION_BYTES = sizeof(uint64_t);
+
+// What keys written before there were versions report; every version handed
+// out is above it
+constexpr uint64_t LEGACY_VERSION = 1;
+
+uint64_t version_of(std::string_view entry) {
+    return decode_u64(entry.data());
+}
+
+std::string_view value_of(std::string_view entry) {
+    return entry.substr(VERSION_BYTES);
+}
+
+// The entry for value at version, in a buffer the calling thread reuses
+std::string_view make_entry(uint64_t version, std::string_view value) {
+    thread_local std::string entry;
+    entry.resize(VERSION_BYTES);
+    encode_u64(&entry[0], version);
+    entry.append(value);
+    return entry;
+}
+
+// A whole decimal int64 and nothing else
+bool parse_integer(std::string_view text, int64_t &n) {
+    const char *first = text.data();
+    const char *last = first + text.size();
+    auto result = std::from_chars(first, last, n);
+    return first != last && result.ec == std::errc() && result.ptr == last;
+}
+
+bool has_expired(const CompactTable &expiries, std::string_view key) {
+    uint64_t expires_at = deadline_of(expiries, key);
+    return expires_at != 0 && is_expired(expires_at, unix_now_ms());
+}
+
+// Size of the log record for a put of a table entry (value and version);
+// one with an expiry carries its deadline too
+uint64_t put_bytes(size_t key_size, size_t entry_size, bool expires) {
+    return Storage::record_bytes(key_size, entry_size + (expires ? sizeof(uint64_t) : 0));
+}
+
+// Cheap per-thread xorshift, for LFU increments and eviction sampling
+uint32_t thread_random() {
+    thread_local uint64_t state = std::hash<std::thread::id>{}(std::this_thread::get_id()) | 1;
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return static_cast<uint32_t>(state >> 32);
+}
+
+} // namespace
+
+KVStore::KVStore(const std::string &storage_file, const KVStoreOptions &options)
+    : num_shards(options.num_shards == 0 ? 1 : options.num_shards),
+      shards(new Shard[num_shards]),
+      options(options) {
+    if (options.persistence || options.engine == StorageEngine::Lsm) {
+        storage = std::make_unique<Storage>(storage_file, options.storage);
+    }
+    if (options.engine == StorageEngine::Lsm) {
+        lsm = std::make_unique<LsmTree>(storage_file, options.lsm);
+        this->options.ordered_index = false;
+        this->options.persistence = true;
+        this->options.max_memory_bytes = 0;
+        this->options.replication_backlog_bytes = 0;
+    }
+    if (this->options.replication_backlog_bytes > 0) {
+        replication = std::make_unique<ReplicationLog>(this->options.replication_backlog_bytes);
+    }
+    if (this->options.max_memory_bytes > 0) {
+        for (size_t i = 0; i < num_shards; i++) {
+            shards[i].store.track_access();
+        }
+    }
+
+    // Storage partitions recovered keys with the same hash as shard_for(),
+    // so each shard is filled by one recovery thread without locking. With
+    // the LSM engine the log holds what was written since the last flush,
+    // deletes included, and goes back into the memtables. Keys that expired
+    // while the store was down come back as deletes.
+    auto recovered = [this](size_t shard, std::string &&key, std::string &&value, uint64_t expires_at,
+                            uint64_t version) {
+        uint64_t bytes = put_bytes(key.size(), value.size() + VERSION_BYTES, expires_at != 0);
+        shards[shard].live_bytes += bytes;
+        if (lsm) {
+            memtable_used += bytes;
+        }
+        version = std::max(version, LEGACY_VERSION);
+        shards[shard].clock = std::max(shards[shard].clock, version);
+        shards[shard].store.put(key, make_entry(version, value));
+        if (expires_at != 0) {
+            shards[shard].expiries.put(key, encode_deadline(expires_at));
+            shards[shard].wheel.schedule(key, expires_at);
+        }
+        if (this->options.ordered_index) {
+            shards[shard].keys.insert(std::move(key));
+        }
+    };
+    if (lsm) {
+        storage->recover(num_shards, recovered, [this](size_t shard, std::string &&key) {
+            memtable_used += Storage::record_bytes(key.size(), 0);
+            shards[shard].tombstones.put(key, "");
+        });
+    } else if (storage) {
+        storage->recover(num_shards, recovered);
+    }
+
+    // Versions go on from above any recovered, and above the log's end
+    // position: that outgrows the versions handed out, so it also covers
+    // keys whose records were deleted or flushed to disk and never replayed
+    uint64_t clock = std::max(LEGACY_VERSION, durable_lsn());
+    for (size_t i = 0; i < num_shards; i++) {
+        clock = std::max(clock, shards[i].clock);
+    }
+    for (size_t i = 0; i < num_shards; i++) {
+        shards[i].clock = clock;
+    }
+
+    // If more came back than the cap allows (it may have been lowered),
+    // every shard is cut down to its share
+    uint64_t seq = 0;
+    for (size_t i = 0; i < num_shards; i++) {
+        account(shards[i]);
+    }
+    if (this->options.max_memory_bytes > 0) {
+        for (size_t i = 0; i < num_shards; i++) {
+            evict(shards[i], {}, this->options.max_memory_bytes / num_shards, seq);
+        }
+        wait_durable(seq);
+    }
+
+    maintainer = std::thread(&KVStore::maintenance_loop, this);
+}
+
+KVStore::~KVStore() {
+    if (replication) {
+        replication->stop();
+    }
+    {
+        std::lock_guard<std::mutex> lock(maint_mtx);
+        maint_stopping = true;
+    }
+    maint_cv.notify_all();
+    maintainer.join();
+}
+
+size_t KVStore::shard_index(const std::string &key) const {
+    return std::hash<std::string>{}(key) % num_shards;
+}
+
+KVStore::Shard &KVStore::shard_for(const std::string &key) {
+    return shards[shard_index(key)];
+}
+
+// Take the write locks of several shards, always in index order so that two
+// batches can never deadlock on each other
+std::vector<std::unique_lock<std::shared_mutex>> KVStore::lock_shards(std::vector<size_t> indices) {
+    std::sort(indices.begin(), indices.end());
+    indices.erase(std::unique(indices.begin(), indices.end()), indices.end());
+    std::vector<std::unique_lock<std::shared_mutex>> locks;
+    locks.reserve(indices.size());
+    for (size_t i : indices) {
+        locks.push_back(write_lock(shards[i]));
+    }
+    return locks;
+}
+
+// Shard locks for the request paths. Only a lock that is taken already is
+// timed, so the uncontended case costs a try_lock and no clock reads.
+std::unique_lock<std::shared_mutex> KVStore::write_lock(const Shard &shard) const {
+    std::unique_lock<std::shared_mutex> lock(shard.mtx, std::try_to_lock);
+    if (!lock.owns_lock()) {
+        auto start = std::chrono::steady_clock::now();
+        lock.lock();
+        lock_wait_histogram.record(std::chrono::steady_clock::now() - start);
+    }
+    return lock;
+}
+
+std::shared_lock<std::shared_mutex> KVStore::read_lock(const Shard &shard) const {
+    std::shared_lock<std::shared_mutex> lock(shard.mtx, std::try_to_lock);
+    if (!lock.owns_lock()) {
+        auto start = std::chrono::steady_clock::now();
+        lock.lock();
+        lock_wait_histogram.record(std::chrono::steady_clock::now() - start);
+    }
+    return lock;
+}
+
+bool KVStore::put(const std::string &key, const std::string &value, std::chrono::milliseconds ttl) {
+    uint64_t seq;
+    if (!put_nowait(key, value, seq, ttl)) {
         return false;
     }
-    
-    std::lock_guard<std::mutex> lock(mtx);
-    store[key] = value;
-    storage.append(key, value);
+    wait_durable(seq);
+    return true;
+}
+
+bool KVStore::put_nowait(const std::string &key, const std::string &value, uint64_t &seq,
+                         std::chrono::milliseconds ttl) {
+    if (key.empty() || ttl.count() < 0) {
+        return false;
+    }
+    uint64_t expires_at = ttl.count() > 0 ? unix_now_ms() + ttl.count() : 0;
+
+    // Queue the record under the shard lock so log order matches map order
+    // for this key; the fsync is waited for after releasing it
+    Shard &shard = shard_for(key);
+    bool needs_defrag;
+    {
+        auto lock = write_lock(shard);
+        uint64_t version = ++shard.clock;
+        seq = log_put(key, value, expires_at, version);
+        apply_put(shard, key, value, expires_at, version);
+        if (options.max_memory_bytes > 0 && memory_in_use > options.max_memory_bytes) {
+            evict(shard, key, 0, seq);
+        }
+        needs_defrag = fragmented(shard);
+    }
+    maybe_maintain(needs_defrag);
     return true;
 }
 
 bool KVStore::get(const std::string &key, std::string &val) {
-    std::lock_guard<std::mutex> lock(mtx);
-    auto it = store.find(key);
-    if (it != store.end()) {
-        val = it->second;
+    uint64_t version;
+    return get(key, val, version);
+}
+
+bool KVStore::get(const std::string &key, std::string &val, uint64_t &version) {
+    Shard &shard = shard_for(key);
+    SSTable::Lookup found;
+    bool expired_entry = false;
+    {
+        auto lock = read_lock(shard);
+        found = memtable_get(shard, key, val, &expired_entry, &version);
+    }
+
+    // The first reader to find an entry expired removes it. The write lock
+    // was not held in between, so the entry may have been rewritten since.
+    if (expired_entry) {
+        auto lock = write_lock(shard);
+        expired_entry = false;
+        found = memtable_get(shard, key, val, &expired_entry, &version);
+        if (expired_entry) {
+            apply_remove(shard, key);
+            expired++;
+        }
+    }
+
+    // The disk is read without the shard lock. A flush that completes in
+    // between only adds newer files, and frozen memtables are dropped only
+    // after their file is visible, so nothing can be missed.
+    if (found == SSTable::Lookup::Missing && lsm) {
+        found = disk_get(key, val, &version);
+    }
+    return found == SSTable::Lookup::Found;
+}
+
+bool KVStore::compare_and_set(const std::string &key, uint64_t expected_version, const std::string &value,
+                              uint64_t &version) {
+    uint64_t seq;
+    if (!compare_and_set_nowait(key, expected_version, value, version, seq)) {
+        return false;
+    }
+    wait_durable(seq);
+    return true;
+}
+
+bool KVStore::compare_and_set_nowait(const std::string &key, uint64_t expected_version, const std::string &value,
+                                     uint64_t &version, uint64_t &seq) {
+    return read_modify_write(key, false, version, seq,
+                             [&](std::string *, uint64_t current_version, std::string &next) {
+                                 if (current_version != expected_version) {
+                                     return false;
+                                 }
+                                 next = value;
+                                 return true;
+                             });
+}
+
+bool KVStore::increment(const std::string &key, int64_t delta, int64_t &result) {
+    uint64_t seq;
+    if (!increment_nowait(key, delta, result, seq)) {
+        return false;
+    }
+    wait_durable(seq);
+    return true;
+}
+
+bool KVStore::increment_nowait(const std::string &key, int64_t delta, int64_t &result, uint64_t &seq) {
+    uint64_t version;
+    return read_modify_write(key, true, version, seq, [&](std::string *current, uint64_t, std::string &next) {
+        int64_t n = 0;
+        if (current && !parse_integer(*current, n)) {
+            return false;
+        }
+        if (__builtin_add_overflow(n, delta, &result)) {
+            return false;
+        }
+        next = std::to_string(result);
         return true;
+    });
+}
+
+bool KVStore::append(const std::string &key, const std::string &suffix, size_t &length) {
+    uint64_t seq;
+    if (!append_nowait(key, suffix, length, seq)) {
+        return false;
+    }
+    wait_durable(seq);
+    return true;
+}
+
+bool KVStore::append_nowait(const std::string &key, const std::string &suffix, size_t &length, uint64_t &seq) {
+    uint64_t version;
+    return read_modify_write(key, true, version, seq, [&](std::string *current, uint64_t, std::string &next) {
+        if (current) {
+            next = std::move(*current);
+        }
+        next += suffix;
+        length = next.size();
+        return true;
+    });
+}
+
+// Read key's value and version and write back what modify makes of them,
+// all under the shard's write lock, so no other write to the key can come
+// in between. modify gets the current value, which it may move from, or
+// null for a key that does not exist (version 0), and returns false to leave the key as it is; version is then the current
+// one, and otherwise the new one. keep_deadline carries an expiry over to
+// the new value; without it the write clears it, as put() does. With the
+// Lsm engine this reads the disk under the lock, like exists().
+bool KVStore::read_modify_write(const std::string &key, bool keep_deadline, uint64_t &version, uint64_t &seq,
+                                const Modify &modify) {
+    seq = 0;
+    version = 0;
+    if (key.empty()) {
+        return false;
+    }
+    Shard &shard = shard_for(key);
+    bool needs_defrag;
+    {
+        auto lock = write_lock(shard);
+        std::string current;
+        uint64_t expires_at = 0;
+        SSTable::Lookup found = memtable_get(shard, key, current, nullptr, &version, &expires_at);
+        if (found == SSTable::Lookup::Missing && lsm) {
+            found = disk_get(key, current, &version, &expires_at);
+        }
+        if (found != SSTable::Lookup::Found) {
+            version = 0;
+            expires_at = 0;
+        }
+        std::string next;
+        if (!modify(found == SSTable::Lookup::Found ? &current : nullptr, version, next)) {
+            return false;
+        }
+        if (!keep_deadline) {
+            expires_at = 0;
+        }
+        version = ++shard.clock;
+        seq = log_put(key, next, expires_at, version);
+        apply_put(shard, key, next, expires_at, version);
+        if (options.max_memory_bytes > 0 && memory_in_use > options.max_memory_bytes) {
+            evict(shard, key, 0, seq);
+        }
+        needs_defrag = fragmented(shard);
+    }
+    maybe_maintain(needs_defrag);
+    return true;
+}
+
+// Called with the shard locked. Missing means the disk has to be asked (or,
+// for the Memory engine, that the key does not exist). An expired entry of
+// the live memtable sets *expired; it still hides what is on disk. Found
+// also reports the entry's version and deadline (0 = none) if asked.
+SSTable::Lookup KVStore::memtable_get(const Shard &shard, const std::string &key, std::string &value,
+                                      bool *expired, uint64_t *version, uint64_t *expires_at) const {
+    // In cache mode every hit counts towards the entry's recency or frequency
+    std::string_view found;
+    bool hit = options.max_memory_bytes > 0
+                   ? shard.store.find(key, found, [this](uint32_t access) { return touched(access); })
+                   : shard.store.find(key, found);
+    if (hit) {
+        if (has_expired(shard.expiries, key)) {
+            if (expired) {
+                *expired = true;
+            }
+            return lsm ? SSTable::Lookup::Deleted : SSTable::Lookup::Missing;
+        }
+        return found_entry(found, shard.expiries, key, value, version, expires_at);
+    }
+    if (!lsm) {
+        return SSTable::Lookup::Missing;
+    }
+    if (shard.tombstones.contains(key)) {
+        return SSTable::Lookup::Deleted;
+    }
+    if (shard.frozen) {
+        if (shard.frozen->find(key, found)) {
+            if (has_expired(*shard.frozen_expiries, key)) {
+                return SSTable::Lookup::Deleted;
+            }
+            return found_entry(found, *shard.frozen_expiries, key, value, version, expires_at);
+        }
+        if (shard.frozen_tombstones->contains(key)) {
+            return SSTable::Lookup::Deleted;
+        }
+    }
+    return SSTable::Lookup::Missing;
+}
+
+SSTable::Lookup KVStore::found_entry(std::string_view entry, const CompactTable &expiries, const std::string &key,
+                                     std::string &value, uint64_t *version, uint64_t *expires_at) {
+    value.assign(value_of(entry));
+    if (version) {
+        *version = version_of(entry);
+    }
+    if (expires_at) {
+        *expires_at = deadline_of(expiries, key);
+    }
+    return SSTable::Lookup::Found;
+}
+
+// The Lsm engine's lookup on disk. Entries flushed before there were
+// versions report LEGACY_VERSION.
+SSTable::Lookup KVStore::disk_get(const std::string &key, std::string &value, uint64_t *version,
+                                  uint64_t *expires_at) const {
+    SSTable::Lookup found = lsm->get(key, value, expires_at, version);
+    if (found == SSTable::Lookup::Found && version) {
+        *version = std::max(*version, LEGACY_VERSION);
+    }
+    return found;
+}
+
+// Called with the shard locked. With the LSM engine this may read the disk
+// under the lock, which deletes of cold keys pay for.
+bool KVStore::exists(const Shard &shard, const std::string &key) const {
+    if (!lsm) {
+        return shard.store.contains(key) && !has_expired(shard.expiries, key);
+    }
+    std::string value;
+    SSTable::Lookup found = memtable_get(shard, key, value);
+    if (found == SSTable::Lookup::Missing) {
+        found = disk_get(key, value);
+    }
+    return found == SSTable::Lookup::Found;
+}
+
+// Called with the shard locked, after the write was logged
+void KVStore::apply_put(Shard &shard, const std::string &key, std::string_view value, uint64_t expires_at,
+                        uint64_t version) {
+    size_t old_size;
+    bool had_expiry = !shard.expiries.empty() && shard.expiries.erase(key);
+    std::string_view entry = make_entry(version, value);
+    if (!shard.store.put(key, entry, &old_size)) {
+        shard.live_bytes -= put_bytes(key.size(), old_size, had_expiry);
+    } else if (options.ordered_index) {
+        shard.keys.insert(key);
+    }
+    shard.live_bytes += put_bytes(key.size(), entry.size(), expires_at != 0);
+    if (expires_at != 0) {
+        shard.expiries.put(key, encode_deadline(expires_at));
+        shard.wheel.schedule(key, expires_at);
+    }
+    if (lsm) {
+        shard.tombstones.erase(key);
+        memtable_used += put_bytes(key.size(), entry.size(), expires_at != 0);
+    }
+    if (options.max_memory_bytes > 0) {
+        std::string_view written;
+        shard.store.find(key, written, [this](uint32_t access) { return touched(access); });
+    }
+    account(shard);
+}
+
+// Also how an expired key is dropped, without a log record of its own:
+// replay treats a put whose deadline has passed as a delete
+void KVStore::apply_remove(Shard &shard, const std::string &key) {
+    size_t old_size = 0;
+    bool had_expiry = !shard.expiries.empty() && shard.expiries.erase(key);
+    if (shard.store.erase(key, &old_size)) {
+        shard.live_bytes -= put_bytes(key.size(), old_size, had_expiry);
+    }
+    if (options.ordered_index) {
+        shard.keys.erase(key);
+    }
+    if (lsm) {
+        shard.tombstones.put(key, "");
+        memtable_used += Storage::record_bytes(key.size(), 0);
+    }
+    account(shard);
+}
+
+// The access word of an entry that was just read or written
+uint32_t KVStore::touched(uint32_t access) const {
+    if (options.eviction_policy == EvictionPolicy::Lru) {
+        return eviction::lru_clock();
+    }
+    return eviction::lfu_touch(access, eviction::lfu_minutes(), thread_random());
+}
+
+// Called with the shard locked after its tables changed: bring its part of
+// memory_in_use up to date
+void KVStore::account(Shard &shard) {
+    size_t bytes = shard.store.live_bytes() + shard.tombstones.live_bytes() + shard.expiries.live_bytes();
+    if (shard.frozen) {
+        bytes += shard.frozen->live_bytes() + shard.frozen_tombstones->live_bytes() +
+                 shard.frozen_expiries->live_bytes();
+    }
+    memory_in_use += bytes - shard.memory; // wraps around correctly when it shrank
+    shard.memory = bytes;
+}
+
+// Called with the shard locked while the store is over max_memory_bytes:
+// evict the worst of a few sampled entries at a time until it is back
+// under, or this shard is down to target bytes. Keys are spread evenly by
+// hash, so evicting from whichever shard is being written keeps them even.
+// The key just written is spared. Each eviction is logged, and replicated,
+// as a delete so a restart does not bring the key back; seq covers it.
+void KVStore::evict(Shard &shard, std::string_view keep, size_t target, uint64_t &seq) {
+    uint32_t now_ms = eviction::lru_clock();
+    uint32_t now_minutes = eviction::lfu_minutes();
+    std::string victim;
+    while (memory_in_use > options.max_memory_bytes && shard.memory > target) {
+        bool found = false;
+        uint64_t worst = 0;
+        shard.store.sample(options.eviction_samples, thread_random(), [&](std::string_view key, uint32_t access) {
+            uint64_t score = eviction::score(options.eviction_policy, access, now_ms, now_minutes);
+            if (key != keep && (!found || score > worst)) {
+                victim.assign(key);
+                worst = score;
+                found = true;
+            }
+        });
+        if (!found) {
+            break;
+        }
+        seq = std::max(seq, log_remove(victim));
+        apply_remove(shard, victim);
+        evicted++;
     }
-    return false;
 }
 
 bool KVStore::remove(const std::string &key) {
-    std::lock_guard<std::mutex> lock(mtx);
-    auto it = store.find(key);
-    if (it != store.end()) {
-        store.erase(it);
-        storage.remove(key);
+    uint64_t seq;
+    if (!remove_nowait(key, seq)) {
+        return false;
+    }
+    wait_durable(seq);
+    return true;
+}
+
+bool KVStore::remove_nowait(const std::string &key, uint64_t &seq) {
+    Shard &shard = shard_for(key);
+    bool needs_defrag;
+    {
+        auto lock = write_lock(shard);
+        if (!exists(shard, key)) {
+            return false;
+        }
+        seq = log_remove(key);
+        apply_remove(shard, key);
+        needs_defrag = fragmented(shard);
+    }
+    maybe_maintain(needs_defrag);
+    return true;
+}
+
+// Queue a write's log record, then hand it to followers when leading; called
+// under the shard lock. Returns 0 without persistence.
+uint64_t KVStore::log_put(const std::string &key, const std::string &value, uint64_t expires_at,
+                          uint64_t version) {
+    uint64_t seq = storage ? storage->enqueue_append(key, value, expires_at, version) : 0;
+    if (replication) {
+        std::string record;
+        Storage::encode_put(record, key, value, expires_at, version);
+        replication->append(record);
+    }
+    return seq;
+}
+
+uint64_t KVStore::log_remove(const std::string &key) {
+    uint64_t seq = storage ? storage->enqueue_remove(key) : 0;
+    if (replication) {
+        std::string record;
+        Storage::encode_remove(record, key);
+        replication->append(record);
+    }
+    return seq;
+}
+
+uint64_t KVStore::log_batch(const WriteBatch &batch) {
+    uint64_t seq = storage ? storage->enqueue_batch(batch) : 0;
+    if (replication) {
+        std::string record;
+        Storage::encode_batch(record, batch);
+        replication->append(record);
+    }
+    return seq;
+}
+
+// seq is 0 if nothing was logged, which is always the case without persistence
+void KVStore::wait_durable(uint64_t seq) {
+    if (storage && seq != 0) {
+        storage->wait_durable(seq);
+    }
+}
+
+void KVStore::wait_durable(uint64_t seq, Durability level) {
+    if (storage && seq != 0) {
+        storage->wait_durable(seq, level);
+    }
+}
+
+uint64_t KVStore::durable_lsn() const {
+    return storage ? storage->durable_lsn() : 0;
+}
+
+Durability KVStore::durability() const {
+    return storage ? options.storage.durability : Durability::None;
+}
+
+bool KVStore::multi_put(const std::vector<std::pair<std::string, std::string>> &items) {
+    uint64_t seq;
+    if (!multi_put_nowait(items, seq)) {
+        return false;
+    }
+    wait_durable(seq);
+    return true;
+}
+
+bool KVStore::multi_put_nowait(const std::vector<std::pair<std::string, std::string>> &items, uint64_t &seq) {
+    seq = 0;
+    std::vector<size_t> touched;
+    touched.reserve(items.size());
+    for (const auto &kv : items) {
+        if (kv.first.empty()) {
+            return false;
+        }
+        touched.push_back(shard_index(kv.first));
+    }
+    if (items.empty()) {
         return true;
     }
-    return false;
+
+    // The batch is encoded under the locks, where the versions are handed out
+    bool needs_defrag = false;
+    {
+        auto locks = lock_shards(touched);
+        WriteBatch batch;
+        std::vector<uint64_t> versions(items.size());
+        for (size_t i = 0; i < items.size(); i++) {
+            versions[i] = ++shards[touched[i]].clock;
+            batch.put(items[i].first, items[i].second, 0, versions[i]);
+        }
+        seq = log_batch(batch);
+        for (size_t i = 0; i < items.size(); i++) {
+            apply_put(shards[touched[i]], items[i].first, items[i].second, 0, versions[i]);
+        }
+        if (options.max_memory_bytes > 0) {
+            for (size_t i = 0; i < items.size() && memory_in_use > options.max_memory_bytes; i++) {
+                evict(shards[touched[i]], items[i].first, 0, seq);
+            }
+        }
+        for (size_t i : touched) {
+            needs_defrag = needs_defrag || fragmented(shards[i]);
+        }
+    }
+    maybe_maintain(needs_defrag);
+    return true;
+}
+
+std::vector<std::optional<std::string>> KVStore::multi_get(const std::vector<std::string> &keys) {
+    // Visit the keys grouped by shard so each shard's read lock is taken once
+    std::vector<std::pair<size_t, size_t>> order; // (shard, position in keys)
+    order.reserve(keys.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+        order.emplace_back(shard_index(keys[i]), i);
+    }
+    std::sort(order.begin(), order.end());
+
+    std::vector<std::optional<std::string>> values(keys.size());
+    std::vector<size_t> on_disk;
+    std::string value;
+    for (size_t i = 0; i < order.size();) {
+        Shard &shard = shards[order[i].first];
+        auto lock = read_lock(shard);
+        for (size_t shard_id = order[i].first; i < order.size() && order[i].first == shard_id; i++) {
+            switch (memtable_get(shard, keys[order[i].second], value)) {
+            case SSTable::Lookup::Found:
+                values[order[i].second] = std::move(value);
+                break;
+            case SSTable::Lookup::Missing:
+                on_disk.push_back(order[i].second);
+                break;
+            case SSTable::Lookup::Deleted:
+                break;
+            }
+        }
+    }
+
+    // As in get(), the disk is read without holding any shard lock
+    if (lsm) {
+        for (size_t i : on_disk) {
+            if (disk_get(keys[i], value) == SSTable::Lookup::Found) {
+                values[i] = std::move(value);
+            }
+        }
+    }
+    return values;
+}
+
+size_t KVStore::multi_remove(const std::vector<std::string> &keys) {
+    uint64_t seq;
+    size_t removed = multi_remove_nowait(keys, seq);
+    wait_durable(seq);
+    return removed;
+}
+
+size_t KVStore::multi_remove_nowait(const std::vector<std::string> &keys, uint64_t &seq) {
+    seq = 0;
+    std::vector<size_t> touched;
+    touched.reserve(keys.size());
+    for (const auto &key : keys) {
+        touched.push_back(shard_index(key));
+    }
+
+    size_t removed = 0;
+    bool needs_defrag = false;
+    {
+        auto locks = lock_shards(touched);
+
+        // Only keys that exist get a tombstone, and each only once
+        WriteBatch batch;
+        std::vector<size_t> doomed;
+        std::unordered_set<std::string_view> seen;
+        for (size_t i = 0; i < keys.size(); i++) {
+            if (keys[i].empty() || !seen.insert(keys[i]).second) {
+                continue;
+            }
+            if (exists(shards[touched[i]], keys[i])) {
+                batch.remove(keys[i]);
+                doomed.push_back(i);
+            }
+        }
+        if (batch.empty()) {
+            return 0;
+        }
+
+        seq = log_batch(batch);
+        for (size_t i : doomed) {
+            Shard &shard = shards[touched[i]];
+            apply_remove(shard, keys[i]);
+            needs_defrag = needs_defrag || fragmented(shard);
+        }
+        removed = doomed.size();
+    }
+    maybe_maintain(needs_defrag);
+    return removed;
+}
+
+std::vector<std::pair<std::string, std::string>> KVStore::scan(const std::string &start, const std::string &end,
+                                                               size_t limit) {
+    // Keys are spread over the shards by hash, so every shard has to be
+    // asked for its first entries in range and the answers merged. Once
+    // limit entries are in hand, the largest of them bounds the rest of the
+    // search; no other shard can hold that same key.
+    std::vector<std::pair<std::string, std::string>> result;
+    if (lsm) {
+        LsmTree::Overlay overlay;
+        for (size_t i = 0; i < num_shards; i++) {
+            memtable_range(shards[i], start, end, limit, overlay);
+        }
+        std::sort(overlay.begin(), overlay.end(), [](const auto &a, const auto &b) { return a.first < b.first; });
+        lsm->scan(start, end, limit, overlay, result);
+        return result;
+    }
+
+    std::string bound = end;
+    auto by_key = [](const auto &a, const auto &b) { return a.first < b.first; };
+    for (size_t i = 0; i < num_shards; i++) {
+        size_t merged = result.size();
+        scan_shard(shards[i], start, bound, limit, result);
+        std::inplace_merge(result.begin(), result.begin() + merged, result.end(), by_key);
+        if (limit > 0 && result.size() >= limit) {
+            result.resize(limit);
+            bound = result.back().first;
+        }
+    }
+    return result;
+}
+
+std::vector<std::pair<std::string, std::string>> KVStore::prefix_scan(const std::string &prefix, size_t limit) {
+    return scan(prefix, prefix_end(prefix), limit);
+}
+
+// Append the first limit entries of one shard in [start, end) to out, sorted
+void KVStore::scan_shard(const Shard &shard, const std::string &start, const std::string &end, size_t limit,
+                         std::vector<std::pair<std::string, std::string>> &out) const {
+    auto lock = read_lock(shard);
+    uint64_t now = unix_now_ms();
+    auto live = [&](std::string_view key) { return !is_expired(deadline_of(shard.expiries, key), now); };
+    if (options.ordered_index) {
+        size_t taken = 0;
+        for (auto it = shard.keys.lower_bound(start); it != shard.keys.end(); ++it) {
+            if ((!end.empty() && *it >= end) || (limit > 0 && taken == limit)) {
+                break;
+            }
+            if (!live(*it)) {
+                continue;
+            }
+            std::string_view entry;
+            shard.store.find(*it, entry);
+            out.emplace_back(*it, value_of(entry));
+            taken++;
+        }
+        return;
+    }
+
+    // Without the index every entry of the shard has to be looked at
+    std::vector<std::pair<std::string_view, std::string_view>> hits;
+    shard.store.for_each([&](std::string_view key, std::string_view entry) {
+        if (key >= start && (end.empty() || key < end) && live(key)) {
+            hits.emplace_back(key, value_of(entry));
+        }
+    });
+    size_t keep = limit > 0 ? std::min(limit, hits.size()) : hits.size();
+    std::partial_sort(hits.begin(), hits.begin() + keep, hits.end(),
+                      [](const auto &a, const auto &b) { return a.first < b.first; });
+    for (size_t i = 0; i < keep; i++) {
+        out.emplace_back(hits[i].first, hits[i].second);
+    }
+}
+
+// Collect a shard's memtable entries in [start, end), tombstones included,
+// sorted and cut off after the limit-th live one: the memtables are newer
+// than anything on disk, so no entry past that point can make the result.
+// Expired entries count as tombstones.
+void KVStore::memtable_range(const Shard &shard, const std::string &start, const std::string &end, size_t limit,
+                             LsmTree::Overlay &out) const {
+    auto in_range = [&](std::string_view key) { return key >= start && (end.empty() || key < end); };
+    uint64_t now = unix_now_ms();
+    LsmTree::Overlay entries;
+    auto add_put = [&](const CompactTable &expiries, std::string_view key, std::string_view entry) {
+        if (is_expired(deadline_of(expiries, key), now)) {
+            entries.emplace_back(key, std::nullopt);
+        } else {
+            entries.emplace_back(key, value_of(entry));
+        }
+    };
+    auto lock = read_lock(shard);
+    shard.store.for_each([&](std::string_view key, std::string_view value) {
+        if (in_range(key)) {
+            add_put(shard.expiries, key, value);
+        }
+    });
+    shard.tombstones.for_each([&](std::string_view key, std::string_view) {
+        if (in_range(key)) {
+            entries.emplace_back(key, std::nullopt);
+        }
+    });
+    if (shard.frozen) {
+        // Only what the live memtable does not override
+        shard.frozen->for_each([&](std::string_view key, std::string_view value) {
+            if (in_range(key) && !shard.store.contains(key) && !shard.tombstones.contains(key)) {
+                add_put(*shard.frozen_expiries, key, value);
+            }
+        });
+        shard.frozen_tombstones->for_each([&](std::string_view key, std::string_view) {
+            if (in_range(key) && !shard.store.contains(key) && !shard.tombstones.contains(key)) {
+                entries.emplace_back(key, std::nullopt);
+            }
+        });
+    }
+    lock.unlock();
+
+    std::sort(entries.begin(), entries.end(), [](const auto &a, const auto &b) { return a.first < b.first; });
+    size_t live = 0;
+    for (auto &entry : entries) {
+        bool deleted = !entry.second;
+        out.push_back(std::move(entry));
+        if (!deleted && limit > 0 && ++live == limit) {
+            break;
+        }
+    }
+}
+
+// Freeze every shard's memtable at one log position, write the frozen
+// tables out as a level-0 SSTable, then drop them and the log they came
+// from. Writers only wait while the log is sealed and the tables swapped.
+void KVStore::flush_memtables() {
+    if (!flush_pending) {
+        std::vector<size_t> all(num_shards);
+        std::iota(all.begin(), all.end(), 0);
+        auto locks = lock_shards(all);
+        flush_tail = storage->rotate(flush_sealed);
+        for (size_t i = 0; i < num_shards; i++) {
+            shards[i].frozen = std::make_unique<CompactTable>();
+            shards[i].frozen_tombstones = std::make_unique<CompactTable>();
+            shards[i].frozen_expiries = std::make_unique<CompactTable>();
+            std::swap(*shards[i].frozen, shards[i].store);
+            std::swap(*shards[i].frozen_tombstones, shards[i].tombstones);
+            std::swap(*shards[i].frozen_expiries, shards[i].expiries);
+            shards[i].live_bytes = 0;
+            account(shards[i]);
+        }
+        memtable_used = 0;
+        flush_pending = true;
+    }
+
+    // Frozen tables are never modified, so they can be read without the
+    // shard locks; a key is in at most one of a shard's two tables. Deadlines
+    // go along to the SSTable, which drops the entry once it has passed.
+    std::vector<LsmTree::Entry> entries;
+    for (size_t i = 0; i < num_shards; i++) {
+        const CompactTable &expiries = *shards[i].frozen_expiries;
+        shards[i].frozen->for_each([&](std::string_view key, std::string_view entry) {
+            entries.push_back({key, value_of(entry), false, deadline_of(expiries, key), version_of(entry)});
+        });
+        shards[i].frozen_tombstones->for_each([&](std::string_view key, std::string_view) {
+            entries.push_back({key, std::string_view(), true});
+        });
+    }
+    std::sort(entries.begin(), entries.end(), [](const auto &a, const auto &b) { return a.key < b.key; });
+    lsm->flush(entries);
+
+    for (size_t i = 0; i < num_shards; i++) {
+        std::unique_lock<std::shared_mutex> lock(shards[i].mtx);
+        shards[i].frozen.reset();
+        shards[i].frozen_tombstones.reset();
+        shards[i].frozen_expiries.reset();
+        account(shards[i]);
+    }
+    flush_pending = false;
+    storage->truncate(flush_tail, flush_sealed);
 }
 
 void KVStore::persist() {
-    std::lock_guard<std::mutex> lock(mtx);
-    storage.compact();
-}
\ No newline at end of file
+    if (!storage) {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(maint_mtx);
+    uint64_t generation = ++compact_requested;
+    maint_cv.notify_all();
+    maint_cv.wait(lock, [&] { return compact_completed >= generation; });
+    if (!compact_error.empty()) {
+        throw std::runtime_error(compact_error);
+    }
+}
+
+void KVStore::checkpoint() {
+    if (!storage) {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(maint_mtx);
+    uint64_t generation = ++checkpoint_requested;
+    maint_cv.notify_all();
+    maint_cv.wait(lock, [&] { return checkpoint_completed >= generation; });
+    if (!checkpoint_error.empty()) {
+        throw std::runtime_error(checkpoint_error);
+    }
+}
+
+double KVStore::garbage_ratio() const {
+    uint64_t disk = storage ? storage->log_bytes() : 0;
+    if (disk == 0) {
+        return 0.0;
+    }
+    uint64_t live = 0;
+    for (size_t i = 0; i < num_shards; i++) {
+        live += shards[i].live_bytes.load(std::memory_order_relaxed);
+    }
+    return live >= disk ? 0.0 : 1.0 - static_cast<double>(live) / disk;
+}
+
+size_t KVStore::memory_bytes() const {
+    size_t total = 0;
+    for (size_t i = 0; i < num_shards; i++) {
+        std::shared_lock<std::shared_mutex> lock(shards[i].mtx);
+        total += shards[i].store.memory_bytes() + shards[i].tombstones.memory_bytes() +
+                 shards[i].expiries.memory_bytes();
+        if (shards[i].frozen) {
+            total += shards[i].frozen->memory_bytes() + shards[i].frozen_tombstones->memory_bytes() +
+                     shards[i].frozen_expiries->memory_bytes();
+        }
+    }
+    return total;
+}
+
+LsmStats KVStore::lsm_stats() const {
+    return lsm ? lsm->stats() : LsmStats();
+}
+
+// Called with the shard locked
+bool KVStore::fragmented(const Shard &shard) const {
+    size_t garbage = shard.store.garbage_bytes();
+    return options.defrag_garbage_ratio > 0 && garbage >= options.defrag_min_bytes &&
+           garbage >= options.defrag_garbage_ratio * shard.store.memory_bytes();
+}
+
+// Ask the maintenance thread for a checkpoint once enough has been logged
+// since the last one, for a compaction once the log is big enough and
+// mostly garbage, or for a defragmentation pass if a shard's arena is
+void KVStore::maybe_maintain(bool fragmented) {
+    if (fragmented && !defrag_requested.load(std::memory_order_relaxed)) {
+        std::lock_guard<std::mutex> lock(maint_mtx);
+        defrag_requested = true;
+        maint_cv.notify_all();
+    }
+
+    // With the LSM engine a checkpoint is a memtable flush, and the log never
+    // needs compacting since every flush truncates it
+    if (!storage) {
+        return;
+    }
+    bool want_checkpoint = lsm ? memtable_used >= options.memtable_bytes
+                               : options.checkpoint_log_bytes > 0 &&
+                                     storage->tail_bytes() >= options.checkpoint_log_bytes;
+    bool want_compact = !lsm && !want_checkpoint && options.compact_garbage_ratio > 0 &&
+                        storage->log_bytes() >= options.compact_min_bytes &&
+                        garbage_ratio() >= options.compact_garbage_ratio;
+    if (!want_checkpoint && !want_compact) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(maint_mtx);
+    if (compact_requested == compact_completed && checkpoint_requested == checkpoint_completed) {
+        (want_checkpoint ? checkpoint_requested : compact_requested)++;
+        maint_cv.notify_all();
+    }
+}
+
+void KVStore::maintenance_loop() {
+    using Clock = std::chrono::steady_clock;
+    auto pending = [&] {
+        return maint_stopping || compact_requested > compact_completed ||
+               checkpoint_requested > checkpoint_completed || defrag_requested || level_compaction_pending;
+    };
+
+    bool checkpoints = options.checkpoint_interval.count() > 0;
+    bool expiring = options.expiry_interval.count() > 0;
+    std::unique_lock<std::mutex> lock(maint_mtx);
+    auto next_checkpoint = Clock::now() + options.checkpoint_interval;
+    auto next_expiry = Clock::now() + options.expiry_interval;
+    while (true) {
+        if (checkpoints || expiring) {
+            auto wake = !expiring ? next_checkpoint
+                                  : !checkpoints ? next_expiry : std::min(next_checkpoint, next_expiry);
+            maint_cv.wait_until(lock, wake, pending);
+        } else {
+            maint_cv.wait(lock, pending);
+        }
+        if (maint_stopping) {
+            break;
+        }
+
+        // Periodic checkpoints are skipped while nothing is being written
+        auto now = Clock::now();
+        if (checkpoints && now >= next_checkpoint) {
+            next_checkpoint = now + options.checkpoint_interval;
+            if (storage && storage->tail_bytes() > 0 && checkpoint_requested == checkpoint_completed) {
+                checkpoint_requested++;
+            }
+        }
+
+        // Expiry runs between the other jobs, and again straight away while
+        // more keys are due than one pass removes
+        if (expiring && now >= next_expiry) {
+            lock.unlock();
+            bool more = expire_due();
+            lock.lock();
+            next_expiry = more ? Clock::now() : Clock::now() + options.expiry_interval;
+        }
+        if (!pending()) {
+            continue;
+        }
+
+        // Log maintenance goes first, then merging SSTables one step at a
+        // time so a flush is never stuck behind a long compaction; reclaiming
+        // memory can wait
+        if (compact_requested == compact_completed && checkpoint_requested == checkpoint_completed) {
+            if (level_compaction_pending) {
+                lock.unlock();
+                bool more = false;
+                try {
+                    lsm->compact();
+                    more = lsm->needs_compaction();
+                } catch (const std::exception &e) {
+                    std::cerr << "SSTable compaction failed: " << e.what() << "\n";
+                }
+                lock.lock();
+                level_compaction_pending = more;
+                continue;
+            }
+            defrag_requested = false;
+            lock.unlock();
+            defragment();
+            lock.lock();
+            continue;
+        }
+
+        // A checkpoint also leaves a log with no garbage, so it answers any
+        // compaction requested before it started
+        bool checkpointing = checkpoint_requested > checkpoint_completed;
+        uint64_t checkpoint_generation = checkpoint_requested;
+        uint64_t compact_generation = compact_requested;
+        lock.unlock();
+        std::string error;
+        try {
+            auto source = [this](uint64_t, const Storage::Emit &emit) { snapshot(emit); };
+            if (lsm) {
+                flush_memtables();
+            } else if (checkpointing) {
+                storage->checkpoint(source);
+            } else {
+                storage->compact(source);
+            }
+        } catch (const std::exception &e) {
+            error = e.what();
+        }
+        lock.lock();
+
+        if (lsm && error.empty()) {
+            level_compaction_pending = lsm->needs_compaction();
+        }
+        if (checkpointing) {
+            checkpoint_error = error;
+            checkpoint_completed = checkpoint_generation;
+            next_checkpoint = Clock::now() + options.checkpoint_interval;
+        }
+        compact_error = error;
+        compact_completed = compact_generation;
+        maint_cv.notify_all();
+    }
+}
+
+// Remove the keys whose timers fell due, at most expiry_batch per shard and
+// lock hold. A timer only counts if its key still has the deadline it was
+// set for; one for a key since rewritten, deleted or flushed to disk is
+// stale. Returns true if some shard had more due than it could take.
+bool KVStore::expire_due() {
+    bool more = false;
+    std::vector<std::pair<std::string, uint64_t>> due;
+    for (size_t i = 0; i < num_shards; i++) {
+        Shard &shard = shards[i];
+        std::unique_lock<std::shared_mutex> lock(shard.mtx);
+        due.clear();
+        more = shard.wheel.advance(unix_now_ms(), options.expiry_batch, due) || more;
+        for (const auto &timer : due) {
+            if (deadline_of(shard.expiries, timer.first) == timer.second) {
+                apply_remove(shard, timer.first);
+                expired++;
+            }
+        }
+    }
+    return more;
+}
+
+// Evacuate sparse arena slabs one per lock hold, so a writer never waits for
+// more than a single slab's worth of copying
+void KVStore::defragment() {
+    for (size_t i = 0; i < num_shards; i++) {
+        while (true) {
+            std::unique_lock<std::shared_mutex> lock(shards[i].mtx);
+            if (!fragmented(shards[i]) || shards[i].store.defragment(1) == 0) {
+                break;
+            }
+            account(shards[i]);
+        }
+    }
+}
+
+void KVStore::dump(const Storage::Emit &emit) {
+    if (!lsm) {
+        snapshot(emit);
+        return;
+    }
+    // Page through a scan; the memtables' deadlines and versions are looked
+    // up, what is on disk is not
+    std::string start;
+    while (true) {
+        auto page = scan(start, "", 1000);
+        for (const auto &entry : page) {
+            Shard &shard = shard_for(entry.first);
+            uint64_t expires_at;
+            uint64_t version = 0;
+            {
+                std::shared_lock<std::shared_mutex> lock(shard.mtx);
+                expires_at = deadline_of(shard.expiries, entry.first);
+                std::string_view found;
+                if (shard.store.find(entry.first, found)) {
+                    version = version_of(found);
+                }
+            }
+            emit(entry.first, entry.second, expires_at, version);
+        }
+        if (page.size() < 1000) {
+            break;
+        }
+        start = page.back().first + '\0';
+    }
+}
+
+uint64_t KVStore::apply_replicated(const std::vector<Storage::LogOp> &ops) {
+    std::vector<std::string> keys;
+    std::vector<size_t> touched;
+    keys.reserve(ops.size());
+    touched.reserve(ops.size());
+    for (const auto &op : ops) {
+        keys.emplace_back(op.key);
+        touched.push_back(shard_index(keys.back()));
+    }
+
+    uint64_t seq = 0;
+    bool needs_defrag = false;
+    {
+        // Puts keep the leader's versions, and the clocks move past them;
+        // one that came without a version gets one here
+        auto locks = lock_shards(touched);
+        std::vector<uint64_t> versions(ops.size());
+        for (size_t i = 0; i < ops.size(); i++) {
+            uint64_t &clock = shards[touched[i]].clock;
+            if (!ops[i].deleted) {
+                versions[i] = ops[i].version != 0 ? ops[i].version : clock + 1;
+                clock = std::max(clock, versions[i]);
+            }
+        }
+        if (ops.size() == 1) {
+            seq = ops[0].deleted ? log_remove(keys[0])
+                                 : log_put(keys[0], std::string(ops[0].value), ops[0].expires_at, versions[0]);
+        } else if (!ops.empty()) {
+            WriteBatch batch;
+            for (size_t i = 0; i < ops.size(); i++) {
+                if (ops[i].deleted) {
+                    batch.remove(keys[i]);
+                } else {
+                    batch.put(keys[i], std::string(ops[i].value), ops[i].expires_at, versions[i]);
+                }
+            }
+            seq = log_batch(batch);
+        }
+        for (size_t i = 0; i < ops.size(); i++) {
+            Shard &shard = shards[touched[i]];
+            if (ops[i].deleted) {
+                apply_remove(shard, keys[i]);
+            } else {
+                apply_put(shard, keys[i], ops[i].value, ops[i].expires_at, versions[i]);
+            }
+        }
+        if (options.max_memory_bytes > 0) {
+            for (size_t i = 0; i < ops.size() && memory_in_use > options.max_memory_bytes; i++) {
+                evict(shards[touched[i]], keys[i], 0, seq);
+            }
+        }
+        for (size_t i : touched) {
+            needs_defrag = needs_defrag || fragmented(shards[i]);
+        }
+    }
+    maybe_maintain(needs_defrag);
+    return seq;
+}
+
+size_t KVStore::extract(const std::vector<std::string> &keys, std::string &records, uint64_t &seq) {
+    seq = 0;
+    std::vector<size_t> touched;
+    touched.reserve(keys.size());
+    for (const auto &key : keys) {
+        touched.push_back(shard_index(key));
+    }
+
+    size_t moved = 0;
+    bool needs_defrag = false;
+    {
+        auto locks = lock_shards(touched);
+        WriteBatch batch;
+        std::vector<size_t> doomed;
+        std::unordered_set<std::string_view> seen;
+        std::string value;
+        for (size_t i = 0; i < keys.size(); i++) {
+            if (keys[i].empty() || !seen.insert(keys[i]).second) {
+                continue;
+            }
+            // Disk reads under the lock; this is not on any request's path
+            Shard &shard = shards[touched[i]];
+            uint64_t version = 0;
+            SSTable::Lookup found = memtable_get(shard, keys[i], value, nullptr, &version);
+            if (found == SSTable::Lookup::Missing && lsm) {
+                found = disk_get(keys[i], value, &version);
+            }
+            if (found != SSTable::Lookup::Found) {
+                continue;
+            }
+            Storage::encode_put(records, keys[i], value, deadline_of(shard.expiries, keys[i]), version);
+            batch.remove(keys[i]);
+            doomed.push_back(i);
+        }
+        if (batch.empty()) {
+            return 0;
+        }
+
+        seq = log_batch(batch);
+        for (size_t i : doomed) {
+            Shard &shard = shards[touched[i]];
+            apply_remove(shard, keys[i]);
+            needs_defrag = needs_defrag || fragmented(shard);
+        }
+        moved = doomed.size();
+    }
+    maybe_maintain(needs_defrag);
+    return moved;
+}
+
+// Copy one shard at a time under its read lock and write it out unlocked,
+// so writers are never held up for longer than a shard copy. Each shard is
+// emitted as one run sorted by key; Storage leaves out what has expired.
+void KVStore::snapshot(const Storage::Emit &emit) {
+    std::vector<std::tuple<std::string, std::string, uint64_t, uint64_t>> copy;
+    for (size_t i = 0; i < num_shards; i++) {
+        {
+            std::shared_lock<std::shared_mutex> lock(shards[i].mtx);
+            shards[i].store.for_each([&](std::string_view key, std::string_view entry) {
+                copy.emplace_back(key, value_of(entry), deadline_of(shards[i].expiries, key), version_of(entry));
+            });
+        }
+        std::sort(copy.begin(), copy.end());
+        for (const auto &entry : copy) {
+            emit(std::get<0>(entry), std::get<1>(entry), std::get<2>(entry), std::get<3>(entry));
+        }
+        copy.clear();
+    }
+}
+
+StorageStats KVStore::storage_stats() const {
+    return storage ? storage->stats() : StorageStats();
+}
+
+metrics::Histogram::Snapshot KVStore::sync_latency() const {
+    return storage ? storage->sync_latency() : metrics::Histogram::Snapshot();
+}
+
+metrics::Histogram::Snapshot KVStore::lock_waits() const {
+    return lock_wait_histogram.snapshot();
+}
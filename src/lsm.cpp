@@ -0,0 +1,743 @@
+#include "lsm.hpp"
+#include "crc32c.hpp"
+#include "expiry.hpp"
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+namespace
+{
+
+const std::string STORAGE_DIR = "storage";
+
+constexpr size_t MAX_LEVELS = 7;
+
+constexpr char MANIFEST_MAGIC[8] = {'D', 'K', 'V', 'M', 'A', 'N', '0', '1'};
+
+void put_u32(std::string &out, uint32_t v)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        out.push_back(static_cast<char>(v >> (8 * i)));
+    }
+}
+
+void put_u64(std::string &out, uint64_t v)
+{
+    for (int i = 0; i < 8; i++)
+    {
+        out.push_back(static_cast<char>(v >> (8 * i)));
+    }
+}
+
+uint32_t get_u32(const char *p)
+{
+    auto u = reinterpret_cast<const unsigned char *>(p);
+    return uint32_t(u[0]) | (uint32_t(u[1]) << 8) | (uint32_t(u[2]) << 16) | (uint32_t(u[3]) << 24);
+}
+
+uint64_t get_u64(const char *p)
+{
+    return uint64_t(get_u32(p)) | (uint64_t(get_u32(p + 4)) << 32);
+}
+
+void fsync_dir()
+{
+    int dfd = open(STORAGE_DIR.c_str(), O_RDONLY | O_DIRECTORY);
+    if (dfd >= 0)
+    {
+        fsync(dfd);
+        close(dfd);
+    }
+}
+
+// SSTable numbers of the files storage/<name>.NNNNNN.sst
+std::vector<uint64_t> list_tables(const std::string &name)
+{
+    std::vector<uint64_t> numbers;
+    std::string prefix = name + ".";
+    DIR *dir = opendir(STORAGE_DIR.c_str());
+    if (dir == nullptr)
+    {
+        return numbers;
+    }
+    while (dirent *entry = readdir(dir))
+    {
+        std::string file = entry->d_name;
+        if (file.size() <= prefix.size() + 4 || file.compare(0, prefix.size(), prefix) != 0 ||
+            file.compare(file.size() - 4, 4, ".sst") != 0)
+        {
+            continue;
+        }
+        std::string digits = file.substr(prefix.size(), file.size() - prefix.size() - 4);
+        if (digits.find_first_not_of("0123456789") == std::string::npos)
+        {
+            numbers.push_back(std::stoull(digits));
+        }
+    }
+    closedir(dir);
+    return numbers;
+}
+
+// A sorted stream of entries, one source of a merge
+class Cursor
+{
+public:
+    virtual ~Cursor() = default;
+    virtual bool valid() const = 0;
+    virtual std::string_view key() const = 0;
+    virtual std::string_view value() const = 0;
+    virtual bool deleted() const = 0;
+    virtual uint64_t expires_at() const = 0;
+    virtual uint64_t version() const = 0;
+    virtual void next() = 0;
+};
+
+// Walks a run of SSTables with disjoint key ranges, in key order: a single
+// level-0 file, or the files of a deeper level. Blocks read by scans and
+// compactions are not offered to the cache. Entries that expired by now_ms
+// show up as tombstones.
+class TableCursor : public Cursor
+{
+public:
+    TableCursor(std::vector<std::shared_ptr<SSTable>> tables, std::string_view start, uint64_t now_ms)
+        : tables(std::move(tables)), now_ms(now_ms), it(*this->tables.front(), false)
+    {
+        while (table < this->tables.size() && this->tables[table]->largest() < start)
+        {
+            table++;
+        }
+        if (table < this->tables.size())
+        {
+            it = SSTable::Iterator(*this->tables[table], false);
+            it.seek(start);
+            skip_exhausted();
+        }
+    }
+
+    bool valid() const override { return table < tables.size(); }
+    std::string_view key() const override { return it.key(); }
+    std::string_view value() const override { return it.value(); }
+    bool deleted() const override { return it.deleted() || is_expired(it.expires_at(), now_ms); }
+    uint64_t expires_at() const override { return it.expires_at(); }
+    uint64_t version() const override { return it.version(); }
+
+    void next() override
+    {
+        it.next();
+        skip_exhausted();
+    }
+
+private:
+    std::vector<std::shared_ptr<SSTable>> tables;
+    uint64_t now_ms;
+    size_t table = 0;
+    SSTable::Iterator it;
+
+    void skip_exhausted()
+    {
+        while (!it.valid() && ++table < tables.size())
+        {
+            it = SSTable::Iterator(*tables[table], false);
+            it.seek_to_first();
+        }
+    }
+};
+
+class OverlayCursor : public Cursor
+{
+public:
+    OverlayCursor(const LsmTree::Overlay &entries, std::string_view start)
+        : entries(entries),
+          pos(std::lower_bound(entries.begin(), entries.end(), start,
+                               [](const auto &entry, std::string_view k)
+                               { return entry.first < k; }) -
+              entries.begin())
+    {
+    }
+
+    bool valid() const override { return pos < entries.size(); }
+    std::string_view key() const override { return entries[pos].first; }
+    std::string_view value() const override { return entries[pos].second ? *entries[pos].second : std::string_view(); }
+    bool deleted() const override { return !entries[pos].second; }
+    uint64_t expires_at() const override { return 0; }
+    uint64_t version() const override { return 0; }
+    void next() override { pos++; }
+
+private:
+    const LsmTree::Overlay &entries;
+    size_t pos;
+};
+
+// Merges sources given newest first into one stream holding only the newest
+// version of every key
+class MergeCursor
+{
+public:
+    explicit MergeCursor(std::vector<std::unique_ptr<Cursor>> sources)
+        : sources(std::move(sources))
+    {
+        find_smallest();
+    }
+
+    bool valid() const { return current != nullptr; }
+    std::string_view key() const { return current->key(); }
+    std::string_view value() const { return current->value(); }
+    bool deleted() const { return current->deleted(); }
+    uint64_t expires_at() const { return current->expires_at(); }
+    uint64_t version() const { return current->version(); }
+
+    void next()
+    {
+        // Older versions of the same key are skipped along with it
+        std::string key(current->key());
+        for (auto &source : sources)
+        {
+            if (source->valid() && source->key() == key)
+            {
+                source->next();
+            }
+        }
+        find_smallest();
+    }
+
+private:
+    std::vector<std::unique_ptr<Cursor>> sources;
+    Cursor *current = nullptr;
+
+    // On a tie the earlier, newer source wins
+    void find_smallest()
+    {
+        current = nullptr;
+        for (auto &source : sources)
+        {
+            if (source->valid() && (current == nullptr || source->key() < current->key()))
+            {
+                current = source.get();
+            }
+        }
+    }
+};
+
+bool overlaps(const SSTable &table, std::string_view start, std::string_view end)
+{
+    return table.largest() >= start && (end.empty() || table.smallest() < end);
+}
+
+} // namespace
+
+LsmTree::LsmTree(const std::string &filename, const LsmOptions &options)
+    : filename(STORAGE_DIR + "/" + filename), options(options), compact_pointers(MAX_LEVELS)
+{
+    if (options.block_cache_bytes > 0)
+    {
+        cache = std::make_unique<BlockCache>(options.block_cache_bytes);
+    }
+    if (mkdir(STORAGE_DIR.c_str(), 0755) == -1 && errno != EEXIST)
+    {
+        throw std::runtime_error("Failed to create storage directory: " + std::string(strerror(errno)));
+    }
+    load();
+}
+
+std::string LsmTree::table_path(uint64_t number) const
+{
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".%06llu.sst", static_cast<unsigned long long>(number));
+    return filename + suffix;
+}
+
+std::string LsmTree::manifest_path() const
+{
+    return filename + ".manifest";
+}
+
+// Manifest: magic "DKVMAN01" | next_file u64 | count u32 |
+// count x (level u32 | number u64) | crc32c u32 over everything before it
+void LsmTree::load()
+{
+    auto version = std::make_shared<Version>();
+    version->levels.resize(MAX_LEVELS);
+
+    std::string data;
+    int in = open(manifest_path().c_str(), O_RDONLY);
+    if (in >= 0)
+    {
+        char buffer[65536];
+        ssize_t n;
+        while ((n = read(in, buffer, sizeof(buffer))) > 0 || (n < 0 && errno == EINTR))
+        {
+            if (n > 0)
+            {
+                data.append(buffer, n);
+            }
+        }
+        close(in);
+
+        if (data.size() < 24 || memcmp(data.data(), MANIFEST_MAGIC, sizeof(MANIFEST_MAGIC)) != 0 ||
+            crc32c(data.data(), data.size() - 4) != get_u32(data.data() + data.size() - 4) ||
+            data.size() != 24 + 12 * size_t(get_u32(data.data() + 16)))
+        {
+            throw std::runtime_error("Corrupt manifest '" + manifest_path() + "'");
+        }
+        next_file = get_u64(data.data() + 8);
+        uint32_t count = get_u32(data.data() + 16);
+        for (uint32_t i = 0; i < count; i++)
+        {
+            const char *p = data.data() + 20 + 12 * size_t(i);
+            uint32_t level = get_u32(p);
+            uint64_t number = get_u64(p + 4);
+            if (level >= MAX_LEVELS)
+            {
+                throw std::runtime_error("Corrupt manifest '" + manifest_path() + "'");
+            }
+            version->levels[level].push_back(std::make_shared<SSTable>(table_path(number), number, cache.get()));
+        }
+    }
+
+    // Files the manifest does not list were being written, or waiting to be
+    // deleted, when the process stopped
+    std::string name = filename.substr(STORAGE_DIR.size() + 1);
+    for (uint64_t number : list_tables(name))
+    {
+        bool listed = false;
+        for (const auto &level : version->levels)
+        {
+            for (const auto &table : level)
+            {
+                listed = listed || table->number() == number;
+            }
+        }
+        if (!listed)
+        {
+            unlink(table_path(number).c_str());
+        }
+        next_file = std::max(next_file, number + 1);
+    }
+
+    current = version;
+}
+
+void LsmTree::write_manifest(const Version &version, uint64_t next)
+{
+    std::string data(MANIFEST_MAGIC, sizeof(MANIFEST_MAGIC));
+    put_u64(data, next);
+    size_t count_pos = data.size();
+    put_u32(data, 0);
+    uint32_t count = 0;
+    for (size_t level = 0; level < version.levels.size(); level++)
+    {
+        for (const auto &table : version.levels[level])
+        {
+            put_u32(data, static_cast<uint32_t>(level));
+            put_u64(data, table->number());
+            count++;
+        }
+    }
+    for (int i = 0; i < 4; i++)
+    {
+        data[count_pos + i] = static_cast<char>(count >> (8 * i));
+    }
+    put_u32(data, crc32c(data.data(), data.size()));
+
+    // Written to a temp file and renamed over the old one, so a crash
+    // leaves either the old layout or the new one
+    std::string tmp = manifest_path() + ".tmp";
+    int out = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0)
+    {
+        throw std::runtime_error("Failed to create '" + tmp + "': " + std::string(strerror(errno)));
+    }
+    const char *p = data.data();
+    size_t left = data.size();
+    while (left > 0)
+    {
+        ssize_t n = write(out, p, left);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n < 0)
+        {
+            close(out);
+            throw std::runtime_error("Failed to write '" + tmp + "': " + std::string(strerror(errno)));
+        }
+        p += n;
+        left -= n;
+    }
+    if (fsync(out) < 0)
+    {
+        close(out);
+        throw std::runtime_error("Failed to sync '" + tmp + "': " + std::string(strerror(errno)));
+    }
+    close(out);
+    if (rename(tmp.c_str(), manifest_path().c_str()) < 0)
+    {
+        throw std::runtime_error("Failed to rename '" + tmp + "': " + std::string(strerror(errno)));
+    }
+    fsync_dir();
+}
+
+std::shared_ptr<const LsmTree::Version> LsmTree::version() const
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    return current;
+}
+
+uint64_t LsmTree::new_file_number()
+{
+    std::lock_guard<std::mutex> lock(install_mtx);
+    return next_file++;
+}
+
+uint64_t LsmTree::level_limit(size_t level) const
+{
+    uint64_t limit = options.level1_bytes;
+    for (size_t i = 1; i < level; i++)
+    {
+        limit *= options.level_multiplier;
+    }
+    return limit;
+}
+
+// Swap removed for added (added goes to level) in a new version, make it
+// durable in the manifest and publish it. Flushes and compactions may
+// finish in any order: each only touches its own files.
+void LsmTree::install(const std::vector<std::shared_ptr<SSTable>> &removed, size_t level,
+                      const std::vector<std::shared_ptr<SSTable>> &added)
+{
+    std::lock_guard<std::mutex> lock(install_mtx);
+    auto next = std::make_shared<Version>(*version());
+    for (auto &files : next->levels)
+    {
+        files.erase(std::remove_if(files.begin(), files.end(), [&](const std::shared_ptr<SSTable> &table)
+                                   { return std::find(removed.begin(), removed.end(), table) != removed.end(); }),
+                    files.end());
+    }
+
+    Level &target = next->levels[level];
+    if (level == 0)
+    {
+        // Level 0 is searched newest first
+        target.insert(target.begin(), added.rbegin(), added.rend());
+    }
+    else
+    {
+        target.insert(target.end(), added.begin(), added.end());
+        std::sort(target.begin(), target.end(), [](const auto &a, const auto &b)
+                  { return a->smallest() < b->smallest(); });
+    }
+
+    fsync_dir(); // the new files' directory entries go before the manifest naming them
+    write_manifest(*next, next_file);
+    for (const auto &table : removed)
+    {
+        table->mark_obsolete();
+    }
+
+    std::lock_guard<std::mutex> publish(mtx);
+    current = next;
+}
+
+SSTable::Lookup LsmTree::get(std::string_view key, std::string &value, uint64_t *entry_expires_at,
+                             uint64_t *entry_version) const
+{
+    auto v = version();
+    uint64_t now = unix_now_ms();
+    auto lookup = [&](const SSTable &table)
+    {
+        uint64_t expires_at = 0;
+        SSTable::Lookup found = table.get(key, value, &expires_at, entry_version);
+        if (found == SSTable::Lookup::Found && entry_expires_at)
+        {
+            *entry_expires_at = expires_at;
+        }
+        return found == SSTable::Lookup::Found && is_expired(expires_at, now) ? SSTable::Lookup::Deleted : found;
+    };
+
+    // Level-0 files overlap, so each is checked, newest first
+    for (const auto &table : v->levels[0])
+    {
+        SSTable::Lookup found = lookup(*table);
+        if (found != SSTable::Lookup::Missing)
+        {
+            return found;
+        }
+    }
+
+    // Deeper levels have at most one file whose range holds the key
+    for (size_t level = 1; level < v->levels.size(); level++)
+    {
+        const Level &files = v->levels[level];
+        auto it = std::lower_bound(files.begin(), files.end(), key, [](const auto &table, std::string_view k)
+                                   { return table->largest() < k; });
+        if (it == files.end())
+        {
+            continue;
+        }
+        SSTable::Lookup found = lookup(**it);
+        if (found != SSTable::Lookup::Missing)
+        {
+            return found;
+        }
+    }
+    return SSTable::Lookup::Missing;
+}
+
+void LsmTree::flush(const std::vector<Entry> &entries)
+{
+    if (entries.empty())
+    {
+        return;
+    }
+    uint64_t number = new_file_number();
+    SSTableWriter writer(table_path(number), options.block_bytes, options.bloom_bits_per_key);
+    for (const auto &entry : entries)
+    {
+        writer.add(entry.key, entry.value, entry.deleted, entry.expires_at, entry.version);
+    }
+    writer.finish();
+    install({}, 0, {std::make_shared<SSTable>(table_path(number), number, cache.get())});
+    stat_flushes++;
+}
+
+bool LsmTree::needs_compaction() const
+{
+    auto v = version();
+    if (v->levels[0].size() >= options.level0_files)
+    {
+        return true;
+    }
+    for (size_t level = 1; level + 1 < v->levels.size(); level++)
+    {
+        uint64_t bytes = 0;
+        for (const auto &table : v->levels[level])
+        {
+            bytes += table->file_bytes();
+        }
+        if (bytes > level_limit(level))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool LsmTree::compact()
+{
+    auto v = version();
+
+    // Pick the inputs: all of level 0 once it has too many files, otherwise
+    // the next file of the level most over its limit (rotating through the
+    // level so every key range gets its turn)
+    size_t level = SIZE_MAX;
+    Level upper;
+    if (v->levels[0].size() >= options.level0_files)
+    {
+        level = 0;
+        upper = v->levels[0];
+    }
+    else
+    {
+        double worst = 1.0;
+        for (size_t i = 1; i + 1 < v->levels.size(); i++)
+        {
+            uint64_t bytes = 0;
+            for (const auto &table : v->levels[i])
+            {
+                bytes += table->file_bytes();
+            }
+            double score = static_cast<double>(bytes) / level_limit(i);
+            if (score > worst)
+            {
+                worst = score;
+                level = i;
+            }
+        }
+        if (level == SIZE_MAX)
+        {
+            return false;
+        }
+        const Level &files = v->levels[level];
+        auto it = std::find_if(files.begin(), files.end(), [&](const auto &table)
+                               { return table->smallest() > compact_pointers[level]; });
+        upper.push_back(it == files.end() ? files.front() : *it);
+    }
+
+    std::string smallest = upper.front()->smallest();
+    std::string largest = upper.front()->largest();
+    for (const auto &table : upper)
+    {
+        smallest = std::min(smallest, table->smallest());
+        largest = std::max(largest, table->largest());
+    }
+    Level lower;
+    for (const auto &table : v->levels[level + 1])
+    {
+        if (table->largest() >= smallest && table->smallest() <= largest)
+        {
+            lower.push_back(table);
+        }
+    }
+
+    // Tombstones only have to be kept while an older version could be
+    // hiding below the output level
+    bool keep_tombstones = false;
+    for (size_t i = level + 2; i < v->levels.size(); i++)
+    {
+        keep_tombstones = keep_tombstones || !v->levels[i].empty();
+    }
+
+    std::vector<std::unique_ptr<Cursor>> sources;
+    uint64_t read_bytes = 0;
+    uint64_t now = unix_now_ms();
+    for (const auto &table : upper)
+    {
+        sources.push_back(std::make_unique<TableCursor>(Level{table}, "", now));
+        read_bytes += table->file_bytes();
+    }
+    if (!lower.empty())
+    {
+        sources.push_back(std::make_unique<TableCursor>(lower, "", now));
+        for (const auto &table : lower)
+        {
+            read_bytes += table->file_bytes();
+        }
+    }
+
+    Level outputs;
+    std::unique_ptr<SSTableWriter> writer;
+    uint64_t number = 0;
+    uint64_t written = 0;
+    auto finish_output = [&]()
+    {
+        if (writer && writer->entries() > 0)
+        {
+            written += writer->finish();
+            outputs.push_back(std::make_shared<SSTable>(table_path(number), number, cache.get()));
+        }
+        writer.reset();
+    };
+    for (MergeCursor merged(std::move(sources)); merged.valid(); merged.next())
+    {
+        if (merged.deleted() && !keep_tombstones)
+        {
+            continue;
+        }
+        if (!writer)
+        {
+            number = new_file_number();
+            writer = std::make_unique<SSTableWriter>(table_path(number), options.block_bytes,
+                                                     options.bloom_bits_per_key);
+        }
+        writer->add(merged.key(), merged.value(), merged.deleted(), merged.expires_at(), merged.version());
+        if (writer->bytes() >= options.file_bytes)
+        {
+            finish_output();
+        }
+    }
+    finish_output();
+
+    Level removed = upper;
+    removed.insert(removed.end(), lower.begin(), lower.end());
+    install(removed, level + 1, outputs);
+    compact_pointers[level] = largest;
+
+    stat_compactions++;
+    stat_compaction_read += read_bytes;
+    stat_compaction_written += written;
+    return true;
+}
+
+void LsmTree::scan(const std::string &start, const std::string &end, size_t limit, const Overlay &overlay,
+                   std::vector<std::pair<std::string, std::string>> &out) const
+{
+    auto v = version();
+    uint64_t now = unix_now_ms();
+
+    std::vector<std::unique_ptr<Cursor>> sources;
+    sources.push_back(std::make_unique<OverlayCursor>(overlay, start));
+    for (const auto &table : v->levels[0])
+    {
+        if (overlaps(*table, start, end))
+        {
+            sources.push_back(std::make_unique<TableCursor>(Level{table}, start, now));
+        }
+    }
+    for (size_t level = 1; level < v->levels.size(); level++)
+    {
+        Level files;
+        for (const auto &table : v->levels[level])
+        {
+            if (overlaps(*table, start, end))
+            {
+                files.push_back(table);
+            }
+        }
+        if (!files.empty())
+        {
+            sources.push_back(std::make_unique<TableCursor>(files, start, now));
+        }
+    }
+
+    size_t found = 0;
+    for (MergeCursor merged(std::move(sources)); merged.valid(); merged.next())
+    {
+        if (!end.empty() && merged.key() >= end)
+        {
+            break;
+        }
+        if (merged.deleted())
+        {
+            continue;
+        }
+        out.emplace_back(merged.key(), merged.value());
+        if (limit > 0 && ++found == limit)
+        {
+            break;
+        }
+    }
+}
+
+LsmStats LsmTree::stats() const
+{
+    auto v = version();
+    LsmStats s;
+    for (const auto &level : v->levels)
+    {
+        uint64_t bytes = 0;
+        for (const auto &table : level)
+        {
+            bytes += table->file_bytes();
+        }
+        s.level_files.push_back(level.size());
+        s.level_bytes.push_back(bytes);
+    }
+    s.flushes = stat_flushes.load();
+    s.compactions = stat_compactions.load();
+    s.compaction_read_bytes = stat_compaction_read.load();
+    s.compaction_write_bytes = stat_compaction_written.load();
+    if (cache)
+    {
+        s.block_cache = cache->stats();
+    }
+    return s;
+}
+
+void LsmTree::destroy(const std::string &filename)
+{
+    std::string prefix = STORAGE_DIR + "/" + filename;
+    for (uint64_t number : list_tables(filename))
+    {
+        char suffix[32];
+        snprintf(suffix, sizeof(suffix), ".%06llu.sst", static_cast<unsigned long long>(number));
+        unlink((prefix + suffix).c_str());
+    }
+    unlink((prefix + ".manifest").c_str());
+    unlink((prefix + ".manifest.tmp").c_str());
+}
@@ -0,0 +1,86 @@
+#include "metrics.hpp"
+#include <algorithm>
+#include <cmath>
+
+namespace metrics {
+
+size_t stripe() {
+    // Threads are dealt stripes in turn as they first record
+    static std::atomic<size_t> next{0};
+    thread_local size_t mine = next.fetch_add(1, std::memory_order_relaxed) % STRIPES;
+    return mine;
+}
+
+uint64_t Counter::value() const {
+    uint64_t total = 0;
+    for (const auto& s : stripes) {
+        total += s.value.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+size_t Histogram::bucket_of(uint64_t ns) {
+    if (ns < SUB_BUCKETS) {
+        return ns;
+    }
+    ns = std::min<uint64_t>(ns, (uint64_t(1) << 40) - 1);
+    size_t msb = 63 - __builtin_clzll(ns);
+    size_t shift = msb - SUB_BITS;
+    return (shift + 1) * SUB_BUCKETS + ((ns >> shift) & (SUB_BUCKETS - 1));
+}
+
+uint64_t Histogram::bucket_limit(size_t bucket) {
+    if (bucket < SUB_BUCKETS) {
+        return bucket;
+    }
+    size_t shift = bucket / SUB_BUCKETS - 1;
+    uint64_t lower = uint64_t(SUB_BUCKETS + bucket % SUB_BUCKETS) << shift;
+    return lower + (uint64_t(1) << shift) - 1;
+}
+
+void Histogram::record(uint64_t ns) {
+    Stripe& s = stripes[stripe()];
+    s.count.fetch_add(1, std::memory_order_relaxed);
+    s.sum_ns.fetch_add(ns, std::memory_order_relaxed);
+    s.buckets[bucket_of(ns)].fetch_add(1, std::memory_order_relaxed);
+    uint64_t max = s.max_ns.load(std::memory_order_relaxed);
+    while (ns > max && !s.max_ns.compare_exchange_weak(max, ns, std::memory_order_relaxed)) {
+    }
+}
+
+Histogram::Snapshot Histogram::snapshot() const {
+    Snapshot snap;
+    snap.buckets.assign(BUCKETS, 0);
+    for (const auto& s : stripes) {
+        snap.count += s.count.load(std::memory_order_relaxed);
+        snap.sum_ns += s.sum_ns.load(std::memory_order_relaxed);
+        snap.max_ns = std::max(snap.max_ns, s.max_ns.load(std::memory_order_relaxed));
+        for (size_t i = 0; i < BUCKETS; i++) {
+            snap.buckets[i] += s.buckets[i].load(std::memory_order_relaxed);
+        }
+    }
+    return snap;
+}
+
+uint64_t Histogram::Snapshot::percentile(double q) const {
+    // Counted from the buckets rather than count, which another thread may
+    // have moved past them
+    uint64_t total = 0;
+    for (uint64_t n : buckets) {
+        total += n;
+    }
+    if (total == 0) {
+        return 0;
+    }
+    uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(q * total)));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < buckets.size(); i++) {
+        seen += buckets[i];
+        if (seen >= rank) {
+            return std::min(bucket_limit(i), max_ns);
+        }
+    }
+    return max_ns;
+}
+
+} // namespace metrics
@@ -0,0 +1,211 @@
+#include "protocol.hpp"
+
+namespace protocol {
+
+namespace {
+
+void put_u16(std::string& out, uint16_t v) {
+    out.push_back(static_cast<char>(v >> 8));
+    out.push_back(static_cast<char>(v));
+}
+
+void put_u32(std::string& out, uint32_t v) {
+    out.push_back(static_cast<char>(v >> 24));
+    out.push_back(static_cast<char>(v >> 16));
+    out.push_back(static_cast<char>(v >> 8));
+    out.push_back(static_cast<char>(v));
+}
+
+uint16_t get_u16(const unsigned char* p) {
+    return static_cast<uint16_t>((p[0] << 8) | p[1]);
+}
+
+uint32_t get_u32(const unsigned char* p) {
+    return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+           (static_cast<uint32_t>(p[2]) << 8) | static_cast<uint32_t>(p[3]);
+}
+
+} // namespace
+
+bool decode_header(std::string_view buf, FrameHeader& header) {
+    if (buf.size() < HEADER_SIZE) {
+        return false;
+    }
+    auto p = reinterpret_cast<const unsigned char*>(buf.data());
+    header.magic = p[0];
+    header.code = p[1];
+    header.flags = get_u16(p + 2);
+    header.request_id = get_u32(p + 4);
+    header.key_len = get_u32(p + 8);
+    header.value_len = get_u32(p + 12);
+    return true;
+}
+
+void encode_header(std::string& out, uint8_t code, uint32_t request_id,
+                   uint32_t key_len, uint32_t value_len, uint16_t flags) {
+    out.push_back(static_cast<char>(MAGIC));
+    out.push_back(static_cast<char>(code));
+    put_u16(out, flags);
+    put_u32(out, request_id);
+    put_u32(out, key_len);
+    put_u32(out, value_len);
+}
+
+void encode_u32(std::string& out, uint32_t v) {
+    put_u32(out, v);
+}
+
+void encode_string(std::string& out, std::string_view s) {
+    put_u32(out, static_cast<uint32_t>(s.size()));
+    out.append(s);
+}
+
+bool decode_u32(std::string_view body, uint32_t& v) {
+    if (body.size() < 4) {
+        return false;
+    }
+    v = get_u32(reinterpret_cast<const unsigned char*>(body.data()));
+    return true;
+}
+
+void encode_u64(std::string& out, uint64_t v) {
+    put_u32(out, static_cast<uint32_t>(v >> 32));
+    put_u32(out, static_cast<uint32_t>(v));
+}
+
+bool decode_u64(std::string_view body, uint64_t& v) {
+    if (body.size() < 8) {
+        return false;
+    }
+    auto p = reinterpret_cast<const unsigned char*>(body.data());
+    v = (static_cast<uint64_t>(get_u32(p)) << 32) | get_u32(p + 4);
+    return true;
+}
+
+bool decode_strings(std::string_view body, std::vector<std::string_view>& items) {
+    uint32_t count;
+    if (!decode_u32(body, count)) {
+        return false;
+    }
+    // Every entry needs at least its length field, so a bogus count cannot
+    // make us reserve more than the body could hold
+    if (count > (body.size() - 4) / 4) {
+        return false;
+    }
+    items.clear();
+    items.reserve(count);
+    size_t pos = 4;
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t len;
+        if (!decode_u32(body.substr(pos), len) || body.size() - pos - 4 < len) {
+            return false;
+        }
+        items.push_back(body.substr(pos + 4, len));
+        pos += 4 + size_t(len);
+    }
+    return pos == body.size();
+}
+
+void encode_values(std::string& out, const std::vector<std::optional<std::string>>& values) {
+    put_u32(out, static_cast<uint32_t>(values.size()));
+    for (const auto& value : values) {
+        out.push_back(value ? 1 : 0);
+        encode_string(out, value ? std::string_view(*value) : std::string_view());
+    }
+}
+
+bool decode_values(std::string_view body, std::vector<std::optional<std::string>>& values) {
+    uint32_t count;
+    if (!decode_u32(body, count) || count > (body.size() - 4) / 5) {
+        return false;
+    }
+    values.clear();
+    values.reserve(count);
+    size_t pos = 4;
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t len;
+        if (body.size() - pos < 5 || !decode_u32(body.substr(pos + 1), len) || body.size() - pos - 5 < len) {
+            return false;
+        }
+        if (body[pos] != 0) {
+            values.emplace_back(std::string(body.substr(pos + 5, len)));
+        } else {
+            values.emplace_back();
+        }
+        pos += 5 + size_t(len);
+    }
+    return pos == body.size();
+}
+
+void encode_scan_request(std::string& out, uint32_t limit, std::string_view end) {
+    put_u32(out, limit);
+    out.append(end);
+}
+
+bool decode_scan_request(std::string_view body, uint32_t& limit, std::string_view& end) {
+    if (!decode_u32(body, limit)) {
+        return false;
+    }
+    end = body.substr(4);
+    return true;
+}
+
+void encode_ttl_value(std::string& out, uint32_t ttl_seconds, std::string_view value) {
+    put_u32(out, ttl_seconds);
+    out.append(value);
+}
+
+bool decode_ttl_value(std::string_view body, uint32_t& ttl_seconds, std::string_view& value) {
+    if (!decode_u32(body, ttl_seconds)) {
+        return false;
+    }
+    value = body.substr(4);
+    return true;
+}
+
+void encode_versioned_value(std::string& out, uint64_t version, std::string_view value) {
+    encode_u64(out, version);
+    out.append(value);
+}
+
+bool decode_versioned_value(std::string_view body, uint64_t& version, std::string_view& value) {
+    if (!decode_u64(body, version)) {
+        return false;
+    }
+    value = body.substr(8);
+    return true;
+}
+
+void encode_entries(std::string& out, const std::vector<std::pair<std::string, std::string>>& entries, bool more) {
+    out.push_back(more ? 1 : 0);
+    put_u32(out, static_cast<uint32_t>(2 * entries.size()));
+    for (const auto& entry : entries) {
+        encode_string(out, entry.first);
+        encode_string(out, entry.second);
+    }
+}
+
+bool decode_entries(std::string_view body, std::vector<std::pair<std::string, std::string>>& entries, bool& more) {
+    std::vector<std::string_view> items;
+    if (body.empty() || !decode_strings(body.substr(1), items) || items.size() % 2 != 0) {
+        return false;
+    }
+    more = body[0] != 0;
+    entries.clear();
+    entries.reserve(items.size() / 2);
+    for (size_t i = 0; i < items.size(); i += 2) {
+        entries.emplace_back(std::string(items[i]), std::string(items[i + 1]));
+    }
+    return true;
+}
+
+void encode_frame(std::string& out, uint8_t code, uint32_t request_id,
+                  std::string_view key, std::string_view value, uint16_t flags) {
+    out.reserve(out.size() + HEADER_SIZE + key.size() + value.size());
+    encode_header(out, code, request_id, static_cast<uint32_t>(key.size()),
+                  static_cast<uint32_t>(value.size()), flags);
+    out.append(key);
+    out.append(value);
+}
+
+} // namespace protocol
@@ -0,0 +1,1136 @@
+#include "raft.hpp"
+#include "expiry.hpp"
+#include "kvstore.hpp"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+using protocol::Opcode;
+
+const std::string STATE_KEY = "state";       // term u64 | voted_for + 1 u64
+const std::string SNAPSHOT_KEY = "snapshot"; // index u64 | term u64
+
+// The apply thread takes at most this many entries per lock hold
+constexpr size_t APPLY_BATCH = 1024;
+
+// Raised to unwind a snapshot that can no longer be sent
+struct SnapshotAborted {};
+
+std::string entry_key(uint64_t index) {
+    std::string key = "e";
+    protocol::encode_u64(key, index);
+    return key;
+}
+
+// Sequential decoding of a request or reply body; ok turns false at the
+// first field that is not there
+struct Reader {
+    std::string_view data;
+    bool ok = true;
+
+    uint64_t u64() {
+        uint64_t v = 0;
+        ok = ok && protocol::decode_u64(data, v);
+        data.remove_prefix(ok ? 8 : data.size());
+        return v;
+    }
+
+    uint32_t u32() {
+        uint32_t v = 0;
+        ok = ok && protocol::decode_u32(data, v);
+        data.remove_prefix(ok ? 4 : data.size());
+        return v;
+    }
+
+    uint8_t u8() {
+        ok = ok && !data.empty();
+        uint8_t v = ok ? static_cast<uint8_t>(data[0]) : 0;
+        data.remove_prefix(ok ? 1 : data.size());
+        return v;
+    }
+
+    std::string_view bytes(size_t n) {
+        ok = ok && data.size() >= n;
+        std::string_view v = ok ? data.substr(0, n) : std::string_view();
+        data.remove_prefix(ok ? n : data.size());
+        return v;
+    }
+};
+
+int connect_to(const std::string &host, int port, std::chrono::milliseconds timeout) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    // Bounds connect() as well as every send
+    timeval tv{};
+    tv.tv_sec = timeout.count() / 1000;
+    tv.tv_usec = (timeout.count() % 1000) * 1000;
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) <= 0 ||
+        connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+bool send_all(int fd, const std::string &data) {
+    size_t off = 0;
+    while (off < data.size()) {
+        ssize_t n = send(fd, data.data() + off, data.size() - off, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        off += n;
+    }
+    return true;
+}
+
+// Receive whatever is there into buffer, waiting up to timeout_ms for it;
+// false once the connection is closed, failed or silent for that long
+bool receive(int fd, std::string &buffer, int timeout_ms) {
+    pollfd pfd{fd, POLLIN, 0};
+    int ready = poll(&pfd, 1, timeout_ms);
+    if (ready <= 0) {
+        return false;
+    }
+    char chunk[65536];
+    ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+    if (n <= 0) {
+        return false;
+    }
+    buffer.append(chunk, n);
+    return true;
+}
+
+// Pop the first reply in buffer; false if it is not whole yet. ok is set
+// if the peer answered the request rather than refusing it.
+bool next_reply(std::string &buffer, std::string &body, bool &ok) {
+    protocol::FrameHeader header;
+    if (!protocol::decode_header(buffer, header) || buffer.size() < header.frame_size()) {
+        return false;
+    }
+    ok = header.magic == protocol::MAGIC && header.code == static_cast<uint8_t>(protocol::Status::Ok);
+    body.assign(buffer, protocol::HEADER_SIZE + header.key_len, header.value_len);
+    buffer.erase(0, header.frame_size());
+    return true;
+}
+
+// Send one request and wait for its reply body
+bool call(int fd, std::string &buffer, Opcode op, const std::string &body, std::string &reply,
+          std::chrono::milliseconds timeout) {
+    std::string frame;
+    protocol::encode_request(frame, op, 0, {}, body);
+    if (!send_all(fd, frame)) {
+        return false;
+    }
+    bool ok = false;
+    while (!next_reply(buffer, reply, ok)) {
+        if (!receive(fd, buffer, static_cast<int>(timeout.count()))) {
+            return false;
+        }
+    }
+    return ok;
+}
+
+void wait_wake(int wake_fd, int timeout_ms) {
+    pollfd pfd{wake_fd, POLLIN, 0};
+    if (poll(&pfd, 1, timeout_ms) > 0) {
+        uint64_t count;
+        ssize_t n = read(wake_fd, &count, sizeof(count));
+        (void)n;
+    }
+}
+
+int ms_until(Clock::time_point t) {
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(t - Clock::now()).count();
+    return static_cast<int>(std::max<long long>(left, 0));
+}
+
+} // namespace
+
+RaftNode::RaftNode(KVStore &store, const RaftOptions &options)
+    : store(store), options(options), rng(std::random_device()() ^ options.id) {
+    if (options.id >= options.peers.size()) {
+        throw std::invalid_argument("Raft node id is not in the peer list");
+    }
+    log_store = std::make_unique<Storage>(options.log_file, options.storage);
+    recover();
+
+    for (size_t i = 0; i < options.peers.size(); i++) {
+        if (i == options.id) {
+            peers.emplace_back();
+            continue;
+        }
+        auto peer = std::make_unique<Peer>();
+        size_t colon = options.peers[i].rfind(':');
+        if (colon == std::string::npos) {
+            throw std::invalid_argument("Raft peer '" + options.peers[i] + "' is not host:port");
+        }
+        peer->host = options.peers[i].substr(0, colon);
+        peer->port = std::stoi(options.peers[i].substr(colon + 1));
+        peer->wake_fd = eventfd(0, EFD_NONBLOCK);
+        peers.push_back(std::move(peer));
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        reset_election_deadline();
+    }
+    for (size_t i = 0; i < peers.size(); i++) {
+        if (peers[i]) {
+            peers[i]->thread = std::thread(&RaftNode::peer_loop, this, std::ref(*peers[i]), i);
+        }
+    }
+    ticker = std::thread(&RaftNode::tick_loop, this);
+    applier = std::thread(&RaftNode::apply_loop, this);
+    syncer = std::thread(&RaftNode::sync_loop, this);
+}
+
+RaftNode::~RaftNode() {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        stopping = true;
+    }
+    changed.notify_all();
+    wake_peers();
+    ticker.join();
+    applier.join();
+    syncer.join();
+    for (auto &peer : peers) {
+        if (peer) {
+            peer->thread.join();
+            close(peer->wake_fd);
+        }
+    }
+}
+
+// Rebuild the term, vote and log from the Raft log; the store already holds
+// everything up to the snapshot, and the rest is applied again as it commits
+void RaftNode::recover() {
+    std::vector<std::pair<uint64_t, Entry>> entries;
+    for (auto &kv : log_store->load()) {
+        Reader value{kv.second};
+        if (kv.first == STATE_KEY) {
+            current_term = value.u64();
+            voted_for = static_cast<int>(value.u64()) - 1;
+        } else if (kv.first == SNAPSHOT_KEY) {
+            snapshot_index = value.u64();
+            snapshot_term = value.u64();
+        } else if (kv.first.size() == 9 && kv.first[0] == 'e') {
+            Reader key{std::string_view(kv.first).substr(1)};
+            uint64_t index = key.u64();
+            uint64_t term = value.u64();
+            if (value.ok) {
+                entries.emplace_back(index, Entry{term, std::string(value.data)});
+            }
+        }
+    }
+
+    // Entries run on from the snapshot; anything after a gap is unreachable
+    std::sort(entries.begin(), entries.end(),
+              [](const auto &a, const auto &b) { return a.first < b.first; });
+    for (auto &entry : entries) {
+        if (entry.first <= snapshot_index) {
+            continue;
+        }
+        if (entry.first != last_index() + 1) {
+            break;
+        }
+        log.push_back(std::move(entry.second));
+    }
+    commit_index = last_applied = snapshot_index;
+    persisted_index = pending_index = last_index();
+}
+
+uint64_t RaftNode::term_at(uint64_t index) const {
+    if (index == snapshot_index) {
+        return snapshot_term;
+    }
+    if (index < snapshot_index || index > last_index()) {
+        return 0;
+    }
+    return log[index - snapshot_index - 1].term;
+}
+
+bool RaftNode::dropped() {
+    uint64_t permille = drop_permille;
+    if (permille == 0) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mtx);
+    return rng() % 1000 < permille;
+}
+
+uint64_t RaftNode::persist_state() {
+    std::string value;
+    protocol::encode_u64(value, current_term);
+    protocol::encode_u64(value, static_cast<uint64_t>(voted_for + 1));
+    return log_store->enqueue_append(STATE_KEY, value);
+}
+
+uint64_t RaftNode::persist_entry(uint64_t index) {
+    const Entry &entry = log[index - snapshot_index - 1];
+    std::string value;
+    value.reserve(8 + entry.records.size());
+    protocol::encode_u64(value, entry.term);
+    value += entry.records;
+    return log_store->enqueue_append(entry_key(index), value);
+}
+
+// Drop the entries from index on, in memory and on disk
+uint64_t RaftNode::truncate_from(uint64_t index) {
+    uint64_t seq = 0;
+    for (uint64_t i = index; i <= last_index(); i++) {
+        seq = log_store->enqueue_remove(entry_key(i));
+    }
+    log.resize(index - snapshot_index - 1);
+    persisted_index = std::min(persisted_index, last_index());
+    pending_index = std::min(pending_index, last_index());
+    return seq;
+}
+
+void RaftNode::reset_election_deadline() {
+    auto base = options.election_timeout.count();
+    auto jitter = static_cast<long long>(rng() % static_cast<uint64_t>(std::max<long long>(base, 1)));
+    election_deadline = Clock::now() + std::chrono::milliseconds(base + jitter);
+}
+
+void RaftNode::wake_peers() {
+    uint64_t one = 1;
+    for (auto &peer : peers) {
+        if (peer) {
+            ssize_t n = write(peer->wake_fd, &one, sizeof(one));
+            (void)n;
+        }
+    }
+}
+
+// Returns the log sequence of the new term, if it is one
+uint64_t RaftNode::become_follower(uint64_t term) {
+    uint64_t seq = 0;
+    if (term > current_term) {
+        current_term = term;
+        voted_for = -1;
+        seq = persist_state();
+    }
+    if (role == RaftRole::Leader) {
+        leader = -1;
+    }
+    role = RaftRole::Follower;
+    votes = 0;
+    changed.notify_all();
+    return seq;
+}
+
+void RaftNode::start_election() {
+    current_term++;
+    role = RaftRole::Candidate;
+    voted_for = static_cast<int>(options.id);
+    leader = -1;
+    votes = 1;
+    reset_election_deadline();
+}
+
+void RaftNode::become_leader() {
+    role = RaftRole::Leader;
+    leader = static_cast<int>(options.id);
+    auto now = Clock::now();
+    for (auto &peer : peers) {
+        if (peer) {
+            peer->next_index = last_index() + 1;
+            peer->match_index = 0;
+            peer->last_contact = now;
+        }
+    }
+
+    // Entries of earlier terms only commit along with one of this term
+    log.push_back(Entry{current_term, std::string()});
+    pending_seq = persist_entry(last_index());
+    pending_index = last_index();
+    changed.notify_all();
+    wake_peers();
+}
+
+// The highest index a majority has on disk commits, if it is of this term
+void RaftNode::advance_commit() {
+    std::vector<uint64_t> matched{persisted_index};
+    for (auto &peer : peers) {
+        if (peer) {
+            matched.push_back(peer->match_index);
+        }
+    }
+    std::sort(matched.begin(), matched.end(), std::greater<uint64_t>());
+    uint64_t index = matched[majority() - 1];
+    if (index > commit_index && term_at(index) == current_term) {
+        commit_index = index;
+        changed.notify_all();
+    }
+}
+
+bool RaftNode::propose(std::string records, uint64_t &index, uint64_t &term) {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (role != RaftRole::Leader || stopping) {
+            return false;
+        }
+        log.push_back(Entry{current_term, std::move(records)});
+        index = last_index();
+        term = current_term;
+        pending_seq = persist_entry(index);
+        pending_index = index;
+    }
+    changed.notify_all();
+    wake_peers();
+    return true;
+}
+
+bool RaftNode::wait_applied(uint64_t index, uint64_t term) {
+    std::unique_lock<std::mutex> lock(mtx);
+    changed.wait_for(lock, options.commit_timeout, [&] { return stopping || last_applied >= index; });
+    if (last_applied < index) {
+        return false;
+    }
+    if (index > snapshot_index) {
+        return term_at(index) == term;
+    }
+
+    // Compacted away since. Terms never decrease along the log, and only
+    // this node appended entries of term while it led, so if the snapshot
+    // ends in term the entry is still the one it proposed. Otherwise there
+    // is no telling.
+    return snapshot_term == term;
+}
+
+bool RaftNode::replicate(std::string records) {
+    uint64_t index, term;
+    return propose(std::move(records), index, term) && wait_applied(index, term);
+}
+
+std::string RaftNode::leader_address() const {
+    std::lock_guard<std::mutex> lock(mtx);
+    return leader >= 0 ? options.peers[leader] : std::string();
+}
+
+RaftStatus RaftNode::status() const {
+    std::lock_guard<std::mutex> lock(mtx);
+    RaftStatus s;
+    s.role = role;
+    s.term = current_term;
+    s.leader = leader;
+    s.last_index = last_index();
+    s.commit_index = commit_index;
+    s.last_applied = last_applied;
+    s.snapshot_index = snapshot_index;
+    s.snapshots_sent = snapshots_sent;
+    s.snapshots_installed = snapshots_installed;
+    return s;
+}
+
+void RaftNode::set_isolated(bool value) {
+    isolated = value;
+    wake_peers();
+}
+
+void RaftNode::set_drop_rate(double rate) {
+    drop_permille = static_cast<uint64_t>(std::clamp(rate, 0.0, 1.0) * 1000);
+}
+
+void RaftNode::tick_loop() {
+    std::unique_lock<std::mutex> lock(mtx);
+    while (!stopping) {
+        changed.wait_for(lock, options.heartbeat_interval / 2);
+        if (stopping) {
+            break;
+        }
+        auto now = Clock::now();
+
+        if (role == RaftRole::Leader) {
+            // A leader cut off from a majority stops taking writes it cannot commit
+            size_t reachable = 1;
+            for (auto &peer : peers) {
+                if (peer && now - peer->last_contact < options.election_timeout) {
+                    reachable++;
+                }
+            }
+            if (reachable < majority()) {
+                become_follower(current_term);
+                reset_election_deadline();
+            }
+            continue;
+        }
+        if (now < election_deadline || isolated) {
+            continue;
+        }
+
+        start_election();
+        uint64_t term = current_term;
+        uint64_t seq = persist_state();
+        lock.unlock();
+        log_store->wait_durable(seq);
+        lock.lock();
+        if (role == RaftRole::Candidate && current_term == term) {
+            if (votes >= majority()) {
+                become_leader();
+            } else {
+                wake_peers();
+            }
+        }
+    }
+}
+
+void RaftNode::sync_loop() {
+    std::unique_lock<std::mutex> lock(mtx);
+    while (true) {
+        changed.wait(lock, [&] { return stopping || pending_index > persisted_index; });
+        if (stopping) {
+            break;
+        }
+        uint64_t index = pending_index;
+        uint64_t seq = pending_seq;
+        lock.unlock();
+        try {
+            log_store->wait_durable(seq);
+        } catch (const std::exception &e) {
+            // Without its own log on disk the leader counts for nothing
+            std::cerr << "Raft log write failed: " << e.what() << "\n";
+            lock.lock();
+            changed.wait_for(lock, options.heartbeat_interval);
+            continue;
+        }
+        lock.lock();
+        if (index <= pending_index && index > persisted_index) {
+            persisted_index = index;
+            if (role == RaftRole::Leader) {
+                advance_commit();
+            }
+        }
+    }
+}
+
+void RaftNode::apply_loop() {
+    std::unique_lock<std::mutex> lock(mtx);
+    uint64_t store_seq = 0;
+    std::vector<std::string> batch;
+    while (true) {
+        changed.wait(lock, [&] { return stopping || (commit_index > last_applied && !installing); });
+        if (stopping) {
+            break;
+        }
+        uint64_t first = last_applied + 1;
+        uint64_t last = std::min(commit_index, last_applied + APPLY_BATCH);
+        batch.clear();
+        for (uint64_t i = first; i <= last; i++) {
+            batch.push_back(log[i - snapshot_index - 1].records);
+        }
+        applying = true;
+        lock.unlock();
+
+        for (const auto &records : batch) {
+            Storage::decode_records(records, [&](const std::vector<Storage::LogOp> &ops) {
+                store_seq = std::max(store_seq, store.apply_replicated(ops));
+            });
+        }
+
+        lock.lock();
+        applying = false;
+        last_applied = last;
+        changed.notify_all();
+
+        if (options.snapshot_entries > 0 && store.persistent() && last_applied - snapshot_index >= options.snapshot_entries) {
+            lock.unlock();
+            store.wait_durable(store_seq);
+            compact_log();
+            lock.lock();
+        }
+    }
+}
+
+// Drop the applied entries from the Raft log, now that the store has them
+// on disk
+void RaftNode::compact_log() {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (installing || last_applied <= snapshot_index) {
+            return;
+        }
+        uint64_t term = term_at(last_applied);
+        log.erase(log.begin(), log.begin() + (last_applied - snapshot_index));
+        snapshot_index = last_applied;
+        snapshot_term = term;
+    }
+
+    // Whatever is logged after the cut lands in the new tail and replays on
+    // top, so the live entries can be read from memory when the file is written
+    log_store->compact([this](uint64_t, const Storage::Emit &emit) {
+        std::lock_guard<std::mutex> lock(mtx);
+        std::string value;
+        protocol::encode_u64(value, current_term);
+        protocol::encode_u64(value, static_cast<uint64_t>(voted_for + 1));
+        emit(STATE_KEY, value, 0, 0);
+        value.clear();
+        protocol::encode_u64(value, snapshot_index);
+        protocol::encode_u64(value, snapshot_term);
+        emit(SNAPSHOT_KEY, value, 0, 0);
+        for (uint64_t i = snapshot_index + 1; i <= last_index(); i++) {
+            const Entry &entry = log[i - snapshot_index - 1];
+            value.clear();
+            protocol::encode_u64(value, entry.term);
+            value += entry.records;
+            emit(entry_key(i), value, 0, 0);
+        }
+    });
+}
+
+void RaftNode::peer_loop(Peer &peer, size_t id) {
+    (void)id;
+    int sock = -1;
+    uint64_t sock_term = 0;
+    std::string inbuf;
+    std::string frame;
+    std::string body;
+    std::string reply;
+    Clock::time_point last_send;
+
+    // Requests sent and not yet answered: the index each one's entries
+    // follow, and when it went out. Replies come back in order.
+    std::deque<std::pair<uint64_t, Clock::time_point>> inflight;
+
+    auto disconnect = [&] {
+        if (sock >= 0) {
+            close(sock);
+        }
+        sock = -1;
+        inflight.clear();
+        inbuf.clear();
+    };
+
+    // Called with mtx held: entries in flight may never arrive, so the next
+    // request starts from the first of them
+    auto rewind = [&] {
+        if (!inflight.empty()) {
+            peer.next_index = inflight.front().first + 1;
+        }
+    };
+
+    while (true) {
+        RaftRole current;
+        uint64_t term;
+        bool active;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            if (stopping) {
+                break;
+            }
+            current = role;
+            term = current_term;
+            active = !isolated && (role == RaftRole::Leader ||
+                                   (role == RaftRole::Candidate && peer.vote_term < current_term));
+            if ((!active || sock_term != term) && sock >= 0) {
+                rewind();
+                disconnect();
+            }
+        }
+        if (!active) {
+            wait_wake(peer.wake_fd, static_cast<int>(options.heartbeat_interval.count()));
+            continue;
+        }
+        if (sock < 0) {
+            sock = connect_to(peer.host, peer.port, options.election_timeout);
+            if (sock < 0) {
+                wait_wake(peer.wake_fd, static_cast<int>(options.heartbeat_interval.count()));
+                continue;
+            }
+            sock_term = term;
+        }
+
+        if (current == RaftRole::Candidate) {
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                if (role != RaftRole::Candidate || current_term != term) {
+                    continue;
+                }
+                peer.vote_term = term;
+                body.clear();
+                protocol::encode_u64(body, term);
+                protocol::encode_u64(body, options.id);
+                protocol::encode_u64(body, last_index());
+                protocol::encode_u64(body, term_at(last_index()));
+            }
+            bool answered = !dropped() && call(sock, inbuf, Opcode::RequestVote, body, reply, options.election_timeout);
+            Reader r{reply};
+            uint64_t reply_term = r.u64();
+            bool granted = r.u8() != 0;
+            std::lock_guard<std::mutex> lock(mtx);
+            if (!answered || !r.ok) {
+                peer.vote_term = 0; // ask again
+                disconnect();
+                continue;
+            }
+            if (reply_term > current_term) {
+                become_follower(reply_term);
+            } else if (granted && role == RaftRole::Candidate && current_term == term && ++votes >= majority()) {
+                become_leader();
+            }
+            continue;
+        }
+
+        // Leader: send what there is, up to max_inflight requests ahead
+        bool snapshot = false;
+        frame.clear();
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            if (role != RaftRole::Leader || current_term != term) {
+                continue;
+            }
+            if (peer.next_index <= snapshot_index) {
+                snapshot = true;
+                rewind();
+            }
+            while (!snapshot && inflight.size() < options.max_inflight) {
+                auto now = Clock::now();
+                bool more = peer.next_index <= last_index();
+                if (!more && !(inflight.empty() && now - last_send >= options.heartbeat_interval)) {
+                    break;
+                }
+                uint64_t prev = peer.next_index - 1;
+                body.clear();
+                protocol::encode_u64(body, term);
+                protocol::encode_u64(body, options.id);
+                protocol::encode_u64(body, prev);
+                protocol::encode_u64(body, term_at(prev));
+                protocol::encode_u64(body, commit_index);
+                size_t count_at = body.size();
+                protocol::encode_u32(body, 0);
+                uint32_t count = 0;
+                size_t bytes = 0;
+                for (uint64_t i = peer.next_index; i <= last_index() && (count == 0 || bytes < options.max_batch_bytes); i++) {
+                    const Entry &entry = log[i - snapshot_index - 1];
+                    protocol::encode_u64(body, entry.term);
+                    protocol::encode_string(body, entry.records);
+                    bytes += entry.records.size();
+                    count++;
+                }
+                std::string encoded_count;
+                protocol::encode_u32(encoded_count, count);
+                body.replace(count_at, 4, encoded_count);
+                protocol::encode_request(frame, Opcode::AppendEntries, 0, {}, body);
+                inflight.emplace_back(prev, now);
+                peer.next_index += count;
+                last_send = now;
+            }
+        }
+        if (snapshot) {
+            disconnect();
+            sock = connect_to(peer.host, peer.port, options.election_timeout);
+            if (sock >= 0) {
+                sock_term = term;
+                try {
+                    send_snapshot(peer, sock, term);
+                } catch (const SnapshotAborted &) {
+                    disconnect();
+                }
+            }
+            continue;
+        }
+        if (!frame.empty() && (dropped() || !send_all(sock, frame))) {
+            std::lock_guard<std::mutex> lock(mtx);
+            rewind();
+            disconnect();
+            continue;
+        }
+
+        // Wait for replies, new entries or the next heartbeat
+        auto next_heartbeat = last_send + options.heartbeat_interval;
+        pollfd fds[2] = {{sock, POLLIN, 0}, {peer.wake_fd, POLLIN, 0}};
+        int timeout = inflight.empty() ? ms_until(next_heartbeat) : static_cast<int>(options.election_timeout.count());
+        if (poll(fds, 2, timeout) < 0 && errno != EINTR) {
+            disconnect();
+            continue;
+        }
+        if (fds[1].revents & POLLIN) {
+            wait_wake(peer.wake_fd, 0);
+        }
+        if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+            if (!receive(sock, inbuf, 0)) {
+                std::lock_guard<std::mutex> lock(mtx);
+                rewind();
+                disconnect();
+                continue;
+            }
+        }
+
+        bool ok;
+        bool broken = false;
+        while (!broken && next_reply(inbuf, reply, ok)) {
+            Reader r{reply};
+            uint64_t reply_term = r.u64();
+            bool success = r.u8() != 0;
+            uint64_t index = r.u64();
+            std::lock_guard<std::mutex> lock(mtx);
+            if (!ok || !r.ok || inflight.empty()) {
+                rewind();
+                broken = true;
+            } else if (reply_term > current_term) {
+                become_follower(reply_term);
+                broken = true;
+            } else if (role != RaftRole::Leader || current_term != term) {
+                broken = true;
+            } else if (success) {
+                peer.match_index = std::max(peer.match_index, index);
+                peer.last_contact = Clock::now();
+                inflight.pop_front();
+                advance_commit();
+            } else {
+                // The follower's log diverges before this request; requests
+                // after it will fail too, so start over from its hint
+                peer.last_contact = Clock::now();
+                peer.next_index = std::max<uint64_t>(1, std::min(index, inflight.front().first + 1));
+                inflight.clear();
+                broken = true;
+            }
+        }
+        if (!broken && !inflight.empty() && Clock::now() - inflight.front().second > options.election_timeout) {
+            std::lock_guard<std::mutex> lock(mtx);
+            rewind();
+            broken = true;
+        }
+        if (broken) {
+            disconnect();
+        }
+    }
+    disconnect();
+}
+
+// Send the store's contents in InstallSnapshot chunks, then resume the log
+// from the index the dump started at
+void RaftNode::send_snapshot(Peer &peer, int sock, uint64_t term) {
+    uint64_t index, index_term;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        index = last_applied;
+        index_term = term_at(index);
+    }
+
+    std::string inbuf;
+    std::string body;
+    std::string reply;
+    std::string records;
+    uint64_t offset = 0;
+    auto send_chunk = [&](bool done) {
+        body.clear();
+        protocol::encode_u64(body, term);
+        protocol::encode_u64(body, options.id);
+        protocol::encode_u64(body, index);
+        protocol::encode_u64(body, index_term);
+        protocol::encode_u64(body, offset);
+        body += static_cast<char>(done ? 1 : 0);
+        body += records;
+        if (isolated || dropped() ||
+            !call(sock, inbuf, Opcode::InstallSnapshot, body, reply, options.election_timeout)) {
+            throw SnapshotAborted();
+        }
+        Reader r{reply};
+        uint64_t reply_term = r.u64();
+        bool accepted = r.u8() != 0;
+        std::lock_guard<std::mutex> lock(mtx);
+        if (r.ok && reply_term > current_term) {
+            become_follower(reply_term);
+        }
+        if (!r.ok || !accepted || role != RaftRole::Leader || current_term != term || stopping) {
+            throw SnapshotAborted();
+        }
+        peer.last_contact = Clock::now();
+        offset += records.size();
+        records.clear();
+    };
+
+    uint64_t now = unix_now_ms();
+    store.dump([&](const std::string &key, const std::string &value, uint64_t expires_at, uint64_t version) {
+        if (is_expired(expires_at, now)) {
+            return;
+        }
+        Storage::encode_put(records, key, value, expires_at, version);
+        if (records.size() >= options.max_batch_bytes) {
+            send_chunk(false);
+        }
+    });
+    send_chunk(true);
+
+    std::lock_guard<std::mutex> lock(mtx);
+    peer.match_index = std::max(peer.match_index, index);
+    peer.next_index = index + 1;
+    snapshots_sent++;
+    advance_commit();
+}
+
+bool RaftNode::handle(Opcode op, std::string_view body, std::string &reply) {
+    if (isolated || dropped()) {
+        return false;
+    }
+    switch (op) {
+    case Opcode::RequestVote:
+        return handle_vote(body, reply);
+    case Opcode::AppendEntries:
+        return handle_append(body, reply);
+    case Opcode::InstallSnapshot:
+        return handle_snapshot(body, reply);
+    default:
+        return false;
+    }
+}
+
+bool RaftNode::handle_vote(std::string_view body, std::string &reply) {
+    Reader r{body};
+    uint64_t term = r.u64();
+    uint64_t candidate = r.u64();
+    uint64_t candidate_last_index = r.u64();
+    uint64_t candidate_last_term = r.u64();
+    if (!r.ok || candidate >= options.peers.size()) {
+        return false;
+    }
+
+    uint64_t seq = 0;
+    bool granted = false;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (term > current_term) {
+            seq = become_follower(term);
+        }
+        uint64_t my_last_term = term_at(last_index());
+        bool up_to_date = candidate_last_term > my_last_term ||
+                          (candidate_last_term == my_last_term && candidate_last_index >= last_index());
+        if (term == current_term && up_to_date &&
+            (voted_for < 0 || voted_for == static_cast<int>(candidate))) {
+            granted = true;
+            voted_for = static_cast<int>(candidate);
+            seq = persist_state();
+            reset_election_deadline();
+        }
+        protocol::encode_u64(reply, current_term);
+        reply += static_cast<char>(granted ? 1 : 0);
+    }
+    // Term and vote are on disk before anyone hears of them
+    if (seq != 0) {
+        log_store->wait_durable(seq);
+    }
+    return true;
+}
+
+bool RaftNode::handle_append(std::string_view body, std::string &reply) {
+    Reader r{body};
+    uint64_t term = r.u64();
+    uint64_t leader_id = r.u64();
+    uint64_t prev_index = r.u64();
+    uint64_t prev_term = r.u64();
+    uint64_t leader_commit = r.u64();
+    uint32_t count = r.u32();
+    std::vector<std::pair<uint64_t, std::string_view>> entries;
+    entries.reserve(count);
+    for (uint32_t i = 0; i < count && r.ok; i++) {
+        uint64_t entry_term = r.u64();
+        uint32_t len = r.u32();
+        entries.emplace_back(entry_term, r.bytes(len));
+    }
+    if (!r.ok || leader_id >= options.peers.size()) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> one_at_a_time(rpc_mtx);
+    uint64_t seq = 0;
+    bool success = false;
+    uint64_t index = 0;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (term < current_term) {
+            protocol::encode_u64(reply, current_term);
+            reply += static_cast<char>(0);
+            protocol::encode_u64(reply, 0);
+            return true;
+        }
+        if (term > current_term || role != RaftRole::Follower) {
+            seq = become_follower(term);
+        }
+        leader = static_cast<int>(leader_id);
+        reset_election_deadline();
+
+        if (prev_index > last_index()) {
+            index = last_index() + 1;
+        } else if (prev_index > snapshot_index && term_at(prev_index) != prev_term) {
+            // Skip the whole conflicting term in one go
+            uint64_t conflict = term_at(prev_index);
+            index = prev_index;
+            while (index - 1 > snapshot_index && term_at(index - 1) == conflict) {
+                index--;
+            }
+        } else {
+            // Entries up to the snapshot are committed, so they match
+            success = true;
+            uint64_t i = prev_index;
+            for (auto &entry : entries) {
+                i++;
+                if (i <= snapshot_index) {
+                    continue;
+                }
+                if (i <= last_index()) {
+                    if (term_at(i) == entry.first) {
+                        continue;
+                    }
+                    seq = truncate_from(i);
+                }
+                log.push_back(Entry{entry.first, std::string(entry.second)});
+                seq = persist_entry(i);
+            }
+            index = prev_index + entries.size();
+            if (leader_commit > commit_index) {
+                commit_index = std::min(leader_commit, index);
+                changed.notify_all();
+            }
+            // A snapshot the leader gave up on is superseded by the log
+            installing = false;
+        }
+        protocol::encode_u64(reply, current_term);
+        reply += static_cast<char>(success ? 1 : 0);
+        protocol::encode_u64(reply, index);
+    }
+    if (seq != 0) {
+        log_store->wait_durable(seq);
+    }
+    return true;
+}
+
+bool RaftNode::handle_snapshot(std::string_view body, std::string &reply) {
+    Reader r{body};
+    uint64_t term = r.u64();
+    uint64_t leader_id = r.u64();
+    uint64_t index = r.u64();
+    uint64_t index_term = r.u64();
+    uint64_t offset = r.u64();
+    bool done = r.u8() != 0;
+    std::string_view records = r.data;
+    if (!r.ok || leader_id >= options.peers.size()) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> one_at_a_time(rpc_mtx);
+    uint64_t seq = 0;
+    auto answer = [&](bool accepted) {
+        protocol::encode_u64(reply, current_term);
+        reply += static_cast<char>(accepted ? 1 : 0);
+        return true;
+    };
+
+    std::unique_lock<std::mutex> lock(mtx);
+    if (term < current_term) {
+        return answer(false);
+    }
+    if (term > current_term || role != RaftRole::Follower) {
+        seq = become_follower(term);
+    }
+    leader = static_cast<int>(leader_id);
+    reset_election_deadline();
+
+    if (offset == 0) {
+        // Start over from an empty log: the store is about to hold a mix of
+        // its old contents and the leader's until the dump is complete, and
+        // only replaying the log from the dump on makes sense of that
+        changed.wait(lock, [&] { return !applying; });
+        truncate_from(snapshot_index + 1);
+        snapshot_index = snapshot_term = 0;
+        commit_index = last_applied = 0;
+        persisted_index = pending_index = 0;
+        std::string position;
+        protocol::encode_u64(position, 0);
+        protocol::encode_u64(position, 0);
+        log_store->enqueue_append(SNAPSHOT_KEY, position);
+        installing = true;
+        install_term = term;
+        install_index = index;
+        install_offset = 0;
+        install_stale.clear();
+        lock.unlock();
+        store.dump([&](const std::string &key, const std::string &, uint64_t, uint64_t) {
+            install_stale.insert(key);
+        });
+        lock.lock();
+    } else if (!installing || install_term != term || install_index != index || install_offset != offset) {
+        return answer(false);
+    }
+    lock.unlock();
+
+    // Applied with the lock released: the apply thread waits for installing
+    // to clear, and rpc_mtx keeps other requests out
+    uint64_t store_seq = 0;
+    size_t decoded = Storage::decode_records(records, [&](const std::vector<Storage::LogOp> &ops) {
+        for (const auto &op : ops) {
+            install_stale.erase(std::string(op.key));
+        }
+        store_seq = std::max(store_seq, store.apply_replicated(ops));
+    });
+    if (decoded != records.size()) {
+        lock.lock();
+        return answer(false);
+    }
+
+    if (done) {
+        std::vector<std::string> doomed(install_stale.begin(), install_stale.end());
+        install_stale.clear();
+        for (size_t i = 0; i < doomed.size(); i += 1000) {
+            std::vector<std::string> keys(doomed.begin() + i, doomed.begin() + std::min(doomed.size(), i + 1000));
+            uint64_t removed_seq;
+            store.multi_remove_nowait(keys, removed_seq);
+            store_seq = std::max(store_seq, removed_seq);
+        }
+        store.wait_durable(store_seq);
+    }
+
+    lock.lock();
+    if (!installing || install_term != term || install_index != index) {
+        return answer(false);
+    }
+    install_offset += records.size();
+    if (done) {
+        installing = false;
+        snapshot_index = index;
+        snapshot_term = index_term;
+        commit_index = last_applied = index;
+        persisted_index = pending_index = index;
+        // Without a persistent store the log has to start over after a restart
+        if (store.persistent()) {
+            std::string position;
+            protocol::encode_u64(position, index);
+            protocol::encode_u64(position, index_term);
+            seq = log_store->enqueue_append(SNAPSHOT_KEY, position);
+        }
+        snapshots_installed++;
+        changed.notify_all();
+    }
+    answer(true);
+    lock.unlock();
+    if (seq != 0) {
+        log_store->wait_durable(seq);
+    }
+    return true;
+}
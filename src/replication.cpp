@@ -0,0 +1,520 @@
+#include "replication.hpp"
+#include "expiry.hpp"
+#include "kvstore.hpp"
+#include "protocol.hpp"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <unordered_set>
+
+namespace {
+
+using protocol::Opcode;
+using protocol::ReplMessage;
+
+// Records are appended to the last chunk until it holds this much, so the
+// backlog is not one allocation per small write
+constexpr size_t CHUNK_BYTES = 64 << 10;
+
+// Most records (or snapshot bytes) sent in one frame
+constexpr size_t FRAME_BYTES = 256 << 10;
+
+// A leader with nothing to send says so this often; a follower that hears
+// nothing for much longer gives up on the connection
+constexpr std::chrono::milliseconds HEARTBEAT_INTERVAL{100};
+constexpr int IDLE_TIMEOUT_S = 5;
+
+// Raised to unwind a snapshot that can no longer be sent
+struct StreamClosed {};
+
+void set_timeout(int fd, int option, int seconds) {
+    timeval tv{};
+    tv.tv_sec = seconds;
+    setsockopt(fd, SOL_SOCKET, option, &tv, sizeof(tv));
+}
+
+bool send_all(int fd, const std::string &data) {
+    size_t off = 0;
+    while (off < data.size()) {
+        ssize_t n = send(fd, data.data() + off, data.size() - off, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        off += n;
+    }
+    return true;
+}
+
+void send_message(int fd, uint8_t code, const std::string &body, std::string &frame) {
+    frame.clear();
+    protocol::encode_frame(frame, code, 0, {}, body);
+    if (!send_all(fd, frame)) {
+        throw std::runtime_error("Replication peer went away");
+    }
+}
+
+// Read until buffer starts with a whole frame; false on EOF, error or timeout
+bool read_frame(int fd, std::string &buffer, protocol::FrameHeader &header) {
+    while (!protocol::decode_header(buffer, header) || buffer.size() < header.frame_size()) {
+        if (protocol::decode_header(buffer, header) &&
+            (header.magic != protocol::MAGIC || size_t(header.key_len) + header.value_len > protocol::MAX_BODY_BYTES)) {
+            return false;
+        }
+        char chunk[65536];
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        buffer.append(chunk, n);
+    }
+    return header.magic == protocol::MAGIC;
+}
+
+std::string_view body_of(const std::string &buffer, const protocol::FrameHeader &header) {
+    return std::string_view(buffer).substr(protocol::HEADER_SIZE + header.key_len, header.value_len);
+}
+
+// replication_id u64 | offset u64, also leader_offset | time
+bool decode_pair(std::string_view body, uint64_t &a, uint64_t &b) {
+    return protocol::decode_u64(body, a) && protocol::decode_u64(body.substr(8), b);
+}
+
+std::string encode_pair(uint64_t a, uint64_t b) {
+    std::string body;
+    protocol::encode_u64(body, a);
+    protocol::encode_u64(body, b);
+    return body;
+}
+
+std::string peer_address(int fd) {
+    sockaddr_in addr{};
+    socklen_t len = sizeof(addr);
+    char host[INET_ADDRSTRLEN] = "?";
+    if (getpeername(fd, reinterpret_cast<sockaddr *>(&addr), &len) == 0) {
+        inet_ntop(AF_INET, &addr.sin_addr, host, sizeof(host));
+    }
+    return std::string(host) + ":" + std::to_string(ntohs(addr.sin_port));
+}
+
+int connect_to(const std::string &host, int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) <= 0 ||
+        connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+uint64_t random_id() {
+    std::random_device device;
+    std::mt19937_64 rng((uint64_t(device()) << 32) ^ device() ^ unix_now_ms());
+    uint64_t id;
+    do {
+        id = rng();
+    } while (id == 0); // 0 stands for no position
+    return id;
+}
+
+} // namespace
+
+ReplicationLog::ReplicationLog(size_t backlog_bytes) : replication_id(random_id()), backlog_bytes(backlog_bytes) {}
+
+ReplicationLog::~ReplicationLog() {
+    stop();
+}
+
+void ReplicationLog::append(std::string_view records) {
+    uint64_t now = unix_now_ms();
+    std::lock_guard<std::mutex> lock(mtx);
+    if (chunks.empty() || chunks.back().records.size() >= CHUNK_BYTES) {
+        chunks.push_back(Chunk{end, now, std::string()});
+    }
+    chunks.back().records.append(records);
+    chunks.back().written_at = now;
+    end += records.size();
+    held += records.size();
+
+    // The chunk being filled always stays
+    while (held > backlog_bytes && chunks.size() > 1) {
+        held -= chunks.front().records.size();
+        chunks.pop_front();
+        start = chunks.front().offset;
+    }
+    appended.notify_all();
+}
+
+uint64_t ReplicationLog::end_offset() const {
+    std::lock_guard<std::mutex> lock(mtx);
+    return end;
+}
+
+ReplicationLog::Read ReplicationLog::read(uint64_t offset, size_t max_bytes, std::chrono::milliseconds wait,
+                                          std::string &out, uint64_t &written_at) const {
+    std::unique_lock<std::mutex> lock(mtx);
+    appended.wait_for(lock, wait, [&] { return stopping || end != offset; });
+    if (stopping || offset < start || offset > end) {
+        return Read::Gone;
+    }
+    if (offset == end) {
+        return Read::Timeout;
+    }
+
+    // The chunk holding offset, then whole chunks after it. Offsets handed
+    // out are always record boundaries, but a chunk may have grown since.
+    auto it = std::upper_bound(chunks.begin(), chunks.end(), offset,
+                               [](uint64_t o, const Chunk &chunk) { return o < chunk.offset; });
+    --it;
+    out.assign(it->records, offset - it->offset, std::string::npos);
+    written_at = it->written_at;
+    for (++it; it != chunks.end() && out.size() < max_bytes; ++it) {
+        out += it->records;
+        written_at = it->written_at;
+    }
+    return Read::Data;
+}
+
+void ReplicationLog::serve(KVStore &store, int fd, uint64_t follower_id, uint64_t offset) {
+    std::list<FollowerStatus>::iterator self;
+    bool resume;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (stopping) {
+            close(fd);
+            return;
+        }
+        resume = follower_id == replication_id && offset >= start && offset <= end;
+        if (!resume) {
+            offset = end;
+        }
+        self = streams.insert(streams.end(), FollowerStatus{peer_address(fd), offset, 0, unix_now_ms()});
+    }
+    set_timeout(fd, SO_SNDTIMEO, IDLE_TIMEOUT_S);
+
+    std::string frame;
+    std::string body;
+    std::string inbox;
+    try {
+        if (resume) {
+            send_message(fd, uint8_t(ReplMessage::Continue), encode_pair(replication_id, offset), frame);
+        } else {
+            // Writes made while the snapshot is taken are in it or not, but
+            // are streamed after it anyway; replaying them is harmless
+            send_message(fd, uint8_t(ReplMessage::FullSync), encode_pair(replication_id, offset), frame);
+            uint64_t now = unix_now_ms();
+            try {
+                store.dump([&](const std::string &key, const std::string &value, uint64_t expires_at,
+                               uint64_t version) {
+                    if (is_expired(expires_at, now)) {
+                        return;
+                    }
+                    Storage::encode_put(body, key, value, expires_at, version);
+                    if (body.size() >= FRAME_BYTES) {
+                        frame.clear();
+                        protocol::encode_frame(frame, uint8_t(ReplMessage::Snapshot), 0, {}, body);
+                        if (!send_all(fd, frame)) {
+                            throw StreamClosed();
+                        }
+                        body.clear();
+                    }
+                });
+            } catch (const StreamClosed &) {
+                throw std::runtime_error("Replication peer went away");
+            }
+            if (!body.empty()) {
+                send_message(fd, uint8_t(ReplMessage::Snapshot), body, frame);
+            }
+            send_message(fd, uint8_t(ReplMessage::SnapshotEnd), std::string(), frame);
+        }
+
+        std::string records;
+        while (true) {
+            uint64_t written_at = 0;
+            Read result = read(offset, FRAME_BYTES, HEARTBEAT_INTERVAL, records, written_at);
+            if (result == Read::Gone) {
+                break; // fell out of the backlog; the follower reconnects and syncs fully
+            }
+            if (result == Read::Data) {
+                body = encode_pair(end_offset(), written_at);
+                body += records;
+                send_message(fd, uint8_t(ReplMessage::Records), body, frame);
+                offset += records.size();
+            } else {
+                send_message(fd, uint8_t(ReplMessage::Heartbeat), encode_pair(end_offset(), unix_now_ms()), frame);
+            }
+
+            // Collect the acknowledgements that have come in meanwhile
+            char chunk[4096];
+            ssize_t n;
+            while ((n = recv(fd, chunk, sizeof(chunk), MSG_DONTWAIT)) > 0) {
+                inbox.append(chunk, n);
+            }
+            if (n == 0) {
+                break;
+            }
+            protocol::FrameHeader header;
+            while (protocol::decode_header(inbox, header) && inbox.size() >= header.frame_size()) {
+                uint64_t acked;
+                if (header.code == uint8_t(Opcode::ReplAck) && protocol::decode_u64(body_of(inbox, header), acked)) {
+                    std::lock_guard<std::mutex> lock(mtx);
+                    self->offset = acked;
+                    self->last_ack_ms = unix_now_ms();
+                }
+                inbox.erase(0, header.frame_size());
+            }
+        }
+    } catch (const std::exception &) {
+        // The follower went away; it reconnects on its own
+    }
+
+    close(fd);
+    std::lock_guard<std::mutex> lock(mtx);
+    streams.erase(self);
+    stream_ended.notify_all();
+}
+
+std::vector<FollowerStatus> ReplicationLog::followers() const {
+    std::lock_guard<std::mutex> lock(mtx);
+    std::vector<FollowerStatus> result(streams.begin(), streams.end());
+    for (auto &follower : result) {
+        follower.lag_bytes = end > follower.offset ? end - follower.offset : 0;
+    }
+    return result;
+}
+
+void ReplicationLog::stop() {
+    std::unique_lock<std::mutex> lock(mtx);
+    stopping = true;
+    appended.notify_all();
+    stream_ended.wait(lock, [&] { return streams.empty(); });
+}
+
+Replica::Replica(KVStore &store, const std::string &host, int port, const ReplicaOptions &options)
+    : store(store), host(host), port(port), options(options) {
+    state.replication_id = options.replication_id;
+    state.offset = options.offset;
+    worker = std::thread(&Replica::run, this);
+}
+
+Replica::~Replica() {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        stopping = true;
+        if (fd >= 0) {
+            shutdown(fd, SHUT_RDWR);
+        }
+    }
+    progress.notify_all();
+    worker.join();
+}
+
+ReplicaStatus Replica::status() const {
+    std::lock_guard<std::mutex> lock(mtx);
+    ReplicaStatus s = state;
+    s.lag_bytes = s.leader_offset > s.offset ? s.leader_offset - s.offset : 0;
+    uint64_t now = unix_now_ms();
+    s.lag_ms = s.lag_bytes > 0 && now > applied_written_at ? now - applied_written_at : 0;
+    return s;
+}
+
+bool Replica::wait_for(uint64_t offset, std::chrono::milliseconds timeout) const {
+    std::unique_lock<std::mutex> lock(mtx);
+    return progress.wait_for(lock, timeout, [&] { return state.connected && state.offset >= offset; });
+}
+
+void Replica::run() {
+    while (true) {
+        int sock = connect_to(host, port);
+        if (sock >= 0) {
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                if (stopping) {
+                    close(sock);
+                    return;
+                }
+                fd = sock;
+            }
+            try {
+                stream(sock);
+            } catch (const std::exception &e) {
+                std::lock_guard<std::mutex> lock(mtx);
+                if (!stopping) {
+                    std::cerr << "Replication from " << host << ":" << port << " failed: " << e.what() << "\n";
+                }
+            }
+            std::lock_guard<std::mutex> lock(mtx);
+            fd = -1;
+            state.connected = false;
+            close(sock);
+        }
+
+        std::unique_lock<std::mutex> lock(mtx);
+        if (progress.wait_for(lock, options.retry_interval, [&] { return stopping; })) {
+            return;
+        }
+    }
+}
+
+void Replica::stream(int sock) {
+    set_timeout(sock, SO_RCVTIMEO, IDLE_TIMEOUT_S);
+    set_timeout(sock, SO_SNDTIMEO, IDLE_TIMEOUT_S);
+
+    std::string frame;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        protocol::encode_request(frame, Opcode::Sync, 0, {}, encode_pair(state.replication_id, state.offset));
+    }
+    if (!send_all(sock, frame)) {
+        throw std::runtime_error("Failed to send Sync");
+    }
+
+    std::string buffer;
+    protocol::FrameHeader header;
+    if (!read_frame(sock, buffer, header)) {
+        throw std::runtime_error("Leader closed the connection");
+    }
+    uint64_t id, offset;
+    if (!decode_pair(body_of(buffer, header), id, offset)) {
+        throw std::runtime_error("Malformed Sync reply");
+    }
+    ReplMessage kind = static_cast<ReplMessage>(header.code);
+    buffer.erase(0, header.frame_size());
+    if (kind == ReplMessage::FullSync) {
+        full_sync(sock, buffer, id, offset);
+    } else if (kind == ReplMessage::Continue) {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (id != state.replication_id || offset != state.offset) {
+            throw std::runtime_error("Leader resumed at the wrong position");
+        }
+        state.partial_syncs++;
+    } else {
+        throw std::runtime_error("Unexpected Sync reply");
+    }
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        state.connected = true;
+    }
+    progress.notify_all();
+
+    std::string ack;
+    while (read_frame(sock, buffer, header)) {
+        std::string_view body = body_of(buffer, header);
+        uint64_t leader_offset, time;
+        if (!decode_pair(body, leader_offset, time)) {
+            throw std::runtime_error("Malformed replication frame");
+        }
+        kind = static_cast<ReplMessage>(header.code);
+        if (kind == ReplMessage::Records) {
+            std::string_view records = body.substr(16);
+            uint64_t seq = 0;
+            size_t decoded = Storage::decode_records(records, [&](const std::vector<Storage::LogOp> &ops) {
+                seq = std::max(seq, store.apply_replicated(ops));
+            });
+            store.wait_durable(seq);
+            std::lock_guard<std::mutex> lock(mtx);
+            if (decoded != records.size()) {
+                // Whatever was applied is now off every known position
+                state.replication_id = 0;
+                throw std::runtime_error("Corrupt records in the replication stream");
+            }
+            state.offset += records.size();
+            applied_written_at = time;
+        } else if (kind != ReplMessage::Heartbeat) {
+            throw std::runtime_error("Unexpected replication frame");
+        }
+        buffer.erase(0, header.frame_size());
+
+        uint64_t applied;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            state.leader_offset = std::max(leader_offset, state.offset);
+            applied = state.offset;
+        }
+        progress.notify_all();
+
+        ack.clear();
+        std::string position;
+        protocol::encode_u64(position, applied);
+        protocol::encode_request(ack, Opcode::ReplAck, 0, {}, position);
+        if (!send_all(sock, ack)) {
+            break;
+        }
+    }
+    throw std::runtime_error("Lost the connection to the leader");
+}
+
+// Replace the store's contents with the leader's snapshot: every key it
+// sends is written, and the keys it did not send are deleted at the end
+void Replica::full_sync(int sock, std::string &buffer, uint64_t id, uint64_t offset) {
+    {
+        // The store stops matching the old position with the first write
+        std::lock_guard<std::mutex> lock(mtx);
+        state.replication_id = 0;
+        state.offset = 0;
+    }
+    std::unordered_set<std::string> stale;
+    store.dump([&](const std::string &key, const std::string &, uint64_t, uint64_t) { stale.insert(key); });
+
+    uint64_t seq = 0;
+    protocol::FrameHeader header;
+    while (true) {
+        if (!read_frame(sock, buffer, header)) {
+            throw std::runtime_error("Lost the connection during a full sync");
+        }
+        ReplMessage kind = static_cast<ReplMessage>(header.code);
+        if (kind == ReplMessage::SnapshotEnd) {
+            buffer.erase(0, header.frame_size());
+            break;
+        }
+        if (kind != ReplMessage::Snapshot) {
+            throw std::runtime_error("Unexpected frame during a full sync");
+        }
+        std::string_view records = body_of(buffer, header);
+        size_t decoded = Storage::decode_records(records, [&](const std::vector<Storage::LogOp> &ops) {
+            for (const auto &op : ops) {
+                stale.erase(std::string(op.key));
+            }
+            seq = std::max(seq, store.apply_replicated(ops));
+        });
+        if (decoded != records.size()) {
+            throw std::runtime_error("Corrupt snapshot in the replication stream");
+        }
+        buffer.erase(0, header.frame_size());
+    }
+
+    std::vector<std::string> doomed(stale.begin(), stale.end());
+    for (size_t i = 0; i < doomed.size(); i += 1000) {
+        std::vector<std::string> keys(doomed.begin() + i, doomed.begin() + std::min(doomed.size(), i + 1000));
+        uint64_t removed_seq;
+        store.multi_remove_nowait(keys, removed_seq);
+        seq = std::max(seq, removed_seq);
+    }
+    store.wait_durable(seq);
+
+    std::lock_guard<std::mutex> lock(mtx);
+    state.replication_id = id;
+    state.offset = offset;
+    state.leader_offset = offset;
+    state.full_syncs++;
+    applied_written_at = unix_now_ms();
+}
@@ -1,35 +1,405 @@
 #include "server.hpp"
+#include "expiry.hpp"
+#include "protocol.hpp"
 #include <iostream>
 #include <thread>
+#include <vector>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <fcntl.h>
 #include <unistd.h>
+#include <cerrno>
+#include <charconv>
+#include <cstdio>
 #include <cstring>
 
-KVServer::KVServer(KVStore* kv, int port) : kvstore(kv), port(port) {}
+namespace {
 
-void KVServer::run() {
+using protocol::Opcode;
+using protocol::Status;
+using Clock = std::chrono::steady_clock;
+
+constexpr size_t READ_CHUNK = 16384;
+constexpr size_t MAX_LINE_BYTES = 64 << 20; // longest unterminated text request we buffer
+constexpr int MAX_EVENTS = 256;
+constexpr size_t OWNED_CHUNK_BYTES = 4096; // values at least this big skip the copy into tail()
+constexpr int MAX_IOV = 64;
+
+// A SCAN reply holds at most this many entries, and stops early once it
+// passes this many bytes; clients page through bigger ranges
+constexpr size_t SCAN_PAGE_ENTRIES = 1000;
+constexpr size_t SCAN_PAGE_BYTES = 1 << 20;
+
+// Per-connection state owned by one reactor thread
+struct Connection {
+    int fd = -1;
+    std::string inbuf;
+    OutputQueue out;
+    bool want_write = false; // EPOLLOUT currently registered
+};
+
+bool set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+// Read straight into the tail of buf instead of bouncing through a stack buffer
+ssize_t read_into(int fd, std::string& buf) {
+    size_t old = buf.size();
+    buf.resize(old + READ_CHUNK);
+    ssize_t r = read(fd, &buf[old], READ_CHUNK);
+    buf.resize(old + (r > 0 ? r : 0));
+    return r;
+}
+
+// Split the next space-delimited token off the front of line
+std::string_view next_token(std::string_view& line) {
+    size_t start = line.find_first_not_of(' ');
+    if (start == std::string_view::npos) {
+        line = {};
+        return {};
+    }
+    size_t end = line.find(' ', start);
+    std::string_view token = line.substr(start, end == std::string_view::npos ? std::string_view::npos : end - start);
+    line = end == std::string_view::npos ? std::string_view() : line.substr(end);
+    return token;
+}
+
+bool parse_text_opcode(std::string_view cmd, Opcode& op) {
+    if (cmd == "PUT") op = Opcode::Put;
+    else if (cmd == "GET") op = Opcode::Get;
+    else if (cmd == "DELETE") op = Opcode::Delete;
+    else if (cmd == "PERSIST") op = Opcode::Persist;
+    else if (cmd == "MPUT") op = Opcode::MPut;
+    else if (cmd == "MGET") op = Opcode::MGet;
+    else if (cmd == "MDELETE") op = Opcode::MDelete;
+    else if (cmd == "SCAN") op = Opcode::Scan;
+    else if (cmd == "REPLICATION") op = Opcode::ReplInfo;
+    else if (cmd == "CLUSTER") op = Opcode::ClusterInfo;
+    else if (cmd == "STATS") op = Opcode::Stats;
+    else if (cmd == "GETV") op = Opcode::GetVersion;
+    else if (cmd == "CAS") op = Opcode::Cas;
+    else if (cmd == "INCRBY") op = Opcode::IncrBy;
+    else if (cmd == "APPEND") op = Opcode::Append;
+    else return false;
+    return true;
+}
+
+// Parse a decimal count, saturating instead of overflowing
+bool parse_count(std::string_view token, size_t& n) {
+    n = 0;
+    for (char c : token) {
+        if (c < '0' || c > '9') {
+            return false;
+        }
+        n = std::min<size_t>(n * 10 + (c - '0'), UINT32_MAX);
+    }
+    return true;
+}
+
+// A whole decimal number of type T and nothing else
+template <typename T>
+bool parse_number(std::string_view token, T& n) {
+    auto result = std::from_chars(token.data(), token.data() + token.size(), n);
+    return !token.empty() && result.ec == std::errc() && result.ptr == token.data() + token.size();
+}
+
+bool is_multi(Opcode op) {
+    return op == Opcode::MPut || op == Opcode::MGet || op == Opcode::MDelete;
+}
+
+bool is_raft_rpc(Opcode op) {
+    return op == Opcode::RequestVote || op == Opcode::AppendEntries || op == Opcode::InstallSnapshot;
+}
+
+bool is_cluster_rpc(Opcode op) {
+    return op == Opcode::ClusterSet || op == Opcode::ClusterPull;
+}
+
+// Writes that read the key's current value first, and answer with a value
+bool is_atomic(Opcode op) {
+    return op == Opcode::Cas || op == Opcode::IncrBy || op == Opcode::Append;
+}
+
+bool is_keyed(Opcode op) {
+    return op == Opcode::Put || op == Opcode::PutEx || op == Opcode::Get || op == Opcode::Delete ||
+           op == Opcode::GetVersion || is_atomic(op);
+}
+
+// The level a request's flags ask for, or fallback for none or an unknown one
+Durability requested_level(uint16_t flags, Durability fallback) {
+    unsigned level = flags & protocol::FLAG_DURABILITY;
+    if (level < static_cast<unsigned>(Durability::Always) || level > static_cast<unsigned>(Durability::None)) {
+        return fallback;
+    }
+    return static_cast<Durability>(level);
+}
+
+bool is_write(Opcode op) {
+    return op == Opcode::Put || op == Opcode::PutEx || op == Opcode::Delete || op == Opcode::MPut ||
+           op == Opcode::MDelete || is_atomic(op);
+}
+
+void format_text_reply(OutputQueue& queue, Opcode op, Status status, std::string& result) {
+    if (status == Status::Ok && op == Opcode::Get && result.size() >= OWNED_CHUNK_BYTES) {
+        queue.append_owned(std::move(result));
+        queue.tail() += '\n';
+        return;
+    }
+
+    // The versioned and atomic commands' results are in their binary form
+    std::string& out = queue.tail();
+    uint64_t n = 0;
+    std::string_view value;
+    switch (status) {
+    case Status::Ok:
+        if (op == Opcode::Get) {
+            out += result;
+            out += '\n';
+        } else if (op == Opcode::GetVersion && protocol::decode_versioned_value(result, n, value)) {
+            out += std::to_string(n);
+            out += ' ';
+            out += value;
+            out += '\n';
+        } else if (op == Opcode::Cas && protocol::decode_u64(result, n)) {
+            out += "OK " + std::to_string(n) + "\n";
+        } else if (op == Opcode::IncrBy && protocol::decode_u64(result, n)) {
+            out += std::to_string(static_cast<int64_t>(n)) + "\n";
+        } else if (op == Opcode::Append && protocol::decode_u64(result, n)) {
+            out += std::to_string(n) + "\n";
+        } else if (op == Opcode::ReplInfo || op == Opcode::ClusterInfo || op == Opcode::Stats) {
+            out += result;
+            out += "END\n";
+        } else {
+            out += "OK\n";
+        }
+        break;
+    case Status::NotFound:
+        out += "KEY NOT_FOUND\n";
+        break;
+    case Status::Error:
+        out += "ERROR\n";
+        break;
+    case Status::UnknownCmd:
+        out += "UNKNOWN_CMD\n";
+        break;
+    case Status::ReadOnly:
+        out += "READONLY\n";
+        break;
+    case Status::NotLeader:
+        // REDIRECT <host:port>, or a bare REDIRECT while there is no leader
+        out += "REDIRECT";
+        if (!result.empty()) {
+            out += ' ';
+            out += result;
+        }
+        out += '\n';
+        break;
+    case Status::Moved:
+        out += "MOVED " + result + "\n";
+        break;
+    case Status::Conflict:
+        protocol::decode_u64(result, n);
+        out += "CONFLICT " + std::to_string(n) + "\n";
+        break;
+    }
+}
+
+// MGET answers one line per key, MDELETE the number of keys removed
+void format_multi_text_reply(OutputQueue& queue, Opcode op, Status status,
+                             const std::vector<std::optional<std::string>>& values, size_t removed) {
+    std::string& out = queue.tail();
+    if (status == Status::ReadOnly) {
+        out += "READONLY\n";
+    } else if (status != Status::Ok) {
+        out += "ERROR\n";
+    } else if (op == Opcode::MGet) {
+        for (const auto& value : values) {
+            out += value ? *value : "KEY NOT_FOUND";
+            out += '\n';
+        }
+    } else if (op == Opcode::MDelete) {
+        out += "DELETED " + std::to_string(removed) + "\n";
+    } else {
+        out += "OK\n";
+    }
+}
+
+// SCAN answers one "key value" line per entry, then MORE if the range goes
+// on past the last key or END if it does not
+void format_scan_text_reply(OutputQueue& queue, Status status,
+                            const std::vector<std::pair<std::string, std::string>>& entries, bool more) {
+    std::string& out = queue.tail();
+    if (status != Status::Ok) {
+        out += "ERROR\n";
+        return;
+    }
+    for (const auto& entry : entries) {
+        out += entry.first;
+        out += ' ';
+        out += entry.second;
+        out += '\n';
+    }
+    out += more ? "MORE\n" : "END\n";
+}
+
+// Lower-case opcode names for STATS and the metrics endpoint; "unknown"
+// for values no opcode uses
+const char* opcode_name(size_t op) {
+    static const char* const names[] = {
+        "unknown", "put", "get", "delete", "persist", "mput", "mget", "mdelete", "scan", "putex", "sync",
+        "repl_ack", "repl_info", "request_vote", "append_entries", "install_snapshot", "cluster_info",
+        "cluster_set", "cluster_pull", "durable", "stats", "getv", "cas", "incrby", "append",
+    };
+    return op < sizeof(names) / sizeof(names[0]) ? names[op] : "unknown";
+}
+
+std::string format_us(uint64_t ns) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.1f", ns / 1000.0);
+    return buf;
+}
+
+// Many idle connections need many descriptors; lift the soft limit to the hard one
+void raise_fd_limit() {
+    rlimit lim{};
+    if (getrlimit(RLIMIT_NOFILE, &lim) == 0 && lim.rlim_cur < lim.rlim_max) {
+        lim.rlim_cur = lim.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &lim);
+    }
+}
+
+void format_binary_reply(OutputQueue& queue, uint32_t request_id, Status status, std::string& result) {
+    bool has_value = status == Status::Ok || status == Status::NotLeader || status == Status::Moved ||
+                     status == Status::Conflict;
+    std::string_view value = has_value ? std::string_view(result) : std::string_view();
+    if (value.size() >= OWNED_CHUNK_BYTES) {
+        protocol::encode_header(queue.tail(), static_cast<uint8_t>(status), request_id,
+                                0, static_cast<uint32_t>(value.size()));
+        queue.append_owned(std::move(result));
+        return;
+    }
+    protocol::encode_response(queue.tail(), status, request_id, value);
+}
+
+} // namespace
+
+std::string& OutputQueue::tail() {
+    if (chunks.empty() || sealed) {
+        chunks.emplace_back();
+        sealed = false;
+    }
+    return chunks.back();
+}
+
+void OutputQueue::append_owned(std::string&& chunk) {
+    chunks.push_back(std::move(chunk));
+    sealed = true;
+}
+
+bool OutputQueue::write_to(int fd) {
+    while (!chunks.empty()) {
+        iovec iov[MAX_IOV];
+        int count = 0;
+        for (auto it = chunks.begin(); it != chunks.end() && count < MAX_IOV; ++it, ++count) {
+            size_t skip = count == 0 ? head_off : 0;
+            iov[count].iov_base = const_cast<char*>(it->data()) + skip;
+            iov[count].iov_len = it->size() - skip;
+        }
+
+        // sendmsg rather than writev, so a client that has gone away is an
+        // EPIPE for this connection and not a SIGPIPE for the process
+        msghdr msg{};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = count;
+        ssize_t n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+
+        sent += n;
+        size_t left = n;
+        while (left > 0) {
+            size_t avail = chunks.front().size() - head_off;
+            if (left < avail) {
+                head_off += left;
+                break;
+            }
+            left -= avail;
+            chunks.pop_front();
+            head_off = 0;
+        }
+    }
+    sealed = false;
+    return true;
+}
+
+KVServer::KVServer(KVStore* kv, int port, const ServerOptions& options)
+    : kvstore(kv), port(port), options(options) {}
+
+int KVServer::open_listener(int listen_port, bool reuse_port) {
     int server_fd = socket(AF_INET, SOCK_STREAM, 0);
     if (server_fd < 0) {
         perror("socket");
-        return;
+        return -1;
+    }
+
+    int one = 1;
+    setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (reuse_port && setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0) {
+        perror("setsockopt(SO_REUSEPORT)");
+        close(server_fd);
+        return -1;
     }
 
     sockaddr_in addr{};
     addr.sin_family = AF_INET;
     addr.sin_addr.s_addr = INADDR_ANY;
-    addr.sin_port = htons(port);
+    addr.sin_port = htons(listen_port);
 
     if (bind(server_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
         perror("bind");
-        return;
+        close(server_fd);
+        return -1;
     }
 
-    if (listen(server_fd, 5) < 0) {
+    if (listen(server_fd, options.backlog) < 0) {
         perror("listen");
+        close(server_fd);
+        return -1;
+    }
+    return server_fd;
+}
+
+void KVServer::run() {
+    raise_fd_limit();
+    if (options.metrics_port > 0) {
+        int fd = open_listener(options.metrics_port, false);
+        if (fd >= 0) {
+            std::cout << "Metrics served on port " << options.metrics_port << "\n";
+            std::thread(&KVServer::serve_metrics, this, fd).detach();
+        }
+    }
+    if (options.mode == ServerMode::Threaded) {
+        run_threaded();
+    } else {
+        run_epoll();
+    }
+}
+
+void KVServer::run_threaded() {
+    int server_fd = open_listener(port, false);
+    if (server_fd < 0) {
         return;
     }
 
-    std::cout << "KVServer listening on port " << port << "\n";
+    std::cout << "KVServer listening on port " << port << " (thread per connection)\n";
 
     while (true) {
         int client_sock = accept(server_fd, nullptr, nullptr);
@@ -37,52 +407,891 @@ void KVServer::run() {
             perror("accept");
             continue;
         }
+        stats->accepted.add();
         std::thread(&KVServer::handle_client, this, client_sock).detach();
     }
 }
 
+void KVServer::run_epoll() {
+    int threads = options.io_threads;
+    if (threads <= 0) {
+        threads = std::max(4u, std::thread::hardware_concurrency());
+    }
+
+    // Every reactor owns a SO_REUSEPORT listener, so the kernel spreads
+    // incoming connections without a shared accept queue or hand-off
+    std::vector<int> listeners;
+    for (int i = 0; i < threads; i++) {
+        int fd = open_listener(port, true);
+        if (fd < 0) {
+            for (int l : listeners) close(l);
+            return;
+        }
+        set_nonblocking(fd);
+        listeners.push_back(fd);
+    }
+
+    std::cout << "KVServer listening on port " << port << " (" << threads << " epoll threads)\n";
+
+    std::vector<std::thread> workers;
+    for (int i = 1; i < threads; i++) {
+        workers.emplace_back(&KVServer::io_loop, this, listeners[i]);
+    }
+    io_loop(listeners[0]);
+    for (auto& w : workers) {
+        w.join();
+    }
+}
+
+void KVServer::io_loop(int listen_fd) {
+    int ep = epoll_create1(0);
+    if (ep < 0) {
+        perror("epoll_create1");
+        return;
+    }
+
+    // The listener is tagged with a null pointer, connections with their state
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.ptr = nullptr;
+    epoll_ctl(ep, EPOLL_CTL_ADD, listen_fd, &ev);
+
+    auto close_conn = [this, ep](Connection* conn) {
+        epoll_ctl(ep, EPOLL_CTL_DEL, conn->fd, nullptr);
+        close(conn->fd);
+        delete conn;
+        stats->closed.add();
+    };
+
+    // Write as much as the socket takes, toggling EPOLLOUT as needed
+    auto flush = [this, ep](Connection* conn) {
+        bool ok = conn->out.write_to(conn->fd);
+        stats->bytes_out.add(conn->out.take_sent());
+        if (!ok) {
+            return false;
+        }
+
+        bool pending = !conn->out.empty();
+        if (pending != conn->want_write) {
+            epoll_event mod{};
+            mod.events = pending ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+            mod.data.ptr = conn;
+            epoll_ctl(ep, EPOLL_CTL_MOD, conn->fd, &mod);
+            conn->want_write = pending;
+        }
+        return true;
+    };
+
+    epoll_event events[MAX_EVENTS];
+
+    while (true) {
+        int n = epoll_wait(ep, events, MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.ptr == nullptr) {
+                while (true) {
+                    int client_sock = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK);
+                    if (client_sock < 0) {
+                        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                            perror("accept");
+                        }
+                        break;
+                    }
+                    int one = 1;
+                    setsockopt(client_sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                    stats->accepted.add();
+
+                    Connection* conn = new Connection();
+                    conn->fd = client_sock;
+                    epoll_event cev{};
+                    cev.events = EPOLLIN;
+                    cev.data.ptr = conn;
+                    if (epoll_ctl(ep, EPOLL_CTL_ADD, client_sock, &cev) < 0) {
+                        perror("epoll_ctl");
+                        close(client_sock);
+                        delete conn;
+                        stats->closed.add();
+                    }
+                }
+                continue;
+            }
+
+            Connection* conn = static_cast<Connection*>(events[i].data.ptr);
+            bool alive = true;
+            bool eof = false;
+
+            if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                while (true) {
+                    ssize_t r = read_into(conn->fd, conn->inbuf);
+                    if (r > 0) {
+                        stats->bytes_in.add(r);
+                        if (static_cast<size_t>(r) < READ_CHUNK) break;
+                        continue;
+                    }
+                    if (r < 0 && errno == EINTR) continue;
+                    if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+                    eof = true; // peer closed or hard error; answer what we have first
+                    break;
+                }
+                std::optional<SyncRequest> sync;
+                if (!conn->inbuf.empty() && !process_input(conn->inbuf, conn->out, sync)) {
+                    alive = false;
+                }
+                if (alive && sync) {
+                    // A follower's stream blocks on the log, so it gets a
+                    // thread of its own rather than a slot in the reactor
+                    epoll_ctl(ep, EPOLL_CTL_DEL, conn->fd, nullptr);
+                    std::thread([this, fd = conn->fd, out = std::move(conn->out), sync = *sync]() mutable {
+                        serve_follower(fd, out, sync);
+                    }).detach();
+                    delete conn;
+                    stats->closed.add(); // a follower's stream is no longer a client connection
+                    continue;
+                }
+            }
+
+            if (alive && !conn->out.empty()) {
+                alive = flush(conn);
+            }
+            if (!alive || eof) {
+                close_conn(conn);
+            }
+        }
+    }
+    close(ep);
+}
+
 void KVServer::handle_client(int client_sock) {
-    char buffer[1024];
+    std::string inbuf;
+    OutputQueue out;
+    std::optional<SyncRequest> sync;
     while (true) {
-        memset(buffer, 0, sizeof(buffer));
-        int n = read(client_sock, buffer, sizeof(buffer) - 1);
-        if (n <= 0) break;
-
-        std::string request(buffer);
-        std::istringstream iss(request);
-        std::string cmd;
-        iss >> cmd;
-
-        std::string response;
-
-        if (cmd == "PUT") {
-            std::string key, value;
-            iss >> key >> value;
-            if (kvstore->put(key, value)) response = "OK\n";
-            else response = "ERROR\n";
-
-        } else if (cmd == "GET") {
-            std::string key;
-            iss >> key;
-            std::string val;
-            if (kvstore->get(key, val)) response = val + "\n";
-            else response = "KEY NOT_FOUND\n";
-
-        } else if (cmd == "DELETE") {
-            std::string key;
-            iss >> key;
-            if (kvstore->remove(key)) response = "OK\n";
-            else response = "KEY NOT_FOUND\n";
-
-        } else if (cmd == "PERSIST") {
+        ssize_t r = read_into(client_sock, inbuf);
+        if (r <= 0) break;
+        stats->bytes_in.add(r);
+        if (!process_input(inbuf, out, sync)) break;
+        if (sync) {
+            stats->closed.add();
+            serve_follower(client_sock, out, *sync);
+            return;
+        }
+        bool ok = out.write_to(client_sock);
+        stats->bytes_out.add(out.take_sent());
+        if (!ok) break;
+    }
+    close(client_sock);
+    stats->closed.add();
+}
+
+void KVServer::serve_follower(int fd, OutputQueue& out, SyncRequest sync) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags & ~O_NONBLOCK) < 0 || !out.write_to(fd)) {
+        close(fd);
+        return;
+    }
+    kvstore->replication_log()->serve(*kvstore, fd, sync.replication_id, sync.offset);
+}
+
+bool KVServer::process_input(std::string& inbuf, OutputQueue& out, std::optional<SyncRequest>& sync) {
+    size_t pos = 0;
+    PendingWrites pending;
+    std::string result;
+    std::vector<std::string_view> args;
+    std::vector<std::optional<std::string>> values;
+    size_t removed = 0;
+    std::vector<std::pair<std::string, std::string>> entries;
+    bool more = false;
+    std::string text_body;
+
+    // The batch waits once, for the strictest level any of its writes asked for
+    auto wrote = [&](Opcode op, Status status, Durability level) {
+        if (status == Status::Ok && is_write(op)) {
+            pending.level = std::min(pending.level, level);
+        }
+    };
+
+    // Each request is timed from the end of the one before, so timing costs
+    // a single clock read per request
+    Clock::time_point last = Clock::now();
+    auto timed = [&](Opcode op) {
+        Clock::time_point now = Clock::now();
+        size_t index = static_cast<size_t>(op);
+        stats->requests[index < Metrics::OPCODES ? index : 0].record(now - last);
+        last = now;
+    };
+
+    while (pos < inbuf.size()) {
+        std::string_view rest(inbuf.data() + pos, inbuf.size() - pos);
+
+        if (static_cast<uint8_t>(rest[0]) == protocol::MAGIC) {
+            protocol::FrameHeader header;
+            if (!protocol::decode_header(rest, header)) break;
+            if (size_t(header.key_len) + header.value_len > protocol::MAX_BODY_BYTES) {
+                protocol::encode_response(out.tail(), Status::Error, header.request_id);
+                return false;
+            }
+            if (rest.size() < header.frame_size()) {
+                // Large value still streaming in; size the buffer once for the whole frame
+                inbuf.reserve(pos + header.frame_size());
+                break;
+            }
+
+            Opcode op = static_cast<Opcode>(header.code);
+            std::string_view key = rest.substr(protocol::HEADER_SIZE, header.key_len);
+            std::string_view value = rest.substr(protocol::HEADER_SIZE + header.key_len, header.value_len);
+            if (op == Opcode::Sync) {
+                uint64_t id, offset;
+                if (kvstore->replication_log() && protocol::decode_u64(value, id) &&
+                    protocol::decode_u64(value.substr(std::min<size_t>(8, value.size())), offset)) {
+                    pos += header.frame_size();
+                    sync = SyncRequest{id, offset};
+                    break;
+                }
+                protocol::encode_response(out.tail(), Status::Error, header.request_id);
+            } else if (is_raft_rpc(op)) {
+                result.clear();
+                bool answered = options.raft && options.raft->handle(op, value, result);
+                format_binary_reply(out, header.request_id, answered ? Status::Ok : Status::Error, result);
+            } else if (is_cluster_rpc(op)) {
+                result.clear();
+                bool answered = options.cluster && options.cluster->handle(op, value, result);
+                format_binary_reply(out, header.request_id, answered ? Status::Ok : Status::Error, result);
+            } else if (is_multi(op)) {
+                Status status = Status::Error;
+                result.clear();
+                if (key.empty() && protocol::decode_strings(value, args)) {
+                    status = execute_multi(op, args, values, removed, result, pending);
+                }
+                wrote(op, status, requested_level(header.flags, kvstore->durability()));
+                if (status == Status::Ok && op == Opcode::MGet) {
+                    protocol::encode_values(result, values);
+                } else if (status == Status::Ok && op == Opcode::MDelete) {
+                    protocol::encode_u32(result, static_cast<uint32_t>(removed));
+                }
+                format_binary_reply(out, header.request_id, status, result);
+            } else if (op == Opcode::Scan) {
+                Status status = Status::Error;
+                uint32_t limit;
+                std::string_view end;
+                result.clear();
+                if (protocol::decode_scan_request(value, limit, end)) {
+                    settle(pending);
+                    status = execute_scan(key, end, limit, entries, more);
+                }
+                if (status == Status::Ok) {
+                    protocol::encode_entries(result, entries, more);
+                }
+                format_binary_reply(out, header.request_id, status, result);
+            } else if (op == Opcode::Durable) {
+                Status status = Status::Error;
+                uint64_t lsn = UINT64_MAX;
+                result.clear();
+                if (value.empty() || protocol::decode_u64(value, lsn)) {
+                    status = execute_durable(lsn, requested_level(header.flags, Durability::Always), pending);
+                }
+                if (status == Status::Ok) {
+                    protocol::encode_u64(result, kvstore->durable_lsn());
+                }
+                format_binary_reply(out, header.request_id, status, result);
+            } else {
+                uint64_t before = pending.durable_seq;
+                Status status = execute(op, key, value, result, pending);
+                wrote(op, status, requested_level(header.flags, kvstore->durability()));
+                if (status == Status::Ok && is_write(op) && !is_atomic(op) &&
+                    (header.flags & protocol::FLAG_RETURN_LSN)) {
+                    result.clear();
+                    protocol::encode_u64(result, pending.durable_seq != before ? pending.durable_seq : 0);
+                }
+                format_binary_reply(out, header.request_id, status, result);
+            }
+            pos += header.frame_size();
+            timed(op);
+            continue;
+        }
+
+        size_t newline = rest.find('\n');
+        if (newline == std::string_view::npos) {
+            if (rest.size() > MAX_LINE_BYTES) return false;
+            break;
+        }
+        std::string_view line = rest.substr(0, newline);
+        if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+        pos += newline + 1;
+
+        Opcode op;
+        std::string_view cmd = next_token(line);
+        if (!parse_text_opcode(cmd, op)) {
+            format_text_reply(out, Opcode::Get, Status::UnknownCmd, result);
+            continue;
+        }
+        if (is_multi(op)) {
+            args.clear();
+            for (std::string_view arg; !(arg = next_token(line)).empty();) {
+                args.push_back(arg);
+            }
+            Status status = execute_multi(op, args, values, removed, result, pending);
+            wrote(op, status, kvstore->durability());
+            if (status == Status::NotLeader || status == Status::Moved) {
+                format_text_reply(out, op, status, result);
+            } else {
+                format_multi_text_reply(out, op, status, values, removed);
+            }
+            timed(op);
+            continue;
+        }
+        if (op == Opcode::Scan) {
+            // SCAN <start> [<end> [<limit>]], with - for no start and + for no end
+            std::string_view start = next_token(line);
+            std::string_view end = next_token(line);
+            std::string_view limit = next_token(line);
+            Status status = Status::Error;
+            size_t n = 0;
+            if (!start.empty() && (limit.empty() || parse_count(limit, n))) {
+                settle(pending);
+                status = execute_scan(start == "-" ? std::string_view() : start,
+                                      end == "+" ? std::string_view() : end, n, entries, more);
+            }
+            format_scan_text_reply(out, status, entries, more);
+            timed(op);
+            continue;
+        }
+        std::string_view key = next_token(line);
+        std::string_view value = next_token(line);
+        std::string_view option = next_token(line);
+        if (op == Opcode::Put && (option == "EX" || option == "ex")) {
+            // PUT <key> <value> EX <seconds> goes through the PutEx path
+            size_t seconds = 0;
+            if (!parse_count(next_token(line), seconds) || seconds == 0) {
+                format_text_reply(out, op, Status::Error, result);
+                timed(op);
+                continue;
+            }
+            text_body.clear();
+            protocol::encode_ttl_value(text_body, static_cast<uint32_t>(seconds), value);
+            op = Opcode::PutEx;
+            value = text_body;
+        } else if (op == Opcode::Cas || op == Opcode::IncrBy) {
+            // CAS <key> <expected_version> <value> and INCRBY <key> <delta>
+            // are turned into the binary bodies execute() takes
+            uint64_t expected = 0;
+            int64_t delta = 0;
+            bool parsed = op == Opcode::Cas ? parse_number(value, expected) : parse_number(value, delta);
+            if (!parsed) {
+                format_text_reply(out, op, Status::Error, result);
+                timed(op);
+                continue;
+            }
+            text_body.clear();
+            if (op == Opcode::Cas) {
+                protocol::encode_versioned_value(text_body, expected, option);
+            } else {
+                protocol::encode_u64(text_body, static_cast<uint64_t>(delta));
+            }
+            value = text_body;
+        }
+        Status status = execute(op, key, value, result, pending);
+        wrote(op, status, kvstore->durability());
+        format_text_reply(out, op, status, result);
+        timed(op);
+    }
+    inbuf.erase(0, pos);
+
+    // Acknowledge the batch's writes only once they are on disk, or with
+    // Raft committed. If the log failed, drop the connection rather than
+    // send OKs for lost writes.
+    settle(pending);
+    if (pending.lost) {
+        return false;
+    }
+    if (pending.durable_seq != 0) {
+        try {
+            kvstore->wait_durable(pending.durable_seq, pending.level);
+        } catch (const std::exception&) {
+            return false;
+        }
+        if (pending.level != Durability::None) {
+            stats->durable_waits.record(Clock::now() - last);
+        }
+    }
+    return true;
+}
+
+Status KVServer::execute_durable(uint64_t lsn, Durability level, PendingWrites& pending) {
+    // Writes earlier in the batch come first, whatever they asked for
+    settle(pending);
+    if (pending.lost) {
+        return Status::Error;
+    }
+    try {
+        if (pending.durable_seq != 0) {
+            kvstore->wait_durable(pending.durable_seq, std::min(pending.level, level));
+        }
+        kvstore->wait_durable(lsn, level);
+    } catch (const std::exception&) {
+        return Status::Error;
+    }
+    return Status::Ok;
+}
+
+Status KVServer::propose(std::string records, std::string& result, PendingWrites& pending) {
+    uint64_t index, term;
+    if (!options.raft->propose(std::move(records), index, term)) {
+        result = options.raft->leader_address();
+        return Status::NotLeader;
+    }
+    if (pending.raft_index != 0 && pending.raft_term != term) {
+        settle(pending);
+    }
+    pending.raft_index = index;
+    pending.raft_term = term;
+    return Status::Ok;
+}
+
+void KVServer::settle(PendingWrites& pending) {
+    if (pending.raft_index != 0 && !options.raft->wait_applied(pending.raft_index, pending.raft_term)) {
+        pending.lost = true;
+    }
+    pending.raft_index = 0;
+}
+
+Status KVServer::execute(Opcode op, std::string_view key, std::string_view value,
+                         std::string& result, PendingWrites& pending) {
+    uint64_t seq = 0;
+    uint64_t& durable_seq = pending.durable_seq;
+    if (options.replica && is_write(op)) {
+        return Status::ReadOnly;
+    }
+    if (options.cluster && is_keyed(op)) {
+        Status routed = options.cluster->route(key, result);
+        if (routed != Status::Ok) return routed;
+    }
+
+    // A bad request must not take the connection's thread down with it
+    try {
+        if (options.raft) {
+            // Writes become log entries, applied to the store once committed
+            std::string records;
+            uint32_t ttl_seconds = 0;
+            std::string_view payload = value;
+            switch (op) {
+            case Opcode::PutEx:
+                if (!protocol::decode_ttl_value(value, ttl_seconds, payload) || ttl_seconds == 0) return Status::Error;
+                [[fallthrough]];
+            case Opcode::Put:
+                if (key.empty()) return Status::Error;
+                Storage::encode_put(records, std::string(key), std::string(payload),
+                                    ttl_seconds == 0 ? 0 : unix_now_ms() + uint64_t(ttl_seconds) * 1000);
+                return propose(std::move(records), result, pending);
+            case Opcode::Delete:
+                settle(pending);
+                if (!kvstore->get(std::string(key), result)) return Status::NotFound;
+                Storage::encode_remove(records, std::string(key));
+                return propose(std::move(records), result, pending);
+            case Opcode::Get:
+            case Opcode::GetVersion:
+                settle(pending);
+                break;
+            case Opcode::Cas:
+            case Opcode::IncrBy:
+            case Opcode::Append:
+                // A proposal is applied long after it is made, so there
+                // is nothing to check the key's current value against
+                return Status::Error;
+            default:
+                break;
+            }
+        }
+
+        switch (op) {
+        case Opcode::Put:
+            if (!kvstore->put_nowait(std::string(key), std::string(value), seq)) return Status::Error;
+            durable_seq = std::max(durable_seq, seq);
+            return Status::Ok;
+
+        case Opcode::PutEx: {
+            uint32_t ttl_seconds;
+            std::string_view payload;
+            if (!protocol::decode_ttl_value(value, ttl_seconds, payload) || ttl_seconds == 0) return Status::Error;
+            if (!kvstore->put_nowait(std::string(key), std::string(payload), seq,
+                                     std::chrono::seconds(ttl_seconds))) {
+                return Status::Error;
+            }
+            durable_seq = std::max(durable_seq, seq);
+            return Status::Ok;
+        }
+
+        case Opcode::Get:
+            return kvstore->get(std::string(key), result) ? Status::Ok : Status::NotFound;
+
+        case Opcode::GetVersion: {
+            std::string found;
+            uint64_t version;
+            if (!kvstore->get(std::string(key), found, version)) return Status::NotFound;
+            result.clear();
+            protocol::encode_versioned_value(result, version, found);
+            return Status::Ok;
+        }
+
+        case Opcode::Cas: {
+            uint64_t expected, version;
+            std::string_view payload;
+            if (key.empty() || !protocol::decode_versioned_value(value, expected, payload)) return Status::Error;
+            bool written =
+                kvstore->compare_and_set_nowait(std::string(key), expected, std::string(payload), version, seq);
+            result.clear();
+            protocol::encode_u64(result, version);
+            if (!written) return Status::Conflict;
+            durable_seq = std::max(durable_seq, seq);
+            return Status::Ok;
+        }
+
+        case Opcode::IncrBy: {
+            uint64_t delta;
+            int64_t sum;
+            if (value.size() != 8 || !protocol::decode_u64(value, delta) ||
+                !kvstore->increment_nowait(std::string(key), static_cast<int64_t>(delta), sum, seq)) {
+                return Status::Error;
+            }
+            durable_seq = std::max(durable_seq, seq);
+            result.clear();
+            protocol::encode_u64(result, static_cast<uint64_t>(sum));
+            return Status::Ok;
+        }
+
+        case Opcode::Append: {
+            size_t length;
+            if (!kvstore->append_nowait(std::string(key), std::string(value), length, seq)) return Status::Error;
+            durable_seq = std::max(durable_seq, seq);
+            result.clear();
+            protocol::encode_u64(result, length);
+            return Status::Ok;
+        }
+
+        case Opcode::Delete:
+            if (!kvstore->remove_nowait(std::string(key), seq)) return Status::NotFound;
+            durable_seq = std::max(durable_seq, seq);
+            return Status::Ok;
+
+        case Opcode::Persist:
             kvstore->persist();
-            response = "OK\n";
+            return Status::Ok;
+
+        case Opcode::ReplInfo:
+            result = replication_info();
+            return Status::Ok;
+
+        case Opcode::ClusterInfo:
+            if (!options.cluster) return Status::Error;
+            result = options.cluster->info();
+            return Status::Ok;
+
+        case Opcode::Stats:
+            result = stats_info();
+            return Status::Ok;
+
+        case Opcode::MPut:
+        case Opcode::MGet:
+        case Opcode::MDelete:
+        case Opcode::Scan:
+        case Opcode::Sync:
+        case Opcode::ReplAck:
+        case Opcode::RequestVote:
+        case Opcode::AppendEntries:
+        case Opcode::InstallSnapshot:
+        case Opcode::ClusterSet:
+        case Opcode::ClusterPull:
+        case Opcode::Durable:
+            break; // see execute_multi(), execute_scan() and process_input()
+        }
+    } catch (const std::exception&) {
+        return Status::Error;
+    }
+    return Status::UnknownCmd;
+}
+
+Status KVServer::execute_multi(Opcode op, const std::vector<std::string_view>& args,
+                               std::vector<std::optional<std::string>>& values, size_t& removed,
+                               std::string& result, PendingWrites& pending) {
+    uint64_t seq = 0;
+    if (options.replica && is_write(op)) {
+        return Status::ReadOnly;
+    }
+    if (options.cluster) {
+        // MPUT's values sit between its keys
+        std::vector<std::string_view> keys;
+        for (size_t i = 0; i < args.size(); i += op == Opcode::MPut ? 2 : 1) {
+            keys.push_back(args[i]);
+        }
+        Status routed = options.cluster->route(keys, result);
+        if (routed != Status::Ok) return routed;
+    }
+
+    try {
+        if (options.raft) {
+            settle(pending);
+            if (op == Opcode::MPut) {
+                if (args.size() % 2 != 0) return Status::Error;
+                WriteBatch batch;
+                for (size_t i = 0; i < args.size(); i += 2) {
+                    if (args[i].empty()) return Status::Error;
+                    batch.put(std::string(args[i]), std::string(args[i + 1]));
+                }
+                std::string records;
+                Storage::encode_batch(records, batch);
+                return batch.empty() ? Status::Ok : propose(std::move(records), result, pending);
+            }
+            if (op == Opcode::MDelete) {
+                // The count is of the keys there when the delete was proposed
+                std::vector<std::string> keys(args.begin(), args.end());
+                std::vector<std::optional<std::string>> found = kvstore->multi_get(keys);
+                WriteBatch batch;
+                removed = 0;
+                for (size_t i = 0; i < keys.size(); i++) {
+                    if (found[i]) {
+                        batch.remove(keys[i]);
+                        removed++;
+                    }
+                }
+                std::string records;
+                Storage::encode_batch(records, batch);
+                return batch.empty() ? Status::Ok : propose(std::move(records), result, pending);
+            }
+        }
 
+        if (op == Opcode::MPut) {
+            if (args.size() % 2 != 0) return Status::Error;
+            std::vector<std::pair<std::string, std::string>> items;
+            items.reserve(args.size() / 2);
+            for (size_t i = 0; i < args.size(); i += 2) {
+                items.emplace_back(std::string(args[i]), std::string(args[i + 1]));
+            }
+            if (!kvstore->multi_put_nowait(items, seq)) return Status::Error;
         } else {
-            response = "UNKNOWN_CMD\n";
+            std::vector<std::string> keys(args.begin(), args.end());
+            if (op == Opcode::MGet) {
+                values = kvstore->multi_get(keys);
+            } else {
+                removed = kvstore->multi_remove_nowait(keys, seq);
+            }
         }
+    } catch (const std::exception&) {
+        return Status::Error;
+    }
+    pending.durable_seq = std::max(pending.durable_seq, seq);
+    return Status::Ok;
+}
+
+Status KVServer::execute_scan(std::string_view start, std::string_view end, size_t limit,
+                              std::vector<std::pair<std::string, std::string>>& entries, bool& more) {
+    size_t page = limit == 0 ? SCAN_PAGE_ENTRIES : std::min(limit, SCAN_PAGE_ENTRIES);
 
-        write(client_sock, response.c_str(), response.size());
+    try {
+        // One entry past the page tells whether the range goes on
+        entries = kvstore->scan(std::string(start), std::string(end), page + 1);
+    } catch (const std::exception&) {
+        return Status::Error;
+    }
+    size_t keep = 0;
+    size_t bytes = 0;
+    while (keep < entries.size() && keep < page && (keep == 0 || bytes < SCAN_PAGE_BYTES)) {
+        bytes += entries[keep].first.size() + entries[keep].second.size();
+        keep++;
+    }
+    more = keep < entries.size();
+    entries.resize(keep);
+    return Status::Ok;
+}
+
+std::string KVServer::replication_info() const {
+    std::string info;
+    auto field = [&info](const char* name, const std::string& value) {
+        info += name;
+        info += ':';
+        info += value;
+        info += '\n';
+    };
+
+    if (options.replica) {
+        ReplicaStatus status = options.replica->status();
+        field("role", "follower");
+        field("connected", status.connected ? "yes" : "no");
+        field("replication_id", std::to_string(status.replication_id));
+        field("offset", std::to_string(status.offset));
+        field("leader_offset", std::to_string(status.leader_offset));
+        field("lag_bytes", std::to_string(status.lag_bytes));
+        field("lag_ms", std::to_string(status.lag_ms));
+        field("full_syncs", std::to_string(status.full_syncs));
+        field("partial_syncs", std::to_string(status.partial_syncs));
+    } else if (ReplicationLog* log = kvstore->replication_log()) {
+        std::vector<FollowerStatus> followers = log->followers();
+        field("role", "leader");
+        field("replication_id", std::to_string(log->id()));
+        field("offset", std::to_string(log->end_offset()));
+        field("followers", std::to_string(followers.size()));
+        for (const auto& follower : followers) {
+            field("follower", follower.address + " offset=" + std::to_string(follower.offset) +
+                                  " lag_bytes=" + std::to_string(follower.lag_bytes));
+        }
+    } else if (options.raft) {
+        static const char* roles[] = {"follower", "candidate", "leader"};
+        RaftStatus status = options.raft->status();
+        field("role", std::string("raft_") + roles[static_cast<int>(status.role)]);
+        field("term", std::to_string(status.term));
+        field("leader", options.raft->leader_address());
+        field("last_index", std::to_string(status.last_index));
+        field("commit_index", std::to_string(status.commit_index));
+        field("last_applied", std::to_string(status.last_applied));
+        field("snapshot_index", std::to_string(status.snapshot_index));
+        field("snapshots_sent", std::to_string(status.snapshots_sent));
+        field("snapshots_installed", std::to_string(status.snapshots_installed));
+    } else {
+        field("role", "standalone");
+    }
+    return info;
+}
+
+std::string KVServer::stats_info() const {
+    std::string info;
+    auto field = [&info](const std::string& name, const std::string& value) {
+        info += name;
+        info += ':';
+        info += value;
+        info += '\n';
+    };
+    auto latency = [](const metrics::Histogram::Snapshot& h) {
+        return "calls=" + std::to_string(h.count) + " p50_us=" + format_us(h.percentile(0.5)) +
+               " p99_us=" + format_us(h.percentile(0.99)) + " p999_us=" + format_us(h.percentile(0.999)) +
+               " max_us=" + format_us(h.max_ns);
+    };
+
+    uint64_t accepted = stats->accepted.value();
+    uint64_t closed = stats->closed.value();
+    field("connections_active", std::to_string(accepted > closed ? accepted - closed : 0));
+    field("connections_total", std::to_string(accepted));
+    field("bytes_in", std::to_string(stats->bytes_in.value()));
+    field("bytes_out", std::to_string(stats->bytes_out.value()));
+    for (size_t op = 0; op < Metrics::OPCODES; op++) {
+        metrics::Histogram::Snapshot h = stats->requests[op].snapshot();
+        if (h.count > 0) {
+            field(std::string("cmd_") + opcode_name(op), latency(h));
+        }
+    }
+    field("durable_wait", latency(stats->durable_waits.snapshot()));
+
+    metrics::Histogram::Snapshot waits = kvstore->lock_waits();
+    field("lock_wait", latency(waits) + " total_us=" + format_us(waits.sum_ns));
+
+    StorageStats storage = kvstore->storage_stats();
+    field("log_sync", latency(kvstore->sync_latency()));
+    field("log_batches", std::to_string(storage.batches));
+    field("log_bytes", std::to_string(storage.log_bytes));
+    field("log_garbage_ratio", std::to_string(kvstore->garbage_ratio()));
+    field("durable_lsn", std::to_string(kvstore->durable_lsn()));
+    field("memory_bytes", std::to_string(kvstore->memory_bytes()));
+    return info;
+}
+
+std::string KVServer::metrics_text() const {
+    std::string text;
+    auto family = [&text](const char* name, const char* type, const char* help) {
+        text += std::string("# HELP ") + name + ' ' + help + '\n';
+        text += std::string("# TYPE ") + name + ' ' + type + '\n';
+    };
+    auto sample = [&text](const std::string& name, const std::string& labels, double value) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%.9g", value);
+        text += name;
+        if (!labels.empty()) {
+            text += '{' + labels + '}';
+        }
+        text += ' ';
+        text += buf;
+        text += '\n';
+    };
+    // A summary in seconds; labels, if any, come before the quantile
+    auto summary = [&](const char* name, const std::string& labels, const metrics::Histogram::Snapshot& h) {
+        std::string prefix = labels.empty() ? "" : labels + ",";
+        for (double q : {0.5, 0.9, 0.99, 0.999}) {
+            char quantile[16];
+            snprintf(quantile, sizeof(quantile), "%g", q);
+            sample(name, prefix + "quantile=\"" + quantile + "\"", h.percentile(q) / 1e9);
+        }
+        sample(std::string(name) + "_sum", labels, h.sum_ns / 1e9);
+        sample(std::string(name) + "_count", labels, double(h.count));
+    };
+
+    family("distkv_request_duration_seconds", "summary", "Server time spent per request, by opcode.");
+    for (size_t op = 0; op < Metrics::OPCODES; op++) {
+        metrics::Histogram::Snapshot h = stats->requests[op].snapshot();
+        if (h.count > 0) {
+            summary("distkv_request_duration_seconds", std::string("op=\"") + opcode_name(op) + '"', h);
+        }
+    }
+    family("distkv_durable_wait_seconds", "summary", "Time a batch of writes waited for the log before replying.");
+    summary("distkv_durable_wait_seconds", "", stats->durable_waits.snapshot());
+
+    uint64_t accepted = stats->accepted.value();
+    uint64_t closed = stats->closed.value();
+    family("distkv_connections_accepted_total", "counter", "Client connections accepted.");
+    sample("distkv_connections_accepted_total", "", double(accepted));
+    family("distkv_connections_active", "gauge", "Client connections open.");
+    sample("distkv_connections_active", "", double(accepted > closed ? accepted - closed : 0));
+    family("distkv_received_bytes_total", "counter", "Bytes read from clients.");
+    sample("distkv_received_bytes_total", "", double(stats->bytes_in.value()));
+    family("distkv_sent_bytes_total", "counter", "Bytes written to clients.");
+    sample("distkv_sent_bytes_total", "", double(stats->bytes_out.value()));
+
+    family("distkv_lock_wait_seconds", "summary", "Time spent waiting for a contended shard lock.");
+    summary("distkv_lock_wait_seconds", "", kvstore->lock_waits());
+
+    StorageStats storage = kvstore->storage_stats();
+    family("distkv_log_sync_seconds", "summary", "Latency of log fdatasyncs.");
+    summary("distkv_log_sync_seconds", "", kvstore->sync_latency());
+    family("distkv_log_batches_total", "counter", "Group commit batches written to the log.");
+    sample("distkv_log_batches_total", "", double(storage.batches));
+    family("distkv_log_bytes", "gauge", "Record bytes recovery would replay.");
+    sample("distkv_log_bytes", "", double(storage.log_bytes));
+    family("distkv_log_garbage_ratio", "gauge", "Fraction of the log compaction would reclaim.");
+    sample("distkv_log_garbage_ratio", "", kvstore->garbage_ratio());
+    family("distkv_memory_bytes", "gauge", "Bytes held by the in-memory tables.");
+    sample("distkv_memory_bytes", "", double(kvstore->memory_bytes()));
+    return text;
+}
+
+void KVServer::serve_metrics(int listen_fd) {
+    while (true) {
+        int fd = accept(listen_fd, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno != EINTR) perror("accept");
+            continue;
+        }
+
+        // Every request gets the metrics; read the headers only so the
+        // client does not see a reset, and give up on a slow one
+        timeval timeout{1, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        std::string request;
+        char buf[4096];
+        while (request.find("\r\n\r\n") == std::string::npos && request.size() < sizeof(buf) * 16) {
+            ssize_t n = read(fd, buf, sizeof(buf));
+            if (n <= 0) break;
+            request.append(buf, n);
+        }
+
+        std::string body = metrics_text();
+        std::string reply = "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " +
+                            std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+        for (size_t sent = 0; sent < reply.size();) {
+            ssize_t n = send(fd, reply.data() + sent, reply.size() - sent, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            sent += n;
+        }
+        close(fd);
     }
-    close(client_sock);
 }
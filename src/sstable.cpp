@@ -0,0 +1,495 @@
+#include "sstable.hpp"
+#include "crc32c.hpp"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+namespace
+{
+
+constexpr char SSTABLE_MAGIC[8] = {'D', 'K', 'V', 'S', 'S', 'T', '0', '1'};
+constexpr size_t FOOTER_SIZE = 5 * 8 + 4 + sizeof(SSTABLE_MAGIC);
+constexpr size_t ENTRY_HEADER_SIZE = 9;
+constexpr uint8_t ENTRY_PUT = 1;
+constexpr uint8_t ENTRY_DELETE = 2;
+constexpr uint8_t ENTRY_PUT_TTL = 3;
+constexpr uint8_t ENTRY_PUT_VERSIONED = 4;
+constexpr uint8_t ENTRY_PUT_VERSIONED_TTL = 5;
+
+void put_u32(std::string &out, uint32_t v)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        out.push_back(static_cast<char>(v >> (8 * i)));
+    }
+}
+
+void put_u64(std::string &out, uint64_t v)
+{
+    for (int i = 0; i < 8; i++)
+    {
+        out.push_back(static_cast<char>(v >> (8 * i)));
+    }
+}
+
+uint32_t get_u32(const char *p)
+{
+    auto u = reinterpret_cast<const unsigned char *>(p);
+    return uint32_t(u[0]) | (uint32_t(u[1]) << 8) | (uint32_t(u[2]) << 16) | (uint32_t(u[3]) << 24);
+}
+
+uint64_t get_u64(const char *p)
+{
+    return uint64_t(get_u32(p)) | (uint64_t(get_u32(p + 4)) << 32);
+}
+
+// The filter is persisted, so it needs a hash that is the same in every
+// build, unlike std::hash: FNV-1a with a final mix to spread the bits
+uint64_t bloom_hash(std::string_view key)
+{
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (unsigned char c : key)
+    {
+        h = (h ^ c) * 0x100000001b3ull;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    return h;
+}
+
+// Bit positions come from double hashing: h1 + i * h2
+template <typename Visit>
+bool for_each_probe(uint64_t hash, uint32_t probes, size_t bits, Visit visit)
+{
+    uint64_t h1 = hash;
+    uint64_t h2 = (hash >> 32) | (hash << 32) | 1;
+    for (uint32_t i = 0; i < probes; i++)
+    {
+        if (!visit((h1 + i * h2) % bits))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void pread_all(int fd, char *out, size_t len, uint64_t offset, const std::string &path)
+{
+    while (len > 0)
+    {
+        ssize_t n = pread(fd, out, len, offset);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            throw std::runtime_error("Failed to read '" + path + "': " +
+                                     std::string(n < 0 ? strerror(errno) : "unexpected end of file"));
+        }
+        out += n;
+        len -= n;
+        offset += n;
+    }
+}
+
+} // namespace
+
+SSTableWriter::SSTableWriter(const std::string &path, size_t block_bytes, size_t bloom_bits_per_key)
+    : path(path), block_bytes(block_bytes), bits_per_key(bloom_bits_per_key)
+{
+    fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        throw std::runtime_error("Failed to create '" + path + "': " + std::string(strerror(errno)));
+    }
+}
+
+SSTableWriter::~SSTableWriter()
+{
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+    if (!finished)
+    {
+        unlink(path.c_str());
+    }
+}
+
+void SSTableWriter::add(std::string_view key, std::string_view value, bool deleted, uint64_t expires_at,
+                        uint64_t version)
+{
+    if (count > 0 && key <= last_key)
+    {
+        throw std::logic_error("SSTable keys must be added in increasing order");
+    }
+    bool ttl = !deleted && expires_at != 0;
+    bool versioned = !deleted && version != 0;
+    uint8_t type = deleted     ? ENTRY_DELETE
+                   : versioned ? (ttl ? ENTRY_PUT_VERSIONED_TTL : ENTRY_PUT_VERSIONED)
+                               : (ttl ? ENTRY_PUT_TTL : ENTRY_PUT);
+    block.push_back(static_cast<char>(type));
+    put_u32(block, static_cast<uint32_t>(key.size()));
+    put_u32(block, static_cast<uint32_t>(value.size() + (ttl ? 8 : 0) + (versioned ? 8 : 0)));
+    block.append(key);
+    if (ttl)
+    {
+        put_u64(block, expires_at);
+    }
+    if (versioned)
+    {
+        put_u64(block, version);
+    }
+    block.append(value);
+    last_key.assign(key);
+    hashes.push_back(bloom_hash(key));
+    count++;
+
+    if (block.size() >= block_bytes)
+    {
+        flush_block();
+    }
+}
+
+void SSTableWriter::flush_block()
+{
+    if (block.empty())
+    {
+        return;
+    }
+    uint32_t crc = crc32c(block.data(), block.size());
+    put_u32(block, crc);
+
+    put_u64(index, offset);
+    put_u32(index, static_cast<uint32_t>(block.size()));
+    put_u32(index, static_cast<uint32_t>(last_key.size()));
+    index.append(last_key);
+
+    write(block);
+    block.clear();
+}
+
+void SSTableWriter::write(const std::string &data)
+{
+    const char *p = data.data();
+    size_t len = data.size();
+    while (len > 0)
+    {
+        ssize_t n = ::write(fd, p, len);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n < 0)
+        {
+            throw std::runtime_error("Failed to write '" + path + "': " + std::string(strerror(errno)));
+        }
+        p += n;
+        len -= n;
+    }
+    offset += data.size();
+}
+
+uint64_t SSTableWriter::finish()
+{
+    flush_block();
+
+    // About bits_per_key * ln 2 probes minimises false positives
+    // (whole bytes, since readers take the bit count from the filter size)
+    size_t bits = (std::max<size_t>(64, hashes.size() * bits_per_key) + 7) / 8 * 8;
+    uint32_t probes = std::max<uint32_t>(1, static_cast<uint32_t>(bits_per_key * 69 / 100));
+    std::string bloom(bits / 8, '\0');
+    for (uint64_t h : hashes)
+    {
+        for_each_probe(h, probes, bits, [&](uint64_t bit)
+                       {
+            bloom[bit / 8] |= static_cast<char>(1 << (bit % 8));
+            return true; });
+    }
+    put_u32(bloom, probes);
+
+    uint64_t index_offset = offset;
+    std::string tail = index + bloom;
+    std::string footer;
+    put_u64(footer, index_offset);
+    put_u64(footer, index.size());
+    put_u64(footer, index_offset + index.size());
+    put_u64(footer, bloom.size());
+    put_u64(footer, count);
+    put_u32(footer, crc32c(tail.data(), tail.size()));
+    footer.append(SSTABLE_MAGIC, sizeof(SSTABLE_MAGIC));
+    write(tail + footer);
+
+    if (fsync(fd) < 0)
+    {
+        throw std::runtime_error("Failed to sync '" + path + "': " + std::string(strerror(errno)));
+    }
+    close(fd);
+    fd = -1;
+    finished = true;
+    return offset;
+}
+
+SSTable::SSTable(const std::string &path, uint64_t number, BlockCache *cache)
+    : path(path), file_number(number), cache(cache)
+{
+    fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        throw std::runtime_error("Failed to open '" + path + "': " + std::string(strerror(errno)));
+    }
+
+    try
+    {
+        struct stat st;
+        if (fstat(fd, &st) < 0 || static_cast<uint64_t>(st.st_size) < FOOTER_SIZE)
+        {
+            throw std::runtime_error("Truncated SSTable '" + path + "'");
+        }
+        size = st.st_size;
+
+        char footer[FOOTER_SIZE];
+        pread_all(fd, footer, FOOTER_SIZE, size - FOOTER_SIZE, path);
+        uint64_t index_offset = get_u64(footer);
+        uint64_t index_size = get_u64(footer + 8);
+        uint64_t bloom_offset = get_u64(footer + 16);
+        uint64_t bloom_size = get_u64(footer + 24);
+        count = get_u64(footer + 32);
+        if (memcmp(footer + 44, SSTABLE_MAGIC, sizeof(SSTABLE_MAGIC)) != 0 ||
+            bloom_offset != index_offset + index_size || bloom_offset + bloom_size != size - FOOTER_SIZE ||
+            bloom_size < 4)
+        {
+            throw std::runtime_error("Corrupt SSTable footer in '" + path + "'");
+        }
+
+        std::string tail(index_size + bloom_size, '\0');
+        pread_all(fd, &tail[0], tail.size(), index_offset, path);
+        if (crc32c(tail.data(), tail.size()) != get_u32(footer + 40))
+        {
+            throw std::runtime_error("Corrupt SSTable index in '" + path + "'");
+        }
+
+        for (size_t pos = 0; pos < index_size;)
+        {
+            if (index_size - pos < 16 || index_size - pos - 16 < get_u32(tail.data() + pos + 12))
+            {
+                throw std::runtime_error("Corrupt SSTable index in '" + path + "'");
+            }
+            BlockHandle handle;
+            handle.offset = get_u64(tail.data() + pos);
+            handle.size = get_u32(tail.data() + pos + 8);
+            uint32_t key_len = get_u32(tail.data() + pos + 12);
+            handle.last_key.assign(tail.data() + pos + 16, key_len);
+            blocks.push_back(std::move(handle));
+            pos += 16 + size_t(key_len);
+        }
+        bloom_probes = get_u32(tail.data() + tail.size() - 4);
+        bloom = tail.substr(index_size, bloom_size - 4);
+
+        if (!blocks.empty())
+        {
+            Iterator it(*this, false);
+            it.seek_to_first();
+            if (it.valid())
+            {
+                first_key.assign(it.key());
+            }
+            last_key = blocks.back().last_key;
+        }
+        if (cache)
+        {
+            for (const auto &handle : blocks)
+            {
+                pinned += sizeof(BlockHandle) + handle.last_key.size();
+            }
+            pinned += bloom.size();
+            cache->pin(pinned);
+        }
+    }
+    catch (...)
+    {
+        close(fd);
+        throw;
+    }
+}
+
+SSTable::~SSTable()
+{
+    if (cache)
+    {
+        cache->unpin(pinned);
+    }
+    close(fd);
+    if (obsolete)
+    {
+        unlink(path.c_str());
+    }
+}
+
+bool SSTable::may_contain(std::string_view key) const
+{
+    size_t bits = bloom.size() * 8;
+    if (bits == 0)
+    {
+        return true;
+    }
+    return for_each_probe(bloom_hash(key), bloom_probes, bits, [&](uint64_t bit)
+                          { return (bloom[bit / 8] >> (bit % 8)) & 1; });
+}
+
+size_t SSTable::find_block(std::string_view key) const
+{
+    auto it = std::lower_bound(blocks.begin(), blocks.end(), key,
+                               [](const BlockHandle &block, std::string_view k)
+                               { return block.last_key < k; });
+    return it - blocks.begin();
+}
+
+BlockCache::Block SSTable::read_block(size_t index, bool fill_cache) const
+{
+    if (cache)
+    {
+        if (auto cached = cache->lookup(file_number, index, fill_cache))
+        {
+            return cached;
+        }
+    }
+
+    const BlockHandle &handle = blocks[index];
+    if (handle.size < 4 || handle.offset + handle.size > size)
+    {
+        throw std::runtime_error("Corrupt SSTable index in '" + path + "'");
+    }
+    auto out = std::make_shared<std::string>(handle.size, '\0');
+    pread_all(fd, &(*out)[0], handle.size, handle.offset, path);
+    if (crc32c(out->data(), out->size() - 4) != get_u32(out->data() + out->size() - 4))
+    {
+        throw std::runtime_error("Corrupt SSTable block in '" + path + "'");
+    }
+    out->resize(out->size() - 4);
+    if (cache && fill_cache)
+    {
+        cache->insert(file_number, index, out);
+    }
+    return out;
+}
+
+SSTable::Lookup SSTable::get(std::string_view key, std::string &value, uint64_t *expires_at,
+                             uint64_t *version) const
+{
+    if (key < first_key || key > last_key || !may_contain(key))
+    {
+        return Lookup::Missing;
+    }
+    Iterator it(*this);
+    it.seek(key);
+    if (!it.valid() || it.key() != key)
+    {
+        return Lookup::Missing;
+    }
+    if (it.deleted())
+    {
+        return Lookup::Deleted;
+    }
+    value.assign(it.value());
+    if (expires_at != nullptr)
+    {
+        *expires_at = it.expires_at();
+    }
+    if (version != nullptr)
+    {
+        *version = it.version();
+    }
+    return Lookup::Found;
+}
+
+SSTable::Iterator::Iterator(const SSTable &table, bool fill_cache)
+    : table(&table), fill_cache(fill_cache), block_index(table.blocks.size())
+{
+}
+
+void SSTable::Iterator::load(size_t index)
+{
+    block_index = index;
+    pos = 0;
+    if (index < table->blocks.size())
+    {
+        data = table->read_block(index, fill_cache);
+    }
+}
+
+void SSTable::Iterator::seek_to_first()
+{
+    load(0);
+    skip_empty_blocks();
+}
+
+void SSTable::Iterator::seek(std::string_view key)
+{
+    load(table->find_block(key));
+    skip_empty_blocks();
+    while (valid() && current_key < key)
+    {
+        next();
+    }
+}
+
+void SSTable::Iterator::next()
+{
+    skip_empty_blocks();
+}
+
+// Decode the entry at pos, moving on to the next block when this one is used up
+void SSTable::Iterator::skip_empty_blocks()
+{
+    while (valid() && pos >= data->size())
+    {
+        load(block_index + 1);
+    }
+    if (valid())
+    {
+        decode_next();
+    }
+}
+
+void SSTable::Iterator::decode_next()
+{
+    if (data->size() - pos < ENTRY_HEADER_SIZE)
+    {
+        throw std::runtime_error("Corrupt SSTable block in '" + table->path + "'");
+    }
+    const std::string &block = *data;
+    uint8_t type = static_cast<uint8_t>(block[pos]);
+    uint32_t key_len = get_u32(block.data() + pos + 1);
+    uint32_t value_len = get_u32(block.data() + pos + 5);
+    bool ttl = type == ENTRY_PUT_TTL || type == ENTRY_PUT_VERSIONED_TTL;
+    bool versioned = type == ENTRY_PUT_VERSIONED || type == ENTRY_PUT_VERSIONED_TTL;
+    if (block.size() - pos - ENTRY_HEADER_SIZE < size_t(key_len) + value_len ||
+        type < ENTRY_PUT || type > ENTRY_PUT_VERSIONED_TTL ||
+        value_len < (ttl ? 8u : 0u) + (versioned ? 8u : 0u))
+    {
+        throw std::runtime_error("Corrupt SSTable block in '" + table->path + "'");
+    }
+    current_key = std::string_view(block.data() + pos + ENTRY_HEADER_SIZE, key_len);
+    current_value = std::string_view(block.data() + pos + ENTRY_HEADER_SIZE + key_len, value_len);
+    current_deleted = type == ENTRY_DELETE;
+    current_expires_at = 0;
+    current_version = 0;
+    if (ttl)
+    {
+        current_expires_at = get_u64(current_value.data());
+        current_value.remove_prefix(8);
+    }
+    if (versioned)
+    {
+        current_version = get_u64(current_value.data());
+        current_value.remove_prefix(8);
+    }
+    pos += ENTRY_HEADER_SIZE + size_t(key_len) + value_len;
+}
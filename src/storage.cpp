@@ -1,229 +1,1770 @@
 #include "storage.hpp"
+#include "crc32c.hpp"
+#include "expiry.hpp"
+#include "uring.hpp"
 #include <fcntl.h>
 #include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <algorithm>
+#include <chrono>
+#include <memory>
 #include <cstring>
 #include <iostream>
+#include <string_view>
+#include <tuple>
 #include <unordered_map>
 
-Storage::Storage(const std::string &filename) : fd(-1)
+namespace
 {
-    const std::string storage_dir = "storage";
 
-    // Create storage directory if it doesn't exist
-    if (mkdir(storage_dir.c_str(), 0755) == -1 && errno != EEXIST)
+const std::string STORAGE_DIR = "storage";
+
+constexpr char SEGMENT_MAGIC[8] = {'D', 'K', 'V', 'S', 'E', 'G', '0', '1'};
+constexpr size_t SEGMENT_HEADER_SIZE = 24;
+constexpr uint32_t SEGMENT_FULL = 1; // holds the whole live set; earlier segments are obsolete
+
+constexpr char SNAPSHOT_MAGIC[8] = {'D', 'K', 'V', 'S', 'N', 'P', '0', '1'};
+constexpr size_t SNAPSHOT_HEADER_SIZE = 32;
+
+constexpr size_t RECORD_HEADER_SIZE = 13;
+constexpr uint8_t RECORD_PUT = 1;
+constexpr uint8_t RECORD_DELETE = 2;
+constexpr uint8_t RECORD_BATCH = 3; // empty key; the value holds put/delete records
+constexpr uint8_t RECORD_PUT_TTL = 4; // value prefixed by its expiry deadline
+constexpr uint8_t RECORD_PUT_VERSIONED = 5;     // value prefixed by its version
+constexpr uint8_t RECORD_PUT_VERSIONED_TTL = 6; // value prefixed by deadline, then version
+
+constexpr size_t WRITE_BUFFER_BYTES = 1 << 20;
+
+// Buffers of a compacted file in flight at once through io_uring
+constexpr size_t RING_DEPTH = 8;
+
+void put_u32(std::string &out, uint32_t v)
+{
+    for (int i = 0; i < 4; i++)
     {
-        throw std::runtime_error("Failed to create storage directory: " +
-                                 std::string(strerror(errno)));
+        out.push_back(static_cast<char>(v >> (8 * i)));
     }
+}
 
-    // Build full file path
-    this->filename = storage_dir + "/" + filename;
+void put_u64(std::string &out, uint64_t v)
+{
+    for (int i = 0; i < 8; i++)
+    {
+        out.push_back(static_cast<char>(v >> (8 * i)));
+    }
+}
 
-    // Open or create the file with O_APPEND to always write at end
-    fd = open(this->filename.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
-    if (fd < 0)
+uint32_t get_u32(const char *p)
+{
+    auto u = reinterpret_cast<const unsigned char *>(p);
+    return uint32_t(u[0]) | (uint32_t(u[1]) << 8) | (uint32_t(u[2]) << 16) | (uint32_t(u[3]) << 24);
+}
+
+uint64_t get_u64(const char *p)
+{
+    return uint64_t(get_u32(p)) | (uint64_t(get_u32(p + 4)) << 32);
+}
+
+bool has_deadline(uint8_t type)
+{
+    return type == RECORD_PUT_TTL || type == RECORD_PUT_VERSIONED_TTL;
+}
+
+bool has_version(uint8_t type)
+{
+    return type == RECORD_PUT_VERSIONED || type == RECORD_PUT_VERSIONED_TTL;
+}
+
+bool is_put(uint8_t type)
+{
+    return type == RECORD_PUT || has_deadline(type) || has_version(type);
+}
+
+// The type of a put record with the given deadline and version (0 = none)
+uint8_t put_type(uint64_t expires_at, uint64_t version)
+{
+    if (version != 0)
     {
-        throw std::runtime_error("Failed to open storage file '" +
-                                 this->filename + "': " + std::string(strerror(errno)));
+        return expires_at != 0 ? RECORD_PUT_VERSIONED_TTL : RECORD_PUT_VERSIONED;
     }
+    return expires_at != 0 ? RECORD_PUT_TTL : RECORD_PUT;
 }
 
-Storage::~Storage()
+// expires_at and version are only written for the types that carry them,
+// as the first 8 (or 16) bytes of the value, deadline first
+void encode_record(std::string &out, uint8_t type, std::string_view key, std::string_view value,
+                   uint64_t expires_at = 0, uint64_t version = 0)
 {
-    if (fd >= 0)
+    size_t start = out.size();
+    bool ttl = has_deadline(type);
+    bool versioned = has_version(type);
+    out.append(4, '\0'); // crc, filled in below
+    out.push_back(static_cast<char>(type));
+    put_u32(out, static_cast<uint32_t>(key.size()));
+    put_u32(out, static_cast<uint32_t>(value.size() + (ttl ? 8 : 0) + (versioned ? 8 : 0)));
+    out.append(key);
+    if (ttl)
     {
-        close(fd);
+        put_u64(out, expires_at);
+    }
+    if (versioned)
+    {
+        put_u64(out, version);
+    }
+    out.append(value);
+
+    uint32_t crc = crc32c(out.data() + start + 4, out.size() - start - 4);
+    for (int i = 0; i < 4; i++)
+    {
+        out[start + i] = static_cast<char>(crc >> (8 * i));
     }
 }
 
-void Storage::append(const std::string &key, const std::string &value)
+struct RecordView
+{
+    uint8_t type;
+    std::string_view key;
+    std::string_view value;
+    uint64_t expires_at; // 0 unless the type carries a deadline
+    uint64_t version;    // 0 unless the type carries a version
+};
+
+// Decode the record at p; returns its length, or 0 if it is torn or corrupt
+size_t decode_record(const char *p, size_t avail, RecordView &rec)
 {
-    // Validate inputs
-    if (key.empty() || key.find(':') != std::string::npos ||
-        key.find('\n') != std::string::npos)
+    if (avail < RECORD_HEADER_SIZE)
     {
-        throw std::invalid_argument("Invalid key format");
+        return 0;
+    }
+    uint64_t key_len = get_u32(p + 5);
+    uint64_t value_len = get_u32(p + 9);
+    uint64_t len = RECORD_HEADER_SIZE + key_len + value_len;
+    if (len > avail || crc32c(p + 4, len - 4) != get_u32(p))
+    {
+        return 0;
+    }
+    rec.type = static_cast<uint8_t>(p[4]);
+    bool ttl = has_deadline(rec.type);
+    bool versioned = has_version(rec.type);
+    bool valid = rec.type == RECORD_BATCH ? key_len == 0
+                 : is_put(rec.type) || rec.type == RECORD_DELETE
+                     ? key_len != 0 && value_len >= (ttl ? 8u : 0u) + (versioned ? 8u : 0u)
+                     : false;
+    if (!valid)
+    {
+        return 0;
+    }
+    rec.key = std::string_view(p + RECORD_HEADER_SIZE, key_len);
+    rec.value = std::string_view(p + RECORD_HEADER_SIZE + key_len, value_len);
+    rec.expires_at = 0;
+    rec.version = 0;
+    if (ttl)
+    {
+        rec.expires_at = get_u64(rec.value.data());
+        rec.value.remove_prefix(8);
     }
-    if (value.find('\n') != std::string::npos)
+    if (versioned)
     {
-        throw std::invalid_argument("Value cannot contain newlines");
+        rec.version = get_u64(rec.value.data());
+        rec.value.remove_prefix(8);
     }
+    return len;
+}
 
-    std::string line = key + ":" + value + "\n";
-    ssize_t written = 0;
-    ssize_t total = line.size();
+std::string encode_segment_header(uint32_t flags, uint64_t base_offset)
+{
+    std::string header(SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC));
+    put_u32(header, flags);
+    put_u32(header, 0);
+    put_u64(header, base_offset);
+    return header;
+}
 
-    // Ensure all bytes are written
-    while (written < total)
+bool decode_segment_header(const std::string &data, uint32_t &flags, uint64_t &base_offset)
+{
+    if (data.size() < SEGMENT_HEADER_SIZE || memcmp(data.data(), SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC)) != 0)
+    {
+        return false;
+    }
+    flags = get_u32(data.data() + 8);
+    base_offset = get_u64(data.data() + 16);
+    return true;
+}
+
+std::string encode_snapshot_header(uint64_t log_offset, uint64_t first_segment)
+{
+    std::string header(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    put_u32(header, 0);
+    put_u32(header, 0);
+    put_u64(header, log_offset);
+    put_u64(header, first_segment);
+    return header;
+}
+
+bool decode_snapshot_header(const std::string &data, uint64_t &log_offset, uint64_t &first_segment)
+{
+    if (data.size() < SNAPSHOT_HEADER_SIZE || memcmp(data.data(), SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0)
     {
-        ssize_t n = write(fd, line.c_str() + written, total - written);
+        return false;
+    }
+    log_offset = get_u64(data.data() + 16);
+    first_segment = get_u64(data.data() + 24);
+    return true;
+}
+
+uint64_t elapsed_us(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now() - start)
+        .count();
+}
+
+void read_file(const std::string &path, std::string &out, size_t limit = SIZE_MAX)
+{
+    out.clear();
+    int in = open(path.c_str(), O_RDONLY);
+    if (in < 0)
+    {
+        throw std::runtime_error("Failed to open '" + path + "': " + std::string(strerror(errno)));
+    }
+    struct stat st;
+    if (fstat(in, &st) == 0)
+    {
+        out.reserve(std::min<size_t>(st.st_size, limit));
+    }
+
+    char buffer[65536];
+    while (out.size() < limit)
+    {
+        ssize_t n = read(in, buffer, std::min(sizeof(buffer), limit - out.size()));
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n < 0)
+        {
+            close(in);
+            perror("read");
+            throw std::runtime_error("Failed to read from storage");
+        }
+        if (n == 0)
+        {
+            break;
+        }
+        out.append(buffer, n);
+    }
+    close(in);
+}
+
+// Bytes of records in a segment or snapshot file, 0 if it is missing
+uint64_t body_bytes(const std::string &path, size_t header_size)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0 && st.st_size > static_cast<off_t>(header_size))
+    {
+        return st.st_size - header_size;
+    }
+    return 0;
+}
+
+void write_fd(int out, const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(out, data, len);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
         if (n < 0)
         {
             perror("write");
             throw std::runtime_error("Failed to write to storage");
         }
-        written += n;
+        data += n;
+        len -= n;
     }
+}
 
-    // Ensure durability
-    if (fsync(fd) < 0)
+// Make a create/rename/unlink in the storage directory durable
+void fsync_dir()
+{
+    int dfd = open(STORAGE_DIR.c_str(), O_RDONLY | O_DIRECTORY);
+    if (dfd >= 0)
     {
-        perror("fsync");
+        fsync(dfd);
+        close(dfd);
     }
 }
 
-void Storage::remove(const std::string &key)
+// Writes a new file front to back, a buffer at a time. With a ring, up to
+// RING_DEPTH buffers are in flight while the next one is filled, instead of
+// each write blocking the thread that produces the records.
+class FileSink
 {
-    // Validate key
-    if (key.empty() || key.find(':') != std::string::npos ||
-        key.find('\n') != std::string::npos)
+public:
+    FileSink(int fd, IoUring *ring) : fd(fd), ring(ring) {}
+
+    // The kernel may still be reading the buffers in flight
+    ~FileSink()
     {
-        throw std::invalid_argument("Invalid key format");
+        try
+        {
+            finish();
+        }
+        catch (const std::exception &)
+        {
+        }
+    }
+
+    // Write out buffer's contents; buffer comes back empty
+    void write(std::string &buffer)
+    {
+        if (ring == nullptr)
+        {
+            write_fd(fd, buffer.data(), buffer.size());
+            offset += buffer.size();
+            buffer.clear();
+            return;
+        }
+
+        while (busy[next])
+        {
+            reap();
+        }
+        // Swapping hands the old slot's allocation back for reuse
+        slots[next].swap(buffer);
+        buffer.clear();
+        offsets[next] = offset;
+        if (!ring->write(fd, slots[next].data(), slots[next].size(), offset, next))
+        {
+            throw std::runtime_error("io_uring submission queue full");
+        }
+        ring->submit();
+        busy[next] = true;
+        in_flight++;
+        offset += slots[next].size();
+        next = (next + 1) % RING_DEPTH;
+    }
+
+    // Wait for every write to land
+    void finish()
+    {
+        while (in_flight > 0)
+        {
+            reap();
+        }
     }
 
-    std::string line = key + ":__DELETE__\n";
-    ssize_t written = 0;
-    ssize_t total = line.size();
+private:
+    int fd;
+    IoUring *ring;
+    uint64_t offset = 0;
+    std::string slots[RING_DEPTH];
+    uint64_t offsets[RING_DEPTH] = {};
+    bool busy[RING_DEPTH] = {};
+    size_t next = 0;
+    size_t in_flight = 0;
 
-    while (written < total)
+    void reap()
     {
-        ssize_t n = write(fd, line.c_str() + written, total - written);
-        if (n < 0)
+        uint64_t slot;
+        int32_t res;
+        ring->wait(slot, res);
+        in_flight--;
+        busy[slot] = false;
+        if (res < 0)
         {
+            errno = -res;
             perror("write");
-            throw std::runtime_error("Failed to write deletion marker");
+            throw std::runtime_error("Failed to write to storage");
         }
-        written += n;
+        // Finish a short write the plain way
+        size_t done = res;
+        const std::string &data = slots[slot];
+        while (done < data.size())
+        {
+            ssize_t n = pwrite(fd, data.data() + done, data.size() - done, offsets[slot] + done);
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (n < 0)
+            {
+                perror("pwrite");
+                throw std::runtime_error("Failed to write to storage");
+            }
+            done += n;
+        }
+    }
+};
+
+// Write a complete segment or snapshot to a temp file, fsync it and rename
+// it into place, so the file is either absent or whole after a crash.
+// Returns the bytes of records written.
+template <typename Body>
+uint64_t write_file_atomically(const std::string &path, const std::string &header, Body body,
+                               IoUring *ring = nullptr)
+{
+    std::string tmp = path + ".tmp";
+    int out = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0)
+    {
+        throw std::runtime_error("Failed to create '" + tmp + "': " + std::string(strerror(errno)));
+    }
+
+    uint64_t written = 0;
+    try
+    {
+        FileSink sink(out, ring);
+        std::string buffer = header;
+        auto emit = [&](uint8_t type, const std::string &key, const std::string &value, uint64_t expires_at = 0,
+                        uint64_t version = 0)
+        {
+            encode_record(buffer, type, key, value, expires_at, version);
+            if (buffer.size() >= WRITE_BUFFER_BYTES)
+            {
+                written += buffer.size();
+                sink.write(buffer);
+            }
+        };
+        body(emit);
+        written += buffer.size();
+        sink.write(buffer);
+        sink.finish();
+    }
+    catch (...)
+    {
+        close(out);
+        unlink(tmp.c_str());
+        throw;
     }
 
-    if (fsync(fd) < 0)
+    if (fsync(out) < 0)
     {
         perror("fsync");
     }
+    close(out);
+    if (rename(tmp.c_str(), path.c_str()) < 0)
+    {
+        throw std::runtime_error("Failed to rename '" + tmp + "': " + std::string(strerror(errno)));
+    }
+    fsync_dir();
+    return written - header.size();
 }
 
-std::vector<std::pair<std::string, std::string>> Storage::load()
+// Adapt write_file_atomically()'s emit for a snapshot source: entries become
+// put records, and those whose deadline has already passed are dropped
+template <typename RecordEmit>
+Storage::Emit live_records(RecordEmit &emit)
+{
+    uint64_t now = unix_now_ms();
+    return [&emit, now](const std::string &key, const std::string &value, uint64_t expires_at, uint64_t version)
+    {
+        if (!is_expired(expires_at, now))
+        {
+            emit(put_type(expires_at, version), key, value, expires_at, version);
+        }
+    };
+}
+
+// Parse the text "key:value\n" format used before segmented logs
+std::unordered_map<std::string, std::string> parse_legacy(const std::string &data)
 {
     std::unordered_map<std::string, std::string> kvmap;
+    size_t pos = 0;
+    size_t newline;
+    while ((newline = data.find('\n', pos)) != std::string::npos)
+    {
+        std::string_view line(data.data() + pos, newline - pos);
+        pos = newline + 1;
+
+        size_t sep = line.find(':');
+        if (sep == std::string_view::npos || sep == 0)
+        {
+            continue;
+        }
+        std::string key(line.substr(0, sep));
+        std::string_view val = line.substr(sep + 1);
+        if (val == "__DELETE__")
+        {
+            kvmap.erase(key);
+        }
+        else
+        {
+            kvmap[key] = std::string(val);
+        }
+    }
+    return kvmap;
+}
+
+} // namespace
+
+Storage::Storage(const std::string &filename, const StorageOptions &options)
+    : fd(-1), options(options)
+{
+    // Create storage directory if it doesn't exist
+    if (mkdir(STORAGE_DIR.c_str(), 0755) == -1 && errno != EEXIST)
+    {
+        throw std::runtime_error("Failed to create storage directory: " +
+                                 std::string(strerror(errno)));
+    }
 
-    // Seek to beginning of file
-    if (lseek(fd, 0, SEEK_SET) < 0)
+    // Build full path prefix of the segment files
+    this->filename = STORAGE_DIR + "/" + filename;
+
+    // One-time upgrade of a pre-segment text log with the same name
+    struct stat st;
+    if (list_segments().empty() && stat(this->filename.c_str(), &st) == 0 && S_ISREG(st.st_mode))
     {
-        perror("lseek");
-        throw std::runtime_error("Failed to seek to beginning of file");
+        convert_legacy(this->filename);
     }
 
-    constexpr size_t BUF_SIZE = 4096;
-    char buffer[BUF_SIZE];
-    std::string leftover;
+    open_active();
+    uint64_t base = 0;
+    disk_bytes = replayable_bytes(base);
+    base_bytes = base;
 
-    ssize_t n;
-    while ((n = read(fd, buffer, BUF_SIZE)) > 0)
+    // Sequence numbers carry on from the end of the log. Whatever a crash
+    // left unsynced in the page cache is synced now, so it all counts as
+    // durable.
+    if (fdatasync(fd) < 0)
     {
-        // Combine leftover from previous iteration with new data
-        std::string chunk = leftover + std::string(buffer, n);
-        leftover.clear();
+        perror("fdatasync");
+    }
+    next_seq = written_seq = durable_seq = active_base + (active_size - SEGMENT_HEADER_SIZE);
 
-        size_t pos = 0;
-        size_t newline;
+    uint64_t offset, first_segment;
+    if (read_snapshot_header(offset, first_segment))
+    {
+        stat_snapshot_bytes = body_bytes(snapshot_path(), SNAPSHOT_HEADER_SIZE);
+        stat_snapshot_offset = offset;
+    }
 
-        // Process each complete line
-        while ((newline = chunk.find('\n', pos)) != std::string::npos)
+    if (options.io_uring && IoUring::supported())
+    {
+        try
+        {
+            log_ring = std::make_unique<IoUring>(4);
+            file_ring = std::make_unique<IoUring>(RING_DEPTH);
+        }
+        catch (const std::exception &)
         {
-            std::string line = chunk.substr(pos, newline - pos);
-            pos = newline + 1;
+            // Out of locked memory or the like: carry on without
+            log_ring.reset();
+            file_ring.reset();
+        }
+    }
 
-            // Parse key:value
-            size_t sep = line.find(':');
-            if (sep == std::string::npos || sep == 0)
-            {
-                // Invalid line format, skip
-                continue;
-            }
+    if (options.group_commit)
+    {
+        flusher = std::thread(&Storage::flush_loop, this);
+    }
+}
 
-            std::string key = line.substr(0, sep);
-            std::string val = line.substr(sep + 1);
+Storage::~Storage()
+{
+    if (flusher.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            stopping = true;
+        }
+        flush_cv.notify_one();
+        flusher.join(); // syncs whatever it wrote without
+    }
 
-            // Handle deletion marker
-            if (val == "__DELETE__")
-            {
-                kvmap.erase(key);
-            }
-            else
-            {
-                kvmap[key] = val;
-            }
+    if (fd >= 0)
+    {
+        if (written_seq > durable_seq && fdatasync(fd) < 0)
+        {
+            perror("fdatasync");
         }
+        close(fd);
+    }
+}
+
+std::string Storage::segment_path(uint64_t id) const
+{
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".%06llu", static_cast<unsigned long long>(id));
+    return filename + suffix;
+}
+
+std::vector<uint64_t> Storage::list_segments() const
+{
+    std::vector<uint64_t> ids;
+    std::string prefix = filename.substr(STORAGE_DIR.size() + 1) + ".";
 
-        // Save any incomplete line for next iteration
-        if (pos < chunk.size())
+    DIR *dir = opendir(STORAGE_DIR.c_str());
+    if (dir == nullptr)
+    {
+        return ids;
+    }
+    while (dirent *entry = readdir(dir))
+    {
+        std::string name = entry->d_name;
+        if (name.size() <= prefix.size() || name.compare(0, prefix.size(), prefix) != 0)
+        {
+            continue;
+        }
+        std::string digits = name.substr(prefix.size());
+        if (digits.find_first_not_of("0123456789") == std::string::npos)
         {
-            leftover = chunk.substr(pos);
+            ids.push_back(std::stoull(digits));
         }
     }
+    closedir(dir);
+
+    std::sort(ids.begin(), ids.end());
+    return ids;
+}
+
+// Open the last segment for appending, cutting off a torn tail left by a crash
+void Storage::open_active()
+{
+    auto ids = list_segments();
+    if (ids.empty())
+    {
+        start_segment(1, 0);
+        return;
+    }
+
+    uint64_t id = ids.back();
+    std::string data;
+    read_file(segment_path(id), data);
+
+    uint32_t flags;
+    uint64_t base;
+    if (!decode_segment_header(data, flags, base))
+    {
+        throw std::runtime_error("Corrupt segment header in '" + segment_path(id) + "'");
+    }
 
-    if (n < 0)
+    if (flags & SEGMENT_FULL)
     {
-        perror("read");
-        throw std::runtime_error("Failed to read from storage");
+        // Compacted segments are never appended to
+        start_segment(id + 1, base);
+        return;
     }
 
-    // Handle any remaining data (incomplete line at EOF - data corruption)
-    if (!leftover.empty())
+    size_t pos = SEGMENT_HEADER_SIZE;
+    RecordView rec;
+    while (size_t len = decode_record(data.data() + pos, data.size() - pos, rec))
     {
-        std::cerr << "Warning: Incomplete line at end of file: " << leftover << std::endl;
+        pos += len;
     }
 
-    // Convert map to vector
-    std::vector<std::pair<std::string, std::string>> data;
-    data.reserve(kvmap.size());
-    for (const auto &kv : kvmap)
+    fd = open(segment_path(id).c_str(), O_RDWR | O_APPEND);
+    if (fd < 0)
     {
-        data.push_back(kv);
+        throw std::runtime_error("Failed to open storage file '" +
+                                 segment_path(id) + "': " + std::string(strerror(errno)));
+    }
+    if (pos < data.size())
+    {
+        if (ftruncate(fd, pos) < 0 || fsync(fd) < 0)
+        {
+            perror("ftruncate");
+        }
     }
 
-    return data;
+    active_id = id;
+    active_base = base;
+    active_size = pos;
 }
 
-//  compact method to remove deleted entries and reduce file size
-void Storage::compact()
+std::string Storage::snapshot_path() const
 {
-    // Load current data
-    auto data = load();
+    return filename + ".snapshot";
+}
 
-    // Close current file
-    close(fd);
+bool Storage::read_snapshot_header(uint64_t &log_offset, uint64_t &first_segment) const
+{
+    struct stat st;
+    if (stat(snapshot_path().c_str(), &st) != 0)
+    {
+        return false;
+    }
+    std::string header;
+    read_file(snapshot_path(), header, SNAPSHOT_HEADER_SIZE);
+    if (!decode_snapshot_header(header, log_offset, first_segment))
+    {
+        throw std::runtime_error("Corrupt snapshot header in '" + snapshot_path() + "'");
+    }
+    return true;
+}
 
-    // Rewrite file with only active entries
-    fd = open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
-    if (fd < 0)
+// Index of the first segment in ids that recovery replays: the newest
+// compacted segment, unless a snapshot taken after it exists, in which case
+// the snapshot is loaded first and only the segments it does not cover follow
+size_t Storage::replay_start(const std::vector<uint64_t> &ids, bool &use_snapshot) const
+{
+    size_t first = 0;
+    bool has_full = false;
+    std::string header;
+    for (size_t i = ids.size(); i-- > 0;)
     {
-        perror("open");
-        throw std::runtime_error("Failed to reopen storage file for compaction");
+        read_file(segment_path(ids[i]), header, SEGMENT_HEADER_SIZE);
+        uint32_t flags;
+        uint64_t base;
+        if (decode_segment_header(header, flags, base) && (flags & SEGMENT_FULL))
+        {
+            first = i;
+            has_full = true;
+            break;
+        }
     }
 
-    // Write all active key-value pairs
-    for (const auto &kv : data)
+    uint64_t offset, first_segment;
+    use_snapshot = read_snapshot_header(offset, first_segment) && (!has_full || ids[first] < first_segment);
+    if (use_snapshot)
     {
-        std::string line = kv.first + ":" + kv.second + "\n";
-        ssize_t written = 0;
-        ssize_t total = line.size();
+        first = std::lower_bound(ids.begin(), ids.end(), first_segment) - ids.begin();
+    }
+    return first;
+}
 
-        while (written < total)
+// Record bytes recovery would replay; base is set to the part of them held
+// by the snapshot or compacted segment the replay starts from
+uint64_t Storage::replayable_bytes(uint64_t &base) const
+{
+    auto ids = list_segments();
+    bool use_snapshot;
+    size_t first = replay_start(ids, use_snapshot);
+
+    uint64_t total = 0;
+    base = 0;
+    if (use_snapshot)
+    {
+        base = body_bytes(snapshot_path(), SNAPSHOT_HEADER_SIZE);
+        total += base;
+    }
+    for (size_t i = first; i < ids.size(); i++)
+    {
+        uint64_t bytes = body_bytes(segment_path(ids[i]), SEGMENT_HEADER_SIZE);
+        if (i == first && !use_snapshot)
         {
-            ssize_t n = write(fd, line.c_str() + written, total - written);
-            if (n < 0)
+            std::string header;
+            read_file(segment_path(ids[i]), header, SEGMENT_HEADER_SIZE);
+            uint32_t flags;
+            uint64_t seg_base;
+            if (decode_segment_header(header, flags, seg_base) && (flags & SEGMENT_FULL))
             {
-                perror("write");
-                throw std::runtime_error("Failed to write during compaction");
+                base = bytes;
             }
-            written += n;
         }
+        total += bytes;
     }
+    return total;
+}
+
+void Storage::start_segment(uint64_t id, uint64_t base_offset)
+{
+    write_file_atomically(segment_path(id), encode_segment_header(0, base_offset), [](auto &) {});
 
-    if (fsync(fd) < 0)
+    int next = open(segment_path(id).c_str(), O_RDWR | O_APPEND);
+    if (next < 0)
     {
-        perror("fsync");
+        throw std::runtime_error("Failed to open storage file '" +
+                                 segment_path(id) + "': " + std::string(strerror(errno)));
     }
-}
\ No newline at end of file
+    if (fd >= 0)
+    {
+        // A write that did not wait for a sync must not be lost by moving on
+        if (written_seq > durable_seq && fdatasync(fd) < 0)
+        {
+            perror("fdatasync");
+        }
+        close(fd);
+    }
+    fd = next;
+    active_id = id;
+    active_base = base_offset;
+    active_size = SEGMENT_HEADER_SIZE;
+}
+
+void Storage::convert_legacy(const std::string &legacy_path)
+{
+    std::string data;
+    read_file(legacy_path, data);
+    auto kvmap = parse_legacy(data);
+
+    write_file_atomically(segment_path(1), encode_segment_header(SEGMENT_FULL, 0), [&](auto &emit)
+                             {
+        for (const auto &kv : kvmap)
+        {
+            emit(RECORD_PUT, kv.first, kv.second);
+        } });
+
+    // Keep the old file around under a name the segment scan ignores
+    if (rename(legacy_path.c_str(), (legacy_path + ".legacy").c_str()) < 0)
+    {
+        perror("rename");
+    }
+    fsync_dir();
+}
+
+void Storage::destroy(const std::string &filename)
+{
+    std::string prefix = filename + ".";
+    unlink((STORAGE_DIR + "/" + filename).c_str());
+
+    DIR *dir = opendir(STORAGE_DIR.c_str());
+    if (dir == nullptr)
+    {
+        return;
+    }
+    std::vector<std::string> doomed;
+    while (dirent *entry = readdir(dir))
+    {
+        std::string name = entry->d_name;
+        if (name.size() <= prefix.size() || name.compare(0, prefix.size(), prefix) != 0)
+        {
+            continue;
+        }
+        std::string rest = name.substr(prefix.size());
+        size_t digits = rest.find_first_not_of("0123456789");
+        if (rest == "legacy" || rest == "snapshot" || rest == "snapshot.tmp" ||
+            (digits != 0 && (digits == std::string::npos || rest.substr(digits) == ".tmp")))
+        {
+            doomed.push_back(STORAGE_DIR + "/" + name);
+        }
+    }
+    closedir(dir);
+
+    for (const auto &path : doomed)
+    {
+        unlink(path.c_str());
+    }
+}
+
+void Storage::append(const std::string &key, const std::string &value)
+{
+    wait_durable(enqueue_append(key, value));
+}
+
+void Storage::remove(const std::string &key)
+{
+    wait_durable(enqueue_remove(key));
+}
+
+uint64_t Storage::enqueue_append(const std::string &key, const std::string &value, uint64_t expires_at,
+                                 uint64_t version)
+{
+    if (key.empty())
+    {
+        throw std::invalid_argument("Invalid key format");
+    }
+
+    std::string record;
+    encode_record(record, put_type(expires_at, version), key, value, expires_at, version);
+    return enqueue(std::move(record));
+}
+
+uint64_t Storage::enqueue_remove(const std::string &key)
+{
+    if (key.empty())
+    {
+        throw std::invalid_argument("Invalid key format");
+    }
+
+    std::string record;
+    encode_record(record, RECORD_DELETE, key, std::string());
+    return enqueue(std::move(record));
+}
+
+void WriteBatch::put(const std::string &key, const std::string &value, uint64_t expires_at, uint64_t version)
+{
+    if (key.empty())
+    {
+        throw std::invalid_argument("Invalid key format");
+    }
+    encode_record(encoded, put_type(expires_at, version), key, value, expires_at, version);
+    records++;
+}
+
+void WriteBatch::remove(const std::string &key)
+{
+    if (key.empty())
+    {
+        throw std::invalid_argument("Invalid key format");
+    }
+    encode_record(encoded, RECORD_DELETE, key, std::string());
+    records++;
+}
+
+uint64_t Storage::enqueue_batch(const WriteBatch &batch)
+{
+    std::string record;
+    encode_record(record, RECORD_BATCH, std::string_view(), batch.encoded);
+    return enqueue(std::move(record), batch.count());
+}
+
+void Storage::encode_put(std::string &out, const std::string &key, const std::string &value, uint64_t expires_at,
+                         uint64_t version)
+{
+    encode_record(out, put_type(expires_at, version), key, value, expires_at, version);
+}
+
+void Storage::encode_remove(std::string &out, const std::string &key)
+{
+    encode_record(out, RECORD_DELETE, key, std::string_view());
+}
+
+void Storage::encode_batch(std::string &out, const WriteBatch &batch)
+{
+    encode_record(out, RECORD_BATCH, std::string_view(), batch.encoded);
+}
+
+size_t Storage::decode_records(std::string_view data, const std::function<void(const std::vector<LogOp> &)> &f)
+{
+    std::vector<LogOp> ops;
+    auto op_of = [](const RecordView &rec)
+    {
+        return LogOp{rec.key, rec.value, rec.expires_at, rec.type == RECORD_DELETE, rec.version};
+    };
+    size_t pos = 0;
+    while (pos < data.size())
+    {
+        RecordView rec;
+        size_t len = decode_record(data.data() + pos, data.size() - pos, rec);
+        if (len == 0)
+        {
+            break;
+        }
+        ops.clear();
+        if (rec.type != RECORD_BATCH)
+        {
+            ops.push_back(op_of(rec));
+        }
+        else
+        {
+            RecordView inner;
+            for (size_t q = 0; q < rec.value.size();)
+            {
+                size_t inner_len = decode_record(rec.value.data() + q, rec.value.size() - q, inner);
+                if (inner_len == 0 || inner.type == RECORD_BATCH)
+                {
+                    return pos;
+                }
+                ops.push_back(op_of(inner));
+                q += inner_len;
+            }
+        }
+        f(ops);
+        pos += len;
+    }
+    return pos;
+}
+
+uint64_t Storage::enqueue(std::string &&record, uint64_t records)
+{
+    std::unique_lock<std::mutex> lock(mtx);
+    if (!write_error.empty())
+    {
+        throw std::runtime_error(write_error);
+    }
+
+    if (!options.group_commit)
+    {
+        // Legacy path: one write per record, inline, synced unless the
+        // level says otherwise
+        bool sync = options.durability == Durability::Always;
+        write_batch(record, records, sync);
+        next_seq += record.size();
+        written_seq = next_seq;
+        if (sync)
+        {
+            durable_seq = next_seq;
+        }
+        return next_seq;
+    }
+
+    pending += record;
+    pending_records += records;
+    next_seq += record.size();
+    flush_cv.notify_one();
+    return next_seq;
+}
+
+void Storage::wait_durable(uint64_t seq)
+{
+    wait_durable(seq, options.durability);
+}
+
+void Storage::wait_durable(uint64_t seq, Durability level)
+{
+    if (level == Durability::None)
+    {
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(mtx);
+    seq = std::min(seq, next_seq);
+    uint64_t *reached = &written_seq;
+    if (level == Durability::Always)
+    {
+        reached = &durable_seq;
+        if (!flusher.joinable())
+        {
+            // Everything is written inline, only the sync may be missing
+            if (durable_seq < seq)
+            {
+                sync_and_record();
+                durable_seq = written_seq;
+            }
+            return;
+        }
+        if (sync_wanted < seq)
+        {
+            sync_wanted = seq;
+            flush_cv.notify_one();
+        }
+    }
+
+    durable_cv.wait(lock, [&]
+                    { return *reached >= seq || !write_error.empty(); });
+    if (*reached < seq)
+    {
+        throw std::runtime_error(write_error);
+    }
+}
+
+uint64_t Storage::durable_lsn() const
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    return durable_seq;
+}
+
+void Storage::flush_loop()
+{
+    using clock = std::chrono::steady_clock;
+    constexpr auto SYNC_INTERVAL = std::chrono::seconds(1);
+
+    std::unique_lock<std::mutex> lock(mtx);
+    auto last_sync = clock::now();
+    while (true)
+    {
+        // Wake for new records, for a caller that needs a sync, and with
+        // EverySec for the next sync falling due
+        auto work = [&]
+        { return stopping || !pending.empty() || sync_wanted > durable_seq; };
+        bool interval = options.durability == Durability::EverySec && written_seq > durable_seq;
+        if (interval)
+        {
+            flush_cv.wait_until(lock, last_sync + SYNC_INTERVAL, work);
+        }
+        else
+        {
+            flush_cv.wait(lock, work);
+        }
+
+        bool due = interval && clock::now() >= last_sync + SYNC_INTERVAL;
+        bool sync = options.durability == Durability::Always || sync_wanted > durable_seq || due ||
+                    (stopping && pending.empty());
+        if (pending.empty() && (!sync || written_seq == durable_seq))
+        {
+            if (stopping)
+            {
+                break; // fully drained and synced
+            }
+            continue;
+        }
+
+        // Optionally linger so more writers can join this batch
+        if (!pending.empty() && options.max_wait.count() > 0 && !stopping)
+        {
+            flush_cv.wait_for(lock, options.max_wait, [&]
+                              { return stopping || pending.size() >= options.max_batch_bytes; });
+        }
+
+        std::string batch;
+        batch.swap(pending);
+        uint64_t records = pending_records;
+        uint64_t batch_seq = next_seq;
+        pending_records = 0;
+        flushing = true;
+        lock.unlock();
+
+        std::string error;
+        try
+        {
+            write_batch(batch, records, sync);
+        }
+        catch (const std::exception &e)
+        {
+            error = e.what();
+        }
+
+        lock.lock();
+        flushing = false;
+        if (error.empty())
+        {
+            written_seq = batch_seq;
+            if (sync)
+            {
+                durable_seq = batch_seq;
+                last_sync = clock::now();
+            }
+        }
+        else
+        {
+            write_error = error;
+        }
+        durable_cv.notify_all();
+    }
+}
+
+// Called with the log to itself: by the flusher while flushing is set, or
+// inline under mtx when group commit is off. An empty batch only syncs.
+void Storage::write_batch(const std::string &batch, uint64_t records, bool sync)
+{
+    if (batch.empty())
+    {
+        if (sync)
+        {
+            sync_and_record();
+        }
+        return;
+    }
+
+    // Roll over to a new segment rather than grow the active one past its
+    // limit; a batch is never split across segments
+    if (active_size > SEGMENT_HEADER_SIZE && active_size + batch.size() > options.segment_bytes)
+    {
+        start_segment(active_id + 1, active_base + (active_size - SEGMENT_HEADER_SIZE));
+    }
+
+    if (log_ring && sync)
+    {
+        write_and_sync(batch);
+    }
+    else
+    {
+        write_all(batch.data(), batch.size(), "Failed to write to storage");
+        if (sync)
+        {
+            sync_and_record();
+        }
+    }
+    record_batch(records, batch.size());
+    active_size += batch.size();
+    disk_bytes += batch.size();
+}
+
+void Storage::write_all(const char *data, size_t len, const char *what)
+{
+    size_t written = 0;
+
+    // Ensure all bytes are written
+    while (written < len)
+    {
+        ssize_t n = write(fd, data + written, len - written);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("write");
+            throw std::runtime_error(what);
+        }
+        written += n;
+    }
+}
+
+void Storage::sync_and_record()
+{
+    auto start = std::chrono::steady_clock::now();
+
+    // Ensure durability; the file size only changes metadata fdatasync
+    // flushes anyway
+    if (fdatasync(fd) < 0)
+    {
+        perror("fdatasync");
+    }
+
+    record_sync(elapsed_us(start));
+}
+
+// The batch and an fdatasync linked behind it go to the kernel in a single
+// io_uring_enter, which also waits for both, where the plain path makes two
+// system calls (more on short writes)
+void Storage::write_and_sync(const std::string &batch)
+{
+    auto start = std::chrono::steady_clock::now();
+    constexpr uint64_t WRITE = 0, SYNC = 1;
+    if (!log_ring->write(fd, batch.data(), batch.size(), active_size, WRITE, true) ||
+        !log_ring->fsync(fd, true, SYNC))
+    {
+        throw std::runtime_error("io_uring submission queue full");
+    }
+    log_ring->submit(2);
+
+    int32_t written = 0, synced = 0;
+    for (int i = 0; i < 2; i++)
+    {
+        uint64_t which;
+        int32_t res;
+        log_ring->wait(which, res);
+        (which == WRITE ? written : synced) = res;
+    }
+    if (written < 0 && written != -EINTR && written != -EAGAIN)
+    {
+        errno = -written;
+        perror("write");
+        throw std::runtime_error("Failed to write to storage");
+    }
+
+    // A short write broke the chain and cancelled the sync: finish both
+    // the plain way
+    size_t done = std::max(written, 0);
+    if (done < batch.size())
+    {
+        write_all(batch.data() + done, batch.size() - done, "Failed to write to storage");
+        synced = fdatasync(fd) < 0 ? -errno : 0;
+    }
+    if (synced < 0)
+    {
+        errno = -synced;
+        perror("fdatasync");
+    }
+    record_sync(elapsed_us(start));
+}
+
+void Storage::record_batch(uint64_t records, uint64_t bytes)
+{
+    stat_batches++;
+    stat_records += records;
+    stat_bytes += bytes;
+
+    uint64_t prev = stat_max_batch.load();
+    while (records > prev && !stat_max_batch.compare_exchange_weak(prev, records))
+    {
+    }
+}
+
+void Storage::record_sync(uint64_t us)
+{
+    stat_syncs++;
+    stat_fsync_us += us;
+    sync_histogram.record(us * 1000);
+
+    uint64_t prev = stat_fsync_max_us.load();
+    while (us > prev && !stat_fsync_max_us.compare_exchange_weak(prev, us))
+    {
+    }
+}
+
+// Wait until nothing is queued or in flight, so fd can be used directly
+void Storage::wait_idle(std::unique_lock<std::mutex> &lock)
+{
+    durable_cv.wait(lock, [&]
+                    { return (pending.empty() && !flushing) || !write_error.empty(); });
+}
+
+StorageStats Storage::stats() const
+{
+    StorageStats s;
+    s.batches = stat_batches.load();
+    s.syncs = stat_syncs.load();
+    s.records = stat_records.load();
+    s.bytes = stat_bytes.load();
+    s.max_batch_records = stat_max_batch.load();
+    s.fsync_total_us = stat_fsync_us.load();
+    s.fsync_max_us = stat_fsync_max_us.load();
+    s.io_uring = log_ring != nullptr;
+    s.compactions = stat_compactions.load();
+    s.log_bytes = disk_bytes.load();
+    s.checkpoints = stat_checkpoints.load();
+    s.snapshot_bytes = stat_snapshot_bytes.load();
+    s.snapshot_offset = stat_snapshot_offset.load();
+    s.snapshot_write_us = stat_snapshot_write_us.load();
+    s.recovery_snapshot_us = stat_recovery_snapshot_us.load();
+    s.recovery_tail_us = stat_recovery_tail_us.load();
+    s.recovery_tail_bytes = stat_recovery_tail_bytes.load();
+    s.recovery_total_us = stat_recovery_total_us.load();
+    return s;
+}
+
+metrics::Histogram::Snapshot Storage::sync_latency() const
+{
+    return sync_histogram.snapshot();
+}
+
+std::vector<std::pair<std::string, std::string>> Storage::load()
+{
+    std::unique_lock<std::mutex> lock(mtx);
+    wait_idle(lock);
+    return read_all();
+}
+
+void Storage::recover(size_t partitions, const RecoverySink &sink)
+{
+    recover(partitions, sink, nullptr);
+}
+
+void Storage::recover(size_t partitions, const RecoverySink &sink, const RemovalSink &removed)
+{
+    std::unique_lock<std::mutex> lock(mtx);
+    wait_idle(lock);
+
+    size_t threads = options.recovery_threads;
+    if (threads == 0)
+    {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    ReplayTimes times;
+    replay(partitions == 0 ? 1 : partitions, threads, sink, UINT64_MAX, &times, removed ? &removed : nullptr);
+    stat_recovery_snapshot_us = times.snapshot_us;
+    stat_recovery_tail_us = times.tail_us;
+    stat_recovery_tail_bytes = times.tail_bytes;
+    stat_recovery_total_us = elapsed_us(start);
+}
+
+std::vector<std::pair<std::string, std::string>> Storage::read_all()
+{
+    std::vector<std::pair<std::string, std::string>> result;
+    replay(1, 1, [&](size_t, std::string &&key, std::string &&value, uint64_t, uint64_t)
+           { result.emplace_back(std::move(key), std::move(value)); });
+    return result;
+}
+
+namespace
+{
+
+// A read-only mapping of one segment or snapshot file
+struct MappedSegment
+{
+    const char *data = nullptr;
+    size_t size = 0;
+    size_t header_size = 0;
+
+    MappedSegment() = default;
+    MappedSegment(const MappedSegment &) = delete;
+    MappedSegment &operator=(const MappedSegment &) = delete;
+    ~MappedSegment()
+    {
+        if (data != nullptr)
+        {
+            munmap(const_cast<char *>(data), size);
+        }
+    }
+};
+
+// A run of whole records replayed by one thread
+struct ReplayRange
+{
+    const char *begin;
+    const char *end;
+};
+
+struct ReplaySlot
+{
+    std::string_view value;
+    bool deleted;
+    uint64_t expires_at;
+    uint64_t version;
+};
+
+using PartialMap = std::unordered_map<std::string_view, ReplaySlot>;
+
+std::unique_ptr<MappedSegment> map_file(const std::string &path)
+{
+    int in = open(path.c_str(), O_RDONLY);
+    if (in < 0)
+    {
+        throw std::runtime_error("Failed to open '" + path + "': " + std::string(strerror(errno)));
+    }
+    struct stat st;
+    auto map = std::make_unique<MappedSegment>();
+    if (fstat(in, &st) == 0 && st.st_size > 0)
+    {
+        void *addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, in, 0);
+        if (addr == MAP_FAILED)
+        {
+            close(in);
+            throw std::runtime_error("Failed to map '" + path + "': " + std::string(strerror(errno)));
+        }
+        madvise(addr, st.st_size, MADV_SEQUENTIAL);
+        madvise(addr, st.st_size, MADV_WILLNEED);
+        map->data = static_cast<const char *>(addr);
+        map->size = st.st_size;
+    }
+    close(in);
+    return map;
+}
+
+} // namespace
+
+// Replay runs in two parallel phases over a read-only mapping of the log.
+// First the record stream is cut into ranges at record boundaries and each
+// range is checksummed and parsed into per-partition maps of string_views
+// (no copies). Then each partition merges its maps in log order, so the
+// latest record per key wins, and hands the survivors to the sink; only
+// live data is ever copied out of the mapping. A snapshot, when recovery
+// starts from one, is simply the first part of the record stream.
+void Storage::replay(size_t partitions, size_t threads, const RecoverySink &sink, uint64_t below_id,
+                     ReplayTimes *times, const RemovalSink *removed)
+{
+    auto ids = list_segments();
+    ids.erase(std::lower_bound(ids.begin(), ids.end(), below_id), ids.end());
+
+    bool use_snapshot;
+    size_t first = replay_start(ids, use_snapshot);
+
+    std::vector<std::unique_ptr<MappedSegment>> maps;
+    size_t total = 0;
+    if (use_snapshot)
+    {
+        auto map = map_file(snapshot_path());
+        map->header_size = SNAPSHOT_HEADER_SIZE;
+        total += map->size - SNAPSHOT_HEADER_SIZE;
+        maps.push_back(std::move(map));
+    }
+    for (size_t i = first; i < ids.size(); i++)
+    {
+        auto map = map_file(segment_path(ids[i]));
+        std::string seg_header(map->data, std::min(map->size, SEGMENT_HEADER_SIZE));
+        uint32_t flags;
+        uint64_t base;
+        if (!decode_segment_header(seg_header, flags, base))
+        {
+            break; // nothing after an unreadable segment can be trusted
+        }
+        map->header_size = SEGMENT_HEADER_SIZE;
+        total += map->size - SEGMENT_HEADER_SIZE;
+        maps.push_back(std::move(map));
+    }
+
+    // Cut the record stream into about one range per thread. Only the length
+    // fields are read here; checksums are verified by the parse phase.
+    std::vector<ReplayRange> ranges;
+    size_t snapshot_ranges = 0;
+    size_t target = std::max<size_t>(total / threads, 1);
+    for (const auto &map : maps)
+    {
+        const char *p = map->data + map->header_size;
+        const char *end = map->data + map->size;
+        const char *start = p;
+        while (end - p >= static_cast<ptrdiff_t>(RECORD_HEADER_SIZE))
+        {
+            uint64_t len = RECORD_HEADER_SIZE + uint64_t(get_u32(p + 5)) + get_u32(p + 9);
+            if (len > static_cast<uint64_t>(end - p))
+            {
+                break;
+            }
+            p += len;
+            if (static_cast<size_t>(p - start) >= target)
+            {
+                ranges.push_back({start, p});
+                start = p;
+            }
+        }
+        // Whatever is left (including a torn tail) is parsed, and rejected, as usual
+        if (start < end)
+        {
+            ranges.push_back({start, end});
+        }
+        if (use_snapshot && map == maps.front())
+        {
+            snapshot_ranges = ranges.size();
+        }
+    }
+
+    // Phase 1: checksum and parse every range into per-partition maps. The
+    // snapshot ranges and the log tail are parsed one after the other so
+    // each can be timed.
+    std::vector<std::vector<PartialMap>> partials(ranges.size(), std::vector<PartialMap>(partitions));
+    std::vector<char> corrupt(ranges.size(), 0);
+    std::atomic<size_t> next_range{0};
+    size_t end_range = 0;
+    auto parse = [&]()
+    {
+        std::hash<std::string_view> hasher;
+        for (size_t r; (r = next_range++) < end_range;)
+        {
+            const char *p = ranges[r].begin;
+            const char *end = ranges[r].end;
+            auto apply = [&](const RecordView &rec)
+            {
+                PartialMap &map = partials[r][partitions == 1 ? 0 : hasher(rec.key) % partitions];
+                map[rec.key] = ReplaySlot{rec.value, rec.type == RECORD_DELETE, rec.expires_at, rec.version};
+            };
+            RecordView rec;
+            while (p < end && !corrupt[r])
+            {
+                size_t len = decode_record(p, end - p, rec);
+                if (len == 0)
+                {
+                    corrupt[r] = 1;
+                    break;
+                }
+                p += len;
+                if (rec.type != RECORD_BATCH)
+                {
+                    apply(rec);
+                    continue;
+                }
+
+                // The batch checksum already covers the nested records
+                const char *q = rec.value.data();
+                const char *batch_end = q + rec.value.size();
+                RecordView inner;
+                while (q < batch_end)
+                {
+                    size_t inner_len = decode_record(q, batch_end - q, inner);
+                    if (inner_len == 0 || inner.type == RECORD_BATCH)
+                    {
+                        corrupt[r] = 1;
+                        break;
+                    }
+                    q += inner_len;
+                    apply(inner);
+                }
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    auto parse_ranges = [&](size_t begin, size_t end)
+    {
+        auto start = std::chrono::steady_clock::now();
+        next_range = begin;
+        end_range = end;
+        for (size_t t = 1; t < std::min(threads, end - begin); t++)
+        {
+            workers.emplace_back(parse);
+        }
+        parse();
+        for (auto &w : workers)
+        {
+            w.join();
+        }
+        workers.clear();
+        return elapsed_us(start);
+    };
+    uint64_t snapshot_us = parse_ranges(0, snapshot_ranges);
+    uint64_t tail_us = parse_ranges(snapshot_ranges, ranges.size());
+    if (times != nullptr)
+    {
+        times->snapshot_us = snapshot_us;
+        times->tail_us = tail_us;
+        times->tail_bytes = total - (use_snapshot ? maps.front()->size - SNAPSHOT_HEADER_SIZE : 0);
+    }
+
+    // The snapshot was renamed into place whole, and the log it replaces is
+    // gone, so damage to it cannot be recovered from by truncating
+    for (size_t r = 0; r < snapshot_ranges; r++)
+    {
+        if (corrupt[r])
+        {
+            throw std::runtime_error("Corrupt record in snapshot '" + snapshot_path() + "'");
+        }
+    }
+
+    // The first torn or corrupt record ends the log: later ranges are dropped
+    size_t valid_ranges = ranges.size();
+    for (size_t r = 0; r < ranges.size(); r++)
+    {
+        if (corrupt[r])
+        {
+            valid_ranges = r + 1;
+            break;
+        }
+    }
+
+    // Phase 2: merge each partition in log order and emit the live keys. A
+    // put whose deadline has passed counts as a delete.
+    std::atomic<size_t> next_partition{0};
+    uint64_t now = unix_now_ms();
+    auto merge = [&]()
+    {
+        for (size_t part; (part = next_partition++) < partitions;)
+        {
+            if (valid_ranges == 0)
+            {
+                break;
+            }
+            PartialMap merged = std::move(partials[0][part]);
+            for (size_t r = 1; r < valid_ranges; r++)
+            {
+                for (const auto &kv : partials[r][part])
+                {
+                    merged[kv.first] = kv.second;
+                }
+                PartialMap().swap(partials[r][part]);
+            }
+            for (const auto &kv : merged)
+            {
+                if (!kv.second.deleted && !is_expired(kv.second.expires_at, now))
+                {
+                    sink(part, std::string(kv.first), std::string(kv.second.value), kv.second.expires_at,
+                         kv.second.version);
+                }
+                else if (removed != nullptr)
+                {
+                    (*removed)(part, std::string(kv.first));
+                }
+            }
+        }
+    };
+
+    for (size_t t = 1; t < std::min(threads, partitions); t++)
+    {
+        workers.emplace_back(merge);
+    }
+    merge();
+    for (auto &w : workers)
+    {
+        w.join();
+    }
+}
+
+//  compact method to remove deleted entries and reduce file size
+void Storage::compact()
+{
+    // Without an in-memory copy to snapshot, replay the sealed segments
+    compact([this](uint64_t sealed_below, const Emit &emit)
+            { replay(1, 1, [&](size_t, std::string &&key, std::string &&value, uint64_t expires_at, uint64_t version)
+                     { emit(key, value, expires_at, version); },
+                     sealed_below); });
+}
+
+void Storage::compact(const Snapshot &snapshot)
+{
+    std::lock_guard<std::mutex> one_at_a_time(compact_mtx);
+
+    // The id between the sealed segments and the new tail is kept free for
+    // the compacted segment, so it sorts after everything it replaces and
+    // before every write it does not cover
+    uint64_t cut, sealed_bytes;
+    uint64_t full_id = seal_active(2, cut, sealed_bytes) - 1;
+
+    // Writers are running again. Replaying the tail on top of a snapshot that
+    // already reflects some of its records gives the same result, so the
+    // snapshot only has to be taken after the cut, not atomically with it.
+    uint64_t full_bytes = write_file_atomically(segment_path(full_id), encode_segment_header(SEGMENT_FULL, cut), [&](auto &emit)
+                                                { snapshot(full_id, live_records(emit)); }, file_ring.get());
+
+    // The compacted segment supersedes everything before it, an older
+    // checkpoint included, as soon as it is renamed into place, so a crash
+    // before the deletes below is harmless
+    disk_bytes += full_bytes;
+    disk_bytes -= sealed_bytes;
+    base_bytes = full_bytes;
+    unlink(snapshot_path().c_str());
+    retire_segments(full_id);
+    stat_compactions++;
+}
+
+void Storage::checkpoint()
+{
+    // Without an in-memory copy, rebuild the live set from the sealed log
+    checkpoint([this](uint64_t sealed_below, const Emit &emit)
+               {
+        std::vector<std::tuple<std::string, std::string, uint64_t, uint64_t>> live;
+        replay(1, 1, [&](size_t, std::string &&key, std::string &&value, uint64_t expires_at, uint64_t version)
+               { live.emplace_back(std::move(key), std::move(value), expires_at, version); },
+               sealed_below);
+        std::sort(live.begin(), live.end());
+        for (const auto &entry : live)
+        {
+            emit(std::get<0>(entry), std::get<1>(entry), std::get<2>(entry), std::get<3>(entry));
+        } });
+}
+
+void Storage::checkpoint(const Snapshot &snapshot)
+{
+    std::lock_guard<std::mutex> one_at_a_time(compact_mtx);
+    auto start = std::chrono::steady_clock::now();
+
+    // Everything before the new tail segment is covered by the snapshot
+    uint64_t cut, sealed_bytes;
+    uint64_t tail_id = seal_active(1, cut, sealed_bytes);
+
+    uint64_t bytes = write_file_atomically(snapshot_path(), encode_snapshot_header(cut, tail_id), [&](auto &emit)
+                                           { snapshot(tail_id, live_records(emit)); }, file_ring.get());
+
+    // Once the snapshot is in place recovery starts from it, so the
+    // segments it covers can go
+    disk_bytes += bytes;
+    disk_bytes -= sealed_bytes;
+    base_bytes = bytes;
+    retire_segments(tail_id);
+
+    stat_checkpoints++;
+    stat_snapshot_bytes = bytes;
+    stat_snapshot_offset = cut;
+    stat_snapshot_write_us = elapsed_us(start);
+}
+
+uint64_t Storage::rotate(uint64_t &sealed_bytes)
+{
+    std::lock_guard<std::mutex> one_at_a_time(compact_mtx);
+    uint64_t cut;
+    return seal_active(1, cut, sealed_bytes);
+}
+
+void Storage::truncate(uint64_t below_id, uint64_t sealed_bytes)
+{
+    std::lock_guard<std::mutex> one_at_a_time(compact_mtx);
+
+    // A snapshot left by a checkpoint only covers segments being dropped
+    unlink(snapshot_path().c_str());
+    retire_segments(below_id);
+    disk_bytes -= std::min(sealed_bytes, disk_bytes.load());
+    base_bytes = 0;
+}
+
+// Send new writes to a fresh tail segment gap ids past the active one and
+// return its id. cut is set to the log position where the tail starts and
+// sealed_bytes to what recovery would replay up to that point.
+uint64_t Storage::seal_active(uint64_t gap, uint64_t &cut, uint64_t &sealed_bytes)
+{
+    std::unique_lock<std::mutex> lock(mtx);
+    wait_idle(lock);
+    if (!write_error.empty())
+    {
+        throw std::runtime_error(write_error);
+    }
+    cut = active_base + (active_size - SEGMENT_HEADER_SIZE);
+    start_segment(active_id + gap, cut);
+    sealed_bytes = disk_bytes.load();
+    return active_id;
+}
+
+void Storage::retire_segments(uint64_t below_id)
+{
+    for (uint64_t id : list_segments())
+    {
+        if (id < below_id)
+        {
+            unlink(segment_path(id).c_str());
+        }
+    }
+    fsync_dir();
+}
+
+uint64_t Storage::log_bytes() const
+{
+    return disk_bytes.load();
+}
+
+uint64_t Storage::tail_bytes() const
+{
+    uint64_t disk = disk_bytes.load();
+    uint64_t base = base_bytes.load();
+    return disk > base ? disk - base : 0;
+}
+
+size_t Storage::record_bytes(size_t key_len, size_t value_len)
+{
+    return RECORD_HEADER_SIZE + key_len + value_len;
+}
@@ -0,0 +1,71 @@
+#include "timer_wheel.hpp"
+
+TimerWheel::TimerWheel(uint64_t tick_ms, uint64_t now_ms)
+    : tick_ms(tick_ms == 0 ? 1 : tick_ms), current(now_ms / this->tick_ms) {}
+
+void TimerWheel::schedule(std::string_view key, uint64_t deadline_ms) {
+    place(Timer{std::string(key), deadline_ms});
+    count++;
+}
+
+// File a timer at the lowest level whose span covers the ticks left until
+// its deadline, in the slot of the deadline's digit at that level. The clock
+// reaches that slot when the window holding the deadline begins, no later
+// than the deadline itself, and cascades it or, at level 0, fires it.
+// Rounding the deadline up to a whole tick keeps timers from firing early.
+void TimerWheel::place(Timer &&timer) {
+    uint64_t tick = (timer.deadline_ms + tick_ms - 1) / tick_ms;
+    if (tick < current) {
+        tick = current;
+    }
+    for (size_t level = 0; level < LEVELS; level++) {
+        if (tick - current < (uint64_t(1) << (SLOT_BITS * (level + 1)))) {
+            slots[level][(tick >> (SLOT_BITS * level)) & (SLOTS - 1)].push_back(std::move(timer));
+            return;
+        }
+    }
+    // Too far out: park it in the top-level slot reached last
+    uint64_t top = current >> (SLOT_BITS * (LEVELS - 1));
+    slots[LEVELS - 1][(top - 1) & (SLOTS - 1)].push_back(std::move(timer));
+}
+
+// Called once the clock has moved to a new tick: every level whose window
+// just began hands its current slot down, highest level first
+void TimerWheel::cascade() {
+    size_t level = 1;
+    while (level < LEVELS && (current & ((uint64_t(1) << (SLOT_BITS * level)) - 1)) == 0) {
+        level++;
+    }
+    for (size_t l = level - 1; l >= 1; l--) {
+        auto &slot = slots[l][(current >> (SLOT_BITS * l)) & (SLOTS - 1)];
+        std::vector<Timer> moving;
+        moving.swap(slot);
+        for (auto &timer : moving) {
+            place(std::move(timer));
+        }
+    }
+}
+
+bool TimerWheel::advance(uint64_t now_ms, size_t max_keys, std::vector<std::pair<std::string, uint64_t>> &due) {
+    uint64_t target = now_ms / tick_ms;
+    size_t taken = 0;
+    while (current <= target) {
+        if (count == 0) {
+            current = target + 1; // nothing to move down on the way
+            break;
+        }
+        auto &slot = slots[0][current & (SLOTS - 1)];
+        while (!slot.empty() && taken < max_keys) {
+            due.emplace_back(std::move(slot.back().key), slot.back().deadline_ms);
+            slot.pop_back();
+            count--;
+            taken++;
+        }
+        if (!slot.empty()) {
+            return true;
+        }
+        current++;
+        cascade();
+    }
+    return false;
+}
@@ -0,0 +1,224 @@
+#include "uring.hpp"
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace
+{
+
+int sys_setup(unsigned entries, io_uring_params *params)
+{
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+int sys_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+int sys_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+    return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, nr_args));
+}
+
+bool probe()
+{
+    io_uring_params params{};
+    int fd = sys_setup(2, &params);
+    if (fd < 0)
+    {
+        return false; // no io_uring, or a seccomp/sysctl policy forbids it
+    }
+
+    // Older kernels have io_uring but not plain IORING_OP_WRITE
+    constexpr unsigned OPS = 64;
+    char buffer[sizeof(io_uring_probe) + OPS * sizeof(io_uring_probe_op)] = {};
+    auto *ops = reinterpret_cast<io_uring_probe *>(buffer);
+    bool ok = sys_register(fd, IORING_REGISTER_PROBE, ops, OPS) == 0 &&
+              ops->last_op >= IORING_OP_WRITE &&
+              (ops->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED) &&
+              (ops->ops[IORING_OP_FSYNC].flags & IO_URING_OP_SUPPORTED);
+    close(fd);
+    return ok;
+}
+
+template <typename T>
+T *at(void *base, unsigned offset)
+{
+    return reinterpret_cast<T *>(static_cast<char *>(base) + offset);
+}
+
+} // namespace
+
+bool IoUring::supported()
+{
+    static const bool available = probe();
+    return available;
+}
+
+IoUring::IoUring(unsigned entries)
+{
+    io_uring_params params{};
+    ring_fd = sys_setup(entries, &params);
+    if (ring_fd < 0)
+    {
+        throw std::runtime_error("io_uring_setup failed: " + std::string(strerror(errno)));
+    }
+    this->entries = params.sq_entries;
+
+    sq_ring_bytes = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_bytes = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single)
+    {
+        sq_ring_bytes = cq_ring_bytes = std::max(sq_ring_bytes, cq_ring_bytes);
+    }
+
+    sq_ring = mmap(nullptr, sq_ring_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+    cq_ring = single ? sq_ring
+                     : mmap(nullptr, cq_ring_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+    sqes_bytes = params.sq_entries * sizeof(io_uring_sqe);
+    void *sqe_area = mmap(nullptr, sqes_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+    if (sq_ring == MAP_FAILED || cq_ring == MAP_FAILED || sqe_area == MAP_FAILED)
+    {
+        int err = errno;
+        if (sq_ring != MAP_FAILED) munmap(sq_ring, sq_ring_bytes);
+        if (!single && cq_ring != MAP_FAILED) munmap(cq_ring, cq_ring_bytes);
+        if (sqe_area != MAP_FAILED) munmap(sqe_area, sqes_bytes);
+        close(ring_fd);
+        throw std::runtime_error("Failed to map the io_uring rings: " + std::string(strerror(err)));
+    }
+    sqes = static_cast<io_uring_sqe *>(sqe_area);
+
+    sq_head = at<unsigned>(sq_ring, params.sq_off.head);
+    sq_tail = at<unsigned>(sq_ring, params.sq_off.tail);
+    sq_mask = *at<unsigned>(sq_ring, params.sq_off.ring_mask);
+    sq_array = at<unsigned>(sq_ring, params.sq_off.array);
+    queued_tail = submitted_tail = *sq_tail;
+
+    cq_head = at<unsigned>(cq_ring, params.cq_off.head);
+    cq_tail = at<unsigned>(cq_ring, params.cq_off.tail);
+    cq_mask = *at<unsigned>(cq_ring, params.cq_off.ring_mask);
+    cqes = at<io_uring_cqe>(cq_ring, params.cq_off.cqes);
+}
+
+IoUring::~IoUring()
+{
+    munmap(sqes, sqes_bytes);
+    if (cq_ring != sq_ring)
+    {
+        munmap(cq_ring, cq_ring_bytes);
+    }
+    munmap(sq_ring, sq_ring_bytes);
+    close(ring_fd);
+}
+
+io_uring_sqe *IoUring::next_sqe()
+{
+    unsigned head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+    if (queued_tail - head >= entries)
+    {
+        return nullptr;
+    }
+    unsigned index = queued_tail & sq_mask;
+    sq_array[index] = index;
+    queued_tail++;
+    io_uring_sqe *sqe = &sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+bool IoUring::write(int fd, const void *data, size_t len, uint64_t offset, uint64_t user_data, bool link)
+{
+    io_uring_sqe *sqe = next_sqe();
+    if (sqe == nullptr)
+    {
+        return false;
+    }
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(data);
+    sqe->len = static_cast<uint32_t>(len);
+    sqe->off = offset;
+    sqe->user_data = user_data;
+    sqe->flags = link ? IOSQE_IO_LINK : 0;
+    return true;
+}
+
+bool IoUring::fsync(int fd, bool datasync, uint64_t user_data, bool link)
+{
+    io_uring_sqe *sqe = next_sqe();
+    if (sqe == nullptr)
+    {
+        return false;
+    }
+    sqe->opcode = IORING_OP_FSYNC;
+    sqe->fd = fd;
+    sqe->fsync_flags = datasync ? IORING_FSYNC_DATASYNC : 0;
+    sqe->user_data = user_data;
+    sqe->flags = link ? IOSQE_IO_LINK : 0;
+    return true;
+}
+
+int IoUring::enter(unsigned to_submit, unsigned wait_nr)
+{
+    while (true)
+    {
+        int n = sys_enter(ring_fd, to_submit, wait_nr, wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0);
+        if (n >= 0 || (errno != EINTR && errno != EAGAIN && errno != EBUSY))
+        {
+            return n;
+        }
+    }
+}
+
+void IoUring::submit(unsigned wait_nr)
+{
+    __atomic_store_n(sq_tail, queued_tail, __ATOMIC_RELEASE);
+    unsigned to_submit = queued_tail - submitted_tail;
+    while (to_submit > 0 || wait_nr > 0)
+    {
+        int n = enter(to_submit, wait_nr);
+        if (n < 0)
+        {
+            throw std::runtime_error("io_uring_enter failed: " + std::string(strerror(errno)));
+        }
+        submitted_tail += n;
+        to_submit -= n;
+        if (to_submit == 0)
+        {
+            break;
+        }
+    }
+}
+
+bool IoUring::peek(uint64_t &user_data, int32_t &res)
+{
+    unsigned head = *cq_head;
+    if (head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE))
+    {
+        return false;
+    }
+    const io_uring_cqe &cqe = static_cast<io_uring_cqe *>(cqes)[head & cq_mask];
+    user_data = cqe.user_data;
+    res = cqe.res;
+    __atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+void IoUring::wait(uint64_t &user_data, int32_t &res)
+{
+    while (!peek(user_data, res))
+    {
+        if (enter(0, 1) < 0)
+        {
+            throw std::runtime_error("io_uring_enter failed: " + std::string(strerror(errno)));
+        }
+    }
+}
@@ -0,0 +1,163 @@
+#include "workload.hpp"
+#include <cmath>
+
+namespace workload {
+
+namespace {
+
+// FNV-1a over the bytes of a 64-bit value
+uint64_t fnv_hash(uint64_t value) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (int i = 0; i < 8; i++) {
+        hash ^= value & 0xff;
+        hash *= 0x100000001b3ull;
+        value >>= 8;
+    }
+    return hash;
+}
+
+double uniform01(std::mt19937_64& rng) {
+    return std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+}
+
+} // namespace
+
+bool parse_distribution(std::string_view name, Distribution& distribution) {
+    if (name == "uniform") distribution = Distribution::Uniform;
+    else if (name == "zipfian") distribution = Distribution::Zipfian;
+    else if (name == "latest") distribution = Distribution::Latest;
+    else return false;
+    return true;
+}
+
+const char* distribution_name(Distribution distribution) {
+    switch (distribution) {
+    case Distribution::Uniform: return "uniform";
+    case Distribution::Zipfian: return "zipfian";
+    case Distribution::Latest: return "latest";
+    }
+    return "unknown";
+}
+
+const char* op_name(Op op) {
+    switch (op) {
+    case Op::Read: return "read";
+    case Op::Update: return "update";
+    case Op::Insert: return "insert";
+    case Op::Scan: return "scan";
+    case Op::ReadModifyWrite: return "read_modify_write";
+    }
+    return "unknown";
+}
+
+bool ycsb_mix(std::string_view name, Mix& mix) {
+    if (name.size() != 1) {
+        return false;
+    }
+    mix = Mix();
+    switch (name[0] | 0x20) {
+    case 'a':
+        mix.read = 0.5;
+        mix.update = 0.5;
+        break;
+    case 'b':
+        mix.read = 0.95;
+        mix.update = 0.05;
+        break;
+    case 'c':
+        mix.read = 1.0;
+        break;
+    case 'd':
+        mix.read = 0.95;
+        mix.insert = 0.05;
+        mix.distribution = Distribution::Latest;
+        break;
+    case 'e':
+        mix.scan = 0.95;
+        mix.insert = 0.05;
+        break;
+    case 'f':
+        mix.read = 0.5;
+        mix.read_modify_write = 0.5;
+        break;
+    default:
+        return false;
+    }
+    return true;
+}
+
+std::string key_name(uint64_t record) {
+    return "user" + std::to_string(fnv_hash(record));
+}
+
+Zipfian::Zipfian(double theta)
+    : theta(theta), alpha(1.0 / (1.0 - theta)), zeta2(1.0 + std::pow(0.5, theta)) {}
+
+void Zipfian::resize(uint64_t n) {
+    if (n < items) {
+        items = 0;
+        zetan = 0;
+    }
+    for (uint64_t i = items + 1; i <= n; i++) {
+        zetan += 1.0 / std::pow(double(i), theta);
+    }
+    items = n;
+    eta = (1.0 - std::pow(2.0 / double(n), 1.0 - theta)) / (1.0 - zeta2 / zetan);
+}
+
+uint64_t Zipfian::next(std::mt19937_64& rng, uint64_t n) {
+    if (n <= 1) {
+        return 0;
+    }
+    if (n != items) {
+        resize(n);
+    }
+    double u = uniform01(rng);
+    double uz = u * zetan;
+    if (uz < 1.0) {
+        return 0;
+    }
+    if (uz < zeta2) {
+        return 1;
+    }
+    uint64_t rank = static_cast<uint64_t>(double(n) * std::pow(eta * u - eta + 1.0, alpha));
+    return rank < n ? rank : n - 1;
+}
+
+Generator::Generator(const Mix& mix, uint64_t seed) : mix(mix), rng(seed) {}
+
+Op Generator::next_op() {
+    double u = uniform01(rng);
+    if ((u -= mix.read) < 0) return Op::Read;
+    if ((u -= mix.update) < 0) return Op::Update;
+    if ((u -= mix.insert) < 0) return Op::Insert;
+    if ((u -= mix.scan) < 0) return Op::Scan;
+    if (mix.read_modify_write > 0) return Op::ReadModifyWrite;
+    // Rounding left u just short of the end; fall back on the last
+    // operation the mix uses
+    if (mix.scan > 0) return Op::Scan;
+    if (mix.insert > 0) return Op::Insert;
+    return mix.update > 0 ? Op::Update : Op::Read;
+}
+
+uint64_t Generator::next_record(uint64_t records) {
+    if (records == 0) {
+        return 0;
+    }
+    switch (mix.distribution) {
+    case Distribution::Uniform:
+        return std::uniform_int_distribution<uint64_t>(0, records - 1)(rng);
+    case Distribution::Zipfian:
+        // Scrambled, so the popular records are not all next to each other
+        return fnv_hash(zipfian.next(rng, records)) % records;
+    case Distribution::Latest:
+        return records - 1 - zipfian.next(rng, records);
+    }
+    return 0;
+}
+
+size_t Generator::next_scan_length() {
+    return std::uniform_int_distribution<size_t>(1, mix.max_scan_length > 0 ? mix.max_scan_length : 1)(rng);
+}
+
+} // namespace workload
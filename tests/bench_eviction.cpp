@@ -0,0 +1,121 @@
+#include "kvstore.hpp"
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+// Cache benchmark: hit rate of a capped KVStore under a Zipfian read trace,
+// used cache-aside (a miss is followed by a put of the key), for each
+// eviction policy. The ideal figure is what keeping exactly the most
+// popular keys that fit would get.
+// Usage: bench_eviction [keys] [operations] [cache_percent] [theta]
+
+using Clock = std::chrono::steady_clock;
+
+// Zipfian ranks 0..n-1, rank 0 the most popular (Gray et al., as in YCSB)
+class Zipfian {
+public:
+    Zipfian(size_t n, double theta) : n(n), theta(theta) {
+        zeta_n = zeta(n);
+        alpha = 1.0 / (1.0 - theta);
+        eta = (1.0 - std::pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta(2) / zeta_n);
+    }
+
+    size_t next(std::mt19937_64 &rng) {
+        double u = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+        double uz = u * zeta_n;
+        if (uz < 1.0) {
+            return 0;
+        }
+        if (uz < 1.0 + std::pow(0.5, theta)) {
+            return 1;
+        }
+        return std::min(n - 1, static_cast<size_t>(n * std::pow(eta * u - eta + 1.0, alpha)));
+    }
+
+    // Probability mass of the top k ranks
+    double head(size_t k) const { return zeta(k) / zeta_n; }
+
+private:
+    size_t n;
+    double theta, zeta_n, alpha, eta;
+
+    double zeta(size_t k) const {
+        double sum = 0;
+        for (size_t i = 1; i <= k; i++) {
+            sum += 1.0 / std::pow(static_cast<double>(i), theta);
+        }
+        return sum;
+    }
+};
+
+std::string make_key(size_t rank) {
+    // Scatter ranks so popularity has nothing to do with key order
+    return "user" + std::to_string((rank * 0x9E3779B97F4A7C15ull) >> 20);
+}
+
+int main(int argc, char* argv[]) {
+    size_t keys = argc > 1 ? std::stoul(argv[1]) : 200000;
+    size_t operations = argc > 2 ? std::stoul(argv[2]) : 2000000;
+    double cache_percent = argc > 3 ? std::stod(argv[3]) : 10;
+    double theta = argc > 4 ? std::stod(argv[4]) : 0.99;
+    const std::string value(100, 'v');
+
+    Zipfian zipf(keys, theta);
+    std::mt19937_64 rng(42);
+    std::vector<size_t> trace(operations);
+    for (auto &rank : trace) {
+        rank = zipf.next(rng);
+    }
+
+    // What every key takes in the store sets the cap
+    size_t full;
+    {
+        KVStoreOptions options;
+        options.persistence = false;
+        KVStore store("storage/bench_eviction.log", options);
+        for (size_t i = 0; i < keys; i++) {
+            store.put(make_key(i), value);
+        }
+        full = store.memory_used();
+    }
+    size_t cap = static_cast<size_t>(full * cache_percent / 100);
+
+    std::cout << "Eviction benchmark: " << keys << " keys, " << operations << " Zipfian(" << theta
+              << ") reads, cache of " << cache_percent << "% (" << cap << " of " << full << " bytes)\n";
+    std::cout << "  ideal\thit rate " << 100 * zipf.head(static_cast<size_t>(keys * cache_percent / 100))
+              << "%\n";
+
+    for (EvictionPolicy policy : {EvictionPolicy::Lru, EvictionPolicy::Lfu}) {
+        KVStoreOptions options;
+        options.persistence = false;
+        options.max_memory_bytes = cap;
+        options.eviction_policy = policy;
+        KVStore store("storage/bench_eviction.log", options);
+
+        // The first half of the trace warms the cache up, the second is measured
+        std::string found;
+        size_t hits = 0;
+        size_t measured = 0;
+        auto start = Clock::now();
+        for (size_t i = 0; i < trace.size(); i++) {
+            std::string key = make_key(trace[i]);
+            bool hit = store.get(key, found);
+            if (!hit) {
+                store.put(key, value);
+            }
+            if (i >= trace.size() / 2) {
+                hits += hit;
+                measured++;
+            }
+        }
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+        std::cout << "  " << (policy == EvictionPolicy::Lru ? "lru" : "lfu") << "\thit rate "
+                  << 100.0 * hits / measured << "%\t" << store.evicted_count() << " evictions\t"
+                  << store.memory_used() << " bytes used\t" << trace.size() / seconds << " ops/s\n";
+    }
+    return 0;
+}
@@ -0,0 +1,73 @@
+#include "kvstore.hpp"
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Multithreaded KVStore throughput benchmark.
+// Usage: bench_kvstore [write_percent] [seconds_per_run]
+
+constexpr int NUM_KEYS = 100000;
+
+double run(KVStore& kv, int threads, int write_pct, double seconds) {
+    std::atomic<bool> stop{false};
+    std::atomic<uint64_t> total{0};
+    std::vector<std::thread> workers;
+
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&, t] {
+            std::mt19937 rng(t * 7919 + 1);
+            std::uniform_int_distribution<int> key_dist(0, NUM_KEYS - 1);
+            std::uniform_int_distribution<int> pct(0, 99);
+            std::string val;
+            uint64_t ops = 0;
+            while (!stop.load(std::memory_order_relaxed)) {
+                std::string key = "key" + std::to_string(key_dist(rng));
+                if (pct(rng) < write_pct) {
+                    kv.put(key, "value" + std::to_string(ops));
+                } else {
+                    kv.get(key, val);
+                }
+                ops++;
+            }
+            total += ops;
+        });
+    }
+
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    stop = true;
+    for (auto& w : workers) {
+        w.join();
+    }
+    return total.load() / seconds;
+}
+
+int main(int argc, char* argv[]) {
+    int write_pct = argc > 1 ? std::stoi(argv[1]) : 5;
+    double seconds = argc > 2 ? std::stod(argv[2]) : 1.0;
+
+    std::cout << "KVStore benchmark: " << NUM_KEYS << " keys, "
+              << write_pct << "% writes, " << seconds << "s per run\n";
+
+    for (size_t shards : {size_t(1), size_t(16), size_t(64)}) {
+        Storage::destroy("bench_kvstore.db");
+        KVStoreOptions options;
+        options.num_shards = shards;
+        KVStore kv("bench_kvstore.db", options);
+        for (int i = 0; i < NUM_KEYS; i++) {
+            kv.put("key" + std::to_string(i), "value" + std::to_string(i));
+        }
+
+        std::cout << "\nshards=" << shards << "\n";
+        for (int threads : {1, 2, 4, 8, 16, 32}) {
+            double ops = run(kv, threads, write_pct, seconds);
+            std::cout << "  threads=" << threads << "\t" << static_cast<uint64_t>(ops) << " ops/s\n";
+        }
+    }
+
+    Storage::destroy("bench_kvstore.db");
+    return 0;
+}
@@ -0,0 +1,101 @@
+#include "compact_table.hpp"
+#include <malloc.h>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Memory and lookup benchmark: CompactTable against the
+// std::unordered_map<std::string, std::string> it replaced in KVStore.
+// Usage: bench_table [entries] [key_size] [value_size]
+
+using Clock = std::chrono::steady_clock;
+
+size_t heap_in_use() {
+    return mallinfo2().uordblks;
+}
+
+std::string make_key(size_t i, size_t key_size) {
+    std::string key = "key" + std::to_string(i);
+    key.resize(std::max(key_size, key.size()), '_');
+    return key;
+}
+
+template <typename Lookup>
+double lookup_ns(size_t entries, size_t key_size, Lookup lookup) {
+    // Keys are built up front so only the lookups are timed
+    std::mt19937 rng(7);
+    std::uniform_int_distribution<size_t> dist(0, entries - 1);
+    std::vector<std::string> keys;
+    for (size_t i = 0; i < 1000000; i++) {
+        keys.push_back(make_key(dist(rng), key_size));
+    }
+
+    size_t hits = 0;
+    auto start = Clock::now();
+    for (const auto& key : keys) {
+        hits += lookup(key);
+    }
+    double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+    if (hits != keys.size()) {
+        std::cerr << "lookup missed a key\n";
+    }
+    return ns / keys.size();
+}
+
+int main(int argc, char* argv[]) {
+    size_t entries = argc > 1 ? std::stoul(argv[1]) : 1000000;
+    size_t key_size = argc > 2 ? std::stoul(argv[2]) : 16;
+    size_t value_size = argc > 3 ? std::stoul(argv[3]) : 32;
+    std::string value(value_size, 'v');
+    double data = static_cast<double>(key_size + value_size);
+
+    std::cout << "Table benchmark: " << entries << " entries, " << key_size << " byte keys, "
+              << value_size << " byte values (" << data << " bytes of data each)\n";
+
+    {
+        size_t before = heap_in_use();
+        std::unordered_map<std::string, std::string> map;
+        for (size_t i = 0; i < entries; i++) {
+            map.emplace(make_key(i, key_size), value);
+        }
+        double per_entry = static_cast<double>(heap_in_use() - before) / entries;
+        double ns = lookup_ns(entries, key_size, [&](const std::string& key) {
+            return map.find(key) != map.end();
+        });
+        std::cout << "  unordered_map\t" << per_entry << " bytes/entry\t" << ns << " ns/lookup\n";
+    }
+
+    {
+        size_t before = heap_in_use();
+        CompactTable table;
+        for (size_t i = 0; i < entries; i++) {
+            table.put(make_key(i, key_size), value);
+        }
+        double per_entry = static_cast<double>(heap_in_use() - before) / entries;
+        double ns = lookup_ns(entries, key_size, [&](const std::string& key) {
+            std::string_view found;
+            return table.find(key, found);
+        });
+        std::cout << "  CompactTable\t" << per_entry << " bytes/entry\t" << ns << " ns/lookup\n";
+
+        // Churn: delete three entries in four, leaving every slab a quarter
+        // full, then reclaim the space
+        for (size_t i = 0; i < entries; i++) {
+            if (i % 4 != 0) {
+                table.erase(make_key(i, key_size));
+            }
+        }
+        size_t fragmented = table.memory_bytes();
+        auto start = Clock::now();
+        while (table.defragment(16) > 0) {
+        }
+        double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        std::cout << "  defragment\t" << fragmented / (1024 * 1024) << " MB -> "
+                  << table.memory_bytes() / (1024 * 1024) << " MB in " << ms << " ms\n";
+    }
+
+    return 0;
+}
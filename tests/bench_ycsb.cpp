@@ -0,0 +1,456 @@
+#include "client.hpp"
+#include "kvstore.hpp"
+#include "metrics.hpp"
+#include "workload.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// YCSB-style load generator. Loads records into a KVStore in this process or
+// a KVServer over the network, runs one of the core workloads against it
+// from many threads, and prints throughput and latency percentiles as JSON
+// so runs can be compared across commits.
+
+using Clock = std::chrono::steady_clock;
+
+static void print_usage(const char* prog) {
+    std::cerr << "Usage: " << prog << " [options]\n"
+              << "  --target=local|HOST:PORT  drive a KVStore in this process or a server (default local)\n"
+              << "  --workload=a|b|c|d|e|f    YCSB core workload (default a)\n"
+              << "  --distribution=uniform|zipfian|latest  which records operations pick\n"
+              << "                            (default: the workload's)\n"
+              << "  --records=N               records loaded before the run (default 100000)\n"
+              << "  --operations=N            stop after N operations (default 0 = run for --seconds)\n"
+              << "  --seconds=S               stop after S seconds (default 10)\n"
+              << "  --threads=N               worker threads, each with its own connection (default 8)\n"
+              << "  --depth=N                 server: requests each connection keeps in flight (default 1)\n"
+              << "  --value-size=N            bytes per value (default 100)\n"
+              << "  --scan-length=N           scans read 1 to N records (default 100)\n"
+              << "  --load=on|off             load the records first (default on)\n"
+              << "  --shards=N                local: KVStore partitions (default 16)\n"
+              << "  --durability=always|everysec|os|memory  local: how writes are logged (default always)\n"
+              << "  --ordered-index=on|off    local: keep keys sorted, for workload e (default off)\n"
+              << "  --output=FILE             write the JSON report to FILE instead of stdout\n";
+}
+
+struct Config {
+    std::string target = "local";
+    std::string host;
+    int port = 0;
+    std::string workload = "a";
+    workload::Mix mix;
+    uint64_t records = 100000;
+    uint64_t operations = 0;
+    double seconds = 10;
+    int threads = 8;
+    size_t depth = 1;
+    size_t value_size = 100;
+    bool load = true;
+    KVStoreOptions store;
+    std::string durability = "always";
+    std::string output;
+};
+
+// What the workers share while the run lasts
+struct Run {
+    const Config& config;
+    std::atomic<uint64_t> inserted;  // records numbered below this exist or are being inserted
+    std::atomic<uint64_t> issued{0}; // operations handed out, for --operations
+    Clock::time_point deadline;
+    std::atomic<uint64_t> errors{0};
+    std::atomic<uint64_t> not_found{0};
+    metrics::Histogram all;
+    metrics::Histogram by_op[workload::OP_COUNT];
+
+    explicit Run(const Config& config) : config(config), inserted(config.records) {}
+
+    // Whether another operation may start at now
+    bool next(Clock::time_point now) {
+        if (config.operations > 0) {
+            return issued.fetch_add(1, std::memory_order_relaxed) < config.operations;
+        }
+        return now < deadline;
+    }
+
+    void record(workload::Op op, Clock::time_point start, Clock::time_point end) {
+        all.record(end - start);
+        by_op[static_cast<size_t>(op)].record(end - start);
+    }
+};
+
+// The records of one thread's share of the load, written in batches
+template <typename PutBatch>
+void load_share(uint64_t first, uint64_t last, const std::string& value, PutBatch put_batch) {
+    constexpr uint64_t BATCH = 100;
+    std::vector<std::pair<std::string, std::string>> items;
+    for (uint64_t base = first; base < last; base += BATCH) {
+        items.clear();
+        for (uint64_t i = base; i < std::min(last, base + BATCH); i++) {
+            items.emplace_back(workload::key_name(i), value);
+        }
+        if (!put_batch(items)) {
+            throw std::runtime_error("Loading records failed");
+        }
+    }
+}
+
+// Start threads workers, each given its index, and wait for them all
+template <typename Worker>
+void run_threads(int threads, Worker worker) {
+    std::vector<std::thread> workers;
+    std::vector<std::string> failures(threads);
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&, t] {
+            try {
+                worker(t);
+            } catch (const std::exception& e) {
+                failures[t] = e.what();
+            }
+        });
+    }
+    for (auto& w : workers) {
+        w.join();
+    }
+    for (const auto& failure : failures) {
+        if (!failure.empty()) {
+            throw std::runtime_error(failure);
+        }
+    }
+}
+
+// A value of size bytes that differs between threads
+std::string make_value(size_t size, int thread) {
+    std::string value(size, 'v');
+    for (size_t i = 0; i < size; i++) {
+        value[i] = static_cast<char>('a' + (i * 7 + thread) % 26);
+    }
+    return value;
+}
+
+void load_local(KVStore& kv, const Config& config) {
+    run_threads(config.threads, [&](int t) {
+        uint64_t first = config.records * t / config.threads;
+        uint64_t last = config.records * (t + 1) / config.threads;
+        load_share(first, last, make_value(config.value_size, t),
+                   [&](const std::vector<std::pair<std::string, std::string>>& items) {
+                       return kv.multi_put(items);
+                   });
+    });
+}
+
+void load_remote(const Config& config) {
+    run_threads(config.threads, [&](int t) {
+        KVClient client(config.host, config.port);
+        uint64_t first = config.records * t / config.threads;
+        uint64_t last = config.records * (t + 1) / config.threads;
+        load_share(first, last, make_value(config.value_size, t),
+                   [&](const std::vector<std::pair<std::string, std::string>>& items) {
+                       return client.multi_put(items);
+                   });
+    });
+}
+
+// One operation at a time straight against the store
+void run_local(KVStore& kv, Run& run) {
+    run_threads(run.config.threads, [&](int t) {
+        workload::Generator gen(run.config.mix, 0x9e3779b97f4a7c15ull * (t + 1));
+        std::string value = make_value(run.config.value_size, t);
+        std::string read;
+        Clock::time_point now = Clock::now();
+        while (run.next(now)) {
+            workload::Op op = gen.next_op();
+            bool ok = true;
+            Clock::time_point start = now;
+            switch (op) {
+            case workload::Op::Read:
+                if (!kv.get(workload::key_name(gen.next_record(run.inserted.load())), read)) {
+                    run.not_found++;
+                }
+                break;
+            case workload::Op::Update:
+                ok = kv.put(workload::key_name(gen.next_record(run.inserted.load())), value);
+                break;
+            case workload::Op::Insert:
+                ok = kv.put(workload::key_name(run.inserted++), value);
+                break;
+            case workload::Op::Scan:
+                kv.scan(workload::key_name(gen.next_record(run.inserted.load())), "", gen.next_scan_length());
+                break;
+            case workload::Op::ReadModifyWrite: {
+                std::string key = workload::key_name(gen.next_record(run.inserted.load()));
+                if (!kv.get(key, read)) {
+                    run.not_found++;
+                }
+                ok = kv.put(key, value);
+                break;
+            }
+            }
+            if (!ok) {
+                run.errors++;
+            }
+            now = Clock::now();
+            run.record(op, start, now);
+        }
+    });
+}
+
+// Each thread keeps up to depth requests in flight on its own connection;
+// a read-modify-write sends its write once the read is answered, and its
+// latency covers both
+void run_remote(Run& run) {
+    struct Pending {
+        workload::Op op;
+        Clock::time_point start;
+        std::string key; // a read-modify-write's, for the write
+    };
+
+    run_threads(run.config.threads, [&](int t) {
+        KVClient client(run.config.host, run.config.port);
+        workload::Generator gen(run.config.mix, 0x9e3779b97f4a7c15ull * (t + 1));
+        std::string value = make_value(run.config.value_size, t);
+        std::deque<Pending> pending;
+        bool stopping = false;
+
+        while (true) {
+            Clock::time_point now = Clock::now();
+            while (!stopping && pending.size() < run.config.depth) {
+                if (!run.next(now)) {
+                    stopping = true;
+                    break;
+                }
+                workload::Op op = gen.next_op();
+                std::string key;
+                switch (op) {
+                case workload::Op::Read:
+                    client.queue_get(workload::key_name(gen.next_record(run.inserted.load())));
+                    break;
+                case workload::Op::Update:
+                    client.queue_put(workload::key_name(gen.next_record(run.inserted.load())), value);
+                    break;
+                case workload::Op::Insert:
+                    client.queue_put(workload::key_name(run.inserted++), value);
+                    break;
+                case workload::Op::Scan:
+                    client.queue_scan(workload::key_name(gen.next_record(run.inserted.load())), "",
+                                      gen.next_scan_length());
+                    break;
+                case workload::Op::ReadModifyWrite:
+                    key = workload::key_name(gen.next_record(run.inserted.load()));
+                    client.queue_get(key);
+                    break;
+                }
+                pending.push_back({op, now, std::move(key)});
+            }
+            if (pending.empty()) {
+                break;
+            }
+
+            KVClient::Reply reply = client.read_reply();
+            Pending done = std::move(pending.front());
+            pending.pop_front();
+            if (reply.status == protocol::Status::NotFound) {
+                run.not_found++;
+            } else if (reply.status != protocol::Status::Ok) {
+                run.errors++;
+            }
+            if (done.op == workload::Op::ReadModifyWrite && !done.key.empty()) {
+                client.queue_put(done.key, value);
+                pending.push_back({done.op, done.start, ""});
+                continue;
+            }
+            run.record(done.op, done.start, Clock::now());
+        }
+    });
+}
+
+void write_latency(std::ostream& out, const metrics::Histogram::Snapshot& snap) {
+    out << "\"p50_us\": " << snap.percentile(0.5) / 1000.0
+        << ", \"p99_us\": " << snap.percentile(0.99) / 1000.0
+        << ", \"p999_us\": " << snap.percentile(0.999) / 1000.0
+        << ", \"max_us\": " << snap.max_ns / 1000.0
+        << ", \"mean_us\": " << snap.mean_ns() / 1000.0;
+}
+
+std::string report(const Config& config, double load_seconds, Run& run, double run_seconds) {
+    std::ostringstream out;
+    metrics::Histogram::Snapshot all = run.all.snapshot();
+    out << "{\n"
+        << "  \"benchmark\": \"ycsb\",\n"
+        << "  \"target\": \"" << config.target << "\",\n"
+        << "  \"workload\": \"" << config.workload << "\",\n"
+        << "  \"distribution\": \"" << workload::distribution_name(config.mix.distribution) << "\",\n"
+        << "  \"records\": " << config.records << ",\n"
+        << "  \"threads\": " << config.threads << ",\n"
+        << "  \"depth\": " << config.depth << ",\n"
+        << "  \"value_size\": " << config.value_size << ",\n";
+    if (config.host.empty()) {
+        out << "  \"shards\": " << config.store.num_shards << ",\n"
+            << "  \"durability\": \"" << config.durability << "\",\n"
+            << "  \"ordered_index\": " << (config.store.ordered_index ? "true" : "false") << ",\n";
+    }
+    out << "  \"load\": {\"records\": " << (config.load ? config.records : 0)
+        << ", \"seconds\": " << load_seconds
+        << ", \"ops_per_sec\": " << (load_seconds > 0 ? uint64_t(config.records / load_seconds) : 0) << "},\n"
+        << "  \"run\": {\"operations\": " << all.count
+        << ", \"seconds\": " << run_seconds
+        << ", \"ops_per_sec\": " << (run_seconds > 0 ? uint64_t(all.count / run_seconds) : 0)
+        << ", \"errors\": " << run.errors.load()
+        << ", \"not_found\": " << run.not_found.load() << ", ";
+    write_latency(out, all);
+    out << "},\n"
+        << "  \"ops\": {";
+    bool first = true;
+    for (size_t i = 0; i < workload::OP_COUNT; i++) {
+        metrics::Histogram::Snapshot snap = run.by_op[i].snapshot();
+        if (snap.count == 0) {
+            continue;
+        }
+        out << (first ? "\n" : ",\n")
+            << "    \"" << workload::op_name(static_cast<workload::Op>(i)) << "\": {\"operations\": "
+            << snap.count << ", ";
+        write_latency(out, snap);
+        out << "}";
+        first = false;
+    }
+    out << "\n  }\n}\n";
+    return out.str();
+}
+
+bool parse_args(int argc, char* argv[], Config& config) {
+    bool distribution_set = false;
+    workload::Distribution distribution = workload::Distribution::Zipfian;
+    size_t scan_length = 100;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        size_t eq = arg.find('=');
+        if (arg.rfind("--", 0) != 0 || eq == std::string::npos) {
+            return false;
+        }
+        std::string name = arg.substr(2, eq - 2);
+        std::string value = arg.substr(eq + 1);
+
+        if (name == "target") {
+            config.target = value;
+        } else if (name == "workload") {
+            config.workload = value;
+        } else if (name == "distribution") {
+            if (!workload::parse_distribution(value, distribution)) return false;
+            distribution_set = true;
+        } else if (name == "records") {
+            config.records = std::stoull(value);
+        } else if (name == "operations") {
+            config.operations = std::stoull(value);
+        } else if (name == "seconds") {
+            config.seconds = std::stod(value);
+        } else if (name == "threads") {
+            config.threads = std::stoi(value);
+        } else if (name == "depth") {
+            config.depth = std::stoul(value);
+        } else if (name == "value-size") {
+            config.value_size = std::stoul(value);
+        } else if (name == "scan-length") {
+            scan_length = std::stoul(value);
+        } else if (name == "load") {
+            config.load = (value != "off");
+        } else if (name == "shards") {
+            config.store.num_shards = std::stoul(value);
+        } else if (name == "durability") {
+            config.durability = value;
+            if (value == "memory") config.store.persistence = false;
+            else if (!parse_durability(value, config.store.storage.durability) ||
+                     config.store.storage.durability == Durability::None) {
+                return false;
+            }
+        } else if (name == "ordered-index") {
+            config.store.ordered_index = (value != "off");
+        } else if (name == "output") {
+            config.output = value;
+        } else {
+            return false;
+        }
+    }
+
+    if (!workload::ycsb_mix(config.workload, config.mix) || config.threads < 1 || config.depth < 1) {
+        return false;
+    }
+    if (distribution_set) {
+        config.mix.distribution = distribution;
+    }
+    config.mix.max_scan_length = scan_length;
+    if (config.target != "local") {
+        size_t colon = config.target.rfind(':');
+        if (colon == std::string::npos) {
+            return false;
+        }
+        config.host = config.target.substr(0, colon);
+        config.port = std::stoi(config.target.substr(colon + 1));
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    Config config;
+    try {
+        if (!parse_args(argc, argv, config)) {
+            print_usage(argv[0]);
+            return 1;
+        }
+    } catch (const std::exception&) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    try {
+        std::unique_ptr<KVStore> kv;
+        if (config.host.empty()) {
+            Storage::destroy("bench_ycsb.db");
+            kv = std::make_unique<KVStore>("bench_ycsb.db", config.store);
+        }
+
+        std::cerr << "Workload " << config.workload << " ("
+                  << workload::distribution_name(config.mix.distribution) << ") against " << config.target
+                  << ": " << config.records << " records, " << config.threads << " threads\n";
+
+        double load_seconds = 0;
+        if (config.load) {
+            auto start = Clock::now();
+            if (kv) load_local(*kv, config);
+            else load_remote(config);
+            load_seconds = std::chrono::duration<double>(Clock::now() - start).count();
+            std::cerr << "  loaded in " << load_seconds << " s\n";
+        }
+
+        Run run(config);
+        auto start = Clock::now();
+        run.deadline = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(config.seconds));
+        if (kv) run_local(*kv, run);
+        else run_remote(run);
+        double run_seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+        std::string json = report(config, load_seconds, run, run_seconds);
+        if (config.output.empty()) {
+            std::cout << json;
+        } else {
+            std::ofstream(config.output) << json;
+            std::cerr << "  report written to " << config.output << "\n";
+        }
+
+        kv.reset();
+        if (config.host.empty()) {
+            Storage::destroy("bench_ycsb.db");
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,289 @@
+#include "async_client.hpp"
+#include "client.hpp"
+#include "kvstore.hpp"
+#include "server.hpp"
+#include <iostream>
+#include <cassert>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+// Servers run until the process exits, so every test gets ports of its own,
+// below the ranges the cluster, raft and replication tests use
+int next_port() {
+    static int port = 3000 + getpid() % 2000;
+    return port++;
+}
+
+// A server on a fresh port; the store and server are never torn down
+KVStore& start_server(int port) {
+    KVStoreOptions options;
+    options.num_shards = 8;
+    options.persistence = false;
+    KVStore* store = new KVStore("test_async_client.db", options);
+
+    ServerOptions server_options;
+    server_options.io_threads = 2;
+    KVServer* server = new KVServer(store, port, server_options);
+    std::thread([server] { server->run(); }).detach();
+    std::this_thread::sleep_for(100ms);
+    return *store;
+}
+
+// Counts down completions; wait() returns once there have been n
+class Latch {
+public:
+    explicit Latch(size_t n) : left(n) {}
+    void done() {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (--left == 0) cv.notify_all();
+    }
+    void wait() {
+        std::unique_lock<std::mutex> lock(mtx);
+        cv.wait(lock, [this] { return left == 0; });
+    }
+
+private:
+    std::mutex mtx;
+    std::condition_variable cv;
+    size_t left;
+};
+
+void test_futures() {
+    std::cout << "Testing futures..." << std::endl;
+
+    int port = next_port();
+    KVStore& store = start_server(port);
+    AsyncKVClient client("127.0.0.1", port);
+    assert(client.live_connections() == 4);
+
+    std::future<bool> put = client.put_async("a", "1");
+    std::future<bool> put2 = client.put_async("b", "2");
+    assert(put.get() && put2.get());
+    std::optional<std::string> value = client.get_async("a").get();
+    assert(value && *value == "1");
+    assert(!client.get_async("nope").get());
+    assert(client.remove_async("b").get());
+    assert(!client.remove_async("b").get());
+    assert(!client.put_async("", "x").get());
+
+    std::string stored;
+    assert(store.get("a", stored) && stored == "1");
+    assert(!store.get("b", stored));
+    assert(client.in_flight() == 0);
+
+    // A large value is written out over several rounds of the loop
+    std::string big(8 << 20, 'x');
+    assert(client.put_async("big", big).get());
+    assert(*client.get_async("big").get() == big);
+
+    bool refused = false;
+    try {
+        AsyncKVClient nobody("127.0.0.1", next_port());
+    } catch (const std::exception&) {
+        refused = true;
+    }
+    assert(refused);
+
+    std::cout << "✓ Futures passed" << std::endl;
+}
+
+void test_callbacks() {
+    std::cout << "Testing callbacks..." << std::endl;
+
+    int port = next_port();
+    start_server(port);
+    AsyncKVClient client("127.0.0.1", port, AsyncClientOptions{2});
+
+    // Callbacks may issue more requests; this chains a put into a get
+    Latch latch(1);
+    std::string seen;
+    client.put_async("chain", "link", [&](protocol::Status status, std::string) {
+        assert(status == protocol::Status::Ok);
+        client.get_async("chain", [&](protocol::Status status, std::string value) {
+            assert(status == protocol::Status::Ok);
+            seen = value;
+            latch.done();
+        });
+    });
+    latch.wait();
+    assert(seen == "link");
+
+    Latch missing(1);
+    client.get_async("nope", [&](protocol::Status status, std::string) {
+        assert(status == protocol::Status::NotFound);
+        missing.done();
+    });
+    missing.wait();
+
+    // Requests the server cannot answer still complete, in order
+    Latch unknown(1);
+    client.request_async(protocol::Opcode::ReplInfo, "", "", [&](protocol::Status status, std::string) {
+        assert(status == protocol::Status::Ok || status == protocol::Status::Error);
+        unknown.done();
+    });
+    unknown.wait();
+
+    std::cout << "✓ Callbacks passed" << std::endl;
+}
+
+void test_many_threads() {
+    std::cout << "Testing many threads with many requests in flight..." << std::endl;
+
+    int port = next_port();
+    KVStore& store = start_server(port);
+    AsyncKVClient client("127.0.0.1", port, AsyncClientOptions{4});
+
+    const int threads = 8;
+    const int per_thread = 25000;
+    Latch latch(threads * per_thread);
+    std::atomic<int> failures{0};
+    std::atomic<size_t> peak{0};
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&, t] {
+            for (int i = 0; i < per_thread; i++) {
+                std::string key = "t" + std::to_string(t) + "_" + std::to_string(i);
+                client.put_async(key, std::to_string(i), [&](protocol::Status status, std::string) {
+                    if (status != protocol::Status::Ok) failures++;
+                    latch.done();
+                });
+                size_t now = client.in_flight();
+                size_t seen = peak.load();
+                while (now > seen && !peak.compare_exchange_weak(seen, now)) {
+                }
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    latch.wait();
+    assert(failures == 0);
+    assert(client.in_flight() == 0);
+    assert(peak > 1000);
+
+    std::string value;
+    for (int t = 0; t < threads; t++) {
+        assert(store.get("t" + std::to_string(t) + "_" + std::to_string(per_thread - 1), value));
+        assert(value == std::to_string(per_thread - 1));
+    }
+
+    // Reads pipelined from every thread see every write
+    std::vector<std::future<std::optional<std::string>>> reads;
+    for (int i = 0; i < per_thread; i += 10) {
+        reads.push_back(client.get_async("t3_" + std::to_string(i)));
+    }
+    for (size_t i = 0; i < reads.size(); i++) {
+        std::optional<std::string> read = reads[i].get();
+        assert(read && *read == std::to_string(i * 10));
+    }
+
+    std::cout << "✓ Many threads passed (peak " << peak << " in flight)" << std::endl;
+}
+
+void test_durability() {
+    std::cout << "Testing durability levels and LSNs..." << std::endl;
+
+    // A logging server that acknowledges writes once the OS has them
+    int port = next_port();
+    KVStoreOptions options;
+    options.num_shards = 4;
+    options.storage.durability = Durability::Os;
+    Storage::destroy("test_async_client.db");
+    KVStore* store = new KVStore("test_async_client.db", options);
+    KVServer* server = new KVServer(store, port);
+    std::thread([server] { server->run(); }).detach();
+    std::this_thread::sleep_for(100ms);
+
+    KVClient client("127.0.0.1", port);
+    uint64_t first = 0, second = 0, removed = 0;
+    assert(client.put("a", "1", Durability::Os, &first));
+    assert(client.put("b", "2", Durability::None, &second));
+    assert(first != 0 && second > first);
+    assert(store->durable_lsn() < second);
+
+    // Asking for Always syncs everything up to the LSN in one round trip
+    assert(client.wait_durable(second) >= second);
+    assert(store->durable_lsn() >= second);
+
+    // A write may ask for more than the server's default
+    assert(client.remove("a", Durability::Always, &removed));
+    assert(removed > second && store->durable_lsn() >= removed);
+    assert(!client.remove("a", Durability::Always));
+
+    // Plain writes and the async client take the server's default
+    assert(client.put("c", "3"));
+    AsyncKVClient async("127.0.0.1", port);
+    assert(async.put_async("d", "4").get());
+    assert(client.wait_durable() > removed);
+
+    std::string value;
+    assert(!store->get("a", value));
+    assert(store->get("b", value) && value == "2");
+    assert(store->get("d", value) && value == "4");
+
+    std::cout << "✓ Durability passed" << std::endl;
+}
+
+void test_atomic_commands() {
+    std::cout << "Testing GETV, CAS, INCRBY and APPEND..." << std::endl;
+
+    int port = next_port();
+    KVStore& store = start_server(port);
+    for (auto protocol : {KVClient::Protocol::Binary, KVClient::Protocol::Text}) {
+        KVClient client("127.0.0.1", port, protocol);
+        std::string prefix = protocol == KVClient::Protocol::Binary ? "bin_" : "text_";
+        std::string value;
+        uint64_t version = 0, current = 0, written = 0;
+        assert(!client.get(prefix + "key", value, version));
+        assert(client.put(prefix + "key", "a"));
+        assert(client.get(prefix + "key", value, version) && value == "a" && version > 0);
+        assert(store.get(prefix + "key", value, current) && current == version);
+
+        assert(!client.compare_and_set(prefix + "key", version + 1, "b", current) && current == version);
+        assert(client.compare_and_set(prefix + "key", version, "b", written) && written > version);
+        assert(client.get(prefix + "key", value, current) && value == "b" && current == written);
+        assert(client.compare_and_set(prefix + "new", 0, "x", written));
+        assert(!client.compare_and_set(prefix + "new", 0, "y", current) && current == written);
+
+        int64_t n = 0;
+        assert(client.increment(prefix + "counter", 10, n) && n == 10);
+        assert(client.increment(prefix + "counter", -25, n) && n == -15);
+        assert(!client.increment(prefix + "key", 1, n));
+
+        size_t length = 0;
+        assert(client.append(prefix + "log", "ab", length) && length == 2);
+        assert(client.append(prefix + "log", "cd", length) && length == 4);
+        assert(client.get(prefix + "log", value) && value == "abcd");
+    }
+
+    std::string stats = KVClient("127.0.0.1", port).stats();
+    assert(stats.find("cmd_cas:calls=8 ") != std::string::npos);
+    assert(stats.find("cmd_incrby:calls=6 ") != std::string::npos);
+
+    std::cout << "✓ GETV, CAS, INCRBY and APPEND passed" << std::endl;
+}
+
+int main() {
+    try {
+        test_futures();
+        test_callbacks();
+        test_many_threads();
+        test_durability();
+        test_atomic_commands();
+
+        std::cout << "\n✓ All async client tests passed!" << std::endl;
+        return 0;
+    } catch (const std::exception& e) {
+        std::cerr << "Test failed: " << e.what() << std::endl;
+        return 1;
+    }
+}
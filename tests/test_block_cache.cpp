@@ -0,0 +1,172 @@
+#include "block_cache.hpp"
+#include "sstable.hpp"
+#include <iostream>
+#include <cassert>
+#include <cstdio>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static BlockCache::Block block_of(size_t size, char fill) {
+    return std::make_shared<const std::string>(size, fill);
+}
+
+void test_hits_and_misses() {
+    std::cout << "Testing lookups and inserts..." << std::endl;
+    
+    BlockCache cache(1 << 20, 4);
+    assert(!cache.lookup(1, 0));
+    cache.insert(1, 0, block_of(1000, 'a'));
+    cache.insert(1, 1, block_of(1000, 'b'));
+    
+    auto block = cache.lookup(1, 0);
+    assert(block && block->size() == 1000 && (*block)[0] == 'a');
+    assert(cache.lookup(1, 1));
+    assert(!cache.lookup(2, 0));
+    
+    BlockCacheStats stats = cache.stats();
+    assert(stats.hits == 2 && stats.misses == 2 && stats.inserts == 2);
+    assert(stats.used_bytes >= 2000 && stats.capacity_bytes == 1 << 20);
+    
+    // The totals are the sum of the per-shard counters
+    uint64_t hits = 0, misses = 0;
+    auto shards = cache.shard_stats();
+    assert(shards.size() == 4);
+    for (const auto &s : shards) {
+        hits += s.hits;
+        misses += s.misses;
+    }
+    assert(hits == stats.hits && misses == stats.misses);
+    
+    std::cout << "✓ Lookups and inserts passed" << std::endl;
+}
+
+void test_budget() {
+    std::cout << "Testing the memory budget..." << std::endl;
+    
+    const uint64_t capacity = 256 << 10;
+    BlockCache cache(capacity, 2);
+    for (uint64_t i = 0; i < 2000; i++) {
+        // Ask twice so every block is popular enough to be admitted
+        cache.lookup(1, i);
+        cache.lookup(1, i);
+        cache.insert(1, i, block_of(4096, 'x'));
+        assert(cache.stats().used_bytes <= capacity);
+    }
+    BlockCacheStats stats = cache.stats();
+    assert(stats.evictions > 0);
+    assert(stats.used_bytes > capacity / 2);
+    
+    // A block bigger than a shard's share is never cached
+    cache.insert(2, 0, block_of(capacity, 'y'));
+    assert(!cache.lookup(2, 0));
+    
+    // Pinned memory shrinks what is left for blocks
+    cache.pin(capacity / 2);
+    for (uint64_t i = 0; i < 100; i++) {
+        cache.lookup(3, i);
+        cache.lookup(3, i);
+        cache.lookup(3, i);
+        cache.insert(3, i, block_of(4096, 'z'));
+    }
+    stats = cache.stats();
+    assert(stats.pinned_bytes == capacity / 2);
+    assert(stats.used_bytes + stats.pinned_bytes <= capacity);
+    cache.unpin(capacity / 2);
+    assert(cache.stats().pinned_bytes == 0);
+    
+    std::cout << "✓ Memory budget passed" << std::endl;
+}
+
+void test_scan_resistance() {
+    std::cout << "Testing that one-off reads keep out of the cache..." << std::endl;
+    
+    BlockCache cache(64 * 5000, 1);
+    
+    // A working set read over and over, while a long run of blocks is read
+    // once each, as a scan through get() would
+    auto read_working_set = [&]() {
+        for (uint64_t i = 0; i < 40; i++) {
+            if (!cache.lookup(1, i)) {
+                cache.insert(1, i, block_of(4096, 'h'));
+            }
+        }
+    };
+    for (int round = 0; round < 5; round++) {
+        read_working_set();
+    }
+    for (uint64_t i = 0; i < 2000; i++) {
+        if (!cache.lookup(2, i)) {
+            cache.insert(2, i, block_of(4096, 'c'));
+        }
+        if (i % 50 == 0) {
+            read_working_set();
+        }
+    }
+    
+    size_t resident = 0;
+    for (uint64_t i = 0; i < 40; i++) {
+        resident += cache.lookup(1, i, false) ? 1 : 0;
+    }
+    assert(resident >= 36);
+    assert(cache.stats().rejects > 0);
+    
+    std::cout << "✓ Scan resistance passed" << std::endl;
+}
+
+void test_sstable_reads() {
+    std::cout << "Testing SSTable reads through the cache..." << std::endl;
+    
+    mkdir("storage", 0755);
+    const std::string path = "storage/test_block_cache.sst";
+    {
+        SSTableWriter writer(path, 1024, 10);
+        for (int i = 0; i < 1000; i++) {
+            char key[16];
+            snprintf(key, sizeof(key), "key%05d", i);
+            writer.add(key, "value" + std::to_string(i), false);
+        }
+        writer.finish();
+    }
+    
+    BlockCache cache(1 << 20);
+    {
+        SSTable table(path, 1, &cache);
+        assert(cache.stats().pinned_bytes > 0);
+        
+        std::string value;
+        assert(table.get("key00042", value) == SSTable::Lookup::Found && value == "value42");
+        uint64_t misses = cache.stats().misses;
+        assert(table.get("key00042", value) == SSTable::Lookup::Found && value == "value42");
+        assert(cache.stats().misses == misses && cache.stats().hits > 0);
+        
+        // Iterators that do not fill the cache leave it as it was
+        uint64_t inserts = cache.stats().inserts;
+        SSTable::Iterator it(table, false);
+        size_t count = 0;
+        for (it.seek_to_first(); it.valid(); it.next()) {
+            count++;
+        }
+        assert(count == 1000);
+        assert(cache.stats().inserts == inserts);
+    }
+    assert(cache.stats().pinned_bytes == 0);
+    unlink(path.c_str());
+    
+    std::cout << "✓ SSTable reads passed" << std::endl;
+}
+
+int main() {
+    try {
+        test_hits_and_misses();
+        test_budget();
+        test_scan_resistance();
+        test_sstable_reads();
+        
+        std::cout << "\n✓ All block cache tests passed!" << std::endl;
+        return 0;
+    } catch (const std::exception& e) {
+        std::cerr << "Test failed: " << e.what() << std::endl;
+        return 1;
+    }
+}
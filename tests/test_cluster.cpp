@@ -0,0 +1,314 @@
+#include "cluster.hpp"
+#include "cluster_client.hpp"
+#include "client.hpp"
+#include "kvstore.hpp"
+#include "server.hpp"
+#include <iostream>
+#include <cassert>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+// Servers run until the process exits, so every test gets ports of its own,
+// below the ranges the replication and raft tests use
+int next_port() {
+    static int port = 5000 + getpid() % 5000;
+    return port++;
+}
+
+struct Node {
+    KVStore* store;
+    ClusterNode* cluster;
+    std::string address;
+};
+
+// A server on a fresh port with the given topology; like the servers, it is
+// never torn down
+Node start_node(const std::string& name, int port, const ClusterTopology& topology) {
+    KVStoreOptions options;
+    options.num_shards = 4;
+    options.persistence = false;
+    KVStore* store = new KVStore(name + std::to_string(port) + ".db", options);
+    std::string address = "127.0.0.1:" + std::to_string(port);
+    ClusterNode* cluster = new ClusterNode(*store, address, topology);
+
+    ServerOptions server_options;
+    server_options.io_threads = 2;
+    server_options.cluster = cluster;
+    KVServer* server = new KVServer(store, port, server_options);
+    std::thread([server] { server->run(); }).detach();
+    return {store, cluster, address};
+}
+
+ClusterTopology make_topology(uint64_t epoch, const std::vector<int>& ports) {
+    ClusterTopology topology;
+    topology.epoch = epoch;
+    for (int port : ports) {
+        topology.nodes.push_back("127.0.0.1:" + std::to_string(port));
+    }
+    return topology;
+}
+
+std::vector<Node> start_cluster(const std::string& name, size_t size) {
+    std::vector<int> ports;
+    for (size_t i = 0; i < size; i++) {
+        ports.push_back(next_port());
+    }
+    std::vector<Node> nodes;
+    for (int port : ports) {
+        nodes.push_back(start_node(name, port, make_topology(1, ports)));
+    }
+    std::this_thread::sleep_for(50ms);
+    return nodes;
+}
+
+size_t count_keys(KVStore& store) {
+    size_t count = 0;
+    store.dump([&count](const std::string&, const std::string&, uint64_t, uint64_t) { count++; });
+    return count;
+}
+
+// Wait for every node to be done moving keys for the latest topology
+void wait_settled(const std::vector<Node>& nodes, uint64_t epoch) {
+    auto deadline = std::chrono::steady_clock::now() + 20s;
+    for (const Node& node : nodes) {
+        while (true) {
+            ClusterStatus status = node.cluster->status();
+            if (status.epoch == epoch && !status.migrating && status.importing == 0) {
+                break;
+            }
+            assert(std::chrono::steady_clock::now() < deadline);
+            std::this_thread::sleep_for(10ms);
+        }
+    }
+}
+
+// Every key on the node that owns it, and on no other
+void check_placement(const std::vector<Node>& nodes, const ClusterTopology& topology, size_t expected) {
+    HashRing ring(topology);
+    size_t total = 0;
+    for (const Node& node : nodes) {
+        node.store->dump([&](const std::string& key, const std::string&, uint64_t, uint64_t) {
+            assert(topology.nodes[ring.owner(key)] == node.address);
+            total++;
+        });
+    }
+    assert(total == expected);
+}
+
+void test_ring() {
+    std::cout << "Testing topologies and the hash ring..." << std::endl;
+
+    ClusterTopology topology = make_topology(7, {1, 2, 3});
+    topology.vnodes = 100;
+    ClusterTopology parsed;
+    assert(ClusterTopology::parse(topology.to_string() + "self:ignored\n", parsed));
+    assert(parsed.epoch == 7 && parsed.vnodes == 100 && parsed.nodes == topology.nodes);
+    assert(!ClusterTopology::parse("epoch:x\n", parsed));
+    assert(!ClusterTopology::parse("garbage\n", parsed));
+    assert(cluster_hash("key") == cluster_hash(std::string("key")));
+
+    // Keys spread about evenly, and the owner depends only on the topology
+    HashRing ring(topology);
+    std::vector<size_t> counts(3, 0);
+    const int keys = 30000;
+    for (int i = 0; i < keys; i++) {
+        counts[ring.owner("key" + std::to_string(i))]++;
+    }
+    for (size_t count : counts) {
+        assert(count > keys / 3 * 0.7 && count < keys / 3 * 1.3);
+    }
+    assert(HashRing(topology).owner("key42") == ring.owner("key42"));
+
+    // A fourth node takes about a quarter of the keys, all from the others
+    ClusterTopology grown = topology;
+    grown.nodes.push_back("127.0.0.1:4");
+    HashRing grown_ring(grown);
+    int moved = 0;
+    for (int i = 0; i < keys; i++) {
+        std::string key = "key" + std::to_string(i);
+        size_t before = ring.owner(key);
+        size_t after = grown_ring.owner(key);
+        if (before != after) {
+            assert(after == 3);
+            moved++;
+        }
+    }
+    assert(moved > keys / 4 * 0.7 && moved < keys / 4 * 1.3);
+
+    std::cout << "✓ Hash ring passed" << std::endl;
+}
+
+void test_routing() {
+    std::cout << "Testing routing and MOVED..." << std::endl;
+
+    std::vector<Node> nodes = start_cluster("test_cluster_routing", 3);
+    ClusterClient client({nodes[0].address});
+    assert(client.topology().epoch == 1 && client.topology().nodes.size() == 3);
+
+    for (int i = 0; i < 300; i++) {
+        assert(client.put("key" + std::to_string(i), "value" + std::to_string(i)));
+    }
+    assert(client.put("ttl", "soon", 3600s));
+    std::string value;
+    assert(client.get("key7", value) && value == "value7");
+    assert(!client.get("nope", value));
+    assert(client.remove("key0"));
+    assert(!client.remove("key0"));
+    check_placement(nodes, client.topology(), 300);
+    for (const Node& node : nodes) {
+        assert(count_keys(*node.store) > 50);
+    }
+
+    // A node answers for another's keys with the owner
+    HashRing ring(client.topology());
+    std::string key = "key1";
+    size_t owner = ring.owner(key);
+    const Node& other = nodes[(owner + 1) % nodes.size()];
+    int other_port = std::stoi(other.address.substr(other.address.rfind(':') + 1));
+    KVClient direct("127.0.0.1", other_port);
+    assert(!direct.get(key, value));
+    direct.queue_put(key, "x");
+    KVClient::Reply reply = direct.read_reply();
+    assert(reply.status == protocol::Status::Moved);
+    assert(reply.value == nodes[owner].address);
+    assert(!direct.multi_put({{key, "x"}}));
+    KVClient text("127.0.0.1", other_port, KVClient::Protocol::Text);
+    assert(text.get(key) == "MOVED " + nodes[owner].address + "\n");
+    std::string info = text.cluster_info();
+    assert(info.find("epoch:1\n") != std::string::npos);
+    assert(info.find("self:" + other.address + "\n") != std::string::npos);
+
+    // Batches fan out to every node
+    std::vector<std::pair<std::string, std::string>> items;
+    std::vector<std::string> keys;
+    for (int i = 0; i < 1000; i++) {
+        items.emplace_back("batch" + std::to_string(i), std::to_string(i));
+        keys.push_back("batch" + std::to_string(i));
+    }
+    keys.push_back("nope");
+    assert(client.multi_put(items));
+    std::vector<std::optional<std::string>> values = client.multi_get(keys);
+    for (int i = 0; i < 1000; i++) {
+        assert(values[i] && *values[i] == std::to_string(i));
+    }
+    assert(!values[1000]);
+    assert(client.multi_remove(keys) == 1000);
+    check_placement(nodes, client.topology(), 300);
+
+    std::cout << "✓ Routing passed" << std::endl;
+}
+
+void test_add_node() {
+    std::cout << "Testing rebalancing onto a new node..." << std::endl;
+
+    std::vector<Node> nodes = start_cluster("test_cluster_grow", 3);
+    ClusterClient client({nodes[0].address});
+    const int keys = 5000;
+    std::vector<std::pair<std::string, std::string>> items;
+    for (int i = 0; i < keys; i++) {
+        items.emplace_back("key" + std::to_string(i), "value" + std::to_string(i));
+    }
+    assert(client.multi_put(items));
+
+    // The new node starts out with the old topology, which it is not in
+    int port = next_port();
+    nodes.push_back(start_node("test_cluster_grow", port, client.topology()));
+    std::vector<std::string> grown = client.topology().nodes;
+    grown.push_back(nodes.back().address);
+
+    // Readers and writers carry on while keys move
+    std::atomic<bool> stop{false};
+    std::atomic<int> errors{0};
+    std::thread worker([&] {
+        ClusterClient during({nodes[1].address});
+        for (int round = 0; !stop; round++) {
+            int i = round % keys;
+            std::string key = "key" + std::to_string(i);
+            std::string value;
+            try {
+                if (!during.get(key, value) || value.compare(0, 5, "value") != 0) {
+                    errors++;
+                }
+                if (!during.put("live" + std::to_string(i % 100), std::to_string(round))) {
+                    errors++;
+                }
+            } catch (const std::exception&) {
+                errors++;
+            }
+        }
+    });
+    std::this_thread::sleep_for(20ms);
+    assert(client.set_nodes(grown));
+    assert(client.topology().epoch == 2);
+    for (int i = 0; i < keys; i += 7) {
+        std::string value;
+        assert(client.get("key" + std::to_string(i), value) && value == "value" + std::to_string(i));
+    }
+    wait_settled(nodes, 2);
+    stop = true;
+    worker.join();
+    assert(errors == 0);
+
+    check_placement(nodes, client.topology(), keys + 100);
+    size_t on_new = count_keys(*nodes.back().store);
+    assert(on_new > keys / 4 * 0.6 && on_new < keys / 4 * 1.4);
+    uint64_t received = nodes.back().cluster->status().keys_received;
+    assert(received >= on_new - 100);
+    assert(nodes[0].cluster->info().find("migrating:no\n") != std::string::npos);
+
+    std::cout << "✓ Adding a node passed" << std::endl;
+}
+
+void test_remove_node() {
+    std::cout << "Testing rebalancing off a node..." << std::endl;
+
+    std::vector<Node> nodes = start_cluster("test_cluster_shrink", 3);
+    ClusterClient client({nodes[0].address, nodes[1].address});
+    const int keys = 3000;
+    std::vector<std::pair<std::string, std::string>> items;
+    for (int i = 0; i < keys; i++) {
+        items.emplace_back("key" + std::to_string(i), "value" + std::to_string(i));
+    }
+    assert(client.multi_put(items));
+
+    assert(client.set_nodes({nodes[0].address, nodes[1].address}));
+    wait_settled(nodes, 2);
+    assert(count_keys(*nodes[2].store) == 0);
+    check_placement(nodes, client.topology(), keys);
+
+    std::vector<std::string> all;
+    for (const auto& item : items) {
+        all.push_back(item.first);
+    }
+    std::vector<std::optional<std::string>> values = client.multi_get(all);
+    for (int i = 0; i < keys; i++) {
+        assert(values[i] && *values[i] == "value" + std::to_string(i));
+    }
+
+    // An old topology is refused
+    assert(!nodes[0].cluster->set_topology(make_topology(1, {1})));
+
+    std::cout << "✓ Removing a node passed" << std::endl;
+}
+
+int main() {
+    try {
+        test_ring();
+        test_routing();
+        test_add_node();
+        test_remove_node();
+
+        std::cout << "\n✓ All cluster tests passed!" << std::endl;
+        return 0;
+    } catch (const std::exception& e) {
+        std::cerr << "Test failed: " << e.what() << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,185 @@
+#include "compact_table.hpp"
+#include <iostream>
+#include <cassert>
+#include <random>
+#include <string>
+#include <unordered_map>
+
+void test_basic_operations() {
+    std::cout << "Testing basic operations..." << std::endl;
+    
+    CompactTable table;
+    assert(table.empty());
+    
+    assert(table.put("key1", "value1"));
+    assert(table.put("key2", ""));
+    assert(table.size() == 2);
+    
+    std::string_view value;
+    assert(table.find("key1", value) && value == "value1");
+    assert(table.find("key2", value) && value.empty());
+    assert(!table.find("key3", value));
+    
+    // Same-size overwrites happen in place, others move the entry
+    size_t old_size = 0;
+    assert(!table.put("key1", "VALUE1", &old_size));
+    assert(old_size == 6);
+    assert(table.garbage_bytes() == 0);
+    assert(!table.put("key1", "a much longer value", &old_size));
+    assert(table.garbage_bytes() > 0);
+    assert(table.find("key1", value) && value == "a much longer value");
+    
+    assert(table.erase("key2", &old_size) && old_size == 0);
+    assert(!table.erase("key2"));
+    assert(!table.contains("key2"));
+    assert(table.size() == 1);
+    
+    std::string binary("k\0ey\n", 5);
+    assert(table.put(binary, std::string("v\0\n", 3)));
+    assert(table.find(binary, value) && value == std::string("v\0\n", 3));
+    
+    std::cout << "✓ Basic operations passed" << std::endl;
+}
+
+void test_against_map() {
+    std::cout << "Testing random operations against std::unordered_map..." << std::endl;
+    
+    CompactTable table;
+    std::unordered_map<std::string, std::string> reference;
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<int> key_dist(0, 4999);
+    std::uniform_int_distribution<int> op_dist(0, 9);
+    std::uniform_int_distribution<int> len_dist(0, 64);
+    
+    for (int i = 0; i < 200000; i++) {
+        std::string key = "key" + std::to_string(key_dist(rng));
+        int op = op_dist(rng);
+        if (op < 6) {
+            std::string value(len_dist(rng), static_cast<char>('a' + i % 26));
+            bool fresh = reference.find(key) == reference.end();
+            assert(table.put(key, value) == fresh);
+            reference[key] = value;
+        } else if (op < 9) {
+            assert(table.erase(key) == (reference.erase(key) == 1));
+        } else {
+            table.defragment(2);
+        }
+    }
+    
+    assert(table.size() == reference.size());
+    for (const auto& kv : reference) {
+        std::string_view value;
+        assert(table.find(kv.first, value) && value == kv.second);
+    }
+    size_t visited = 0;
+    table.for_each([&](std::string_view key, std::string_view value) {
+        assert(reference.at(std::string(key)) == value);
+        visited++;
+    });
+    assert(visited == reference.size());
+    
+    std::cout << "✓ Random operations passed" << std::endl;
+}
+
+void test_defragment() {
+    std::cout << "Testing defragmentation..." << std::endl;
+    
+    CompactTable table;
+    std::string value(100, 'v');
+    for (int i = 0; i < 50000; i++) {
+        table.put("key" + std::to_string(i), value);
+    }
+    size_t full = table.memory_bytes();
+    
+    // Delete nine keys in ten; the slabs stay allocated until defragmented
+    for (int i = 0; i < 50000; i++) {
+        if (i % 10 != 0) {
+            table.erase("key" + std::to_string(i));
+        }
+    }
+    assert(table.memory_bytes() == full);
+    assert(table.garbage_bytes() > full / 2);
+    
+    size_t freed = 0;
+    while (size_t n = table.defragment(1)) {
+        freed += n;
+    }
+    assert(freed > 0);
+    assert(table.memory_bytes() < full / 2);
+    assert(table.garbage_bytes() < table.memory_bytes() / 2);
+    
+    // Everything that survived is still there, at its new location
+    for (int i = 0; i < 50000; i += 10) {
+        std::string_view found;
+        assert(table.find("key" + std::to_string(i), found) && found == value);
+    }
+    
+    // Large entries get their own slab, released as soon as they die
+    std::string big(1 << 20, 'b');
+    size_t before = table.memory_bytes();
+    table.put("big", big);
+    assert(table.memory_bytes() >= before + big.size());
+    table.erase("big");
+    assert(table.memory_bytes() == before);
+    
+    std::cout << "✓ Defragmentation passed" << std::endl;
+}
+
+void test_access_words() {
+    std::cout << "Testing access words..." << std::endl;
+    
+    CompactTable table;
+    table.track_access();
+    for (int i = 0; i < 100; i++) {
+        table.put("key" + std::to_string(i), "v");
+    }
+    
+    // A touch sees the old word and stores what it returns
+    std::string_view found;
+    auto touch = [](uint32_t word) { return word + 10; };
+    assert(table.find("key7", found, touch) && found == "v");
+    assert(table.find("key7", found, touch));
+    assert(table.find("key42", found, touch));
+    assert(!table.find("missing", found, touch));
+    
+    // Words move along when the table grows, and start at 0 for new keys
+    for (int i = 100; i < 5000; i++) {
+        table.put("key" + std::to_string(i), "v");
+    }
+    table.erase("key9");
+    std::unordered_map<std::string, uint32_t> words;
+    table.sample(SIZE_MAX, 12345, [&](std::string_view key, uint32_t word) {
+        assert(words.emplace(std::string(key), word).second);
+    });
+    assert(words.size() == table.size());
+    assert(words["key7"] == 20 && words["key42"] == 10 && words["key4999"] == 0);
+    assert(words.count("key9") == 0);
+    
+    // Samples are live entries, as many as asked for
+    std::mt19937_64 rng(3);
+    for (int round = 0; round < 100; round++) {
+        size_t seen = 0;
+        table.sample(5, rng(), [&](std::string_view key, uint32_t) {
+            assert(table.find(key, found));
+            seen++;
+        });
+        assert(seen == 5);
+    }
+    
+    std::cout << "✓ Access words passed" << std::endl;
+}
+
+int main() {
+    try {
+        test_basic_operations();
+        test_against_map();
+        test_defragment();
+        test_access_words();
+        
+        std::cout << "\n✓ All compact table tests passed!" << std::endl;
+        return 0;
+    } catch (const std::exception& e) {
+        std::cerr << "Test failed: " << e.what() << std::endl;
+        return 1;
+    }
+}
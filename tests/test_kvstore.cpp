@@ -1,6 +1,14 @@
 #include "kvstore.hpp"
+#include "key_range.hpp"
 #include <iostream>
 #include <cassert>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <dirent.h>
+#include <vector>
 
 void test_basic_operations() {
     std::cout << "Testing basic operations..." << std::endl;
@@ -113,6 +121,678 @@ void test_compaction() {
     std::cout << "✓ Compaction passed" << std::endl;
 }
 
+void test_concurrent_shards() {
+    std::cout << "Testing concurrent access across shards..." << std::endl;
+    
+    Storage::destroy("test_shards.db");
+    
+    KVStoreOptions options;
+    options.num_shards = 4;
+    
+    {
+        KVStore kv("test_shards.db", options);
+        assert(kv.shard_count() == 4);
+        
+        std::vector<std::thread> workers;
+        for (int t = 0; t < 4; t++) {
+            workers.emplace_back([&kv, t] {
+                std::string val;
+                for (int i = 0; i < 200; i++) {
+                    std::string key = "t" + std::to_string(t) + "_" + std::to_string(i);
+                    kv.put(key, std::to_string(i));
+                    assert(kv.get(key, val) && val == std::to_string(i));
+                    if (i % 2 == 0) {
+                        assert(kv.remove(key));
+                    }
+                }
+            });
+        }
+        for (auto& w : workers) {
+            w.join();
+        }
+    }
+    
+    // Reopen with a different shard count; the data must not depend on it
+    options.num_shards = 7;
+    KVStore kv("test_shards.db", options);
+    std::string val;
+    for (int t = 0; t < 4; t++) {
+        for (int i = 0; i < 200; i++) {
+            std::string key = "t" + std::to_string(t) + "_" + std::to_string(i);
+            if (i % 2 == 0) {
+                assert(!kv.get(key, val));
+            } else {
+                assert(kv.get(key, val) && val == std::to_string(i));
+            }
+        }
+    }
+    
+    std::cout << "✓ Concurrent shards passed" << std::endl;
+}
+
+void test_background_compaction() {
+    std::cout << "Testing background compaction..." << std::endl;
+    
+    Storage::destroy("test_bg_compact.db");
+    
+    KVStoreOptions options;
+    options.compact_min_bytes = 4096;
+    options.compact_garbage_ratio = 0.5;
+    
+    {
+        KVStore kv("test_bg_compact.db", options);
+        
+        // Overwriting a handful of keys turns most of the log into garbage
+        for (int i = 0; i < 2000; i++) {
+            kv.put("hot" + std::to_string(i % 5), "value" + std::to_string(i));
+        }
+        
+        // The garbage threshold kicks off compaction without anyone asking
+        for (int i = 0; i < 500 && kv.storage_stats().compactions == 0; i++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        assert(kv.storage_stats().compactions > 0);
+        
+        // PERSIST runs while another client keeps writing
+        std::atomic<bool> stop{false};
+        std::thread writer([&] {
+            for (int i = 0; !stop; i++) {
+                kv.put("during" + std::to_string(i % 100), std::to_string(i));
+            }
+        });
+        for (int i = 0; i < 3; i++) {
+            kv.persist();
+        }
+        stop = true;
+        writer.join();
+        kv.put("after", "persist");
+        assert(kv.garbage_ratio() < 0.5);
+    }
+    
+    {
+        KVStore kv("test_bg_compact.db", options);
+        std::string val;
+        for (int i = 0; i < 5; i++) {
+            assert(kv.get("hot" + std::to_string(i), val));
+            assert(val == "value" + std::to_string(1995 + i));
+        }
+        assert(kv.get("during0", val));
+        assert(kv.get("after", val) && val == "persist");
+    }
+    
+    std::cout << "✓ Background compaction passed" << std::endl;
+}
+
+void test_checkpoint() {
+    std::cout << "Testing checkpoints..." << std::endl;
+    
+    Storage::destroy("test_kv_checkpoint.db");
+    
+    KVStoreOptions options;
+    options.checkpoint_log_bytes = 8192;
+    
+    {
+        KVStore kv("test_kv_checkpoint.db", options);
+        
+        // Logging past checkpoint_log_bytes takes a snapshot in the background
+        for (int i = 0; i < 1000; i++) {
+            kv.put("key" + std::to_string(i % 50), "value" + std::to_string(i));
+        }
+        for (int i = 0; i < 500 && kv.storage_stats().checkpoints == 0; i++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        assert(kv.storage_stats().checkpoints > 0);
+        
+        // An explicit checkpoint while another client keeps writing
+        std::atomic<bool> stop{false};
+        std::thread writer([&] {
+            for (int i = 0; !stop; i++) {
+                kv.put("during" + std::to_string(i % 100), std::to_string(i));
+            }
+        });
+        kv.checkpoint();
+        stop = true;
+        writer.join();
+        kv.remove("key0");
+    }
+    
+    {
+        KVStore kv("test_kv_checkpoint.db", options);
+        StorageStats stats = kv.storage_stats();
+        assert(stats.snapshot_bytes > 0);
+        assert(stats.recovery_tail_bytes < options.checkpoint_log_bytes + 4096);
+        
+        std::string val;
+        assert(!kv.get("key0", val));
+        assert(kv.get("key49", val) && val == "value999");
+        assert(kv.get("during0", val));
+    }
+    
+    std::cout << "✓ Checkpoints passed" << std::endl;
+}
+
+void test_multi_ops() {
+    std::cout << "Testing batch operations..." << std::endl;
+    
+    Storage::destroy("test_multi.db");
+    
+    {
+        KVStore kv("test_multi.db");
+        std::vector<std::pair<std::string, std::string>> items;
+        for (int i = 0; i < 100; i++) {
+            items.emplace_back("key" + std::to_string(i), "value" + std::to_string(i));
+        }
+        
+        // The whole batch is one log record and one fsync
+        uint64_t before = kv.storage_stats().batches;
+        assert(kv.multi_put(items));
+        assert(kv.storage_stats().batches == before + 1);
+        
+        // An empty key rejects the batch without applying any of it
+        assert(!kv.multi_put({{"fresh", "x"}, {"", "y"}}));
+        std::string val;
+        assert(!kv.get("fresh", val));
+        
+        auto values = kv.multi_get({"key5", "missing", "key99", "key5"});
+        assert(values.size() == 4);
+        assert(values[0] && *values[0] == "value5");
+        assert(!values[1]);
+        assert(values[2] && *values[2] == "value99");
+        assert(values[3] && *values[3] == "value5");
+        
+        // Missing and repeated keys are only counted once
+        assert(kv.multi_remove({"key0", "key1", "key1", "missing"}) == 2);
+        assert(!kv.get("key0", val));
+        assert(kv.multi_remove({"missing"}) == 0);
+    }
+    
+    {
+        KVStore kv("test_multi.db");
+        auto values = kv.multi_get({"key0", "key1", "key2", "key99"});
+        assert(!values[0] && !values[1]);
+        assert(values[2] && *values[2] == "value2");
+        assert(values[3] && *values[3] == "value99");
+    }
+    
+    std::cout << "✓ Batch operations passed" << std::endl;
+}
+
+void test_scan() {
+    std::cout << "Testing range scans..." << std::endl;
+    
+    // The ordered index and the full-walk fallback must agree
+    for (bool ordered : {true, false}) {
+        Storage::destroy("test_scan.db");
+        KVStoreOptions options;
+        options.ordered_index = ordered;
+        
+        {
+            KVStore kv("test_scan.db", options);
+            for (int i = 0; i < 300; i++) {
+                char key[16];
+                snprintf(key, sizeof(key), "user:%03d", i);
+                kv.put(key, "u" + std::to_string(i));
+                snprintf(key, sizeof(key), "item:%03d", i);
+                kv.put(key, "i" + std::to_string(i));
+            }
+            kv.put("user", "bare");
+            kv.put("usez", "after");
+            
+            auto range = kv.scan("user:010", "user:020");
+            assert(range.size() == 10);
+            assert(range.front().first == "user:010" && range.front().second == "u10");
+            assert(range.back().first == "user:019");
+            
+            auto limited = kv.scan("item:", "", 5);
+            assert(limited.size() == 5);
+            assert(limited[0].first == "item:000" && limited[4].first == "item:004");
+            
+            auto users = kv.prefix_scan("user:");
+            assert(users.size() == 300);
+            for (size_t i = 1; i < users.size(); i++) {
+                assert(users[i - 1].first < users[i].first);
+            }
+            assert(kv.prefix_scan("user").size() == 301);
+            assert(kv.scan("", "").size() == 602);
+            
+            // Deletes and overwrites show up in later scans
+            kv.remove("user:000");
+            kv.put("user:001", "changed");
+            users = kv.prefix_scan("user:", 1);
+            assert(users.size() == 1 && users[0].first == "user:001" && users[0].second == "changed");
+            
+            // Paging from just after the last key visits every key once
+            std::string start = "item:";
+            size_t seen = 0;
+            while (true) {
+                auto page = kv.scan(start, prefix_end("item:"), 7);
+                if (page.empty()) {
+                    break;
+                }
+                seen += page.size();
+                start = page.back().first + '\0';
+            }
+            assert(seen == 300);
+        }
+        
+        // The index is rebuilt on recovery
+        {
+            KVStore kv("test_scan.db", options);
+            auto users = kv.prefix_scan("user:");
+            assert(users.size() == 299 && users.front().second == "changed");
+        }
+    }
+    
+    std::cout << "✓ Range scans passed" << std::endl;
+}
+
+void test_lsm_engine() {
+    std::cout << "Testing the LSM storage engine..." << std::endl;
+    
+    Storage::destroy("test_lsm_engine.db");
+    LsmTree::destroy("test_lsm_engine.db");
+    KVStoreOptions options;
+    options.engine = StorageEngine::Lsm;
+    options.num_shards = 4;
+    options.memtable_bytes = 16 << 10;
+    options.lsm.block_bytes = 512;
+    options.lsm.level0_files = 2;
+    options.lsm.level1_bytes = 64 << 10;
+    options.lsm.level_multiplier = 4;
+    options.lsm.file_bytes = 16 << 10;
+    
+    auto key_of = [](int i) {
+        char key[16];
+        snprintf(key, sizeof(key), "user:%05d", i);
+        return std::string(key);
+    };
+    
+    {
+        KVStore kv("test_lsm_engine.db", options);
+        for (int round = 0; round < 3; round++) {
+            for (int i = 0; i < 2000; i++) {
+                kv.put(key_of(i), "v" + std::to_string(round) + "-" + std::to_string(i));
+            }
+        }
+        for (int i = 0; i < 2000; i += 10) {
+            assert(kv.remove(key_of(i)));
+        }
+        assert(!kv.remove("never-written"));
+        kv.persist();
+        
+        // Everything was flushed out of the memtable
+        assert(kv.memory_bytes() < 16 << 10);
+        std::string value;
+        assert(kv.get(key_of(1), value) && value == "v2-1");
+        assert(!kv.get(key_of(10), value));
+        
+        // Cold keys can be deleted and overwritten
+        assert(kv.remove(key_of(1)));
+        assert(!kv.get(key_of(1), value));
+        assert(!kv.remove(key_of(1)));
+        kv.put(key_of(10), "back");
+        
+        auto values = kv.multi_get({key_of(1), key_of(10), key_of(11), "missing"});
+        assert(!values[0] && values[1] && *values[1] == "back");
+        assert(values[2] && *values[2] == "v2-11" && !values[3]);
+        
+        // Scans merge the memtable over the SSTables
+        auto range = kv.scan(key_of(0), key_of(20));
+        assert(range.size() == 18);
+        assert(range[0].first == key_of(2) && range[0].second == "v2-2");
+        assert(range[8].first == key_of(10) && range[8].second == "back");
+        auto page = kv.prefix_scan("user:", 5);
+        assert(page.size() == 5 && page.back().first == key_of(6));
+        assert(kv.prefix_scan("user:").size() == 1800);
+        
+        LsmStats stats = kv.lsm_stats();
+        assert(stats.flushes > 0);
+    }
+    
+    // Restart: the SSTables plus the log tail give back the same data
+    {
+        KVStore kv("test_lsm_engine.db", options);
+        std::string value;
+        assert(!kv.get(key_of(1), value));
+        assert(kv.get(key_of(10), value) && value == "back");
+        assert(kv.get(key_of(1999), value) && value == "v2-1999");
+        assert(kv.prefix_scan("user:").size() == 1800);
+        
+        // Enough writes to push data into deeper levels
+        for (int round = 0; round < 4; round++) {
+            for (int i = 0; i < 2000; i++) {
+                kv.put(key_of(i), "w" + std::to_string(round));
+            }
+            kv.persist();
+        }
+        kv.checkpoint();
+        assert(kv.get(key_of(1), value) && value == "w3");
+        assert(kv.prefix_scan("user:").size() == 2000);
+    }
+    
+    {
+        KVStore kv("test_lsm_engine.db", options);
+        for (int i = 0; i < 2000; i += 7) {
+            std::string value;
+            assert(kv.get(key_of(i), value) && value == "w3");
+        }
+        LsmStats stats = kv.lsm_stats();
+        assert(stats.level_files[0] + stats.level_files[1] + stats.level_files[2] > 0);
+        assert(stats.block_cache.misses > 0 && stats.block_cache.pinned_bytes > 0);
+        assert(stats.block_cache.used_bytes + stats.block_cache.pinned_bytes <= options.lsm.block_cache_bytes);
+    }
+    
+    std::cout << "✓ LSM storage engine passed" << std::endl;
+}
+
+void test_ttl() {
+    std::cout << "Testing keys with a TTL..." << std::endl;
+    
+    using std::chrono::milliseconds;
+    for (StorageEngine engine : {StorageEngine::Memory, StorageEngine::Lsm}) {
+        Storage::destroy("test_ttl.db");
+        LsmTree::destroy("test_ttl.db");
+        KVStoreOptions options;
+        options.engine = engine;
+        options.num_shards = 4;
+        options.ordered_index = engine == StorageEngine::Memory;
+        options.expiry_interval = milliseconds(0); // lazy expiry only
+        
+        {
+            KVStore kv("test_ttl.db", options);
+            std::string value;
+            kv.put("forever", "1");
+            kv.put("long", "2", std::chrono::hours(1));
+            kv.put("renewed", "3", milliseconds(200));
+            kv.put("renewed", "4"); // a plain put clears the TTL
+            assert(!kv.put("negative", "x", milliseconds(-1)));
+            if (engine == StorageEngine::Lsm) {
+                // Expires while on disk
+                kv.put("cold", "5", milliseconds(200));
+                kv.persist();
+            }
+            kv.put("short", "6", milliseconds(200));
+            assert(kv.get("short", value) && value == "6");
+            
+            uint64_t seq = 0;
+            for (int i = 0; i < 500; i++) {
+                assert(kv.put_nowait("bulk" + std::to_string(i), "v", seq, milliseconds(200)));
+            }
+            kv.wait_durable(seq);
+            assert(kv.prefix_scan("bulk").size() == 500);
+            
+            std::this_thread::sleep_for(milliseconds(400));
+            assert(kv.expired_count() == 0);
+            assert(!kv.get("short", value));
+            assert(kv.expired_count() == 1);
+            assert(!kv.get("cold", value));
+            assert(!kv.remove("bulk1"));
+            assert(kv.prefix_scan("bulk").empty());
+            auto values = kv.multi_get({"bulk2", "long", "renewed"});
+            assert(!values[0] && *values[1] == "2" && *values[2] == "4");
+            assert(kv.scan("", "").size() == 3);
+        }
+        
+        // Expired puts in the log replay as deletes
+        options.expiry_interval = milliseconds(20);
+        {
+            KVStore kv("test_ttl.db", options);
+            std::string value;
+            assert(!kv.get("short", value) && !kv.get("cold", value));
+            assert(kv.get("long", value) && value == "2");
+            assert(kv.get("renewed", value) && value == "4");
+            assert(kv.prefix_scan("bulk").empty());
+            
+            // The expiry pass removes keys nobody reads
+            uint64_t seq = 0;
+            for (int i = 0; i < 300; i++) {
+                assert(kv.put_nowait("active" + std::to_string(i), "v", seq, milliseconds(100)));
+            }
+            kv.wait_durable(seq);
+            std::this_thread::sleep_for(milliseconds(400));
+            assert(kv.expired_count() == 300);
+            assert(kv.prefix_scan("active").empty());
+            
+            // Compaction (or a flush) keeps the deadlines that have not passed
+            kv.put("soon", "7", milliseconds(300));
+            kv.persist();
+            assert(kv.get("soon", value) && value == "7");
+            kv.checkpoint();
+            std::this_thread::sleep_for(milliseconds(400));
+            assert(!kv.get("soon", value));
+            assert(kv.scan("", "").size() == 3);
+        }
+        
+        {
+            KVStore kv("test_ttl.db", options);
+            std::string value;
+            assert(!kv.get("soon", value));
+            assert(kv.get("long", value) && value == "2");
+            assert(kv.scan("", "").size() == 3);
+        }
+    }
+    
+    std::cout << "✓ TTLs passed" << std::endl;
+}
+
+void test_versions() {
+    std::cout << "Testing versions and atomic updates..." << std::endl;
+    
+    using std::chrono::milliseconds;
+    for (StorageEngine engine : {StorageEngine::Memory, StorageEngine::Lsm}) {
+        Storage::destroy("test_versions.db");
+        LsmTree::destroy("test_versions.db");
+        KVStoreOptions options;
+        options.engine = engine;
+        options.num_shards = 4;
+        
+        uint64_t kept_version, gone_version, flushed_version;
+        {
+            KVStore kv("test_versions.db", options);
+            std::string value;
+            uint64_t v1, v2, version;
+            assert(!kv.get("key", value, v1));
+            kv.put("key", "a");
+            assert(kv.get("key", value, v1) && value == "a" && v1 > 0);
+            kv.put("key", "b");
+            assert(kv.get("key", value, v2) && value == "b" && v2 > v1);
+            
+            // Compare-and-set only writes over the version it was given
+            assert(!kv.compare_and_set("key", v1, "c", version) && version == v2);
+            assert(!kv.compare_and_set("key", 0, "c", version) && version == v2);
+            assert(kv.compare_and_set("key", v2, "c", version) && version > v2);
+            assert(kv.get("key", value, v1) && value == "c" && v1 == version);
+            assert(!kv.compare_and_set("new", 5, "x", version) && version == 0);
+            assert(kv.compare_and_set("new", 0, "x", version) && version > 0);
+            assert(!kv.compare_and_set("", 0, "x", version));
+            
+            // A key deleted and written again does not get an old version back
+            assert(kv.remove("new"));
+            assert(kv.compare_and_set("new", 0, "y", v2) && v2 > version);
+            
+            // Counters; a missing key counts as 0
+            int64_t n;
+            assert(kv.increment("counter", 5, n) && n == 5);
+            assert(kv.increment("counter", -7, n) && n == -2);
+            assert(kv.get("counter", value) && value == "-2");
+            assert(!kv.increment("key", 1, n));
+            kv.put("big", std::to_string(INT64_MAX));
+            assert(!kv.increment("big", 1, n));
+            assert(kv.increment("big", -1, n) && n == INT64_MAX - 1);
+            kv.put("padded", " 1");
+            assert(!kv.increment("padded", 1, n));
+            
+            size_t length;
+            assert(kv.append("log", "ab", length) && length == 2);
+            assert(kv.append("log", "cd", length) && length == 4);
+            assert(kv.get("log", value) && value == "abcd");
+            
+            // Increments and appends keep a TTL, a compare-and-set clears it
+            kv.put("ttl_counter", "1", milliseconds(200));
+            assert(kv.increment("ttl_counter", 1, n) && n == 2);
+            kv.put("ttl_cas", "1", milliseconds(200));
+            assert(kv.get("ttl_cas", value, version));
+            assert(kv.compare_and_set("ttl_cas", version, "2", version));
+            std::this_thread::sleep_for(milliseconds(400));
+            assert(!kv.get("ttl_counter", value));
+            assert(kv.get("ttl_cas", value) && value == "2");
+            
+            // Concurrent increments, and compare-and-set retry loops, lose nothing
+            std::vector<std::thread> threads;
+            for (int t = 0; t < 4; t++) {
+                threads.emplace_back([&kv] {
+                    int64_t sum;
+                    std::string current;
+                    uint64_t seen, written;
+                    for (int i = 0; i < 250; i++) {
+                        assert(kv.increment("hits", 1, sum));
+                        do {
+                            if (!kv.get("cas_hits", current, seen)) {
+                                current = "0";
+                                seen = 0;
+                            }
+                        } while (!kv.compare_and_set("cas_hits", seen, std::to_string(std::stoi(current) + 1),
+                                                     written));
+                    }
+                });
+            }
+            for (auto &thread : threads) {
+                thread.join();
+            }
+            assert(kv.get("hits", value) && value == "1000");
+            assert(kv.get("cas_hits", value) && value == "1000");
+            
+            kv.put("gone", "1");
+            assert(kv.get("gone", value, gone_version));
+            assert(kv.remove("gone"));
+            kv.put("flushed", "1");
+            kv.persist();
+            assert(kv.get("flushed", value, flushed_version));
+            assert(kv.get("key", value, kept_version));
+        }
+        
+        // Versions survive a restart, and new ones go on from above them
+        {
+            KVStore kv("test_versions.db", options);
+            std::string value;
+            uint64_t version;
+            assert(kv.get("key", value, version) && value == "c" && version == kept_version);
+            assert(kv.get("flushed", value, version) && version == flushed_version);
+            assert(kv.get("counter", value) && value == "-2");
+            kv.put("gone", "2");
+            assert(kv.get("gone", value, version) && version > gone_version && version > kept_version);
+            
+            uint64_t written;
+            assert(kv.multi_put({{"m1", "1"}, {"m2", "2"}}));
+            assert(kv.get("m1", value, version) && version > kept_version);
+            assert(kv.compare_and_set("m1", version, "3", written) && written > version);
+        }
+    }
+    Storage::destroy("test_versions.db");
+    LsmTree::destroy("test_versions.db");
+    
+    std::cout << "✓ Versions and atomic updates passed" << std::endl;
+}
+
+// Files in storage/ belonging to the store named filename
+static size_t files_of(const std::string &filename) {
+    size_t count = 0;
+    if (DIR *dir = opendir("storage")) {
+        while (dirent *entry = readdir(dir)) {
+            count += std::string(entry->d_name).compare(0, filename.size(), filename) == 0;
+        }
+        closedir(dir);
+    }
+    return count;
+}
+
+void test_eviction() {
+    std::cout << "Testing maxmemory eviction..." << std::endl;
+    
+    const std::string value(100, 'v');
+    for (EvictionPolicy policy : {EvictionPolicy::Lru, EvictionPolicy::Lfu}) {
+        Storage::destroy("test_eviction.db");
+        KVStoreOptions options;
+        options.num_shards = 4;
+        options.max_memory_bytes = 200 << 10;
+        options.eviction_policy = policy;
+        
+        size_t kept = 0;
+        {
+            KVStore kv("test_eviction.db", options);
+            std::string found;
+            
+            // A small hot set is read, cache-aside, between every write of a
+            // long run of cold keys, which together need far more than the
+            // cap. The LRU clock ticks in milliseconds, so the run is spread
+            // out enough for the hot keys to look younger than the cold ones.
+            size_t hot_misses = 0;
+            for (int i = 0; i < 20000; i++) {
+                if (i % 100 == 0) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+                kv.put("cold" + std::to_string(i), value);
+                assert(kv.memory_used() <= options.max_memory_bytes);
+                std::string hot = "hot" + std::to_string(i % 50);
+                if (!kv.get(hot, found)) {
+                    hot_misses++;
+                    kv.put(hot, value);
+                }
+            }
+            assert(kv.evicted_count() > 10000);
+            assert(kv.memory_used() > options.max_memory_bytes / 2);
+            
+            // Past the first round, sampling picks a hot key only rarely
+            assert(hot_misses < 50 + 100);
+            for (int i = 0; i < 20000; i++) {
+                kept += kv.get("cold" + std::to_string(i), found);
+            }
+            assert(kept < 20000 / 2);
+            for (int i = 0; i < 50; i++) {
+                kept += kv.get("hot" + std::to_string(i), found);
+            }
+        }
+        
+        // Evictions were logged, so what comes back is what was left
+        {
+            KVStore kv("test_eviction.db", options);
+            std::string found;
+            size_t recovered = 0;
+            for (int i = 0; i < 20000; i++) {
+                recovered += kv.get("cold" + std::to_string(i), found);
+            }
+            for (int i = 0; i < 50; i++) {
+                recovered += kv.get("hot" + std::to_string(i), found);
+            }
+            assert(recovered == kept);
+        }
+    }
+    
+    // Without persistence nothing is written and nothing survives a restart
+    Storage::destroy("test_nolog.db");
+    KVStoreOptions options;
+    options.persistence = false;
+    options.max_memory_bytes = 64 << 10;
+    {
+        KVStore kv("test_nolog.db", options);
+        for (int i = 0; i < 5000; i++) {
+            kv.put("key" + std::to_string(i), value);
+        }
+        assert(kv.remove("key4999"));
+        kv.persist();
+        kv.checkpoint();
+        assert(kv.evicted_count() > 0);
+    }
+    assert(files_of("test_nolog.db") == 0);
+    {
+        KVStore kv("test_nolog.db", options);
+        std::string found;
+        assert(!kv.get("key0", found) && !kv.get("key4998", found));
+    }
+    
+    std::cout << "✓ Eviction passed" << std::endl;
+}
+
 int main() {
     try {
         test_basic_operations();
@@ -120,6 +800,15 @@ int main() {
         test_persistence();
         test_empty_key();
         test_compaction();
+        test_concurrent_shards();
+        test_background_compaction();
+        test_checkpoint();
+        test_multi_ops();
+        test_scan();
+        test_lsm_engine();
+        test_ttl();
+        test_versions();
+        test_eviction();
         
         std::cout << "\n✓ All tests passed!" << std::endl;
         return 0;
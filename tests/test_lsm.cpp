@@ -0,0 +1,364 @@
+#include "lsm.hpp"
+#include "sstable.hpp"
+#include <algorithm>
+#include <iostream>
+#include <cassert>
+#include <cstdio>
+#include <map>
+#include <optional>
+#include <random>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static std::string key_of(int i) {
+    char key[16];
+    snprintf(key, sizeof(key), "key%06d", i);
+    return key;
+}
+
+static std::vector<LsmTree::Entry> entries_of(const std::map<std::string, std::optional<std::string>> &batch) {
+    std::vector<LsmTree::Entry> entries;
+    for (const auto &[key, value] : batch) {
+        entries.push_back({key, value ? std::string_view(*value) : std::string_view(), !value});
+    }
+    return entries;
+}
+
+static std::vector<std::pair<std::string, std::string>> expected(const std::map<std::string, std::string> &reference) {
+    return {reference.begin(), reference.end()};
+}
+
+void test_sstable() {
+    std::cout << "Testing SSTable write and read..." << std::endl;
+    
+    mkdir("storage", 0755);
+    const std::string path = "storage/test_sstable.sst";
+    {
+        SSTableWriter writer(path, 512, 10);
+        for (int i = 0; i < 5000; i += 2) {
+            writer.add(key_of(i), "value" + std::to_string(i), i % 10 == 0);
+        }
+        writer.add(std::string("z\0bin", 5), std::string("v\0\n", 3), false);
+        assert(writer.entries() == 2501);
+        assert(writer.finish() > 0);
+    }
+    
+    {
+        SSTable table(path, 7);
+        assert(table.number() == 7);
+        assert(table.entries() == 2501);
+        assert(table.smallest() == key_of(0));
+        assert(table.largest() == std::string("z\0bin", 5));
+        
+        std::string value;
+        assert(table.get(key_of(4), value) == SSTable::Lookup::Found && value == "value4");
+        assert(table.get(key_of(4998), value) == SSTable::Lookup::Found && value == "value4998");
+        assert(table.get(key_of(20), value) == SSTable::Lookup::Deleted);
+        assert(table.get(key_of(3), value) == SSTable::Lookup::Missing);
+        assert(table.get("a", value) == SSTable::Lookup::Missing);
+        assert(table.get("zzz", value) == SSTable::Lookup::Missing);
+        assert(table.get(std::string("z\0bin", 5), value) == SSTable::Lookup::Found);
+        assert(value == std::string("v\0\n", 3));
+        
+        // Every key passes the bloom filter; most absent ones do not
+        int false_positives = 0;
+        for (int i = 0; i < 5000; i++) {
+            if (i % 2 == 0) {
+                assert(table.may_contain(key_of(i)));
+            } else if (table.may_contain(key_of(i))) {
+                false_positives++;
+            }
+        }
+        assert(false_positives < 125);
+        
+        // Iteration visits everything in order, from any starting point
+        SSTable::Iterator it(table);
+        size_t count = 0;
+        std::string previous;
+        for (it.seek_to_first(); it.valid(); it.next()) {
+            assert(count == 0 || previous < it.key());
+            previous = std::string(it.key());
+            count++;
+        }
+        assert(count == 2501);
+        
+        it.seek(key_of(101));
+        assert(it.valid() && it.key() == key_of(102) && it.value() == "value102" && !it.deleted());
+        it.seek(key_of(110));
+        assert(it.valid() && it.key() == key_of(110) && it.deleted());
+        it.seek("zzz");
+        assert(!it.valid());
+    }
+    
+    // A damaged footer is refused
+    {
+        FILE *file = fopen(path.c_str(), "r+b");
+        fseek(file, -4, SEEK_END);
+        fputc('X', file);
+        fclose(file);
+        bool threw = false;
+        try {
+            SSTable table(path, 7);
+        } catch (const std::exception &) {
+            threw = true;
+        }
+        assert(threw);
+    }
+    unlink(path.c_str());
+    
+    std::cout << "✓ SSTable write and read passed" << std::endl;
+}
+
+void test_flush_and_get() {
+    std::cout << "Testing LSM flush and lookups..." << std::endl;
+    
+    LsmTree::destroy("test_lsm");
+    {
+        LsmTree tree("test_lsm");
+        std::string value;
+        assert(tree.get("missing", value) == SSTable::Lookup::Missing);
+        
+        std::map<std::string, std::optional<std::string>> first, second;
+        for (int i = 0; i < 100; i++) {
+            first[key_of(i)] = "old" + std::to_string(i);
+        }
+        for (int i = 50; i < 150; i++) {
+            second[key_of(i)] = i % 10 == 0 ? std::nullopt : std::optional<std::string>("new" + std::to_string(i));
+        }
+        tree.flush(entries_of(first));
+        tree.flush(entries_of(second));
+        
+        // The newer file wins where they overlap
+        assert(tree.get(key_of(10), value) == SSTable::Lookup::Found && value == "old10");
+        assert(tree.get(key_of(51), value) == SSTable::Lookup::Found && value == "new51");
+        assert(tree.get(key_of(60), value) == SSTable::Lookup::Deleted);
+        assert(tree.get(key_of(149), value) == SSTable::Lookup::Found && value == "new149");
+        assert(tree.get(key_of(150), value) == SSTable::Lookup::Missing);
+        
+        LsmStats stats = tree.stats();
+        assert(stats.flushes == 2);
+        assert(stats.level_files[0] == 2);
+    }
+    
+    // The manifest brings the same layout back
+    {
+        LsmTree tree("test_lsm");
+        std::string value;
+        assert(tree.get(key_of(51), value) == SSTable::Lookup::Found && value == "new51");
+        assert(tree.get(key_of(60), value) == SSTable::Lookup::Deleted);
+        assert(tree.stats().level_files[0] == 2);
+    }
+    LsmTree::destroy("test_lsm");
+    
+    std::cout << "✓ LSM flush and lookups passed" << std::endl;
+}
+
+void test_compaction_against_map() {
+    std::cout << "Testing leveled compaction against std::map..." << std::endl;
+    
+    LsmTree::destroy("test_lsm");
+    LsmOptions options;
+    options.block_bytes = 256;
+    options.level0_files = 2;
+    options.level1_bytes = 32 << 10;
+    options.level_multiplier = 4;
+    options.file_bytes = 8 << 10;
+    
+    std::map<std::string, std::string> reference;
+    std::mt19937 rng(7);
+    std::uniform_int_distribution<int> key_dist(0, 2999);
+    std::uniform_int_distribution<int> op_dist(0, 9);
+    {
+        LsmTree tree("test_lsm", options);
+        for (int round = 0; round < 40; round++) {
+            std::map<std::string, std::optional<std::string>> batch;
+            for (int i = 0; i < 200; i++) {
+                std::string key = key_of(key_dist(rng));
+                if (op_dist(rng) < 2) {
+                    batch[key] = std::nullopt;
+                    reference.erase(key);
+                } else {
+                    std::string value = "r" + std::to_string(round) + "-" + std::to_string(i);
+                    batch[key] = value;
+                    reference[key] = value;
+                }
+            }
+            tree.flush(entries_of(batch));
+            while (tree.needs_compaction()) {
+                assert(tree.compact());
+            }
+        }
+        assert(!tree.compact());
+        
+        LsmStats stats = tree.stats();
+        assert(stats.compactions > 0);
+        assert(stats.compaction_write_bytes > 0);
+        assert(stats.level_files[0] < options.level0_files);
+        size_t deeper = 0;
+        for (size_t level = 1; level < stats.level_files.size(); level++) {
+            deeper += stats.level_files[level];
+        }
+        assert(deeper > 1);
+        
+        for (int i = 0; i < 3000; i++) {
+            std::string value;
+            auto it = reference.find(key_of(i));
+            SSTable::Lookup found = tree.get(key_of(i), value);
+            if (it == reference.end()) {
+                assert(found != SSTable::Lookup::Found);
+            } else {
+                assert(found == SSTable::Lookup::Found && value == it->second);
+            }
+        }
+        
+        // A full scan matches the reference exactly
+        std::vector<std::pair<std::string, std::string>> all;
+        tree.scan("", "", 0, {}, all);
+        assert(all == expected(reference));
+    }
+    
+    // And so does the reopened tree
+    {
+        LsmTree tree("test_lsm", options);
+        std::vector<std::pair<std::string, std::string>> all;
+        tree.scan("", "", 0, {}, all);
+        assert(all == expected(reference));
+    }
+    LsmTree::destroy("test_lsm");
+    
+    std::cout << "✓ Leveled compaction passed" << std::endl;
+}
+
+void test_scan_overlay() {
+    std::cout << "Testing scans with a memtable overlay..." << std::endl;
+    
+    LsmTree::destroy("test_lsm");
+    {
+        LsmTree tree("test_lsm");
+        std::map<std::string, std::optional<std::string>> batch;
+        for (int i = 0; i < 20; i++) {
+            batch[key_of(i)] = "disk" + std::to_string(i);
+        }
+        tree.flush(entries_of(batch));
+        
+        // Overlay entries replace, delete and add keys
+        LsmTree::Overlay overlay = {
+            {key_of(2), std::nullopt},
+            {key_of(3), std::string("mem3")},
+            {key_of(5), std::string("mem5")},
+            {key_of(30), std::string("mem30")},
+        };
+        std::vector<std::pair<std::string, std::string>> out;
+        tree.scan(key_of(1), key_of(6), 0, overlay, out);
+        assert(out.size() == 4);
+        assert(out[0].first == key_of(1) && out[0].second == "disk1");
+        assert(out[1].first == key_of(3) && out[1].second == "mem3");
+        assert(out[2].first == key_of(4) && out[2].second == "disk4");
+        assert(out[3].first == key_of(5) && out[3].second == "mem5");
+        
+        out.clear();
+        tree.scan(key_of(18), "", 3, overlay, out);
+        assert(out.size() == 3);
+        assert(out[2].first == key_of(30) && out[2].second == "mem30");
+        
+        out.clear();
+        tree.scan(key_of(0), "", 2, overlay, out);
+        assert(out.size() == 2 && out[1].first == key_of(1));
+    }
+    LsmTree::destroy("test_lsm");
+    
+    std::cout << "✓ Overlay scans passed" << std::endl;
+}
+
+void test_versions() {
+    std::cout << "Testing entry versions..." << std::endl;
+    
+    mkdir("storage", 0755);
+    const std::string path = "storage/test_versions.sst";
+    const uint64_t later = 4102444800000ull; // 2100-01-01
+    {
+        SSTableWriter writer(path, 512, 10);
+        writer.add("a", "plain", false);
+        writer.add("b", "versioned", false, 0, 42);
+        writer.add("c", "both", false, later, 43);
+        writer.add("d", "", true);
+        writer.finish();
+    }
+    {
+        // Entries without a version read as 0, and the deadline comes
+        // back ahead of the version it is stored with
+        SSTable table(path, 1);
+        std::string value;
+        uint64_t expires_at = 1, version = 1;
+        assert(table.get("a", value, &expires_at, &version) == SSTable::Lookup::Found);
+        assert(value == "plain" && expires_at == 0 && version == 0);
+        assert(table.get("b", value, &expires_at, &version) == SSTable::Lookup::Found);
+        assert(value == "versioned" && expires_at == 0 && version == 42);
+        assert(table.get("c", value, &expires_at, &version) == SSTable::Lookup::Found);
+        assert(value == "both" && expires_at == later && version == 43);
+        
+        SSTable::Iterator it(table);
+        it.seek("b");
+        assert(it.valid() && it.value() == "versioned" && it.version() == 42);
+        it.next();
+        assert(it.valid() && it.value() == "both" && it.expires_at() == later && it.version() == 43);
+        it.next();
+        assert(it.valid() && it.deleted() && it.version() == 0);
+    }
+    unlink(path.c_str());
+    
+    // Versions go through flushes and compactions unchanged
+    LsmTree::destroy("test_lsm");
+    LsmOptions options;
+    options.level0_files = 2;
+    {
+        LsmTree tree("test_lsm", options);
+        std::vector<std::string> values;
+        for (int i = 0; i < 100; i++) {
+            values.push_back("v" + std::to_string(i));
+        }
+        std::vector<LsmTree::Entry> first, second;
+        for (int i = 0; i < 100; i++) {
+            first.push_back({values[i], values[i], false, 0, uint64_t(i + 1)});
+        }
+        for (int i = 0; i < 100; i += 2) {
+            second.push_back({values[i], values[i], false, i % 4 == 0 ? later : 0, uint64_t(1000 + i)});
+        }
+        auto by_key = [](const auto &a, const auto &b) { return a.key < b.key; };
+        std::sort(first.begin(), first.end(), by_key);
+        std::sort(second.begin(), second.end(), by_key);
+        tree.flush(first);
+        tree.flush(second);
+        assert(tree.needs_compaction() && tree.compact());
+        assert(tree.stats().level_files[0] == 0);
+        
+        std::string value;
+        for (int i = 0; i < 100; i++) {
+            uint64_t expires_at = 1, version = 0;
+            assert(tree.get(values[i], value, &expires_at, &version) == SSTable::Lookup::Found);
+            assert(value == values[i]);
+            assert(version == (i % 2 == 0 ? uint64_t(1000 + i) : uint64_t(i + 1)));
+            assert(expires_at == (i % 4 == 0 ? later : 0));
+        }
+    }
+    LsmTree::destroy("test_lsm");
+    
+    std::cout << "✓ Entry versions passed" << std::endl;
+}
+
+int main() {
+    try {
+        test_sstable();
+        test_flush_and_get();
+        test_compaction_against_map();
+        test_scan_overlay();
+        test_versions();
+        
+        std::cout << "\n✓ All lsm tests passed!" << std::endl;
+        return 0;
+    } catch (const std::exception& e) {
+        std::cerr << "Test failed: " << e.what() << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,171 @@
+#include "metrics.hpp"
+#include "client.hpp"
+#include "kvstore.hpp"
+#include "server.hpp"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <iostream>
+#include <cassert>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+// Below the ports the async client, cluster, raft and replication tests use
+int next_port() {
+    static int port = 1500 + getpid() % 1000;
+    return port++;
+}
+
+void test_histogram() {
+    std::cout << "Testing histograms..." << std::endl;
+
+    // Small values are exact, larger ones land in a bucket at most 1/8 wide
+    for (uint64_t v : {0ull, 1ull, 7ull, 8ull, 15ull, 16ull, 1000ull, 123456789ull, 1ull << 39}) {
+        size_t b = metrics::Histogram::bucket_of(v);
+        assert(b < metrics::Histogram::BUCKETS);
+        assert(metrics::Histogram::bucket_limit(b) >= v);
+        assert(b == 0 || metrics::Histogram::bucket_limit(b - 1) < v);
+        assert(metrics::Histogram::bucket_limit(b) - v <= v / 8);
+    }
+    assert(metrics::Histogram::bucket_of(7) == 7);
+    assert(metrics::Histogram::bucket_of(~0ull) == metrics::Histogram::BUCKETS - 1);
+
+    metrics::Histogram h;
+    assert(h.snapshot().percentile(0.99) == 0);
+    for (uint64_t i = 1; i <= 1000; i++) {
+        h.record(i * 1000);
+    }
+    metrics::Histogram::Snapshot snap = h.snapshot();
+    assert(snap.count == 1000);
+    assert(snap.max_ns == 1000000);
+    assert(snap.sum_ns == 500500000);
+    uint64_t p50 = snap.percentile(0.5);
+    uint64_t p99 = snap.percentile(0.99);
+    assert(p50 >= 500000 && p50 <= 500000 * 9 / 8);
+    assert(p99 >= 990000 && p99 <= 1000000);
+    assert(snap.percentile(1.0) == 1000000);
+
+    std::cout << "✓ Histograms passed" << std::endl;
+}
+
+void test_concurrent_recording() {
+    std::cout << "Testing concurrent recording..." << std::endl;
+
+    metrics::Counter counter;
+    metrics::Histogram h;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 16; t++) {
+        threads.emplace_back([&, t] {
+            for (int i = 0; i < 10000; i++) {
+                counter.add(2);
+                h.record(t * 100 + i % 100);
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    assert(counter.value() == 16 * 10000 * 2);
+    assert(h.snapshot().count == 16 * 10000);
+    assert(h.snapshot().max_ns == 1599);
+
+    std::cout << "✓ Concurrent recording passed" << std::endl;
+}
+
+// The body of an HTTP GET, or empty if the request failed
+std::string http_get(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+    if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+        close(fd);
+        return "";
+    }
+    std::string request = "GET /metrics HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    assert(send(fd, request.data(), request.size(), MSG_NOSIGNAL) == ssize_t(request.size()));
+    std::string reply;
+    char buf[4096];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        reply.append(buf, n);
+    }
+    close(fd);
+    if (reply.rfind("HTTP/1.1 200 OK\r\n", 0) != 0) {
+        return "";
+    }
+    size_t body = reply.find("\r\n\r\n");
+    return body == std::string::npos ? "" : reply.substr(body + 4);
+}
+
+void test_server_stats() {
+    std::cout << "Testing STATS and the metrics endpoint..." << std::endl;
+
+    int port = next_port();
+    int metrics_port = next_port();
+    KVStoreOptions options;
+    options.num_shards = 4;
+    Storage::destroy("test_metrics.db");
+    KVStore* store = new KVStore("test_metrics.db", options);
+    ServerOptions server_options;
+    server_options.io_threads = 2;
+    server_options.metrics_port = metrics_port;
+    KVServer* server = new KVServer(store, port, server_options);
+    std::thread([server] { server->run(); }).detach();
+    std::this_thread::sleep_for(100ms);
+
+    KVClient client("127.0.0.1", port);
+    for (int i = 0; i < 100; i++) {
+        assert(client.put("k" + std::to_string(i), "v"));
+    }
+    std::string value;
+    for (int i = 0; i < 50; i++) {
+        assert(client.get("k" + std::to_string(i), value));
+    }
+    assert(client.remove("k0"));
+
+    std::string stats = client.stats();
+    assert(stats.find("connections_active:1\n") != std::string::npos);
+    assert(stats.find("cmd_put:calls=100 ") != std::string::npos);
+    assert(stats.find("cmd_get:calls=50 ") != std::string::npos);
+    assert(stats.find("cmd_delete:calls=1 ") != std::string::npos);
+    assert(stats.find("durable_wait:calls=101 ") != std::string::npos);
+    assert(stats.find("log_sync:calls=") != std::string::npos);
+
+    // The text protocol answers with the same lines
+    KVClient text("127.0.0.1", port, KVClient::Protocol::Text);
+    std::string text_stats = text.stats();
+    assert(text_stats.find("connections_active:2\n") != std::string::npos);
+    assert(text_stats.find("cmd_stats:calls=1 ") != std::string::npos);
+
+    std::string body = http_get(metrics_port);
+    assert(!body.empty());
+    assert(body.find("# TYPE distkv_request_duration_seconds summary\n") != std::string::npos);
+    assert(body.find("distkv_request_duration_seconds_count{op=\"put\"} 100\n") != std::string::npos);
+    assert(body.find("distkv_request_duration_seconds{op=\"get\",quantile=\"0.99\"} ") != std::string::npos);
+    assert(body.find("distkv_connections_active 2\n") != std::string::npos);
+    assert(body.find("distkv_log_sync_seconds_count ") != std::string::npos);
+    assert(body.find("distkv_log_garbage_ratio ") != std::string::npos);
+
+    std::cout << "✓ STATS and the metrics endpoint passed" << std::endl;
+}
+
+int main() {
+    try {
+        test_histogram();
+        test_concurrent_recording();
+        test_server_stats();
+
+        std::cout << "\n✓ All metrics tests passed!" << std::endl;
+        return 0;
+    } catch (const std::exception& e) {
+        std::cerr << "Test failed: " << e.what() << std::endl;
+        return 1;
+    }
+}
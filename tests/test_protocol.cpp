@@ -0,0 +1,201 @@
+#include "protocol.hpp"
+#include <iostream>
+#include <cassert>
+
+void test_frame_roundtrip() {
+    std::cout << "Testing frame round trip..." << std::endl;
+    
+    std::string buf;
+    protocol::encode_request(buf, protocol::Opcode::Put, 42, "key", "value with spaces\nand newlines");
+    
+    protocol::FrameHeader header;
+    assert(protocol::decode_header(buf, header));
+    assert(header.magic == protocol::MAGIC);
+    assert(header.code == static_cast<uint8_t>(protocol::Opcode::Put));
+    assert(header.request_id == 42);
+    assert(header.key_len == 3);
+    assert(header.value_len == 30);
+    assert(header.frame_size() == buf.size());
+    
+    std::string_view body(buf);
+    assert(body.substr(protocol::HEADER_SIZE, header.key_len) == "key");
+    assert(body.substr(protocol::HEADER_SIZE + header.key_len) == "value with spaces\nand newlines");
+    assert(header.flags == 0);
+    
+    // Flags carry a durability level and the ask for the write's LSN
+    buf.clear();
+    protocol::encode_request(buf, protocol::Opcode::Delete, 7, "key", {}, 3 | protocol::FLAG_RETURN_LSN);
+    assert(protocol::decode_header(buf, header));
+    assert((header.flags & protocol::FLAG_DURABILITY) == 3);
+    assert(header.flags & protocol::FLAG_RETURN_LSN);
+    
+    std::cout << "✓ Frame round trip passed" << std::endl;
+}
+
+void test_partial_header() {
+    std::cout << "Testing partial header..." << std::endl;
+    
+    std::string buf;
+    protocol::encode_response(buf, protocol::Status::NotFound, 7);
+    assert(buf.size() == protocol::HEADER_SIZE);
+    
+    // A header split across reads must not decode until complete
+    protocol::FrameHeader header;
+    for (size_t n = 0; n < protocol::HEADER_SIZE; n++) {
+        assert(!protocol::decode_header(std::string_view(buf.data(), n), header));
+    }
+    assert(protocol::decode_header(buf, header));
+    assert(header.code == static_cast<uint8_t>(protocol::Status::NotFound));
+    assert(header.request_id == 7);
+    assert(header.key_len == 0 && header.value_len == 0);
+    
+    std::cout << "✓ Partial header passed" << std::endl;
+}
+
+void test_large_lengths() {
+    std::cout << "Testing large lengths..." << std::endl;
+    
+    std::string value(70000, 'v');
+    std::string buf;
+    protocol::encode_request(buf, protocol::Opcode::Put, 0xFFFFFFFF, "k", value);
+    
+    protocol::FrameHeader header;
+    assert(protocol::decode_header(buf, header));
+    assert(header.request_id == 0xFFFFFFFF);
+    assert(header.value_len == 70000);
+    
+    std::cout << "✓ Large lengths passed" << std::endl;
+}
+
+void test_multi_bodies() {
+    std::cout << "Testing multi-key bodies..." << std::endl;
+    
+    std::string body;
+    protocol::encode_u32(body, 3);
+    protocol::encode_string(body, "k1");
+    protocol::encode_string(body, "");
+    protocol::encode_string(body, "value\nwith newline");
+    
+    std::vector<std::string_view> items;
+    assert(protocol::decode_strings(body, items));
+    assert(items.size() == 3);
+    assert(items[0] == "k1" && items[1].empty() && items[2] == "value\nwith newline");
+    
+    // Truncated, padded or over-counted lists are rejected
+    assert(!protocol::decode_strings(body.substr(0, body.size() - 1), items));
+    assert(!protocol::decode_strings(body + "x", items));
+    std::string huge;
+    protocol::encode_u32(huge, 0xFFFFFFFF);
+    assert(!protocol::decode_strings(huge, items));
+    
+    std::vector<std::optional<std::string>> values = {std::string("a"), std::nullopt, std::string()};
+    std::string encoded;
+    protocol::encode_values(encoded, values);
+    std::vector<std::optional<std::string>> decoded;
+    assert(protocol::decode_values(encoded, decoded));
+    assert(decoded == values);
+    assert(!protocol::decode_values(encoded.substr(0, encoded.size() - 1), decoded));
+    
+    std::cout << "✓ Multi-key bodies passed" << std::endl;
+}
+
+void test_scan_bodies() {
+    std::cout << "Testing scan bodies..." << std::endl;
+    
+    std::string request;
+    protocol::encode_scan_request(request, 100, std::string_view("end\0key", 7));
+    uint32_t limit;
+    std::string_view end;
+    assert(protocol::decode_scan_request(request, limit, end));
+    assert(limit == 100 && end == std::string_view("end\0key", 7));
+    assert(!protocol::decode_scan_request("abc", limit, end));
+    
+    std::vector<std::pair<std::string, std::string>> entries = {{"a", "1"}, {"b", ""}, {"c\n", "3 3"}};
+    std::string body;
+    protocol::encode_entries(body, entries, true);
+    std::vector<std::pair<std::string, std::string>> decoded;
+    bool more = false;
+    assert(protocol::decode_entries(body, decoded, more));
+    assert(more && decoded == entries);
+    
+    body.clear();
+    protocol::encode_entries(body, {}, false);
+    assert(protocol::decode_entries(body, decoded, more));
+    assert(!more && decoded.empty());
+    assert(!protocol::decode_entries("", decoded, more));
+    
+    std::cout << "✓ Scan bodies passed" << std::endl;
+}
+
+void test_ttl_bodies() {
+    std::cout << "Testing PutEx bodies..." << std::endl;
+    
+    std::string body;
+    protocol::encode_ttl_value(body, 3600, std::string_view("va\0lue", 6));
+    uint32_t ttl = 0;
+    std::string_view value;
+    assert(protocol::decode_ttl_value(body, ttl, value));
+    assert(ttl == 3600 && value == std::string_view("va\0lue", 6));
+    assert(!protocol::decode_ttl_value("abc", ttl, value));
+    
+    std::cout << "✓ PutEx bodies passed" << std::endl;
+}
+
+void test_versioned_bodies() {
+    std::cout << "Testing Cas and GetVersion bodies..." << std::endl;
+    
+    std::string body;
+    protocol::encode_versioned_value(body, 0x0102030405060708ull, std::string_view("va\0lue", 6));
+    assert(body.size() == 14 && body[0] == 1 && body[7] == 8);
+    uint64_t version = 0;
+    std::string_view value;
+    assert(protocol::decode_versioned_value(body, version, value));
+    assert(version == 0x0102030405060708ull && value == std::string_view("va\0lue", 6));
+    body.clear();
+    protocol::encode_versioned_value(body, 0, "");
+    assert(protocol::decode_versioned_value(body, version, value) && version == 0 && value.empty());
+    assert(!protocol::decode_versioned_value("1234567", version, value));
+    
+    // IncrBy deltas and results are i64s sent as u64s
+    body.clear();
+    protocol::encode_u64(body, static_cast<uint64_t>(int64_t(-5)));
+    uint64_t delta = 0;
+    assert(protocol::decode_u64(body, delta) && static_cast<int64_t>(delta) == -5);
+    
+    std::cout << "✓ Cas and GetVersion bodies passed" << std::endl;
+}
+
+void test_replication_bodies() {
+    std::cout << "Testing replication bodies..." << std::endl;
+    
+    std::string body;
+    protocol::encode_u64(body, 0x0123456789abcdefull);
+    protocol::encode_u64(body, 42);
+    body += "records";
+    uint64_t a = 0, b = 0;
+    assert(protocol::decode_u64(body, a) && a == 0x0123456789abcdefull);
+    assert(protocol::decode_u64(std::string_view(body).substr(8), b) && b == 42);
+    assert(std::string_view(body).substr(16) == "records");
+    assert(!protocol::decode_u64("1234567", a));
+    
+    std::cout << "✓ Replication bodies passed" << std::endl;
+}
+
+int main() {
+    try {
+        test_frame_roundtrip();
+        test_partial_header();
+        test_large_lengths();
+        test_multi_bodies();
+        test_scan_bodies();
+        test_ttl_bodies();
+        test_versioned_bodies();
+        test_replication_bodies();
+        
+        std::cout << "\n✓ All protocol tests passed!" << std::endl;
+        return 0;
+    } catch (const std::exception& e) {
+        std::cerr << "Test failed: " << e.what() << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,354 @@
+#include "raft.hpp"
+#include "client.hpp"
+#include "kvstore.hpp"
+#include "server.hpp"
+#include <iostream>
+#include <cassert>
+#include <chrono>
+#include <dirent.h>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+// Servers run until the process exits, so every test gets ports of its own,
+// below the ephemeral range the nodes' own connections are bound in
+int next_port() {
+    static int port = 10000 + getpid() % 10000;
+    return port++;
+}
+
+// Start every run from empty logs
+void remove_files(const std::string& prefix) {
+    if (DIR* dir = opendir("storage")) {
+        while (dirent* entry = readdir(dir)) {
+            std::string name = entry->d_name;
+            if (name.compare(0, prefix.size(), prefix) == 0) {
+                unlink(("storage/" + name).c_str());
+            }
+        }
+        closedir(dir);
+    }
+}
+
+RaftOptions raft_options(const std::vector<int>& ports, size_t id, const std::string& name) {
+    RaftOptions options;
+    for (int port : ports) {
+        options.peers.push_back("127.0.0.1:" + std::to_string(port));
+    }
+    options.id = id;
+    options.log_file = name + std::to_string(id) + ".raft";
+    options.election_timeout = 200ms;
+    options.heartbeat_interval = 30ms;
+    return options;
+}
+
+struct Node {
+    KVStore* store;
+    RaftNode* raft;
+    int port;
+};
+
+// A cluster of servers on fresh ports; like the servers, it is never torn down
+std::vector<Node> start_cluster(const std::string& name, size_t size, bool persistent,
+                                uint64_t snapshot_entries = 100000) {
+    remove_files(name);
+    std::vector<int> ports;
+    for (size_t i = 0; i < size; i++) {
+        ports.push_back(next_port());
+    }
+
+    std::vector<Node> nodes;
+    for (size_t i = 0; i < size; i++) {
+        KVStoreOptions options;
+        options.num_shards = 4;
+        options.persistence = persistent;
+        KVStore* store = new KVStore(name + std::to_string(i) + ".db", options);
+
+        RaftOptions raft = raft_options(ports, i, name);
+        raft.snapshot_entries = snapshot_entries;
+        RaftNode* node = new RaftNode(*store, raft);
+
+        ServerOptions server_options;
+        server_options.io_threads = 2;
+        server_options.raft = node;
+        KVServer* server = new KVServer(store, ports[i], server_options);
+        std::thread([server] { server->run(); }).detach();
+        nodes.push_back({store, node, ports[i]});
+    }
+    return nodes;
+}
+
+// The node that leads in the highest term, once all but skip agree on it
+size_t wait_for_leader(const std::vector<Node>& nodes, int skip = -1) {
+    auto deadline = std::chrono::steady_clock::now() + 10s;
+    while (std::chrono::steady_clock::now() < deadline) {
+        int leader = -1;
+        uint64_t term = 0;
+        bool agreed = true;
+        for (size_t i = 0; i < nodes.size(); i++) {
+            RaftStatus status = nodes[i].raft->status();
+            if (static_cast<int>(i) != skip && status.role == RaftRole::Leader && status.term >= term) {
+                leader = static_cast<int>(i);
+                term = status.term;
+            }
+        }
+        for (size_t i = 0; i < nodes.size() && leader >= 0; i++) {
+            RaftStatus status = nodes[i].raft->status();
+            agreed = agreed && (static_cast<int>(i) == skip || (status.term == term && status.leader == leader));
+        }
+        if (leader >= 0 && agreed) {
+            return leader;
+        }
+        std::this_thread::sleep_for(20ms);
+    }
+    assert(false && "no leader elected");
+    return 0;
+}
+
+// Wait for every node but skip to apply everything the leader has committed
+void catch_up(const std::vector<Node>& nodes, size_t leader, int skip = -1) {
+    uint64_t commit = nodes[leader].raft->status().commit_index;
+    auto deadline = std::chrono::steady_clock::now() + 10s;
+    for (size_t i = 0; i < nodes.size(); i++) {
+        while (static_cast<int>(i) != skip && nodes[i].raft->status().last_applied < commit) {
+            assert(std::chrono::steady_clock::now() < deadline);
+            std::this_thread::sleep_for(10ms);
+        }
+    }
+}
+
+size_t count_keys(KVStore& store) {
+    size_t count = 0;
+    store.dump([&count](const std::string&, const std::string&, uint64_t, uint64_t) { count++; });
+    return count;
+}
+
+std::string put_records(const std::string& key, const std::string& value) {
+    std::string records;
+    Storage::encode_put(records, key, value);
+    return records;
+}
+
+void test_single_node() {
+    std::cout << "Testing a single node and restart..." << std::endl;
+
+    remove_files("test_raft_single");
+    KVStoreOptions options;
+    options.num_shards = 4;
+    options.persistence = false;
+    RaftOptions raft = raft_options({next_port()}, 0, "test_raft_single");
+    std::string value;
+    uint64_t term;
+
+    {
+        KVStore store("test_raft_single.db", options);
+        RaftNode node(store, raft);
+        while (node.status().role != RaftRole::Leader) {
+            std::this_thread::sleep_for(10ms);
+        }
+        for (int i = 0; i < 100; i++) {
+            assert(node.replicate(put_records("k" + std::to_string(i), "v" + std::to_string(i))));
+        }
+        std::string records;
+        Storage::encode_remove(records, "k0");
+        assert(node.replicate(records));
+        assert(store.get("k99", value) && value == "v99");
+        assert(!store.get("k0", value));
+
+        // An entry index and term identify
+        uint64_t index;
+        assert(node.propose(put_records("k100", "v100"), index, term));
+        assert(node.wait_applied(index, term));
+        assert(!node.wait_applied(index, term + 1));
+        assert(node.leader_address() == raft.peers[0]);
+    }
+
+    // The store kept nothing, so the whole log is applied again
+    KVStore store("test_raft_single.db", options);
+    RaftNode node(store, raft);
+    while (node.status().last_applied < 103) {
+        std::this_thread::sleep_for(10ms);
+    }
+    assert(node.status().term > term);
+    assert(store.get("k99", value) && value == "v99");
+    assert(store.get("k100", value) && value == "v100");
+    assert(!store.get("k0", value));
+
+    std::cout << "✓ Single node passed" << std::endl;
+}
+
+void test_replicated_writes() {
+    std::cout << "Testing election and replicated writes..." << std::endl;
+
+    std::vector<Node> nodes = start_cluster("test_raft_writes", 3, false);
+    size_t leader = wait_for_leader(nodes);
+    size_t follower = (leader + 1) % nodes.size();
+
+    KVClient client("127.0.0.1", nodes[leader].port);
+    assert(client.put("a", "1"));
+    assert(client.put("b", "2"));
+    assert(client.remove("b"));
+    assert(!client.remove("b"));
+    assert(client.multi_put({{"m1", "x"}, {"m2", "y"}}));
+    assert(client.multi_remove({"m1", "nope"}) == 1);
+    assert(client.put("ttl", "soon", std::chrono::seconds(3600)));
+    std::string value;
+    assert(client.get("a", value) && value == "1");
+    catch_up(nodes, leader);
+
+    for (const Node& node : nodes) {
+        assert(node.store->get("a", value) && value == "1");
+        assert(!node.store->get("b", value));
+        assert(!node.store->get("m1", value));
+        assert(node.store->get("m2", value) && value == "y");
+        assert(node.store->get("ttl", value) && value == "soon");
+    }
+
+    // Followers serve reads but send writes to the leader
+    KVClient to_follower("127.0.0.1", nodes[follower].port);
+    assert(to_follower.get("a", value) && value == "1");
+    assert(!to_follower.put("a", "2"));
+    to_follower.queue_put("a", "2");
+    KVClient::Reply reply = to_follower.read_reply();
+    assert(reply.status == protocol::Status::NotLeader);
+    assert(reply.value == "127.0.0.1:" + std::to_string(nodes[leader].port));
+
+    std::string info = to_follower.replication_info();
+    assert(info.find("role:raft_follower\n") != std::string::npos);
+    assert(info.find("leader:127.0.0.1:" + std::to_string(nodes[leader].port) + "\n") != std::string::npos);
+    assert(client.replication_info().find("role:raft_leader\n") != std::string::npos);
+
+    std::cout << "✓ Replicated writes passed" << std::endl;
+}
+
+void test_failover() {
+    std::cout << "Testing leader failover..." << std::endl;
+
+    std::vector<Node> nodes = start_cluster("test_raft_failover", 3, false);
+    size_t old_leader = wait_for_leader(nodes);
+    uint64_t old_term = nodes[old_leader].raft->status().term;
+    {
+        KVClient client("127.0.0.1", nodes[old_leader].port);
+        assert(client.put("before", "1"));
+    }
+
+    // Cut the leader off: the others elect one of their own, and the old
+    // one, hearing from nobody, stops taking writes
+    nodes[old_leader].raft->set_isolated(true);
+    size_t leader = wait_for_leader(nodes, static_cast<int>(old_leader));
+    assert(leader != old_leader);
+    assert(nodes[leader].raft->status().term > old_term);
+    while (nodes[old_leader].raft->status().role == RaftRole::Leader) {
+        std::this_thread::sleep_for(10ms);
+    }
+    {
+        KVClient client("127.0.0.1", nodes[old_leader].port);
+        assert(!client.put("lost", "1"));
+    }
+    {
+        KVClient client("127.0.0.1", nodes[leader].port);
+        assert(client.put("after", "2"));
+        std::string value;
+        assert(client.get("before", value) && value == "1");
+    }
+
+    // Back on the network, it follows the new leader and catches up
+    nodes[old_leader].raft->set_isolated(false);
+    leader = wait_for_leader(nodes);
+    catch_up(nodes, leader);
+    std::string value;
+    for (const Node& node : nodes) {
+        assert(node.store->get("before", value) && value == "1");
+        assert(node.store->get("after", value) && value == "2");
+        assert(!node.store->get("lost", value));
+    }
+
+    std::cout << "✓ Failover passed" << std::endl;
+}
+
+void test_snapshot_install() {
+    std::cout << "Testing snapshots for lagging followers..." << std::endl;
+
+    std::vector<Node> nodes = start_cluster("test_raft_snapshot", 3, true, 100);
+    size_t leader = wait_for_leader(nodes);
+    size_t lagging = (leader + 1) % nodes.size();
+    KVClient client("127.0.0.1", nodes[leader].port);
+    assert(client.put("stale", "1"));
+    catch_up(nodes, leader);
+
+    // The log moves on without the follower, and drops what it missed
+    nodes[lagging].raft->set_isolated(true);
+    assert(client.remove("stale"));
+    for (int i = 0; i < 500; i++) {
+        assert(client.put("key" + std::to_string(i), "value" + std::to_string(i)));
+    }
+    while (nodes[leader].raft->status().snapshot_index == 0) {
+        std::this_thread::sleep_for(10ms);
+    }
+
+    nodes[lagging].raft->set_isolated(false);
+    leader = wait_for_leader(nodes);
+    catch_up(nodes, leader);
+    assert(nodes[lagging].raft->status().snapshots_installed >= 1);
+    std::string value;
+    assert(nodes[lagging].store->get("key499", value) && value == "value499");
+    assert(!nodes[lagging].store->get("stale", value));
+    assert(count_keys(*nodes[lagging].store) == count_keys(*nodes[leader].store));
+
+    std::cout << "✓ Snapshot install passed" << std::endl;
+}
+
+void test_message_loss() {
+    std::cout << "Testing writes with lost messages..." << std::endl;
+
+    std::vector<Node> nodes = start_cluster("test_raft_loss", 3, false);
+    for (const Node& node : nodes) {
+        node.raft->set_drop_rate(0.1);
+    }
+
+    // A write that fails may or may not have happened; retry until one is acknowledged
+    for (int i = 0; i < 100; i++) {
+        std::string key = "key" + std::to_string(i);
+        while (true) {
+            size_t leader = wait_for_leader(nodes);
+            KVClient client("127.0.0.1", nodes[leader].port);
+            if (client.put(key, std::to_string(i))) {
+                break;
+            }
+        }
+    }
+
+    for (const Node& node : nodes) {
+        node.raft->set_drop_rate(0);
+    }
+    size_t leader = wait_for_leader(nodes);
+    catch_up(nodes, leader);
+    std::string value;
+    for (const Node& node : nodes) {
+        for (int i = 0; i < 100; i++) {
+            assert(node.store->get("key" + std::to_string(i), value) && value == std::to_string(i));
+        }
+    }
+
+    std::cout << "✓ Message loss passed" << std::endl;
+}
+
+int main() {
+    try {
+        test_single_node();
+        test_replicated_writes();
+        test_failover();
+        test_snapshot_install();
+        test_message_loss();
+
+        std::cout << "\n✓ All raft tests passed!" << std::endl;
+        return 0;
+    } catch (const std::exception& e) {
+        std::cerr << "Test failed: " << e.what() << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,258 @@
+#include "replication.hpp"
+#include "client.hpp"
+#include "kvstore.hpp"
+#include "server.hpp"
+#include <iostream>
+#include <cassert>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <unistd.h>
+
+using namespace std::chrono_literals;
+
+// Servers run until the process exits, so every test gets ports of its own
+int next_port() {
+    static int port = 20000 + getpid() % 20000;
+    return port++;
+}
+
+// A leader on a fresh port; the store and server are never torn down
+KVStore& start_leader(int port, size_t backlog_bytes) {
+    KVStoreOptions options;
+    options.num_shards = 4;
+    options.persistence = false;
+    options.replication_backlog_bytes = backlog_bytes;
+    KVStore* store = new KVStore("storage/test_replication_leader.log", options);
+
+    ServerOptions server_options;
+    server_options.io_threads = 1;
+    KVServer* server = new KVServer(store, port, server_options);
+    std::thread([server] { server->run(); }).detach();
+    std::this_thread::sleep_for(100ms);
+    return *store;
+}
+
+KVStoreOptions follower_options() {
+    KVStoreOptions options;
+    options.num_shards = 4;
+    options.persistence = false;
+    return options;
+}
+
+// Wait for the follower to apply everything the leader has logged so far
+void catch_up(KVStore& leader, const Replica& replica) {
+    bool caught_up = replica.wait_for(leader.replication_log()->end_offset(), 10s);
+    assert(caught_up);
+    (void)caught_up;
+}
+
+void test_backlog() {
+    std::cout << "Testing the replication backlog..." << std::endl;
+
+    ReplicationLog log(1000);
+    std::string record;
+    Storage::encode_put(record, "key", "value");
+    log.append(record);
+    assert(log.end_offset() == record.size());
+
+    std::string out;
+    uint64_t written_at = 0;
+    assert(log.read(0, 1 << 20, 0ms, out, written_at) == ReplicationLog::Read::Data);
+    assert(out == record && written_at > 0);
+
+    // Nothing past the end yet
+    auto start = std::chrono::steady_clock::now();
+    assert(log.read(log.end_offset(), 1 << 20, 50ms, out, written_at) == ReplicationLog::Read::Timeout);
+    assert(std::chrono::steady_clock::now() - start >= 50ms);
+
+    // Records are kept in chunks; once a second one starts the first is
+    // dropped for being over the limit, and positions in it are gone
+    uint64_t middle = log.end_offset();
+    std::string big;
+    Storage::encode_put(big, "big", std::string(1000, 'x'));
+    for (int i = 0; i < 100; i++) {
+        log.append(big);
+    }
+    assert(log.read(0, 1 << 20, 0ms, out, written_at) == ReplicationLog::Read::Gone);
+    assert(log.read(middle, 1 << 20, 0ms, out, written_at) == ReplicationLog::Read::Gone);
+    assert(log.read(log.end_offset() + 1, 1 << 20, 0ms, out, written_at) == ReplicationLog::Read::Gone);
+
+    // What is left decodes as whole records
+    uint64_t tail = log.end_offset() - 10 * big.size();
+    assert(log.read(tail, 1 << 20, 0ms, out, written_at) == ReplicationLog::Read::Data);
+    size_t records = 0;
+    assert(Storage::decode_records(out, [&](const std::vector<Storage::LogOp>& ops) {
+               records += ops.size();
+           }) == out.size());
+    assert(records == 10);
+
+    std::cout << "✓ Backlog passed" << std::endl;
+}
+
+void test_streaming() {
+    std::cout << "Testing full sync and streaming..." << std::endl;
+
+    int port = next_port();
+    KVStore& leader = start_leader(port, 16 << 20);
+    for (int i = 0; i < 1000; i++) {
+        leader.put("before" + std::to_string(i), "value" + std::to_string(i));
+    }
+
+    KVStore follower("storage/test_replication_follower.log", follower_options());
+    follower.put("stale", "gone after the full sync");
+    Replica replica(follower, "127.0.0.1", port);
+    catch_up(leader, replica);
+
+    std::string value;
+    assert(follower.get("before999", value) && value == "value999");
+    assert(!follower.get("stale", value));
+    assert(replica.status().full_syncs == 1);
+
+    // Every kind of write is streamed
+    leader.put("k", "v1");
+    leader.put("k", "v2");
+    leader.remove("before0");
+    leader.multi_put({{"m1", "a"}, {"m2", "b"}});
+    leader.multi_remove({"before1", "before2"});
+    leader.put("ttl", "short", std::chrono::seconds(1));
+    leader.put("ttl_long", "long", std::chrono::seconds(3600));
+    catch_up(leader, replica);
+
+    assert(follower.get("k", value) && value == "v2");
+    assert(!follower.get("before0", value));
+    assert(!follower.get("before1", value) && !follower.get("before2", value));
+    assert(follower.get("m1", value) && value == "a");
+    assert(follower.get("m2", value) && value == "b");
+    assert(follower.get("ttl_long", value) && value == "long");
+
+    // The deadline came with the put, so the key expires on its own
+    assert(follower.get("ttl", value));
+    std::this_thread::sleep_for(1100ms);
+    assert(!follower.get("ttl", value));
+
+    ReplicaStatus status = replica.status();
+    assert(status.connected);
+    assert(status.offset == leader.replication_log()->end_offset());
+    assert(status.lag_bytes == 0 && status.lag_ms == 0);
+    assert(status.partial_syncs == 0);
+
+    std::vector<FollowerStatus> followers = leader.replication_log()->followers();
+    assert(followers.size() == 1);
+
+    std::cout << "✓ Streaming passed" << std::endl;
+}
+
+void test_resync() {
+    std::cout << "Testing partial and full resync..." << std::endl;
+
+    int port = next_port();
+    KVStore& leader = start_leader(port, 200 << 10);
+    KVStore follower("storage/test_replication_follower.log", follower_options());
+    std::string value;
+
+    ReplicaStatus left_off;
+    {
+        Replica replica(follower, "127.0.0.1", port);
+        leader.put("a", "1");
+        catch_up(leader, replica);
+        left_off = replica.status();
+    }
+
+    // Writes made while the follower is away are still in the backlog
+    leader.put("b", "2");
+    ReplicaOptions options;
+    options.replication_id = left_off.replication_id;
+    options.offset = left_off.offset;
+    {
+        Replica replica(follower, "127.0.0.1", port, options);
+        catch_up(leader, replica);
+        assert(follower.get("b", value) && value == "2");
+        assert(replica.status().partial_syncs == 1);
+        assert(replica.status().full_syncs == 0);
+        left_off = replica.status();
+    }
+
+    // Once they no longer fit, the follower has to start over
+    std::string big(1000, 'x');
+    for (int i = 0; i < 1000; i++) {
+        leader.put("big" + std::to_string(i), big);
+    }
+    options.replication_id = left_off.replication_id;
+    options.offset = left_off.offset;
+    {
+        Replica replica(follower, "127.0.0.1", port, options);
+        catch_up(leader, replica);
+        assert(replica.status().full_syncs == 1);
+        assert(replica.status().partial_syncs == 0);
+        assert(follower.get("big999", value) && value == big);
+        assert(follower.get("a", value) && value == "1");
+    }
+
+    // A follower of a different leader has nothing in common with this one
+    options.replication_id = left_off.replication_id + 1;
+    {
+        Replica replica(follower, "127.0.0.1", port, options);
+        catch_up(leader, replica);
+        assert(replica.status().full_syncs == 1);
+    }
+
+    std::cout << "✓ Resync passed" << std::endl;
+}
+
+void test_read_only_follower() {
+    std::cout << "Testing that followers refuse writes..." << std::endl;
+
+    int leader_port = next_port();
+    KVStore& leader = start_leader(leader_port, 1 << 20);
+    leader.put("shared", "leader");
+
+    KVStore follower("storage/test_replication_follower.log", follower_options());
+    Replica replica(follower, "127.0.0.1", leader_port);
+    catch_up(leader, replica);
+
+    int follower_port = next_port();
+    ServerOptions server_options;
+    server_options.io_threads = 1;
+    server_options.replica = &replica;
+    KVServer* server = new KVServer(&follower, follower_port, server_options);
+    std::thread([server] { server->run(); }).detach();
+    std::this_thread::sleep_for(100ms);
+
+    KVClient client("127.0.0.1", follower_port);
+    std::string value;
+    assert(client.get("shared", value) && value == "leader");
+    assert(!client.put("shared", "local"));
+    assert(!client.remove("shared"));
+    assert(client.get("shared", value) && value == "leader");
+    std::string info = client.replication_info();
+    assert(info.find("role:follower\n") != std::string::npos);
+    assert(info.find("connected:yes\n") != std::string::npos);
+    assert(info.find("lag_bytes:0\n") != std::string::npos);
+
+    KVClient text("127.0.0.1", follower_port, KVClient::Protocol::Text);
+    assert(!text.put("shared", "local"));
+    assert(text.replication_info() == info);
+
+    KVClient to_leader("127.0.0.1", leader_port);
+    info = to_leader.replication_info();
+    assert(info.find("role:leader\n") != std::string::npos);
+    assert(info.find("followers:1\n") != std::string::npos);
+
+    std::cout << "✓ Read-only followers passed" << std::endl;
+}
+
+int main() {
+    try {
+        test_backlog();
+        test_streaming();
+        test_resync();
+        test_read_only_follower();
+
+        std::cout << "\n✓ All replication tests passed!" << std::endl;
+        return 0;
+    } catch (const std::exception& e) {
+        std::cerr << "Test failed: " << e.what() << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,115 @@
+#include "timer_wheel.hpp"
+#include <iostream>
+#include <cassert>
+#include <map>
+#include <random>
+#include <string>
+
+void test_fires_on_time() {
+    std::cout << "Testing that timers fire at their deadline..." << std::endl;
+
+    const uint64_t start = 1000000;
+    TimerWheel wheel(10, start);
+    wheel.schedule("a", start + 25);
+    wheel.schedule("b", start + 25);
+    wheel.schedule("c", start + 100);
+    assert(wheel.size() == 3);
+
+    std::vector<std::pair<std::string, uint64_t>> due;
+    assert(!wheel.advance(start + 24, 100, due));
+    assert(due.empty());
+
+    // Deadlines round up to a whole tick, so nothing fires early
+    assert(!wheel.advance(start + 29, 100, due));
+    assert(due.empty());
+    assert(!wheel.advance(start + 30, 100, due));
+    assert(due.size() == 2 && due[0].second == start + 25);
+
+    due.clear();
+    assert(!wheel.advance(start + 1000, 100, due));
+    assert(due.size() == 1 && due[0].first == "c");
+    assert(wheel.size() == 0);
+
+    // A deadline already in the past fires with the next tick
+    wheel.schedule("late", start);
+    due.clear();
+    assert(!wheel.advance(start + 1010, 100, due));
+    assert(due.size() == 1 && due[0].first == "late");
+
+    std::cout << "✓ Deadlines passed" << std::endl;
+}
+
+void test_bounded_slices() {
+    std::cout << "Testing that advance hands out bounded slices..." << std::endl;
+
+    const uint64_t start = 5000;
+    TimerWheel wheel(1, start);
+    for (int i = 0; i < 250; i++) {
+        wheel.schedule("key" + std::to_string(i), start + 10);
+    }
+    wheel.schedule("later", start + 20);
+
+    std::vector<std::pair<std::string, uint64_t>> due;
+    assert(wheel.advance(start + 30, 100, due));
+    assert(due.size() == 100);
+    assert(wheel.advance(start + 30, 100, due));
+    assert(due.size() == 200);
+    assert(!wheel.advance(start + 30, 100, due));
+    assert(due.size() == 251);
+    assert(due.back().first == "later");
+    assert(wheel.size() == 0);
+
+    std::cout << "✓ Bounded slices passed" << std::endl;
+}
+
+void test_every_level() {
+    std::cout << "Testing deadlines across every level..." << std::endl;
+
+    // Deadlines from one tick to beyond the top level's span, checked
+    // against a plain ordered map while the clock moves in uneven steps
+    const uint64_t start = 123456789;
+    TimerWheel wheel(1, start);
+    std::multimap<uint64_t, std::string> expected;
+    std::mt19937_64 rng(42);
+    for (int i = 0; i < 5000; i++) {
+        uint64_t span = uint64_t(1) << (rng() % 27);
+        uint64_t deadline = start + 1 + rng() % span;
+        std::string key = "k" + std::to_string(i);
+        wheel.schedule(key, deadline);
+        expected.emplace(deadline, key);
+    }
+
+    uint64_t now = start;
+    std::vector<std::pair<std::string, uint64_t>> due;
+    while (!expected.empty()) {
+        now += 1 + rng() % 200000;
+        due.clear();
+        wheel.advance(now, SIZE_MAX, due);
+        size_t fired = 0;
+        while (!expected.empty() && expected.begin()->first <= now) {
+            expected.erase(expected.begin());
+            fired++;
+        }
+        assert(due.size() == fired);
+        for (const auto &timer : due) {
+            assert(timer.second <= now);
+        }
+    }
+    assert(wheel.size() == 0);
+
+    std::cout << "✓ Every level passed" << std::endl;
+}
+
+int main() {
+    try {
+        test_fires_on_time();
+        test_bounded_slices();
+        test_every_level();
+
+        std::cout << "\n✓ All timer wheel tests passed!" << std::endl;
+        return 0;
+    } catch (const std::exception& e) {
+        std::cerr << "Test failed: " << e.what() << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,138 @@
+#include "workload.hpp"
+#include <iostream>
+#include <cassert>
+#include <algorithm>
+#include <cmath>
+#include <set>
+#include <string>
+#include <vector>
+
+void test_mixes() {
+    std::cout << "Testing workload mixes..." << std::endl;
+
+    for (const char* name : {"a", "b", "c", "d", "e", "f", "A", "F"}) {
+        workload::Mix mix;
+        assert(workload::ycsb_mix(name, mix));
+        double total = mix.read + mix.update + mix.insert + mix.scan + mix.read_modify_write;
+        assert(std::abs(total - 1.0) < 1e-9);
+    }
+    workload::Mix mix;
+    assert(!workload::ycsb_mix("g", mix));
+    assert(!workload::ycsb_mix("ab", mix));
+    assert(!workload::ycsb_mix("", mix));
+
+    assert(workload::ycsb_mix("d", mix));
+    assert(mix.distribution == workload::Distribution::Latest);
+
+    // The operations drawn follow the mix
+    assert(workload::ycsb_mix("b", mix));
+    workload::Generator gen(mix, 1);
+    int counts[workload::OP_COUNT] = {};
+    for (int i = 0; i < 100000; i++) {
+        counts[static_cast<size_t>(gen.next_op())]++;
+    }
+    assert(counts[size_t(workload::Op::Read)] > 94000 && counts[size_t(workload::Op::Read)] < 96000);
+    assert(counts[size_t(workload::Op::Update)] > 4000 && counts[size_t(workload::Op::Update)] < 6000);
+    assert(counts[size_t(workload::Op::Insert)] == 0);
+
+    assert(workload::ycsb_mix("e", mix));
+    workload::Generator scans(mix, 2);
+    for (int i = 0; i < 1000; i++) {
+        size_t length = scans.next_scan_length();
+        assert(length >= 1 && length <= mix.max_scan_length);
+    }
+
+    workload::Distribution distribution;
+    assert(workload::parse_distribution("latest", distribution));
+    assert(distribution == workload::Distribution::Latest);
+    assert(!workload::parse_distribution("normal", distribution));
+    assert(std::string(workload::distribution_name(workload::Distribution::Zipfian)) == "zipfian");
+
+    std::cout << "✓ Workload mixes passed" << std::endl;
+}
+
+void test_key_names() {
+    std::cout << "Testing key names..." << std::endl;
+
+    std::set<std::string> keys;
+    for (uint64_t i = 0; i < 10000; i++) {
+        std::string key = workload::key_name(i);
+        assert(key.rfind("user", 0) == 0);
+        keys.insert(key);
+    }
+    assert(keys.size() == 10000);
+    assert(workload::key_name(42) == workload::key_name(42));
+
+    std::cout << "✓ Key names passed" << std::endl;
+}
+
+// How many of n draws land on each of records records
+std::vector<int> histogram(workload::Distribution distribution, uint64_t records, int n) {
+    workload::Mix mix;
+    mix.distribution = distribution;
+    workload::Generator gen(mix, 7);
+    std::vector<int> hits(records);
+    for (int i = 0; i < n; i++) {
+        uint64_t r = gen.next_record(records);
+        assert(r < records);
+        hits[r]++;
+    }
+    return hits;
+}
+
+void test_distributions() {
+    std::cout << "Testing key distributions..." << std::endl;
+
+    const uint64_t records = 1000;
+    const int draws = 200000;
+
+    // Uniform: every record is picked about as often
+    std::vector<int> uniform = histogram(workload::Distribution::Uniform, records, draws);
+    for (int h : uniform) {
+        assert(h > 100 && h < 300);
+    }
+
+    // Zipfian: a few hot records take much of the load, and they are not
+    // the lowest numbered ones
+    std::vector<int> zipf = histogram(workload::Distribution::Zipfian, records, draws);
+    std::vector<int> sorted = zipf;
+    std::sort(sorted.rbegin(), sorted.rend());
+    int top10 = 0;
+    for (int i = 0; i < 10; i++) {
+        top10 += sorted[i];
+    }
+    assert(top10 > draws / 4);
+    assert(std::max_element(zipf.begin(), zipf.end()) - zipf.begin() != 0);
+
+    // Latest: the newest record is the hottest, and old ones are rarely read
+    std::vector<int> latest = histogram(workload::Distribution::Latest, records, draws);
+    assert(std::max_element(latest.begin(), latest.end()) - latest.begin() == int(records - 1));
+    int newest = 0;
+    for (uint64_t i = records - 10; i < records; i++) {
+        newest += latest[i];
+    }
+    assert(newest > draws / 4);
+
+    // The item count may grow between draws, as inserts add records
+    workload::Zipfian zipfian;
+    std::mt19937_64 rng(3);
+    for (uint64_t n = 1; n < 5000; n++) {
+        assert(zipfian.next(rng, n) < n);
+    }
+    int zeros = 0;
+    for (int i = 0; i < 10000; i++) {
+        zeros += zipfian.next(rng, 5000) == 0;
+    }
+    assert(zeros > 500);
+
+    std::cout << "✓ Key distributions passed" << std::endl;
+}
+
+int main() {
+    test_mixes();
+    test_key_names();
+    test_distributions();
+
+    std::cout << "\n✓ All workload tests passed!" << std::endl;
+    return 0;
+}